@@ -28,10 +28,12 @@
 #include <string.h>
 
 #include <libopencm3/stm32/gpio.h>
+#include <libopencm3/stm32/rcc.h>
+#include <libopencm3/stm32/timer.h>
 
 #include "at88sc0104.h"
 
-#include "util.h" // delay()
+#include "util.h"
 #include "timer.h"
 #include "memzero.h"
 
@@ -49,9 +51,13 @@
 // Global variables
 static uint8_t CM_UserZone;
 static uint8_t CM_AntiTearing;
+static uint8_t CM_ZoneSelected;	// CM_UserZone and CM_AntiTearing are set on the chip
 static uint8_t CM_Encrypt;
 static uint8_t CM_Authenticate;
 
+uint32_t cm_bus_transactions;
+uint32_t cm_bus_errors;
+
 
 
 #define CM_PWRON_CLKS (15)
@@ -217,24 +223,57 @@ uint8_t cm_aCommunicationTest(void)
                         GPIO Macros - I2C like bit banging
 *************************************************************************/
 
-/* CLK on PB6, DATA on PB7 */
+/* CLK on PB6, DATA on PB7
+ *
+ * Both lines are open drain outputs with pull-up: "high" releases the line,
+ * "low" pulls it down.  The input data register reflects the pin level in
+ * open drain mode, so DATA can be sampled without switching the pin mode.
+ * A single BSRR write per edge keeps the bus fast and the timing defined
+ * by cm_Delay() alone.
+ */
+
+#define CM_BUS_SETUP	{ gpio_mode_setup(GPIOB, GPIO_MODE_OUTPUT, GPIO_PUPD_PULLUP, GPIO6 | GPIO7); \
+			  gpio_set_output_options(GPIOB, GPIO_OTYPE_OD, GPIO_OSPEED_2MHZ, GPIO6 | GPIO7); }
+
+#define CM_CLK_HI		gpio_set(GPIOB, GPIO6)
+#define CM_CLK_LO		gpio_clear(GPIOB, GPIO6)
 
-#define CM_CLK_OUT 		gpio_mode_setup(GPIOB, GPIO_MODE_OUTPUT, GPIO_PUPD_PULLUP, GPIO6)
-#define CM_CLK_HI		gpio_mode_setup(GPIOB, GPIO_MODE_INPUT, GPIO_PUPD_PULLUP, GPIO6)
-#define CM_CLK_LO   	{ gpio_clear(GPIOB, GPIO6); CM_CLK_OUT; }
+#define CM_DATA_HI		gpio_set(GPIOB, GPIO7)
+#define CM_DATA_LO		gpio_clear(GPIOB, GPIO7)
+#define CM_DATA_RD		gpio_get(GPIOB, GPIO7)
 
-#define CM_DATA_OUT 	gpio_mode_setup(GPIOB, GPIO_MODE_OUTPUT, GPIO_PUPD_PULLUP, GPIO7)
-#define CM_DATA_IN    	gpio_mode_setup(GPIOB, GPIO_MODE_INPUT, GPIO_PUPD_PULLUP, GPIO7)
-#define CM_DATA_HI		CM_DATA_IN
-#define CM_DATA_LO  	{ gpio_clear(GPIOB, GPIO7); CM_DATA_OUT; }
-#define CM_DATA_RD  	gpio_get(GPIOB, GPIO7)
+/* Bus timing
+ *
+ * cm_Delay() counts in quarter bus clock periods (a cm_ClockCycle() is
+ * 4 units).  It is timed by TIM5, a free running 32-bit timer on APB1,
+ * instead of a nop loop, so the bus clock does not depend on compiler
+ * flags.  The timer registers are accessible from unprivileged code, unlike
+ * the DWT cycle counter and SysTick.  The bus runs at the 1 MHz maximum of
+ * the AT88SC two-wire interface; GPIO overhead only makes it slower.
+ */
+#define CM_TIMER		TIM5
+#define CM_TIMER_HZ		60000000	// APB1 timer clock at 120 MHz core
+#define CM_BUS_HZ		1000000
+#define CM_DELAY_TICKS	(CM_TIMER_HZ / CM_BUS_HZ / 4)
+
+static void cm_TimerInit(void)
+{
+    rcc_periph_clock_enable(RCC_TIM5);
+    TIM_CR1(CM_TIMER) = 0;
+    TIM_PSC(CM_TIMER) = 0;
+    TIM_ARR(CM_TIMER) = 0xFFFFFFFF;
+    TIM_EGR(CM_TIMER) = TIM_EGR_UG;
+    TIM_CR1(CM_TIMER) = TIM_CR1_CEN;
+}
 
 /*************************************************************************
                                        Basic bus communication
 **************************************************************************/
 static void cm_Delay(uint8_t Delay)
 {
-    delay(Delay);
+    uint32_t start = TIM_CNT(CM_TIMER);
+    uint32_t ticks = (uint32_t)Delay * CM_DELAY_TICKS;
+    while ((uint32_t)(TIM_CNT(CM_TIMER) - start) < ticks) {}
 }
 
  // Half a clock cycle high
@@ -299,7 +338,7 @@ static void cm_Stop(void)
 
 // Write a byte on the bus
 // return 0 on success
-static uint8_t cm_Write(uint8_t Data)
+static RAMCODE uint8_t cm_Write(uint8_t Data)
 {
     uint8_t i;
 
@@ -352,7 +391,7 @@ static void cm_AckNak(uint8_t Ack)
 
 
 // Reads one byte from the bus
-static uint8_t cm_Read(void)
+static RAMCODE uint8_t cm_Read(void)
 {
     uint8_t i;
     uint8_t rByte = 0;
@@ -462,9 +501,10 @@ void cm_PowerOn(void)
     cm_ResetCrypto();
     CM_UserZone = CM_AntiTearing = 0;
 
+    cm_TimerInit();
+
     // Initialize the bus
-    CM_DATA_OUT;
-    CM_CLK_OUT;
+    CM_BUS_SETUP;
     CM_CLK_LO;
     CM_DATA_HI;
     // Give a certain number of clocks to initialize the bus
@@ -478,6 +518,7 @@ static uint8_t cm_ReadCommand(uint8_t * InsBuff, uint8_t * RetVal, uint8_t Len)
 	uint8_t Return;
 	int i;
 
+	cm_bus_transactions++;
 	for (i = 0; i < 20; i++) {
 		if ((Return = cm_SendCommand(InsBuff)) != CM_SUCCESS)
 			continue;
@@ -486,6 +527,7 @@ static uint8_t cm_ReadCommand(uint8_t * InsBuff, uint8_t * RetVal, uint8_t Len)
 	}
 
 	if (i >= 20) {
+		cm_bus_errors++;
 		return Return;
 	}
 
@@ -500,11 +542,12 @@ static uint8_t cm_WriteCommand(uint8_t * InsBuff, const uint8_t * SendVal,
 		uint8_t Len)
 {
 	uint8_t Return;
-	if ((Return = cm_SendCommand(InsBuff)) != CM_SUCCESS) {
-		return Return;
+	cm_bus_transactions++;
+	if ((Return = cm_SendCommand(InsBuff)) != CM_SUCCESS
+		|| (Return = cm_SendData(SendVal, Len)) != CM_SUCCESS) {
+		cm_bus_errors++;
 	}
-
-	return cm_SendData(SendVal, Len);
+	return Return;
 }
 
 
@@ -534,10 +577,19 @@ uint8_t cm_SetUserZone(uint8_t ZoneNumber, uint8_t AntiTearing)
 	// Save the global variables
 	CM_UserZone = ZoneNumber;
 	CM_AntiTearing = AntiTearing;
+	CM_ZoneSelected = TRUE;
 
 	return CM_SUCCESS;
 }
 
+// Select the user area unless it is selected already in this session
+static uint8_t cm_SelectUserZone(uint8_t ZoneNumber, uint8_t AntiTearing)
+{
+	if (CM_ZoneSelected && CM_UserZone == ZoneNumber && CM_AntiTearing == AntiTearing)
+		return CM_SUCCESS;
+	return cm_SetUserZone(ZoneNumber, AntiTearing);
+}
+
 
 
 // Burn fuse
@@ -674,6 +726,80 @@ uint8_t cm_WriteUserZone(uint8_t CryptoAddr, const uint8_t * Buffer, uint8_t Cou
 }
 
 
+/*!
+ *
+ * \brief 	Read a user zone record in one transfer
+ *
+ * \note The zone is only selected if it is not selected already, so
+ * repeated reads of the same zone cost a single read command each.
+ *
+ * \param	ZoneNumber: user zone 0..3
+ * \param	CryptoAddr: start address inside the zone
+ * \param	Buffer: receives Count bytes
+ * \param	Count: number of bytes, the record must lie inside the zone
+ *
+ * \retval 0 on success
+ */
+uint8_t cm_ReadZone(uint8_t ZoneNumber, uint8_t CryptoAddr, uint8_t * Buffer, uint8_t Count)
+{
+	uint8_t Return;
+
+	if (Count == 0 || CryptoAddr + Count > CM_USERZONE_SIZE)
+		return CM_FAILED;
+
+	if ((Return = cm_SelectUserZone(ZoneNumber, FALSE)) != CM_SUCCESS)
+		return Return;
+
+	return cm_ReadUserZone(CryptoAddr, Buffer, Count);
+}
+
+
+/*!
+ *
+ * \brief 	Write a user zone record in page sized bursts
+ *
+ * \note Each write command may not cross a page and carries at most
+ * 16 bytes, 8 with anti-tearing.  Every burst needs its own checksum and
+ * ack polling for the write cycle (see table 8-2), so the record is cut
+ * into as few bursts as possible.
+ *
+ * \param	ZoneNumber: user zone 0..3
+ * \param	CryptoAddr: start address inside the zone
+ * \param	Buffer: Count bytes to write
+ * \param	Count: number of bytes, the record must lie inside the zone
+ * \param	AntiTearing: use anti-tearing writes
+ *
+ * \retval 0 on success
+ */
+uint8_t cm_WriteZone(uint8_t ZoneNumber, uint8_t CryptoAddr, const uint8_t * Buffer, uint8_t Count,
+		uint8_t AntiTearing)
+{
+	uint8_t Return;
+	uint8_t max = AntiTearing ? 8 : CM_USERZONE_PAGE;
+
+	if (Count == 0 || CryptoAddr + Count > CM_USERZONE_SIZE)
+		return CM_FAILED;
+
+	if ((Return = cm_SelectUserZone(ZoneNumber, AntiTearing)) != CM_SUCCESS)
+		return Return;
+
+	while (Count) {
+		uint8_t n = CM_USERZONE_PAGE - (CryptoAddr % CM_USERZONE_PAGE);
+		if (n > max)
+			n = max;
+		if (n > Count)
+			n = Count;
+		if ((Return = cm_WriteUserZone(CryptoAddr, Buffer, n)) != CM_SUCCESS)
+			return Return;
+		CryptoAddr += n;
+		Buffer += n;
+		Count -= n;
+	}
+
+	return CM_SUCCESS;
+}
+
+
 // Read the fuse
 uint8_t cm_ReadFuse(uint8_t * Fuse)
 {
@@ -855,6 +981,58 @@ uint8_t cm_WriteConfigZone(uint8_t CryptoAddr, const uint8_t * Buffer, uint8_t C
 }
 
 
+/*!
+ * \brief	Write a configuration zone range in page bursts
+ *
+ * \note	No anti-tearing, so a single command can carry a full page.
+ *		The command and data of the next page are run through the
+ *		polynomials while the chip is still busy with the write cycle
+ *		of the previous page, its ack polling comes last.
+ *
+ * \param	CryptoAddr: start address
+ * \param	Buffer: Count bytes to write
+ * \param	Count: number of bytes
+ *
+ * \retval 0 on success
+ */
+uint8_t cm_WriteConfigPages(uint8_t CryptoAddr, const uint8_t * Buffer, uint8_t Count)
+{
+	uint8_t Return = CM_SUCCESS;
+	uint8_t Busy = FALSE;
+	uint8_t Data[CM_CONFIG_PAGE];
+
+	while (Count) {
+		uint8_t n = CM_CONFIG_PAGE - (CryptoAddr % CM_CONFIG_PAGE);
+		if (n > Count)
+			n = Count;
+
+		// prepare the page
+		uint8_t CmdWriteConfigZone[4] = { CM_CMD_SYSTEMWR, 0x00, CryptoAddr, n };
+		cm_GPAcmd2(CmdWriteConfigZone);
+		memcpy(Data, Buffer, n);
+		cm_GPAencrypt((CryptoAddr >= CM_PSW_ADDR) && CM_Encrypt, Data, n);
+
+		// the previous page has to be done before the chip takes the next one
+		if (Busy && (Return = cm_WaitAckPolling(5)) != CM_SUCCESS)
+			break;
+
+		if ((Return = cm_WriteCommand(CmdWriteConfigZone, Data, n)) != CM_SUCCESS)
+			break;
+		Busy = TRUE;
+
+		CryptoAddr += n;
+		Buffer += n;
+		Count -= n;
+	}
+
+	if (Return == CM_SUCCESS && Busy)
+		Return = cm_WaitAckPolling(5);
+
+	memzero(Data, sizeof(Data));
+	return Return;
+}
+
+
 // Send checksum
 uint8_t cm_SendChecksum(uint8_t * ChkSum)
 {
@@ -904,11 +1082,15 @@ uint8_t cm_DeactivateSecurity(void)
                                              CryptoMemory low level interface
 ****************************************************************************/
 
-/* state machine registers implementing the crypto */
+/*
+ * state machine registers implementing the crypto, each polynomial is a
+ * shift register packed into one integer: cell i of R and T is 5 bits
+ * wide at bit 5 * i, cell i of S is 7 bits wide at bit 7 * i
+ */
 CONFIDENTIAL static struct {
-	uint8_t	R[7];
-	uint8_t S[7];
-	uint8_t T[5];
+	uint64_t R;
+	uint64_t S;
+	uint32_t T;
 	uint8_t out;
 } Gpa;
 
@@ -931,52 +1113,55 @@ static void cm_ResetCrypto(void)
 {
 	memzero(&Gpa, sizeof(Gpa));
 	CM_Encrypt = CM_Authenticate = FALSE;
+	CM_ZoneSelected = FALSE;
 }
 
 // Generate next value
 static uint8_t cm_GPAGen(uint8_t Datain)
 {
-	uint8_t Din_gpa;
-	uint8_t Ri, Si, Ti;
-	uint8_t R_sum, S_sum, T_sum;
+	uint32_t Din_gpa;
+	uint32_t Ri, Si, Ti;
+	uint32_t R_sum, S_sum, T_sum;
 
 #define CM_MOD_R (0x1F)
 #define CM_MOD_T (0x1F)
 #define CM_MOD_S (0x7F)
 
+#define CM_MASK_R ((1ULL << 35) - 1)
+#define CM_MASK_S ((1ULL << 49) - 1)
+#define CM_MASK_T ((1UL << 25) - 1)
+
 #define cm_Mod(x,y,m) ( (x+y)>m ?(x+y-m) : (x+y) )
 #define cm_RotR(x)    ( ((x & 0x0F)<<1) | ((x & 0x10)>>4) )
 #define cm_RotS(x)    ( ((x & 0x3F)<<1) | ((x & 0x40)>>6) )
 #define cm_RotT(x)    ( ((x & 0x0F)<<1) | ((x & 0x10)>>4) )
 
+#define cm_CellR(i)   ( (uint32_t)(Gpa.R >> (5 * (i))) & 0x1F )
+#define cm_CellS(i)   ( (uint32_t)(Gpa.S >> (7 * (i))) & 0x7F )
+#define cm_CellT(i)   ( (Gpa.T >> (5 * (i))) & 0x1F )
+
 	// Input Character
 	Din_gpa = Datain ^ Gpa.out;
 	Ri = Din_gpa & 0x1F;			 	// Ri[4:0] = Din_gpa[4:0]
 	Si = ((Din_gpa & 0x0F) << 3) | ((Din_gpa & 0xE0) >> 5); // Si[6:0] = { Din_gpa[3:0], Din_gpa[7:5] }
 	Ti = (Din_gpa & 0xF8) >> 3; 		// Ti[4:0] = Din_gpa[7:3];
 
-	//R polynomial
-	R_sum = cm_Mod(Gpa.R[3], cm_RotR(Gpa.R[6]), CM_MOD_R);
-	memmove(&Gpa.R[1], &Gpa.R[0], 6);
-	Gpa.R[3] ^= Ri;
-	Gpa.R[0] = R_sum;
+	// R polynomial: shift all cells up by one, R[3] ^= Ri, R[0] = R_sum
+	R_sum = cm_Mod(cm_CellR(3), cm_RotR(cm_CellR(6)), CM_MOD_R);
+	Gpa.R = (((Gpa.R << 5) & CM_MASK_R) ^ ((uint64_t)Ri << 15)) | R_sum;
 
-	//S polynomial
-	S_sum = cm_Mod(Gpa.S[5], cm_RotS(Gpa.S[6]), CM_MOD_S);
-	memmove(&Gpa.S[1], &Gpa.S[0], 6);
-	Gpa.S[5] ^= Si;
-	Gpa.S[0] = S_sum;
+	// S polynomial: shift all cells up by one, S[5] ^= Si, S[0] = S_sum
+	S_sum = cm_Mod(cm_CellS(5), cm_RotS(cm_CellS(6)), CM_MOD_S);
+	Gpa.S = (((Gpa.S << 7) & CM_MASK_S) ^ ((uint64_t)Si << 35)) | S_sum;
 
-	//T polynomial
-	T_sum = cm_Mod(Gpa.T[4], Gpa.T[2], CM_MOD_T);
-	memmove(&Gpa.T[1], &Gpa.T[0], 4);
-	Gpa.T[2] ^= Ti;
-	Gpa.T[0] = T_sum;
+	// T polynomial: shift all cells up by one, T[2] ^= Ti, T[0] = T_sum
+	T_sum = cm_Mod(cm_CellT(4), cm_CellT(2), CM_MOD_T);
+	Gpa.T = (((Gpa.T << 5) & CM_MASK_T) ^ (Ti << 10)) | T_sum;
 
 	// Output Stage
 	Gpa.out = ((Gpa.out << 4) & 0xF0) |	// shift previous nibble left
-			(((((Gpa.R[0] ^ Gpa.R[4]) & 0x0F) & (~Gpa.S[0]))
-					| ((((Gpa.T[0] ^ Gpa.T[3]) & 0x0F) & Gpa.S[0]))) & 0x0F); // and concatenate 4 new bits selected by Si
+			((((R_sum ^ cm_CellR(4)) & ~S_sum)
+					| ((T_sum ^ cm_CellT(3)) & S_sum)) & 0x0F); // and concatenate 4 new bits selected by Si
 	return Gpa.out;
 }
 
@@ -18,9 +18,13 @@ uint8_t cm_VerifySecurePasswd(const uint8_t *passwd);
 uint8_t cm_ResetPassword(void);
 uint8_t cm_ReadConfigZone(uint8_t CryptoAddr, uint8_t *Buffer, uint8_t Count);
 uint8_t cm_WriteConfigZone(uint8_t CryptoAddr, const uint8_t *Buffer, uint8_t Count, uint8_t AntiTearing);
+uint8_t cm_WriteConfigPages(uint8_t CryptoAddr, const uint8_t *Buffer, uint8_t Count);
 uint8_t cm_SetUserZone(uint8_t ZoneNumber, uint8_t AntiTearing);
 uint8_t cm_ReadUserZone(uint8_t CryptoAddr, uint8_t *Buffer, uint8_t Count);
 uint8_t cm_WriteUserZone(uint8_t CryptoAddr, const uint8_t *Buffer, uint8_t Count);
+uint8_t cm_ReadZone(uint8_t ZoneNumber, uint8_t CryptoAddr, uint8_t *Buffer, uint8_t Count);
+uint8_t cm_WriteZone(uint8_t ZoneNumber, uint8_t CryptoAddr, const uint8_t *Buffer, uint8_t Count,
+		uint8_t AntiTearing);
 uint8_t cm_SendChecksum(uint8_t *ChkSum);
 uint8_t cm_ReadChecksum(uint8_t *ChkSum);
 uint8_t cm_ReadFuse(uint8_t *Fuze);
@@ -28,6 +32,10 @@ uint8_t cm_BurnFuse(uint8_t Fuze);
 uint8_t cm_aCommunicationTest(void);
 void cm_PowerOn(void);
 
+// read and write commands sent to the chip since boot, and the failed ones
+extern uint32_t cm_bus_transactions;
+extern uint32_t cm_bus_errors;
+
 enum { CM_PWREAD = 1, CM_PWWRITE = 0 };
 
 /*****************************************************************
@@ -52,6 +60,13 @@ enum { CM_PWREAD = 1, CM_PWWRITE = 0 };
 #define CM_PER        (0x00)
 
 #define CM_PSW_ADDR   (0xB0)
+#define CM_PSW_SETS   (7)     // set 7 is the secure code
+
+#define CM_CONFIG_PAGE    (16)
+
+/* user zones of the AT88SC0104C */
+#define CM_USERZONE_SIZE  (32)
+#define CM_USERZONE_PAGE  (16)
 
 
 #endif    /* __AT88SC0104_H__ */
@@ -0,0 +1,502 @@
+/*
+ * This file is part of the TREZOR project, https://trezor.io/
+ *
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Benchmark image.
+ *
+ * Runs the hot paths of the firmware a fixed number of times and reports
+ * the cost of one operation in cycles and the resulting operations per
+ * second.  On the device the results are shown on the screen and sent as
+ * 64 byte packets on the bulk IN endpoint of a vendor interface (one per
+ * benchmark, see BenchPacket), the emulator prints them to stdout.  The
+ * emulator counts nanoseconds instead of cycles.  The device also reports
+ * the peak stack use of every benchmark (painted before each run).
+ *
+ * Built with RAMFUNC=1 the hot kernels run from SRAM, the size of the
+ * copied code is reported as an extra "ramfunc bytes" packet.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "buttons.h"
+#include "layout.h"
+#include "oled.h"
+#include "setup.h"
+#include "util.h"
+#include "rng.h"
+#include "memory.h"
+#include "bip32.h"
+#include "bip39.h"
+#include "curves.h"
+#include "ecdsa.h"
+#include "secp256k1.h"
+#include "nist256p1.h"
+#include "ed25519-donna/ed25519.h"
+#include "sha2.h"
+#include "sha3.h"
+#include "hasher.h"
+#include "aes/aes.h"
+
+#include <libopencm3/stm32/flash.h>
+
+#if EMULATOR
+#include <time.h>
+#else
+#include <libopencm3/cm3/dwt.h>
+#include <libopencm3/cm3/scs.h>
+#include <libopencm3/usb/usbd.h>
+#endif
+
+#if CRYPTOMEM
+#include "at88sc0104.h"
+#endif
+
+#if EMULATOR
+#define BENCH_HZ 1000000000ULL
+#else
+#define BENCH_HZ 120000000ULL
+#endif
+
+// last flash sector, the benchmark image is far smaller than 7 sectors
+#define BENCH_FLASH_SECTOR 11
+#define BENCH_FLASH_ADDR   0x080E0000
+
+typedef struct {
+	const char *name;
+	uint32_t ops;
+	void (*run)(uint32_t i);
+	uint64_t cycles;
+	uint32_t stack; // bytes, device only
+} BenchEntry;
+
+/* packet sent over USB for every benchmark, little endian */
+typedef struct {
+	char name[32];
+	uint32_t ops;
+	uint32_t ops_per_sec;
+	uint64_t cycles_per_op;
+	uint32_t stack;
+	uint8_t reserved[12];
+} __attribute__((packed)) BenchPacket;
+
+_Static_assert(sizeof(BenchPacket) == 64, "BenchPacket must fill one packet");
+
+static const char *mnemonic = "abandon abandon abandon abandon abandon abandon abandon abandon abandon abandon abandon about";
+
+static uint8_t seed[64];
+static HDNode node;
+static uint8_t digest[32];
+static uint8_t sig[64];
+static uint8_t buffer[1024];
+static ed25519_secret_key ed_sk;
+static ed25519_public_key ed_pk;
+static aes_encrypt_ctx aes_ctx;
+
+static uint32_t bench_now(void)
+{
+#if EMULATOR
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec * 1000000000 + t.tv_nsec;
+#else
+	return DWT_CYCCNT;
+#endif
+}
+
+static void bench_mnemonic_to_seed(uint32_t i)
+{
+	(void)i;
+	mnemonic_to_seed(mnemonic, "", seed, 0);
+}
+
+static void bench_ckd(uint32_t i)
+{
+	// one step of m/44'/0'/0'/0/i
+	static const uint32_t path[4] = { 0x8000002C, 0x80000000, 0x80000000, 0 };
+	if (i % 5 == 0) {
+		hdnode_from_seed(seed, 64, SECP256K1_NAME, &node);
+	}
+	hdnode_private_ckd(&node, i % 5 < 4 ? path[i % 5] : i);
+}
+
+static void bench_sign_secp256k1(uint32_t i)
+{
+	digest[0] = i;
+	ecdsa_sign_digest(&secp256k1, seed, digest, sig, NULL, NULL);
+}
+
+static void bench_sign_nist256p1(uint32_t i)
+{
+	digest[0] = i;
+	ecdsa_sign_digest(&nist256p1, seed, digest, sig, NULL, NULL);
+}
+
+static void bench_sign_ed25519(uint32_t i)
+{
+	digest[0] = i;
+	ed25519_sign(digest, sizeof(digest), ed_sk, ed_pk, sig);
+}
+
+static void bench_sha256(uint32_t i)
+{
+	(void)i;
+	sha256_Raw(buffer, sizeof(buffer), digest);
+}
+
+static void bench_keccak(uint32_t i)
+{
+	(void)i;
+	keccak_256(buffer, sizeof(buffer), digest);
+}
+
+// the double hashes that Decred and Groestlcoin style curves use for
+// transaction and base58 check hashing, next to sha256 above
+static void bench_blaked(uint32_t i)
+{
+	(void)i;
+	hasher_Raw(HASHER_BLAKED, buffer, sizeof(buffer), digest);
+}
+
+static void bench_groestld(uint32_t i)
+{
+	(void)i;
+	hasher_Raw(HASHER_GROESTLD_TRUNC, buffer, sizeof(buffer), digest);
+}
+
+static void bench_aes_cbc(uint32_t i)
+{
+	(void)i;
+	uint8_t iv[16] = {0};
+	aes_cbc_encrypt(buffer, buffer, sizeof(buffer), iv, &aes_ctx);
+}
+
+static void bench_oled_draw(uint32_t i)
+{
+	(void)i;
+	oledDrawString(0, 0, "abcdefghijklmnopqrstu", FONT_STANDARD);
+}
+
+static void bench_oled_refresh(uint32_t i)
+{
+	(void)i;
+	// every page changes, so the whole screen is sent
+	oledInvert(0, 0, OLED_WIDTH - 1, OLED_HEIGHT - 1);
+	oledRefresh();
+}
+
+#if CRYPTOMEM
+static void bench_cm_read_config(uint32_t i)
+{
+	(void)i;
+	cm_ReadConfigZone(0, buffer, 32);
+}
+
+static void bench_cm_read_user(uint32_t i)
+{
+	(void)i;
+	cm_SetUserZone(0, false);
+	cm_ReadUserZone(0, buffer, 32);
+}
+#endif
+
+#if BENCH_FLASH
+static void bench_flash_erase(uint32_t i)
+{
+	(void)i;
+	flash_unlock();
+	flash_erase_sector(BENCH_FLASH_SECTOR, FLASH_CR_PROGRAM_X32);
+	flash_lock();
+}
+
+static void bench_flash_program(uint32_t i)
+{
+	// 1 KiB per operation
+	flash_unlock();
+	for (uint32_t j = 0; j < sizeof(buffer); j += 4) {
+		flash_program_word(BENCH_FLASH_ADDR + i * sizeof(buffer) + j, i + j);
+	}
+	flash_lock();
+}
+#endif
+
+static BenchEntry benchmarks[] = {
+	{ "mnemonic_to_seed",   1, bench_mnemonic_to_seed, 0, 0 },
+	{ "hdnode_private_ckd", 20, bench_ckd, 0, 0 },
+	{ "sign secp256k1",     4, bench_sign_secp256k1, 0, 0 },
+	{ "sign nist256p1",     4, bench_sign_nist256p1, 0, 0 },
+	{ "sign ed25519",       4, bench_sign_ed25519, 0, 0 },
+	{ "sha256 1k",          64, bench_sha256, 0, 0 },
+	{ "keccak256 1k",       64, bench_keccak, 0, 0 },
+	{ "blake256d 1k",       64, bench_blaked, 0, 0 },
+	{ "groestl512d 1k",     16, bench_groestld, 0, 0 },
+	{ "aes-cbc 1k",         64, bench_aes_cbc, 0, 0 },
+	{ "oledDrawString",     64, bench_oled_draw, 0, 0 },
+	{ "oledRefresh",        32, bench_oled_refresh, 0, 0 },
+#if CRYPTOMEM
+	{ "cm_ReadConfigZone",  16, bench_cm_read_config, 0, 0 },
+	{ "cm_ReadUserZone",    16, bench_cm_read_user, 0, 0 },
+#endif
+#if BENCH_FLASH
+	// erase first, programming needs the erased sector
+	{ "flash erase",        1, bench_flash_erase, 0, 0 },
+	{ "flash program 1k",   16, bench_flash_program, 0, 0 },
+#endif
+};
+
+#define BENCH_COUNT (sizeof(benchmarks) / sizeof(benchmarks[0]))
+
+static uint64_t bench_cycles_per_op(const BenchEntry *b)
+{
+	return b->cycles / b->ops;
+}
+
+static uint32_t bench_ops_per_sec(const BenchEntry *b)
+{
+	return b->cycles ? (uint32_t)(BENCH_HZ * b->ops / b->cycles) : 0;
+}
+
+#if !EMULATOR
+
+static const struct usb_device_descriptor dev_descr = {
+	.bLength = USB_DT_DEVICE_SIZE,
+	.bDescriptorType = USB_DT_DEVICE,
+	.bcdUSB = 0x0200,
+	.bDeviceClass = 0,
+	.bDeviceSubClass = 0,
+	.bDeviceProtocol = 0,
+	.bMaxPacketSize0 = 64,
+	.idVendor = 0x534c,
+	.idProduct = 0x0001,
+	.bcdDevice = 0x0100,
+	.iManufacturer = 1,
+	.iProduct = 2,
+	.iSerialNumber = 3,
+	.bNumConfigurations = 1,
+};
+
+static const struct usb_endpoint_descriptor bench_endpoints[1] = {{
+	.bLength = USB_DT_ENDPOINT_SIZE,
+	.bDescriptorType = USB_DT_ENDPOINT,
+	.bEndpointAddress = 0x81,
+	.bmAttributes = USB_ENDPOINT_ATTR_BULK,
+	.wMaxPacketSize = 64,
+	.bInterval = 0,
+}};
+
+static const struct usb_interface_descriptor bench_iface[] = {{
+	.bLength = USB_DT_INTERFACE_SIZE,
+	.bDescriptorType = USB_DT_INTERFACE,
+	.bInterfaceNumber = 0,
+	.bAlternateSetting = 0,
+	.bNumEndpoints = 1,
+	.bInterfaceClass = 0xFF,
+	.bInterfaceSubClass = 0,
+	.bInterfaceProtocol = 0,
+	.iInterface = 0,
+	.endpoint = bench_endpoints,
+}};
+
+static const struct usb_interface ifaces[] = {{
+	.num_altsetting = 1,
+	.altsetting = bench_iface,
+}};
+
+static const struct usb_config_descriptor config = {
+	.bLength = USB_DT_CONFIGURATION_SIZE,
+	.bDescriptorType = USB_DT_CONFIGURATION,
+	.wTotalLength = 0,
+	.bNumInterfaces = 1,
+	.bConfigurationValue = 1,
+	.iConfiguration = 0,
+	.bmAttributes = 0x80,
+	.bMaxPower = 0x32,
+	.interface = ifaces,
+};
+
+static const char *usb_strings[] = {
+	"SatoshiLabs",
+	"TREZOR Benchmark",
+	"01234567",
+};
+
+static usbd_device *usbd_dev;
+static uint8_t usbd_control_buffer[128];
+static volatile bool usb_configured = false;
+
+static void bench_set_config(usbd_device *dev, uint16_t wValue)
+{
+	(void)wValue;
+	usbd_ep_setup(dev, 0x81, USB_ENDPOINT_ATTR_BULK, 64, 0);
+	usb_configured = true;
+}
+
+static void usbInit(void)
+{
+	usbd_dev = usbd_init(&otgfs_usb_driver, &dev_descr, &config, usb_strings, 3, usbd_control_buffer, sizeof(usbd_control_buffer));
+	usbd_register_set_config_callback(usbd_dev, bench_set_config);
+}
+
+#endif
+
+static void bench_report(const BenchEntry *b)
+{
+#if EMULATOR
+	printf("%-20s %6u ops %12llu ns/op %10u ops/s\n", b->name, (unsigned)b->ops,
+		(unsigned long long)bench_cycles_per_op(b), (unsigned)bench_ops_per_sec(b));
+	fflush(stdout);
+#else
+	if (!usb_configured) {
+		return;
+	}
+	BenchPacket p;
+	memset(&p, 0, sizeof(p));
+	strlcpy(p.name, b->name, sizeof(p.name));
+	p.ops = b->ops;
+	p.ops_per_sec = bench_ops_per_sec(b);
+	p.cycles_per_op = bench_cycles_per_op(b);
+	p.stack = b->stack;
+	while (usbd_ep_write_packet(usbd_dev, 0x81, &p, sizeof(p)) == 0) {
+		usbd_poll(usbd_dev);
+	}
+#endif
+}
+
+#if RAMFUNC && !EMULATOR
+
+// what RAMFUNC=1 costs, so that the speedup can be weighed against it
+static void bench_report_ramfunc(void)
+{
+	if (!usb_configured) {
+		return;
+	}
+	BenchPacket p;
+	memset(&p, 0, sizeof(p));
+	strlcpy(p.name, "ramfunc bytes", sizeof(p.name));
+	p.ops = _eramfunc - _ramfunc;
+	while (usbd_ep_write_packet(usbd_dev, 0x81, &p, sizeof(p)) == 0) {
+		usbd_poll(usbd_dev);
+	}
+}
+
+#endif
+
+static void bench_poll(void)
+{
+#if EMULATOR
+	emulatorPoll();
+#else
+	usbd_poll(usbd_dev);
+#endif
+}
+
+static void bench_run(BenchEntry *b)
+{
+	layoutProgress(b->name, (b - benchmarks) * 1000 / BENCH_COUNT);
+	b->cycles = 0;
+#if !EMULATOR
+	stack_paint();
+#endif
+	for (uint32_t i = 0; i < b->ops; i++) {
+		bench_poll();
+		uint32_t start = bench_now();
+		b->run(i);
+		b->cycles += (uint32_t)(bench_now() - start);
+	}
+#if !EMULATOR
+	b->stack = stack_used();
+#endif
+}
+
+// six results per page, the buttons page through them
+static void bench_show(size_t page)
+{
+	char line[32];
+	oledClear();
+	for (size_t i = 0; i < 6 && page * 6 + i < BENCH_COUNT; i++) {
+		const BenchEntry *b = &benchmarks[page * 6 + i];
+		oledDrawString(0, i * 9, b->name, FONT_STANDARD);
+		snprintf(line, sizeof(line), "%lu/s", (unsigned long)bench_ops_per_sec(b));
+		oledDrawStringRight(OLED_WIDTH - 1, i * 9, line, FONT_STANDARD);
+	}
+	snprintf(line, sizeof(line), "%lu/%lu", (unsigned long)page + 1, (unsigned long)(BENCH_COUNT + 5) / 6);
+	oledDrawStringCenter(OLED_HEIGHT - 8, line, FONT_STANDARD);
+	oledRefresh();
+}
+
+int main(void)
+{
+#ifndef APPVER
+	setup();
+	__stack_chk_guard = random32(); // this supports compiler provided unpredictable stack protection checks
+	oledInit();
+#else
+	setupApp();
+	__stack_chk_guard = random32(); // this supports compiler provided unpredictable stack protection checks
+#endif
+
+#if !EMULATOR
+	SCS_DEMCR |= SCS_DEMCR_TRCENA;
+	DWT_CYCCNT = 0;
+	DWT_CTRL |= DWT_CTRL_CYCCNTENA;
+	setupUSB();
+	usbInit();
+#endif
+
+#if CRYPTOMEM
+	cm_PowerOn();
+#endif
+
+	// fixed inputs, so that runs of different versions are comparable
+	memset(buffer, 0xA5, sizeof(buffer));
+	memset(digest, 0x5A, sizeof(digest));
+	memset(ed_sk, 0x42, sizeof(ed_sk));
+	ed25519_publickey(ed_sk, ed_pk);
+	uint8_t key[32];
+	memset(key, 0x3C, sizeof(key));
+	aes_encrypt_key256(key, &aes_ctx);
+
+	for (size_t i = 0; i < BENCH_COUNT; i++) {
+		bench_run(&benchmarks[i]);
+	}
+	for (size_t i = 0; i < BENCH_COUNT; i++) {
+		bench_report(&benchmarks[i]);
+	}
+#if RAMFUNC && !EMULATOR
+	bench_report_ramfunc();
+#endif
+
+	size_t page = 0;
+	for (;;) {
+		bench_show(page);
+		do {
+			bench_poll();
+			buttonUpdate();
+		} while (!button.YesUp && !button.NoUp);
+		if (button.YesUp) {
+			page = (page + 1) % ((BENCH_COUNT + 5) / 6);
+		} else {
+			// repeat the whole run
+			for (size_t i = 0; i < BENCH_COUNT; i++) {
+				bench_run(&benchmarks[i]);
+				bench_report(&benchmarks[i]);
+			}
+			page = 0;
+		}
+	}
+
+	return 0;
+}
@@ -0,0 +1,241 @@
+/*
+ * This file is part of the TREZOR project, https://trezor.io/
+ *
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Host microbenchmarks of the firmware's parsing and serialization code.
+ *
+ * The modules are linked from libfirmware-host.a, built for the host
+ * against stubs.c in place of the layouts and button confirmation.  Each
+ * benchmark runs a fixed corpus a fixed number of times and prints the
+ * cost of one operation in nanoseconds, so that runs of different
+ * commits are comparable.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "bip32.h"
+#include "curves.h"
+#include "coins.h"
+#include "crypto.h"
+#include "transaction.h"
+#include "nem2.h"
+
+typedef struct {
+	const char *name;
+	uint32_t ops;
+	void (*run)(uint32_t i);
+	uint64_t ns;
+} BenchEntry;
+
+static const CoinInfo *coin;
+static HDNode root;
+static TxInputType input;
+static TxOutputType output_p2pkh, output_bech32, output_change;
+static TxOutputBinType bin;
+static MultisigRedeemScriptType multisig[2];
+static NEMTransactionCommon nem_common;
+static NEMTransfer nem_transfer;
+static NEMMosaic nem_mosaics[8];
+static uint8_t hash[32];
+static volatile uint32_t sink;
+
+static uint64_t bench_now(void)
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return (uint64_t)t.tv_sec * 1000000000 + t.tv_nsec;
+}
+
+static void bench_compile_output_p2pkh(uint32_t i)
+{
+	(void)i;
+	sink += compile_output(coin, &root, &output_p2pkh, &bin, false);
+}
+
+static void bench_compile_output_bech32(uint32_t i)
+{
+	(void)i;
+	sink += compile_output(coin, &root, &output_bech32, &bin, false);
+}
+
+static void bench_compile_output_change(uint32_t i)
+{
+	// m/44'/0'/0'/1/i, the account level comes from the node cache
+	output_change.address_n[4] = i;
+	sink += compile_output(coin, &root, &output_change, &bin, false);
+}
+
+static void bench_tx_serialize(uint32_t i)
+{
+	TxStruct tx;
+	tx_init(&tx, NULL, 2, 2, 1, 0, 0, HASHER_SHA2D);
+	input.prev_index = i;
+	sink += tx_serialize_input_hash(&tx, &input);
+	sink += tx_serialize_input_hash(&tx, &input);
+	sink += tx_serialize_output_hash(&tx, &bin);
+	sink += tx_serialize_output_hash(&tx, &bin);
+	tx_hash_final(&tx, hash, false);
+}
+
+static void bench_tx_input_weight(uint32_t i)
+{
+	input.script_type = (i & 1) ? InputScriptType_SPENDWITNESS : InputScriptType_SPENDADDRESS;
+	sink += tx_input_weight(coin, &input);
+}
+
+static void bench_ser_length(uint32_t i)
+{
+	static const uint32_t lengths[4] = { 25, 252, 4000, 100000 };
+	uint8_t out[5];
+	sink += ser_length(lengths[i & 3], out);
+}
+
+static void bench_multisig_fingerprint(uint32_t i)
+{
+	// alternate between two wallets, so every call misses the cache
+	sink += cryptoMultisigFingerprint(&multisig[i & 1], hash);
+}
+
+static void bench_nem_validate(uint32_t i)
+{
+	(void)i;
+	sink += nem_validate_common(&nem_common, false) == NULL;
+	sink += nem_validate_transfer(&nem_transfer, NEM_NETWORK_MAINNET) == NULL;
+}
+
+static void bench_nem_canonicalize(uint32_t i)
+{
+	(void)i;
+	sink += nem_canonicalizeMosaics(nem_transfer.mosaics, nem_transfer.mosaics_count);
+	// restore the unsorted corpus for the next run
+	memcpy(nem_transfer.mosaics, nem_mosaics, sizeof(nem_mosaics));
+}
+
+static BenchEntry benchmarks[] = {
+	{ "compile_output p2pkh",      20000, bench_compile_output_p2pkh, 0 },
+	{ "compile_output bech32",     20000, bench_compile_output_bech32, 0 },
+	{ "compile_output change",     200, bench_compile_output_change, 0 },
+	{ "tx_serialize 2-in 2-out",   20000, bench_tx_serialize, 0 },
+	{ "tx_input_weight",           1000000, bench_tx_input_weight, 0 },
+	{ "ser_length",                1000000, bench_ser_length, 0 },
+	{ "multisig fingerprint 2/3",  20000, bench_multisig_fingerprint, 0 },
+	{ "nem validate transfer",     20000, bench_nem_validate, 0 },
+	{ "nem canonicalize 8",        100000, bench_nem_canonicalize, 0 },
+};
+
+#define BENCH_COUNT (sizeof(benchmarks) / sizeof(benchmarks[0]))
+
+static void bench_setup(void)
+{
+	static const char *mosaic_names[8] = { "xem", "coin", "xem", "gold", "coin", "alpha", "xem", "beta" };
+	uint8_t seed[64];
+
+	memset(seed, 0xA5, sizeof(seed));
+	hdnode_from_seed(seed, sizeof(seed), SECP256K1_NAME, &root);
+	coin = coinByName("Bitcoin");
+
+	output_p2pkh.amount = 100000;
+	output_p2pkh.script_type = OutputScriptType_PAYTOADDRESS;
+	output_p2pkh.has_address = true;
+	strlcpy(output_p2pkh.address, "1BvBMSEYstWetqTFn5Au4m4GFg7xJaNVN2", sizeof(output_p2pkh.address));
+
+	output_bech32 = output_p2pkh;
+	strlcpy(output_bech32.address, "bc1qw508d6qejxtdgg4y5r3zarvary0c5xw7kv8f3t4", sizeof(output_bech32.address));
+
+	output_change.amount = 100000;
+	output_change.script_type = OutputScriptType_PAYTOADDRESS;
+	output_change.address_n_count = 5;
+	output_change.address_n[0] = 0x8000002C;
+	output_change.address_n[1] = 0x80000000;
+	output_change.address_n[2] = 0x80000000;
+	output_change.address_n[3] = 1;
+
+	compile_output(coin, &root, &output_p2pkh, &bin, false);
+
+	input.prev_hash.size = 32;
+	memset(input.prev_hash.bytes, 0x11, 32);
+	input.has_script_sig = true;
+	input.script_sig.size = 107;
+	memset(input.script_sig.bytes, 0x22, 107);
+	input.has_sequence = true;
+	input.sequence = 0xffffffff;
+	input.has_script_type = true;
+
+	for (int w = 0; w < 2; w++) {
+		multisig[w].has_m = true;
+		multisig[w].m = 2;
+		multisig[w].pubkeys_count = 3;
+		for (int k = 0; k < 3; k++) {
+			HDNodeType *node = &multisig[w].pubkeys[k].node;
+			node->depth = 4;
+			node->fingerprint = 0x01020304 * (k + 1);
+			node->child_num = w;
+			node->chain_code.size = 32;
+			memset(node->chain_code.bytes, 0x30 + k, 32);
+			node->has_public_key = true;
+			node->public_key.size = 33;
+			memset(node->public_key.bytes, 0x40 + 3 * k + w, 33);
+			node->public_key.bytes[0] = 0x02;
+		}
+	}
+
+	nem_common.has_network = true;
+	nem_common.network = NEM_NETWORK_MAINNET;
+	nem_common.has_timestamp = true;
+	nem_common.timestamp = 74649215;
+	nem_common.has_fee = true;
+	nem_common.fee = 2000000;
+	nem_common.has_deadline = true;
+	nem_common.deadline = 74735615;
+
+	ed25519_public_key recipient;
+	memset(recipient, 0x5A, sizeof(recipient));
+	nem_transfer.has_recipient = nem_get_address(recipient, NEM_NETWORK_MAINNET, nem_transfer.recipient);
+	nem_transfer.has_amount = true;
+	nem_transfer.amount = 2000000;
+	nem_transfer.mosaics_count = 8;
+	for (int k = 0; k < 8; k++) {
+		NEMMosaic *m = &nem_mosaics[k];
+		m->has_namespace = true;
+		strlcpy(m->namespace, k & 1 ? "nem" : "dim", sizeof(m->namespace));
+		m->has_mosaic = true;
+		strlcpy(m->mosaic, mosaic_names[k], sizeof(m->mosaic));
+		m->has_quantity = true;
+		m->quantity = 1000 * (k + 1);
+	}
+	memcpy(nem_transfer.mosaics, nem_mosaics, sizeof(nem_mosaics));
+}
+
+int main(void)
+{
+	bench_setup();
+
+	for (size_t i = 0; i < BENCH_COUNT; i++) {
+		BenchEntry *b = &benchmarks[i];
+		uint64_t start = bench_now();
+		for (uint32_t j = 0; j < b->ops; j++) {
+			b->run(j);
+		}
+		b->ns = bench_now() - start;
+		printf("%-26s %8u ops %10llu ns/op\n", b->name, (unsigned)b->ops,
+			(unsigned long long)(b->ns / b->ops));
+		fflush(stdout);
+	}
+
+	return 0;
+}
@@ -0,0 +1,55 @@
+/*
+ * This file is part of the TREZOR project, https://trezor.io/
+ *
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ * Stand-ins for the parts of the firmware that the host benchmarks do
+ * not link: the screen layouts, button confirmation and translations.
+ * Confirmations succeed without showing anything.
+ */
+
+#include "layout2.h"
+#include "protect.h"
+#include "gettext.h"
+
+void layoutConfirmOutput(const CoinInfo *coin, const TxOutputType *out)
+{
+	(void)coin;
+	(void)out;
+}
+
+void layoutConfirmOpReturn(const uint8_t *data, uint32_t size)
+{
+	(void)data;
+	(void)size;
+}
+
+void layoutProgressTick(void)
+{
+}
+
+bool protectButton(ButtonRequestType type, bool confirm_only)
+{
+	(void)type;
+	(void)confirm_only;
+	return true;
+}
+
+char const *strGetTrad(char const *str)
+{
+	return str;
+}
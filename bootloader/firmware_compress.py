@@ -0,0 +1,103 @@
+#!/usr/bin/env python
+# Compress a signed firmware image for a compressed FirmwareUpload.
+#
+# Output: "SAFZ", uint32 image length (little endian), LZ stream.  The
+# stream is a sequence of tokens: a control byte c < 0x80 is followed by
+# c + 1 literal bytes, c >= 0x80 copies (c & 0x7f) + 3 bytes from the
+# 16-bit little endian distance that follows (1..4096).  The decoder is
+# in bootloader/usb.c.
+from __future__ import print_function
+import argparse
+import struct
+
+MAGIC = b'SAFZ'
+WINDOW = 4096
+MIN_MATCH = 3
+MAX_MATCH = 0x7f + MIN_MATCH
+MAX_LITERALS = 0x80
+MAX_CHAIN = 64
+
+
+def compress(data):
+    data = bytearray(data)
+    out = bytearray()
+    literals = bytearray()
+    heads = {}
+    i = 0
+
+    def flush():
+        while literals:
+            chunk = literals[:MAX_LITERALS]
+            out.append(len(chunk) - 1)
+            out.extend(chunk)
+            del literals[:MAX_LITERALS]
+
+    while i < len(data):
+        best_len, best_dist = 0, 0
+        if i + MIN_MATCH <= len(data):
+            key = bytes(data[i:i + MIN_MATCH])
+            chain = heads.get(key, [])
+            limit = min(MAX_MATCH, len(data) - i)
+            for j in reversed(chain[-MAX_CHAIN:]):
+                if i - j > WINDOW:
+                    break
+                n = 0
+                while n < limit and data[j + n] == data[i + n]:
+                    n += 1
+                if n > best_len:
+                    best_len, best_dist = n, i - j
+                    if n == limit:
+                        break
+        if best_len >= MIN_MATCH:
+            flush()
+            out.append(0x80 | (best_len - MIN_MATCH))
+            out.extend(struct.pack('<H', best_dist))
+            step = best_len
+        else:
+            literals.append(data[i])
+            step = 1
+        for k in range(i, min(i + step, len(data) - MIN_MATCH + 1)):
+            heads.setdefault(bytes(data[k:k + MIN_MATCH]), []).append(k)
+        i += step
+    flush()
+    return MAGIC + struct.pack('<I', len(data)) + bytes(out)
+
+
+def decompress(payload):
+    assert payload[:4] == MAGIC
+    length = struct.unpack('<I', payload[4:8])[0]
+    src = bytearray(payload[8:])
+    out = bytearray()
+    i = 0
+    while len(out) < length:
+        c = src[i]
+        i += 1
+        if c < 0x80:
+            out.extend(src[i:i + c + 1])
+            i += c + 1
+        else:
+            dist = src[i] | (src[i + 1] << 8)
+            i += 2
+            for _ in range((c & 0x7f) + MIN_MATCH):
+                out.append(out[-dist])
+    return bytes(out)
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Compress a firmware image for upload.')
+    parser.add_argument('input', help='signed firmware image')
+    parser.add_argument('output', help='compressed payload')
+    args = parser.parse_args()
+
+    data = open(args.input, 'rb').read()
+    if data[:4] != b'SAFT':
+        raise Exception('Not a firmware image: %s' % args.input)
+    payload = compress(data)
+    if decompress(payload) != data:
+        raise Exception('Round trip failed')
+    open(args.output, 'wb').write(payload)
+    print('%d -> %d bytes (%.1f%%)' % (len(data), len(payload), 100.0 * len(payload) / len(data)))
+
+
+if __name__ == '__main__':
+    main()
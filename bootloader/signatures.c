@@ -41,16 +41,23 @@ static const uint8_t * const pubkey[PUBKEYS] = {
 int signatures_ok(uint8_t *store_hash)
 {
 	const uint32_t codelen = *((const uint32_t *)FLASH_META_CODELEN);
-	const uint8_t sigindex1 = *((const uint8_t *)FLASH_META_SIGINDEX1);
-	const uint8_t sigindex2 = *((const uint8_t *)FLASH_META_SIGINDEX2);
-	const uint8_t sigindex3 = *((const uint8_t *)FLASH_META_SIGINDEX3);
 
+	// always rehash, nothing in the meta sectors can vouch for the code
 	uint8_t hash[32];
 	sha256_Raw((const uint8_t *)FLASH_APP_START, codelen, hash);
 	if (store_hash) {
 		memcpy(store_hash, hash, 32);
 	}
 
+	return signatures_match(hash);
+}
+
+int signatures_match(const uint8_t *hash)
+{
+	const uint8_t sigindex1 = *((const uint8_t *)FLASH_META_SIGINDEX1);
+	const uint8_t sigindex2 = *((const uint8_t *)FLASH_META_SIGINDEX2);
+	const uint8_t sigindex3 = *((const uint8_t *)FLASH_META_SIGINDEX3);
+
 	if (sigindex1 < 1 || sigindex1 > PUBKEYS) return SIG_FAIL; // invalid index
 	if (sigindex2 < 1 || sigindex2 > PUBKEYS) return SIG_FAIL; // invalid index
 	if (sigindex3 < 1 || sigindex3 > PUBKEYS) return SIG_FAIL; // invalid index
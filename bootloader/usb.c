@@ -20,6 +20,8 @@
 #include <libopencm3/usb/usbd.h>
 #include <libopencm3/usb/hid.h>
 #include <libopencm3/stm32/flash.h>
+#include <libopencm3/cm3/dwt.h>
+#include <libopencm3/cm3/scs.h>
 
 #include <string.h>
 
@@ -36,8 +38,14 @@
 #include "ecdsa.h"
 #include "secp256k1.h"
 #include "memzero.h"
+#include "timer.h"
+#if CRYPTOMEM
+#include "cryptomem.h"
+#endif
 
 #define FIRMWARE_MAGIC "SAFT"
+// compressed upload: magic, uint32 image length (little endian), LZ stream
+#define FIRMWARE_MAGIC_LZ "SAFZ"
 
 #define ENDPOINT_ADDRESS_IN         (0x81)
 #define ENDPOINT_ADDRESS_OUT        (0x01)
@@ -177,6 +185,7 @@ enum {
 	STATE_OPEN,
 	STATE_FLASHSTART,
 	STATE_FLASHING,
+	STATE_FINISHING,
 	STATE_CHECK,
 	STATE_END,
 };
@@ -189,6 +198,23 @@ static uint32_t msg_size = 0;
 
 static uint8_t meta_backup[FLASH_META_LEN];
 
+static usbd_device *usbd_dev;
+
+// code sectors are erased lazily by usbLoop(), just ahead of the write
+// cursor, never from within the rx callback
+#define FLASH_CODE_SECTOR_LEN(s)	((s) == FLASH_CODE_SECTOR_FIRST ? 0x10000 : 0x20000)
+static int flash_erased_sector;
+static uint32_t flash_erased_end;
+
+// an upload packet that may need more than the erased flash waits here,
+// with the endpoint NAKing the host, until usbLoop() has erased ahead
+static uint8_t flash_held[64] __attribute__((aligned(4)));
+static uint8_t flash_held_pos;		// first payload byte, 0 if nothing is held
+
+// code is hashed while it is programmed
+static SHA256_CTX flash_hash_ctx;
+static uint8_t flash_hash[32];
+
 static void send_msg_success(usbd_device *dev)
 {
 	// response: Success message (id 2), payload len 0
@@ -315,12 +341,542 @@ static void restore_metadata(const uint8_t *backup)
 	flash_lock();
 }
 
+static bool sector_blank(uint32_t start, uint32_t len)
+{
+	const uint32_t *w = (const uint32_t *)FLASH_PTR(start);
+	for (uint32_t i = 0; i < len / 4; i++) {
+		if (w[i] != 0xFFFFFFFF) {
+			return false;
+		}
+	}
+	return true;
+}
+
+static void erase_next_code_sector(void)
+{
+	flash_erased_sector++;
+	uint32_t len = FLASH_CODE_SECTOR_LEN(flash_erased_sector);
+	// a sector that is already blank does not need the slow erase cycle
+	if (!sector_blank(flash_erased_end, len)) {
+		flash_erase_sector(flash_erased_sector, FLASH_CR_PROGRAM_X32);
+	}
+	flash_erased_end += len;
+}
+
+static void flash_program_begin(void)
+{
+	flash_wait_for_last_operation();
+	// x64 parallelism needs an external Vpp, so x32 is the widest we can use
+	FLASH_CR = (FLASH_CR & ~(FLASH_CR_PROGRAM_MASK << FLASH_CR_PROGRAM_SHIFT))
+		| (FLASH_CR_PROGRAM_X32 << FLASH_CR_PROGRAM_SHIFT);
+	FLASH_CR |= FLASH_CR_PG;
+}
+
+static void flash_program_end(void)
+{
+	flash_wait_for_last_operation();
+	FLASH_CR &= ~FLASH_CR_PG;
+}
+
+// code address the next word goes to
+static uint32_t flash_code_cursor(void)
+{
+	return FLASH_APP_START + (flash_pos < FLASH_META_DESC_LEN ? 0 : flash_pos - FLASH_META_DESC_LEN);
+}
+
+static void flash_program_next_word(uint32_t word)
+{
+	uint32_t addr;
+	if (flash_pos < FLASH_META_DESC_LEN) {
+		addr = FLASH_META_START + flash_pos;		// the first 256 bytes of firmware is metadata descriptor
+	} else {
+		addr = FLASH_APP_START + (flash_pos - FLASH_META_DESC_LEN);	// the rest is code
+		sha256_Update(&flash_hash_ctx, (const uint8_t *)&word, sizeof(word));
+	}
+	flash_write32(addr, word);
+	flash_pos += 4;
+}
+
+// image bytes in upload order, the magic is already consumed
+static uint8_t towrite[4] __attribute__((aligned(4)));
+static int wi;
+
+static void flash_program_byte(uint8_t b)
+{
+	towrite[wi] = b;
+	wi++;
+	if (wi == 4) {
+		const uint32_t *w = (const uint32_t *)towrite;
+		flash_program_next_word(*w);
+		wi = 0;
+	}
+}
+
+/*
+ * Decoder for compressed uploads (bootloader/firmware_compress.py).
+ *
+ * The stream is a sequence of tokens: a control byte c < 0x80 is
+ * followed by c + 1 literal bytes, c >= 0x80 copies (c & 0x7F) + 3
+ * bytes from the 16-bit little endian distance that follows, at most
+ * LZ_WINDOW bytes back.  The decoded image starts with FIRMWARE_MAGIC
+ * and is programmed exactly like a raw upload, so the hash and the
+ * signature check run over the reconstructed image.
+ */
+#define LZ_WINDOW    4096
+#define LZ_MIN_MATCH 3
+
+enum {
+	LZ_CTRL,
+	LZ_LITERAL,
+	LZ_DIST_LO,
+	LZ_DIST_HI,
+};
+
+static bool flash_compressed;
+static struct {
+	uint8_t state;
+	uint8_t count;		// literal bytes left or match length
+	uint16_t dist;
+	uint32_t out;		// decoded bytes, including the magic
+	uint8_t window[LZ_WINDOW];
+} lz;
+
+static void lz_init(void)
+{
+	lz.state = LZ_CTRL;
+	lz.out = 0;
+}
+
+static bool lz_put(uint8_t b)
+{
+	lz.window[lz.out % LZ_WINDOW] = b;
+	if (lz.out < 4) {
+		if (b != FIRMWARE_MAGIC[lz.out]) {
+			return false;
+		}
+	} else if (flash_pos < flash_len) {
+		flash_program_byte(b);
+	} else {
+		return false;	// longer than announced
+	}
+	lz.out++;
+	return true;
+}
+
+static bool lz_input(uint8_t c)
+{
+	switch (lz.state) {
+		case LZ_CTRL:
+			if (c & 0x80) {
+				lz.count = (c & 0x7F) + LZ_MIN_MATCH;
+				lz.state = LZ_DIST_LO;
+			} else {
+				lz.count = c + 1;
+				lz.state = LZ_LITERAL;
+			}
+			return true;
+		case LZ_LITERAL:
+			if (--lz.count == 0) {
+				lz.state = LZ_CTRL;
+			}
+			return lz_put(c);
+		case LZ_DIST_LO:
+			lz.dist = c;
+			lz.state = LZ_DIST_HI;
+			return true;
+		default:
+			lz.dist |= c << 8;
+			if (lz.dist == 0 || lz.dist > LZ_WINDOW || lz.dist > lz.out) {
+				return false;
+			}
+			while (lz.count) {
+				lz.count--;
+				if (!lz_put(lz.window[(lz.out - lz.dist) % LZ_WINDOW])) {
+					return false;
+				}
+			}
+			lz.state = LZ_CTRL;
+			return true;
+	}
+}
+
+// most image bytes a single upload packet can decode to, 63 payload bytes
+// of 3 byte matches
+#define FLASH_PACKET_MAX_OUT	(63 / 3 * (0x7F + LZ_MIN_MATCH))
+
+// the next packet may write past the erased sectors
+static bool flash_erase_needed(void)
+{
+	return flash_erased_sector < FLASH_CODE_SECTOR_LAST
+		&& flash_code_cursor() + FLASH_PACKET_MAX_OUT + 4 > flash_erased_end;
+}
+
+// feed upload payload bytes, false on a corrupt compressed stream
+static bool flash_upload(const uint8_t *p, const uint8_t *end)
+{
+	if (flash_erase_needed()) {
+		return false;	// usbLoop() did not erase ahead, should not happen
+	}
+	while (p < end && flash_pos < flash_len) {
+		if (flash_compressed) {
+			if (!lz_input(*p)) {
+				return false;
+			}
+		} else {
+			flash_program_byte(*p);
+		}
+		p++;
+	}
+	return true;
+}
+
+/*
+ * SelfTest
+ *
+ * The 53 byte payload of the USB test selects the profile.  With the
+ * upper case alphabet the full test runs: an RNG histogram over 2M bytes
+ * and a flash test on the metadata sectors, which are backed up and
+ * restored.  With the lower case alphabet the quick production profile
+ * runs: a chi-square test over 256k RNG bytes, a flash test on a blank
+ * scratch slot past the firmware image and the CryptoMemory
+ * communication test.
+ *
+ * The result goes out as the text of the Success / Failure message, one
+ * "name=ms" entry per test, with '!' instead of '=' for a failed test.
+ */
+#define SELFTEST_PAYLOAD_LEN	53
+#define SELFTEST_PATTERN_EDGE	"\x00\xFF\x55\xAA\x66\x99\x33\xCC"
+
+static const char selftest_full_payload[] = SELFTEST_PATTERN_EDGE "ABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789!" SELFTEST_PATTERN_EDGE;
+static const char selftest_quick_payload[] = SELFTEST_PATTERN_EDGE "abcdefghijklmnopqrstuvwxyz0123456789!" SELFTEST_PATTERN_EDGE;
+
+// scratch slots are taken top down from the end of the last code sector
+// and come back blank with the next firmware upload
+#define SELFTEST_SCRATCH_LEN	0x400
+#define SELFTEST_SCRATCH_SECTOR	(FLASH_ORIGIN + FLASH_TOTAL_SIZE - FLASH_CODE_SECTOR_LEN(FLASH_CODE_SECTOR_LAST))
+
+// room for the message text in a single report
+#define SELFTEST_REPORT_LEN	48
+
+static uint32_t selftest_cycles;
+
+static void selftest_timer_start(void)
+{
+	SCS_DEMCR |= SCS_DEMCR_TRCENA;
+	DWT_CTRL |= DWT_CTRL_CYCCNTENA;
+	selftest_cycles = DWT_CYCCNT;
+}
+
+// milliseconds since the previous call, at the 120 MHz core clock
+static uint32_t selftest_timer_lap(void)
+{
+	uint32_t now = DWT_CYCCNT;
+	uint32_t ms = (now - selftest_cycles) / 120000;
+	selftest_cycles = now;
+	return ms;
+}
+
+static bool selftest_rng(bool quick)
+{
+	uint32_t cnt[256];
+	memset(cnt, 0, sizeof(cnt));
+	const int rounds = quick ? 256 * 250 : 256 * 2000;
+	for (int i = 0; i < rounds; i++) {
+		uint32_t r = random32();
+		cnt[r & 0xFF]++;
+		cnt[(r >> 8) & 0xFF]++;
+		cnt[(r >> 16) & 0xFF]++;
+		cnt[(r >> 24) & 0xFF]++;
+	}
+	if (!quick) {
+		bool status = true;
+		for (int i = 0; i < 256; i++) {
+			status = status && (cnt[i] >= 7600) && (cnt[i] <= 8400);
+		}
+		return status;
+	}
+	// chi-square with 255 degrees of freedom over 1000 expected hits per
+	// value, both tails at p < 0.002: 190 < X^2 < 330
+	uint64_t sq = 0;
+	for (int i = 0; i < 256; i++) {
+		int32_t d = (int32_t)cnt[i] - 1000;
+		sq += (uint64_t)((int64_t)d * d);
+	}
+	return sq > 190 * 1000 && sq < 330 * 1000;
+}
+
+static bool selftest_cpu(void)
+{
+	// privkey :   e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855
+	// pubkey  : 04a34b99f22c790c4e36b2b3c2c35a36db06226e41c692fc82b8b56ac1c540c5bd
+	//             5b8dec5235a0fa8722476c7709c02559e3aa73aa03918ba2d492eea75abea235
+	// digest  :   c84a4cc264100070c8be2acf4072efaadaedfef3d6209c0fe26387e6b1262bbf
+	// sig:    :   f7869c679bbed1817052affd0264ccc6486795f6d06d0c187651b8f3863670c8
+	//             2ccf89be32a53eb65ea7c007859783d46717986fead0833ec60c5729cdc4a9ee
+	return 0 == ecdsa_verify_digest(&secp256k1,
+		(const uint8_t *)"\x04\xa3\x4b\x99\xf2\x2c\x79\x0c\x4e\x36\xb2\xb3\xc2\xc3\x5a\x36\xdb\x06\x22\x6e\x41\xc6\x92\xfc\x82\xb8\xb5\x6a\xc1\xc5\x40\xc5\xbd\x5b\x8d\xec\x52\x35\xa0\xfa\x87\x22\x47\x6c\x77\x09\xc0\x25\x59\xe3\xaa\x73\xaa\x03\x91\x8b\xa2\xd4\x92\xee\xa7\x5a\xbe\xa2\x35",
+		(const uint8_t *)"\xf7\x86\x9c\x67\x9b\xbe\xd1\x81\x70\x52\xaf\xfd\x02\x64\xcc\xc6\x48\x67\x95\xf6\xd0\x6d\x0c\x18\x76\x51\xb8\xf3\x86\x36\x70\xc8\x2c\xcf\x89\xbe\x32\xa5\x3e\xb6\x5e\xa7\xc0\x07\x85\x97\x83\xd4\x67\x17\x98\x6f\xea\xd0\x83\x3e\xc6\x0c\x57\x29\xcd\xc4\xa9\xee",
+		(const uint8_t *)"\xc8\x4a\x4c\xc2\x64\x10\x00\x70\xc8\xbe\x2a\xcf\x40\x72\xef\xaa\xda\xed\xfe\xf3\xd6\x20\x9c\x0f\xe2\x63\x87\xe6\xb1\x26\x2b\xbf");
+}
+
+static bool selftest_flash_full(void)
+{
+	// backup metadata
+	backup_metadata(meta_backup);
+
+	// write test pattern
+	erase_metadata_sectors();
+	flash_unlock();
+	for (int i = 0; i < FLASH_META_LEN / 4; i++) {
+		flash_program_word(FLASH_META_START + i * 4, 0x3C695A0F);
+	}
+	flash_lock();
+
+	// compute hash of written test pattern
+	uint8_t hash[32];
+	sha256_Raw(FLASH_PTR(FLASH_META_START), FLASH_META_LEN, hash);
+
+	// restore metadata from backup
+	erase_metadata_sectors();
+	restore_metadata(meta_backup);
+	memzero(meta_backup, sizeof(meta_backup));
+
+	// compare against known hash computed via the following Python3 script:
+	// hashlib.sha256(binascii.unhexlify('0F5A693C' * 8192)).hexdigest()
+	return 0 == memcmp(hash, "\xa6\xc2\x25\xa4\x76\xa1\xde\x76\x09\xe0\xb0\x07\xf8\xe2\x5a\xec\x1d\x75\x8d\x5c\x36\xc8\x4a\x6b\x75\x4e\xd5\x3d\xe6\x99\x97\x64", 32);
+}
+
+// highest blank scratch slot above the firmware image, 0 if there is none
+static uint32_t selftest_scratch_slot(void)
+{
+	uint32_t image_end = FLASH_APP_START;
+	if (firmware_present()) {
+		image_end += *((const uint32_t *)FLASH_PTR(FLASH_META_CODELEN));
+	}
+	for (uint32_t a = FLASH_ORIGIN + FLASH_TOTAL_SIZE - SELFTEST_SCRATCH_LEN; a >= SELFTEST_SCRATCH_SECTOR && a >= image_end; a -= SELFTEST_SCRATCH_LEN) {
+		if (sector_blank(a, SELFTEST_SCRATCH_LEN)) {
+			return a;
+		}
+	}
+	// all slots used, start over if the image leaves the sector alone
+	if (image_end <= SELFTEST_SCRATCH_SECTOR) {
+		flash_unlock();
+		flash_erase_sector(FLASH_CODE_SECTOR_LAST, FLASH_CR_PROGRAM_X32);
+		flash_lock();
+		return FLASH_ORIGIN + FLASH_TOTAL_SIZE - SELFTEST_SCRATCH_LEN;
+	}
+	return 0;
+}
+
+static bool selftest_flash_quick(void)
+{
+	uint32_t slot = selftest_scratch_slot();
+	if (slot == 0) {
+		return false;
+	}
+	// neighbouring words hold complementary patterns
+	flash_clear_status_flags();
+	flash_unlock();
+	for (uint32_t i = 0; i < SELFTEST_SCRATCH_LEN / 4; i++) {
+		flash_program_word(slot + i * 4, (i & 1) ? 0xC396A5F0 : 0x3C695A0F);
+	}
+	flash_lock();
+	if ((FLASH_SR & (FLASH_SR_PGAERR | FLASH_SR_PGPERR | FLASH_SR_PGSERR | FLASH_SR_WRPERR)) != 0) {
+		return false;
+	}
+	const uint32_t *w = (const uint32_t *)FLASH_PTR(slot);
+	for (uint32_t i = 0; i < SELFTEST_SCRATCH_LEN / 4; i++) {
+		if (w[i] != ((i & 1) ? 0xC396A5F0 : 0x3C695A0F)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+static bool selftest_cryptomem(void)
+{
+#if CRYPTOMEM
+	// the communication test polls for the write acknowledge with timer_ms()
+	timer_init();
+	return cm_prodtest_communication_test() == CM_SUCCESS;
+#else
+	return true;
+#endif
+}
+
+static char selftest_text[SELFTEST_REPORT_LEN + 1];
+static int selftest_text_len;
+
+// append "name=ms", or "name!ms" for a failed test, to the report
+static void selftest_report(const char *name, bool status, uint32_t ms)
+{
+	char entry[24];
+	int n = 0;
+	if (selftest_text_len > 0) {
+		entry[n++] = ' ';
+	}
+	while (*name && n < 12) {
+		entry[n++] = *name++;
+	}
+	entry[n++] = status ? '=' : '!';
+	char digits[10];
+	int d = 0;
+	do {
+		digits[d++] = '0' + ms % 10;
+		ms /= 10;
+	} while (ms > 0);
+	while (d > 0) {
+		entry[n++] = digits[--d];
+	}
+	if (selftest_text_len + n <= SELFTEST_REPORT_LEN) {
+		memcpy(selftest_text + selftest_text_len, entry, n);
+		selftest_text_len += n;
+		selftest_text[selftest_text_len] = '\0';
+	}
+}
+
+static void send_msg_selftest(usbd_device *dev, bool status)
+{
+	// response: Success message (id 2) with message = report
+	//       or: Failure message (id 3) with code = 99 (Failure_FirmwareError)
+	//           and message = report
+	static uint8_t resp[64] __attribute__((aligned(4)));
+	memset(resp, 0, sizeof(resp));
+	memcpy(resp, "?##", 3);
+	int n = 9;
+	if (status) {
+		resp[4] = 0x02;
+		resp[n++] = 0x0a;
+	} else {
+		resp[4] = 0x03;
+		resp[n++] = 0x08;
+		resp[n++] = 0x63;
+		resp[n++] = 0x12;
+	}
+	resp[n++] = selftest_text_len;
+	memcpy(resp + n, selftest_text, selftest_text_len);
+	n += selftest_text_len;
+	resp[8] = n - 9;
+	while ( usbd_ep_write_packet(dev, ENDPOINT_ADDRESS_IN, resp, 64) != 64) {}
+}
+
+// the upload ends, leave the flash locked
+static void flash_abort(void)
+{
+	if (flash_state == STATE_FLASHING) {
+		flash_program_end();
+	}
+	if (flash_state == STATE_FLASHING || flash_state == STATE_FINISHING) {
+		flash_lock();
+	}
+	if (flash_held_pos) {
+		flash_held_pos = 0;
+		usbd_ep_nak_set(usbd_dev, ENDPOINT_ADDRESS_OUT, 0);
+	}
+	flash_state = STATE_END;
+}
+
+static void flash_hold(usbd_device *dev, const uint8_t *buf, uint8_t pos)
+{
+	memcpy(flash_held, buf, 64);
+	flash_held_pos = pos;
+	usbd_ep_nak_set(dev, ENDPOINT_ADDRESS_OUT, 1);
+}
+
+static void flash_upload_packet(usbd_device *dev, const uint8_t *p, const uint8_t *end)
+{
+	if (!flash_upload(p, end)) {	// invalid contents
+		flash_abort();
+		send_msg_failure(dev);
+		layoutDialog(&bmp_icon_error, NULL, NULL, NULL, "Error installing ", "firmware.", NULL, "Unplug your Safe-T", "and try again.", NULL);
+		return;
+	}
+	if (flash_anim % 32 == 4) {
+		layoutProgress("INSTALLING ... Please wait", 1000 * flash_pos / flash_len);
+	}
+	flash_anim++;
+	// flashing done, usbLoop() finishes the image
+	if (flash_pos == flash_len) {
+		sha256_Final(&flash_hash_ctx, flash_hash);
+		flash_program_end();
+		flash_state = STATE_FINISHING;
+	}
+}
+
+static void flash_check(usbd_device *dev)
+{
+	if (!brand_new_firmware) {
+		layoutFirmwareHash(flash_hash);
+		do {
+			delay(100000);
+			buttonUpdate();
+		} while (!button.YesUp && !button.NoUp);
+	}
+
+	bool hash_check_ok = brand_new_firmware || button.YesUp;
+
+	layoutProgress("INSTALLING ... Please wait", 1000);
+	uint8_t flags = *FLASH_PTR(FLASH_META_FLAGS);
+	// the streamed hash covers the whole code only if the header agrees on its length
+	bool hash_streamed = *((const uint32_t *)FLASH_PTR(FLASH_META_CODELEN)) == flash_len - FLASH_META_DESC_LEN;
+	int signed_firmware = hash_streamed ? signatures_match(flash_hash) : signatures_ok(NULL);
+	// wipe storage if:
+	// 0) there was no firmware
+	// 1) old firmware was unsigned
+	// 2) firmware restore flag isn't set
+	// 3) signatures are not ok
+	if (brand_new_firmware || old_was_unsigned || (flags & 0x01) == 0 || SIG_OK != signed_firmware) {
+		memzero(meta_backup, sizeof(meta_backup));
+	}
+	// copy new firmware header
+	memcpy(meta_backup, (void *)FLASH_META_START, FLASH_META_DESC_LEN);
+	// write "SAFT" in header only when hash was confirmed
+	if (hash_check_ok) {
+		memcpy(meta_backup, FIRMWARE_MAGIC, 4);
+	} else {
+		memzero(meta_backup, 4);
+	}
+
+	// no need to erase, because we are not changing any already flashed byte.
+	restore_metadata(meta_backup);
+	memzero(meta_backup, sizeof(meta_backup));
+
+	flash_state = STATE_END;
+	if (hash_check_ok) {
+		layoutDialog(&bmp_icon_ok, NULL, NULL, NULL, "New firmware", "successfully installed.", NULL, "You may now", "unplug your Safe-T.", NULL);
+		send_msg_success(dev);
+	} else {
+		layoutDialog(&bmp_icon_warning, NULL, NULL, NULL, "Firmware installation", "aborted.", NULL, "You need to repeat", "the procedure with", "the correct firmware.");
+		send_msg_failure(dev);
+	}
+}
+
+// clear code sectors past the end of the new image and check the result
+static void flash_finish(usbd_device *dev)
+{
+	while (flash_erased_sector < FLASH_CODE_SECTOR_LAST) {
+		erase_next_code_sector();
+	}
+	flash_wait_for_last_operation();
+	flash_lock();
+	if ((FLASH_SR & (FLASH_SR_PGAERR | FLASH_SR_PGPERR | FLASH_SR_PGSERR | FLASH_SR_WRPERR)) != 0) {
+		send_msg_failure(dev);
+		flash_state = STATE_END;
+		layoutDialog(&bmp_icon_error, NULL, NULL, NULL, "Error installing ", "firmware.", NULL, "Unplug your Safe-T", "and try again.", NULL);
+		return;
+	}
+	flash_state = STATE_CHECK;
+	if (!brand_new_firmware) {
+		send_msg_buttonrequest_firmwarecheck(dev);
+		return;
+	}
+	flash_check(dev);
+}
+
 static void hid_rx_callback(usbd_device *dev, uint8_t ep)
 {
 	(void)ep;
 	static uint8_t buf[64] __attribute__((aligned(4)));
-	static uint8_t towrite[4] __attribute__((aligned(4)));
-	static int wi;
 
 	if ( usbd_ep_read_packet(dev, ENDPOINT_ADDRESS_OUT, buf, 64) != 64) return;
 
@@ -384,81 +940,49 @@ static void hid_rx_callback(usbd_device *dev, uint8_t ep)
 			return;
 		}
 		if (msg_id == 0x0020) {		// SelfTest message (id 32)
+			selftest_timer_start();
+			selftest_text_len = 0;
 
 			// USB TEST
 			layoutProgress("TESTING USB ...", 0);
-			bool status_usb = (buf[9] == 0x0a) && (buf[10] == 53) && (0 == memcmp(buf + 11, "\x00\xFF\x55\xAA\x66\x99\x33\xCC" "ABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789!" "\x00\xFF\x55\xAA\x66\x99\x33\xCC", 53));
+			bool status_usb = (buf[9] == 0x0a) && (buf[10] == SELFTEST_PAYLOAD_LEN);
+			bool quick = status_usb && (0 == memcmp(buf + 11, selftest_quick_payload, SELFTEST_PAYLOAD_LEN));
+			status_usb = status_usb && (quick || 0 == memcmp(buf + 11, selftest_full_payload, SELFTEST_PAYLOAD_LEN));
+			selftest_report("usb", status_usb, selftest_timer_lap());
 
 			// RNG TEST
-			layoutProgress("TESTING RNG ...", 250);
-			uint32_t cnt[256];
-			memset(cnt, 0, sizeof(cnt));
-			for (int i = 0; i < (256 * 2000); i++) {
-				uint32_t r = random32();
-				cnt[r & 0xFF]++;
-				cnt[(r >> 8) & 0xFF]++;
-				cnt[(r >> 16) & 0xFF]++;
-				cnt[(r >> 24) & 0xFF]++;
-			}
-			bool status_rng = true;
-			for (int i = 0; i < 256; i++) {
-				status_rng = status_rng && (cnt[i] >= 7600) && (cnt[i] <= 8400);
-			}
+			layoutProgress("TESTING RNG ...", 200);
+			bool status_rng = selftest_rng(quick);
+			selftest_report("rng", status_rng, selftest_timer_lap());
 
 			// CPU TEST
-			layoutProgress("TESTING CPU ...", 500);
-			// privkey :   e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855
-			// pubkey  : 04a34b99f22c790c4e36b2b3c2c35a36db06226e41c692fc82b8b56ac1c540c5bd
-			//             5b8dec5235a0fa8722476c7709c02559e3aa73aa03918ba2d492eea75abea235
-			// digest  :   c84a4cc264100070c8be2acf4072efaadaedfef3d6209c0fe26387e6b1262bbf
-			// sig:    :   f7869c679bbed1817052affd0264ccc6486795f6d06d0c187651b8f3863670c8
-			//             2ccf89be32a53eb65ea7c007859783d46717986fead0833ec60c5729cdc4a9ee
-			bool status_cpu = (0 == ecdsa_verify_digest(&secp256k1,
-				(const uint8_t *)"\x04\xa3\x4b\x99\xf2\x2c\x79\x0c\x4e\x36\xb2\xb3\xc2\xc3\x5a\x36\xdb\x06\x22\x6e\x41\xc6\x92\xfc\x82\xb8\xb5\x6a\xc1\xc5\x40\xc5\xbd\x5b\x8d\xec\x52\x35\xa0\xfa\x87\x22\x47\x6c\x77\x09\xc0\x25\x59\xe3\xaa\x73\xaa\x03\x91\x8b\xa2\xd4\x92\xee\xa7\x5a\xbe\xa2\x35",
-				(const uint8_t *)"\xf7\x86\x9c\x67\x9b\xbe\xd1\x81\x70\x52\xaf\xfd\x02\x64\xcc\xc6\x48\x67\x95\xf6\xd0\x6d\x0c\x18\x76\x51\xb8\xf3\x86\x36\x70\xc8\x2c\xcf\x89\xbe\x32\xa5\x3e\xb6\x5e\xa7\xc0\x07\x85\x97\x83\xd4\x67\x17\x98\x6f\xea\xd0\x83\x3e\xc6\x0c\x57\x29\xcd\xc4\xa9\xee",
-				(const uint8_t *)"\xc8\x4a\x4c\xc2\x64\x10\x00\x70\xc8\xbe\x2a\xcf\x40\x72\xef\xaa\xda\xed\xfe\xf3\xd6\x20\x9c\x0f\xe2\x63\x87\xe6\xb1\x26\x2b\xbf"));
+			layoutProgress("TESTING CPU ...", 400);
+			bool status_cpu = selftest_cpu();
+			selftest_report("cpu", status_cpu, selftest_timer_lap());
 
 			// FLASH TEST
-			layoutProgress("TESTING FLASH ...", 750);
-
-			// backup metadata
-			backup_metadata(meta_backup);
+			layoutProgress("TESTING FLASH ...", 600);
+			bool status_flash = quick ? selftest_flash_quick() : selftest_flash_full();
+			selftest_report("flash", status_flash, selftest_timer_lap());
 
-			// write test pattern
-			erase_metadata_sectors();
-			flash_unlock();
-			for (int i = 0; i < FLASH_META_LEN / 4; i++) {
-				flash_program_word(FLASH_META_START + i * 4, 0x3C695A0F);
+			// CRYPTOMEM TEST, quick profile only
+			bool status_cm = true;
+			if (quick) {
+				layoutProgress("TESTING CRYPTOMEM ...", 800);
+				status_cm = selftest_cryptomem();
+				selftest_report("cm", status_cm, selftest_timer_lap());
 			}
-			flash_lock();
 
-			// compute hash of written test pattern
-			uint8_t hash[32];
-			sha256_Raw(FLASH_PTR(FLASH_META_START), FLASH_META_LEN, hash);
+			bool status_all = status_usb && status_rng && status_cpu && status_flash && status_cm;
 
-			// restore metadata from backup
-			erase_metadata_sectors();
-			restore_metadata(meta_backup);
-			memzero(meta_backup, sizeof(meta_backup));
-
-			// compare against known hash computed via the following Python3 script:
-			// hashlib.sha256(binascii.unhexlify('0F5A693C' * 8192)).hexdigest()
-			bool status_flash = (0 == memcmp(hash, "\xa6\xc2\x25\xa4\x76\xa1\xde\x76\x09\xe0\xb0\x07\xf8\xe2\x5a\xec\x1d\x75\x8d\x5c\x36\xc8\x4a\x6b\x75\x4e\xd5\x3d\xe6\x99\x97\x64", 32));
-
-			bool status_all = status_usb && status_rng && status_cpu && status_flash;
-
-			if (status_all) {
-				send_msg_success(dev);
-			} else {
-				send_msg_failure(dev);
-			}
+			send_msg_selftest(dev, status_all);
 			layoutDialog(status_all ? &bmp_icon_info : &bmp_icon_error,
 				NULL, NULL, NULL,
 				status_usb   ? "Test USB ... OK"   : "Test USB ... Failed",
 				status_rng   ? "Test RNG ... OK"   : "Test RNG ... Failed",
 				status_cpu   ? "Test CPU ... OK"   : "Test CPU ... Failed",
 				status_flash ? "Test FLASH ... OK" : "Test FLASH ... Failed",
-				NULL,
+				quick ? (status_cm ? "Test CM ... OK" : "Test CM ... Failed") : NULL,
 				NULL
 			);
 			return;
@@ -486,14 +1010,10 @@ static void hid_rx_callback(usbd_device *dev, uint8_t ep)
 				flash_wait_for_last_operation();
 				flash_clear_status_flags();
 				flash_unlock();
-				// erase metadata area
+				// erase metadata area, the code area is erased
+				// sector by sector while the upload is running
+				layoutProgress("ERASING ... Please wait", 0);
 				for (int i = FLASH_META_SECTOR_FIRST; i <= FLASH_META_SECTOR_LAST; i++) {
-					layoutProgress("ERASING ... Please wait", 1000 * (i - FLASH_META_SECTOR_FIRST) / (FLASH_CODE_SECTOR_LAST - FLASH_META_SECTOR_FIRST));
-					flash_erase_sector(i, FLASH_CR_PROGRAM_X32);
-				}
-				// erase code area
-				for (int i = FLASH_CODE_SECTOR_FIRST; i <= FLASH_CODE_SECTOR_LAST; i++) {
-					layoutProgress("ERASING ... Please wait", 1000 * (i - FLASH_META_SECTOR_FIRST) / (FLASH_CODE_SECTOR_LAST - FLASH_META_SECTOR_FIRST));
 					flash_erase_sector(i, FLASH_CR_PROGRAM_X32);
 				}
 				layoutProgress("INSTALLING ... Please wait", 0);
@@ -536,36 +1056,42 @@ static void hid_rx_callback(usbd_device *dev, uint8_t ep)
 			// read payload length
 			uint8_t *p = buf + 10;
 			flash_len = readprotobufint(&p);
+			// a compressed payload announces the length of the image
+			flash_compressed = memcmp(p, FIRMWARE_MAGIC_LZ, 4) == 0;
+			if (flash_compressed) {
+				p += 4;
+				flash_len = p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+				p += 4;
+				lz_init();
+			}
 			if (flash_len > FLASH_TOTAL_SIZE + FLASH_META_DESC_LEN - (FLASH_APP_START - FLASH_ORIGIN)) { // firmware is too big
 				send_msg_failure(dev);
 				flash_state = STATE_END;
 				layoutDialog(&bmp_icon_error, NULL, NULL, NULL, "Firmware is too big.", NULL, "Get official firmware", "from safe-t.io/start", NULL, NULL);
 				return;
 			}
-			// check firmware magic
-			if (memcmp(p, FIRMWARE_MAGIC, 4) != 0) {
+			// check firmware magic, the decoder checks it for compressed payloads
+			if (!flash_compressed && memcmp(p, FIRMWARE_MAGIC, 4) != 0) {
 				send_msg_failure(dev);
 				flash_state = STATE_END;
 				layoutDialog(&bmp_icon_error, NULL, NULL, NULL, "Wrong firmware header.", NULL, "Get official firmware", "from safe-t.io/start", NULL, NULL); // FIXME url!!!
 				return;
 			}
 			flash_state = STATE_FLASHING;
-			p += 4;         // Don't flash firmware header yet.
+			if (!flash_compressed) {
+				p += 4;         // Don't flash firmware header yet.
+			}
 			flash_pos = 4;
+			flash_erased_sector = FLASH_CODE_SECTOR_FIRST - 1;
+			flash_erased_end = FLASH_APP_START;
+			sha256_Init(&flash_hash_ctx);
 			wi = 0;
+			// flash stays unlocked and in program mode for the whole upload
+			flash_clear_status_flags();
 			flash_unlock();
-			while (p < buf + 64) {
-				towrite[wi] = *p;
-				wi++;
-				if (wi == 4) {
-					const uint32_t *w = (uint32_t *)towrite;
-					flash_program_word(FLASH_META_START + flash_pos, *w);
-					flash_pos += 4;
-					wi = 0;
-				}
-				p++;
-			}
-			flash_lock();
+			flash_program_begin();
+			// the first code sector is erased by usbLoop()
+			flash_hold(dev, buf, p - buf);
 			return;
 		}
 		return;
@@ -573,93 +1099,24 @@ static void hid_rx_callback(usbd_device *dev, uint8_t ep)
 
 	if (flash_state == STATE_FLASHING) {
 		if (buf[0] != '?') {	// invalid contents
+			flash_abort();
 			send_msg_failure(dev);
-			flash_state = STATE_END;
 			layoutDialog(&bmp_icon_error, NULL, NULL, NULL, "Error installing ", "firmware.", NULL, "Unplug your Safe-T", "and try again.", NULL);
 			return;
 		}
-		const uint8_t *p = buf + 1;
-		if (flash_anim % 32 == 4) {
-			layoutProgress("INSTALLING ... Please wait", 1000 * flash_pos / flash_len);
-		}
-		flash_anim++;
-		flash_unlock();
-		while (p < buf + 64 && flash_pos < flash_len) {
-			towrite[wi] = *p;
-			wi++;
-			if (wi == 4) {
-				const uint32_t *w = (const uint32_t *)towrite;
-				if (flash_pos < FLASH_META_DESC_LEN) {
-					flash_program_word(FLASH_META_START + flash_pos, *w);			// the first 256 bytes of firmware is metadata descriptor
-				} else {
-					flash_program_word(FLASH_APP_START + (flash_pos - FLASH_META_DESC_LEN), *w);	// the rest is code
-				}
-				flash_pos += 4;
-				wi = 0;
-			}
-			p++;
-		}
-		flash_lock();
-		// flashing done
-		if (flash_pos == flash_len) {
-			flash_state = STATE_CHECK;
-			if (!brand_new_firmware) {
-				send_msg_buttonrequest_firmwarecheck(dev);
-				return;
-			}
-		} else {
+		if (flash_erase_needed()) {
+			flash_hold(dev, buf, 1);
 			return;
 		}
+		flash_upload_packet(dev, buf + 1, buf + 64);
+		return;
 	}
 
 	if (flash_state == STATE_CHECK) {
-
-		if (!brand_new_firmware) {
-			if (msg_id != 0x001B) {	// ButtonAck message (id 27)
-				return;
-			}
-			uint8_t hash[32];
-			sha256_Raw(FLASH_PTR(FLASH_APP_START), flash_len - FLASH_META_DESC_LEN, hash);
-			layoutFirmwareHash(hash);
-			do {
-				delay(100000);
-				buttonUpdate();
-			} while (!button.YesUp && !button.NoUp);
-		}
-
-		bool hash_check_ok = brand_new_firmware || button.YesUp;
-
-		layoutProgress("INSTALLING ... Please wait", 1000);
-		uint8_t flags = *FLASH_PTR(FLASH_META_FLAGS);
-		// wipe storage if:
-		// 0) there was no firmware
-		// 1) old firmware was unsigned
-		// 2) firmware restore flag isn't set
-		// 3) signatures are not ok
-		if (brand_new_firmware || old_was_unsigned || (flags & 0x01) == 0 || SIG_OK != signatures_ok(NULL)) {
-			memzero(meta_backup, sizeof(meta_backup));
-		}
-		// copy new firmware header
-		memcpy(meta_backup, (void *)FLASH_META_START, FLASH_META_DESC_LEN);
-		// write "SAFT" in header only when hash was confirmed
-		if (hash_check_ok) {
-			memcpy(meta_backup, FIRMWARE_MAGIC, 4);
-		} else {
-			memzero(meta_backup, 4);
-		}
-
-		// no need to erase, because we are not changing any already flashed byte.
-		restore_metadata(meta_backup);
-		memzero(meta_backup, sizeof(meta_backup));
-
-		flash_state = STATE_END;
-		if (hash_check_ok) {
-			layoutDialog(&bmp_icon_ok, NULL, NULL, NULL, "New firmware", "successfully installed.", NULL, "You may now", "unplug your Safe-T.", NULL);
-			send_msg_success(dev);
-		} else {
-			layoutDialog(&bmp_icon_warning, NULL, NULL, NULL, "Firmware installation", "aborted.", NULL, "You need to repeat", "the procedure with", "the correct firmware.");
-			send_msg_failure(dev);
+		if (!brand_new_firmware && msg_id != 0x001B) {	// ButtonAck message (id 27)
+			return;
 		}
+		flash_check(dev);
 		return;
 	}
 
@@ -680,7 +1137,6 @@ static void hid_set_config(usbd_device *dev, uint16_t wValue)
 	);
 }
 
-static usbd_device *usbd_dev;
 static uint8_t usbd_control_buffer[128];
 
 void checkButtons(void)
@@ -712,13 +1168,44 @@ void checkButtons(void)
 	}
 }
 
+// the host went away in the middle of an upload
+static void usb_reset(void)
+{
+	if (flash_state == STATE_FLASHING || flash_state == STATE_FINISHING) {
+		flash_abort();
+		layoutDialog(&bmp_icon_error, NULL, NULL, NULL, "Error installing ", "firmware.", NULL, "Unplug your Safe-T", "and try again.", NULL);
+	}
+}
+
+// flash work that must not run inside the rx callback
+static void flash_poll(void)
+{
+	if (flash_state == STATE_FLASHING && flash_erase_needed()) {
+		flash_program_end();
+		erase_next_code_sector();
+		flash_program_begin();
+	}
+	if (flash_state == STATE_FLASHING && flash_held_pos && !flash_erase_needed()) {
+		uint8_t pos = flash_held_pos;
+		flash_held_pos = 0;
+		usbd_ep_nak_set(usbd_dev, ENDPOINT_ADDRESS_OUT, 0);
+		flash_upload_packet(usbd_dev, flash_held + pos, flash_held + 64);
+	}
+	if (flash_state == STATE_FINISHING) {
+		flash_finish(usbd_dev);
+	}
+}
+
 void usbLoop(bool firmware_present)
 {
 	brand_new_firmware = !firmware_present;
 	usbd_dev = usbd_init(&otgfs_usb_driver, &dev_descr, &config, usb_strings, 3, usbd_control_buffer, sizeof(usbd_control_buffer));
 	usbd_register_set_config_callback(usbd_dev, hid_set_config);
+	usbd_register_reset_callback(usbd_dev, usb_reset);
+	usbd_register_suspend_callback(usbd_dev, usb_reset);
 	for (;;) {
 		usbd_poll(usbd_dev);
+		flash_poll();
 		if (brand_new_firmware && (flash_state == STATE_READY || flash_state == STATE_OPEN)) {
 			checkButtons();
 		}
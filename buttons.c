@@ -19,20 +19,122 @@
 
 #include "buttons.h"
 
+#if !EMULATOR
+#include <libopencm3/stm32/exti.h>
+#include <libopencm3/stm32/rcc.h>
+#include <libopencm3/cm3/nvic.h>
+#endif
+
 struct buttonState button;
 
+#define BUTTON_PINS (BTN_PIN_YES | BTN_PIN_NO)
+
+/*
+ * With buttonInitIRQ() the pins are no longer sampled by buttonUpdate().
+ * Every edge raises an EXTI interrupt, which (re)starts the debounce
+ * countdown in SysTick.  When the pins have been stable for
+ * BUTTON_DEBOUNCE_MS the new state is appended to the queue, so a press
+ * and release between two calls of buttonUpdate() is seen as two
+ * updates instead of being lost.  If the queue overflows, buttonUpdate()
+ * falls back to the latest debounced state.
+ */
+#define BUTTON_QUEUE_SIZE 16
+
+static bool button_irq = false;
+static volatile uint16_t button_stable = BUTTON_PINS;
+static volatile uint8_t button_debounce = 0;
+static volatile uint16_t button_queue[BUTTON_QUEUE_SIZE];
+static volatile uint8_t button_queue_head = 0, button_queue_tail = 0;
+
 #if !EMULATOR
 uint16_t buttonRead(void) {
 	return gpio_port_read(BTN_PORT);
 }
+
+static void buttonEdge(void) {
+	exti_reset_request(BUTTON_PINS);
+	button_debounce = BUTTON_DEBOUNCE_MS;
+}
+
+// the EXTI lines are the pin numbers, GPIO2 and GPIO5
+void exti2_isr(void) {
+	buttonEdge();
+}
+
+void exti9_5_isr(void) {
+	buttonEdge();
+}
+
+/*
+ * Captures the buttons from the EXTI interrupts.  This needs privileged
+ * mode to set up the interrupt controller, so it has to be called before
+ * the MPU is configured, and SysTick has to run for buttonTick().
+ */
+void buttonInitIRQ(void) {
+	rcc_periph_clock_enable(RCC_SYSCFG);
+	button_stable = buttonRead() & BUTTON_PINS;
+	button_queue_head = button_queue_tail = 0;
+	exti_select_source(BUTTON_PINS, BTN_PORT);
+	exti_set_trigger(BUTTON_PINS, EXTI_TRIGGER_BOTH);
+	exti_reset_request(BUTTON_PINS);
+	exti_enable_request(BUTTON_PINS);
+	nvic_enable_irq(NVIC_EXTI2_IRQ);
+	nvic_enable_irq(NVIC_EXTI9_5_IRQ);
+	button_irq = true;
+}
+#else
+void buttonInitIRQ(void) {
+}
 #endif
 
+/* called from the SysTick interrupt every millisecond */
+void buttonTick(void) {
+	if (button_debounce == 0 || --button_debounce != 0) {
+		return;
+	}
+	uint16_t state = buttonRead() & BUTTON_PINS;
+	if (state == button_stable) {
+		return;
+	}
+	button_stable = state;
+	uint8_t head = button_queue_head;
+	if ((uint8_t)(head - button_queue_tail) < BUTTON_QUEUE_SIZE) {
+		button_queue[head % BUTTON_QUEUE_SIZE] = state;
+		button_queue_head = head + 1;
+	}
+}
+
+static uint16_t last_state = BUTTON_PINS;
+
+static uint16_t buttonQueuePop(void) {
+	uint8_t tail = button_queue_tail;
+	if (tail == button_queue_head) {
+		return button_stable;
+	}
+	uint16_t state = button_queue[tail % BUTTON_QUEUE_SIZE];
+	button_queue_tail = tail + 1;
+	return state;
+}
+
+/*
+ * Drops the queued edges and takes the current state as the last one, so
+ * that a press captured before a dialog was shown cannot answer it.
+ */
+void buttonFlush(void)
+{
+	button_queue_tail = button_queue_head;
+	last_state = button_irq ? button_stable : (buttonRead() & BUTTON_PINS);
+	button.YesUp = false;
+	button.YesDown = 0;
+	button.NoUp = false;
+	button.NoDown = 0;
+}
+
 void buttonUpdate()
 {
 	uint16_t state;
-	static uint16_t last_state = BTN_PIN_YES | BTN_PIN_NO;
 
-	state = buttonRead();
+	state = button_irq ? buttonQueuePop() : buttonRead();
 
 	if ((state & BTN_PIN_YES) == 0) {	// Yes button is down
 		if ((last_state & BTN_PIN_YES) == 0) {		// last Yes was down
@@ -34,6 +34,12 @@ extern struct buttonState button;
 
 uint16_t buttonRead(void);
 void buttonUpdate(void);
+void buttonFlush(void);
+void buttonInitIRQ(void);
+void buttonTick(void);
+
+// time the pins have to be stable after an edge
+#define BUTTON_DEBOUNCE_MS 5
 
 #ifndef BTN_PORT
 #define BTN_PORT	GPIOC
@@ -19,9 +19,10 @@
 #if CRYPTOMEM
 #include <stdint.h>
 #include <string.h>
-#include "at88sc0104.h"
+#include "cryptomem.h"
 #include "rng.h"
 #include "memzero.h"
+#include "timer.h"
 
 #include <libopencm3/stm32/flash.h>
 
@@ -31,7 +32,9 @@
 #endif
 
 static const uint8_t default_pw[3] = { 0xFF, 0xFF, 0xFF };
-#define CM_DEFAULT_PW 0xFFFFFF
+
+/* milliseconds an authenticated session without password is kept unused */
+#define CM_SESSION_IDLE_TIMEOUT (60 * 1000)
 
 
 #define OTP_START_ADDR		(0x1FFF7800U)
@@ -156,10 +159,26 @@ uint8_t cm_check_programming(uint8_t seed[4][8])
 	return ret;
 }
 
+/* per step timing of the last provisioning run */
+static uint32_t cm_step_ms[CM_STEP_COUNT];
+static uint32_t cm_step_start;
+
+static void cm_step_done(int step)
+{
+	uint32_t now = timer_ms();
+	cm_step_ms[step] += now - cm_step_start;
+	cm_step_start = now;
+}
+
 /*!
  *
  * \brief 	Do the initial programming of the cryptomem
  *
+ * \note	The passwords, seeds and access registers are collected into
+ * 			images of their config zone ranges first and written in page
+ * 			bursts.  Everything written is read back and compared in one
+ * 			pass before the fuses are burnt.
+ *
  * \param	seed: 4 sets of crypto seeds
  *
  * returns CM_SUCCESS if ok
@@ -167,8 +186,6 @@ uint8_t cm_check_programming(uint8_t seed[4][8])
  */
 uint8_t cm_init_manufacturing(uint8_t seed[4][8])
 {
-	// FIXME: this needs to be called from prodtest during manufacturing
-
 	cm_PowerOn();
 
 	uint8_t ret = cm_aCommunicationTest();
@@ -198,55 +215,64 @@ uint8_t cm_init_manufacturing(uint8_t seed[4][8])
 		return ret;
 	}
 
-	/* set passwords to all ones */
-
-	memset(write_buffer, 0xFF, 3);
-
-	for (int i = 0; i < 7; i++) {
-		// write Pw
-		if ((ret = cm_WriteConfigZone(CM_PSW_ADDR + (i << 3) + 1, write_buffer,
-				3, TRUE)) != CM_SUCCESS) {
-			return ret;
-		}
-		// read PW
-		if ((ret = cm_WriteConfigZone(CM_PSW_ADDR + (i << 3) + 5, write_buffer,
-				3, TRUE)) != CM_SUCCESS) {
-			return ret;
-		}
+	/* passwords 0..6 all ones, the attempt counters in between stay as they are */
+	uint8_t pw[CM_PSW_SETS * 8];
+	if ((ret = cm_ReadConfigZone(CM_PSW_ADDR, pw, sizeof(pw))) != CM_SUCCESS) {
+		return ret;
+	}
+	for (int i = 0; i < CM_PSW_SETS; i++) {
+		memset(pw + (i << 3) + 1, 0xFF, 3);	// write PW
+		memset(pw + (i << 3) + 5, 0xFF, 3);	// read PW
 	}
 
+	/* zone configuration: R/W PW, R/W auth, encryption; auth key i, POK key i, pw i */
+	uint8_t arpr[8];
 	for (int i = 0; i < 4; i++) {
-		if ((ret = cm_WriteConfigZone(CM_G_ADDR + (i << 3), seed[i], 8, TRUE))
-				!= CM_SUCCESS) {
-			return ret;
-		}
-
-		/* set zone configuration */
-		uint8_t AR = 0x57; // R/W PW, R/W auth, encryption
-
-		uint8_t PR = (i << 6) | (i << 4) | i;	  // auth key i, POK key i, pw i
-
-		if ((ret = cm_WriteConfigZone(CM_AR_ADDR + (i << 1), &AR, 1, TRUE))
-				!= CM_SUCCESS) {
-			return ret;
-		}
+		arpr[i << 1] = 0x57;
+		arpr[(i << 1) + 1] = (i << 6) | (i << 4) | i;
+	}
 
-		if ((ret = cm_WriteConfigZone(CM_PR_ADDR + (i << 1), &PR, 1, TRUE))
-				!= CM_SUCCESS) {
-			return ret;
-		}
+	cm_step_done(CM_STEP_PREPARE);
 
-		if ((ret = cm_ReadConfigZone(CM_AR_ADDR + (i << 1), &AR, 1))
-				!= CM_SUCCESS) {
-			return ret;
-		}
+	if ((ret = cm_WriteConfigPages(CM_PSW_ADDR, pw, sizeof(pw))) != CM_SUCCESS) {
+		return ret;
+	}
+	if ((ret = cm_WriteConfigPages(CM_G_ADDR, &seed[0][0], 4 * 8)) != CM_SUCCESS) {
+		return ret;
+	}
+	if ((ret = cm_WriteConfigPages(CM_AR_ADDR, arpr, sizeof(arpr))) != CM_SUCCESS) {
+		return ret;
+	}
 
-		if ((ret = cm_ReadConfigZone(CM_PR_ADDR + (i << 1), &PR, 1))
-				!= CM_SUCCESS) {
-			return ret;
-		}
+	cm_step_done(CM_STEP_CONFIG);
 
+	/* verify all of it before anything irreversible happens */
+	uint8_t readback[CM_PSW_SETS * 8];
+	uint8_t diff = 0;
+	if ((ret = cm_ReadConfigZone(CM_PSW_ADDR, readback, sizeof(pw))) != CM_SUCCESS) {
+		return ret;
+	}
+	for (unsigned i = 0; i < sizeof(pw); i++) {
+		diff |= readback[i] ^ pw[i];
+	}
+	if ((ret = cm_ReadConfigZone(CM_G_ADDR, readback, 4 * 8)) != CM_SUCCESS) {
+		return ret;
+	}
+	for (unsigned i = 0; i < 4 * 8; i++) {
+		diff |= readback[i] ^ seed[i >> 3][i & 7];
+	}
+	if ((ret = cm_ReadConfigZone(CM_AR_ADDR, readback, sizeof(arpr))) != CM_SUCCESS) {
+		return ret;
+	}
+	for (unsigned i = 0; i < sizeof(arpr); i++) {
+		diff |= readback[i] ^ arpr[i];
 	}
+	memzero(readback, sizeof(readback));
+	if (diff != 0) {
+		return CM_FAILED;
+	}
+
+	cm_step_done(CM_STEP_VERIFY);
 
 	memcpy(write_buffer, (uint8_t[] ) { 0x40, 0x53, 0x30, 0x00 }, 4); // set Mfg Code to "AS0"
 	if ((ret = cm_WriteConfigZone(0x0C, write_buffer, 4, TRUE)) != CM_SUCCESS) {
@@ -278,6 +304,8 @@ uint8_t cm_init_manufacturing(uint8_t seed[4][8])
 	cm_VerifySecurePasswd(write_buffer);
 	cm_VerifySecurePasswd(write_buffer);
 
+	cm_step_done(CM_STEP_FUSES);
+
 	return ret;
 }
 
@@ -288,7 +316,7 @@ uint8_t cm_prodtest_communication_test(void)
 	return cm_aCommunicationTest();
 }
 
-uint8_t cm_prodtest_initialization(void)
+static uint8_t cm_provision(void)
 {
 	uint8_t ret;
 	uint8_t crypto_seed[4][8];
@@ -306,6 +334,7 @@ uint8_t cm_prodtest_initialization(void)
 	if (ret == CM_SUCCESS) {
 		/* store in OTP, too */
 		ret = cm_store_seed_in_OTP(crypto_seed);
+		cm_step_done(CM_STEP_OTP);
 		if (ret == CM_FAILED) {
 			return ret;
 		}
@@ -318,6 +347,7 @@ uint8_t cm_prodtest_initialization(void)
 			}
 
 			ret = cm_check_programming(seed);
+			cm_step_done(CM_STEP_CHECK);
 			if (ret == 0) {
 				return CM_SUCCESS;
 			} else {
@@ -328,6 +358,28 @@ uint8_t cm_prodtest_initialization(void)
 	return CM_SUCCESS;
 }
 
+/*!
+ *
+ * \brief 	Provision a new cryptomem, or check an already programmed one
+ *
+ * \param	step_ms: if not NULL, receives the time spent in each
+ * 			CM_STEP_* in milliseconds, 0 for steps that did not run
+ *
+ * returns CM_SUCCESS if the chip is programmed correctly
+ */
+uint8_t cm_prodtest_initialization(uint32_t step_ms[CM_STEP_COUNT])
+{
+	memset(cm_step_ms, 0, sizeof(cm_step_ms));
+	cm_step_start = timer_ms();
+
+	uint8_t ret = cm_provision();
+
+	if (step_ms != NULL) {
+		memcpy(step_ms, cm_step_ms, sizeof(cm_step_ms));
+	}
+	return ret;
+}
+
 /*
  * We have 4 zones in the cryptomem we can use. Initially all 4 areas are unused and protected
  * by the same default PW 0xFFFFFF.
@@ -342,7 +394,13 @@ static enum { CMSTATE_IDLE, CMSTATE_AUTHENTICATED, CMSTATE_PW_ENTERED, CMSTATE_Z
 /* zone to use */
 static int zone_index = -1;
 
-int8_t cm_get_remaining_zones(void);
+/* cached PAC (remaining password attempts) of zone_index, -1 if unknown.
+ * It is updated on every password verification we do ourselves, so the
+ * chip only has to be asked after an error or a zone change. */
+static int8_t zone_pac = -1;
+
+/* last use of the authenticated session, see cm_session_idle() */
+static uint32_t cm_session_used;
 
 bool cm_init( void )
 {
@@ -351,6 +409,7 @@ bool cm_init( void )
 
 	cm_state = CMSTATE_IDLE;
 	zone_index = -1;
+	zone_pac = -1;
 
 	return (cm_get_remaining_zones() > 0);
 }
@@ -371,14 +430,13 @@ static int8_t cm_get_zone_index(void)
 		//continue;
 		if (PAC > 0) {
 			zone_index = i;
+			zone_pac = PAC;
 			return CM_SUCCESS;
 		}
 	}
 	return CM_FAILED;
 }
 
-int8_t cm_deactivate_security( void );
-
 int8_t cm_get_remaining_PIN_attempts(void)
 {
 	if (cm_state == CMSTATE_ZONE_LOCKED)
@@ -394,12 +452,16 @@ int8_t cm_get_remaining_PIN_attempts(void)
 			return -1;
 	}
 
+	if (zone_pac >= 0)
+		return zone_pac;
+
 	uint8_t PAC;
 
-	cm_CheckPAC(zone_index, CM_PWWRITE, &PAC);
+	ret = cm_CheckPAC(zone_index, CM_PWWRITE, &PAC);
 	if (ret != CM_SUCCESS) {
 		return -1;
 	}
+	zone_pac = PAC;
 	return PAC;
 }
 
@@ -414,10 +476,18 @@ int8_t cm_get_remaining_zones(void)
 }
 
 
+/*
+ * An authenticated session is reused by all operations until it is
+ * dropped: by session_clear(true) through cm_deactivate_security(), by a
+ * wrong password, or by cm_session_idle().  Only then does the next
+ * operation pay for a new mutual authentication.
+ */
 static int8_t cm_activate_security (void)
 {
-	if (cm_state == CMSTATE_AUTHENTICATED || cm_state == CMSTATE_PW_ENTERED)
+	if (cm_state == CMSTATE_AUTHENTICATED || cm_state == CMSTATE_PW_ENTERED) {
+		cm_session_used = timer_ms();
 		return CM_SUCCESS;
+	}
 
 	uint8_t ret = cm_get_zone_index();
 	if (ret != CM_SUCCESS) {
@@ -446,10 +516,24 @@ static int8_t cm_activate_security (void)
 	if (ret != CM_SUCCESS)
 		return ret;
 	cm_state = CMSTATE_AUTHENTICATED;
+	cm_session_used = timer_ms();
 
 	return CM_SUCCESS;
 }
 
+/*
+ * Drop a session nobody entered a password on after CM_SESSION_IDLE_TIMEOUT.
+ * A session with the password entered lives as long as the cached PIN and
+ * ends with session_clear(true), storage still needs it for the AES key.
+ */
+void cm_session_idle(void)
+{
+	if (cm_state == CMSTATE_AUTHENTICATED
+		&& timer_expired(cm_session_used + CM_SESSION_IDLE_TIMEOUT)) {
+		cm_deactivate_security();
+	}
+}
+
 int8_t cm_deactivate_security( void )
 {
 	/* disable authentication - just in case... */
@@ -479,15 +563,34 @@ int8_t cm_open_zone(uint32_t pw)
 	if (ret != CM_SUCCESS) {
 		// wrong password de-authenticates
 		cm_deactivate_security();
-		if (ret == CM_PWD_NOK_LOCKED)
+		// the chip decremented the counter, read it again next time
+		zone_pac = -1;
+		if (ret == CM_PWD_NOK_LOCKED) {
 			cm_state = CMSTATE_ZONE_LOCKED;
+			zone_pac = 0;
+		}
 		return ret;
 	}
 	cm_state = CMSTATE_PW_ENTERED;
+	zone_pac = 4; // a correct password restores all attempts
 
 	return CM_SUCCESS;
 }
 
+/*
+ * Verify a password again, on the running session if there is one.  A
+ * correct password keeps the session open, a wrong one ends it.
+ */
+int8_t cm_check_PIN(uint32_t pw)
+{
+	uint8_t ret = cm_activate_security();
+	if (ret != CM_SUCCESS)
+		return ret;
+
+	cm_state = CMSTATE_AUTHENTICATED;
+	return cm_open_zone(pw);
+}
+
 static int8_t cm_send_default_PW( void )
 {
 	int8_t ret = cm_VerifyPassword(default_pw, zone_index, CM_PWWRITE);
@@ -500,10 +603,12 @@ static int8_t cm_send_default_PW( void )
 		cm_VerifyPassword(default_pw, zone_index, CM_PWWRITE);
 
 		zone_index = -1;
+		zone_pac = -1;
 		cm_activate_security();
 		cm_state = CMSTATE_ZONE_LOCKED;
 		return cm_VerifyPassword(default_pw, zone_index, CM_PWWRITE);
 	}
+	zone_pac = 4;
 	return ret;
 }
 
@@ -516,20 +621,16 @@ int8_t cm_get_aes_key( uint8_t *key )
 		return CM_FAILED;
 	}
 
-	cm_SetUserZone(zone_index, FALSE);
-	return cm_ReadUserZone( 0, key, 32);
+	return cm_ReadZone(zone_index, 0, key, 32);
 }
 
 
 static int8_t cm_write_key_to_user_zone( uint8_t *key)
 {
-	cm_SetUserZone(zone_index, TRUE);
-	cm_WriteUserZone( 0, key, 8); // 8 byte at a time...
-	cm_WriteUserZone( 8, key+8, 8);
-	cm_WriteUserZone( 16, key+16, 8);
-	cm_WriteUserZone( 24, key+24, 8);
-
-	return CM_SUCCESS;
+	/* no anti-tearing: a torn write can only hit a key nothing is encrypted
+	 * with yet (new zone) or one that is wiped anyway, and plain writes take
+	 * 2 page bursts instead of 4 */
+	return cm_WriteZone(zone_index, 0, key, 32, FALSE);
 }
 
 int8_t cm_initialize_new_zone( void )
@@ -606,6 +707,7 @@ int8_t cm_wipe_zone( void )
 			// previous Pin entry locked the zone invalidate it
 			cm_deactivate_security();
 			zone_index = -1; // need to check for next zone for next operation
+			zone_pac = -1;
 
 			// no need to wipe, zone is locked already anyway
 			return 0;
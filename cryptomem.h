@@ -8,14 +8,18 @@
 #ifndef CRYPTOMEM_H_
 #define CRYPTOMEM_H_
 
-enum { CM_SUCCESS = 0, CM_FAILED=1, CM_FAIL_CMDSTART, CM_FAIL_CMDSEND, CM_FAIL_WRDATA, CM_FAIL_RDDATA,
-	CM_FAIL_PwD_NOK, CM_DEAUTH, CM_ACK_POLL_FAIL, CM_ALREADY_PGMD, CM_DEFAULT_Pw_NOK, CM_PWD_NOK_LOCKED };
+#include <stdbool.h>
+#include <stdint.h>
+#include "at88sc0104.h"
 
 #define CM_DEFAULT_PW 0xFFFFFF
 uint8_t cm_init_manufacturing(uint8_t seed[4][8]);
 uint8_t cm_check_programming(uint8_t seed[4][8]);
 uint8_t cm_prodtest_communication_test(void);
-uint8_t cm_prodtest_initialization(void);
+
+/* provisioning steps timed by cm_prodtest_initialization(), in ms */
+enum { CM_STEP_PREPARE = 0, CM_STEP_CONFIG, CM_STEP_VERIFY, CM_STEP_FUSES, CM_STEP_OTP, CM_STEP_CHECK, CM_STEP_COUNT };
+uint8_t cm_prodtest_initialization(uint32_t step_ms[CM_STEP_COUNT]);
 
 bool cm_init( void );
 
@@ -26,10 +30,12 @@ uint8_t cm_store_seed_in_OTP(uint8_t seed[4][8]);
 int8_t cm_get_aes_key( uint8_t *key );
 int8_t cm_set_PIN(uint32_t pw);
 int8_t cm_open_zone(uint32_t pw);
+int8_t cm_check_PIN(uint32_t pw);
 int8_t cm_wipe_zone( void );
 int8_t cm_initialize_new_zone( void );
 
 int8_t cm_deactivate_security( void );
+void cm_session_idle(void);
 int8_t cm_get_remaining_PIN_attempts(void);
 int8_t cm_get_remaining_zones(void);
 
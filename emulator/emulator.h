@@ -24,13 +24,26 @@
 
 #include "strl.h"
 
+#include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
 
 void emulatorPoll(void);
 void emulatorRandom(void *buffer, size_t size);
 
+bool emulatorVirtualTime(void);
+void emulatorTimerAdvance(uint32_t millis);
+
+extern int emulator_flash_fd;
+
+void emulatorFlashFlush(void);
+void emulatorFlashSnapshot(void);
+void emulatorFlashRestore(void);
+bool emulatorFlashRestored(void);
+
 void emulatorSocketInit(void);
 size_t emulatorSocketRead(int *iface, void *buffer, size_t size);
+void emulatorSocketWait(uint32_t timeout);
 size_t emulatorSocketWrite(int iface, const void *buffer, size_t size);
 
 #endif
@@ -20,9 +20,81 @@
 #include <string.h>
 #include <assert.h>
 #include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
 
+#include "emulator.h"
 #include "memory.h"
 
+/* Dirty tracking uses the smallest sector size, so large sectors cover
+ * several pages. */
+#define FLASH_PAGE_SIZE  0x4000
+#define FLASH_PAGE_COUNT (FLASH_TOTAL_SIZE / FLASH_PAGE_SIZE)
+
+static uint64_t flash_dirty;
+static uint8_t *flash_snapshot;
+static bool flash_restored;
+
+_Static_assert(FLASH_PAGE_COUNT <= 64, "Dirty page mask is too small");
+
+static void flash_mark_dirty(size_t offset, size_t size) {
+	for (size_t page = offset / FLASH_PAGE_SIZE; page * FLASH_PAGE_SIZE < offset + size; page++) {
+		flash_dirty |= (uint64_t) 1 << page;
+	}
+}
+
+void emulatorFlashFlush(void) {
+	for (size_t page = 0; flash_dirty != 0 && page < FLASH_PAGE_COUNT; page++) {
+		if (!(flash_dirty & ((uint64_t) 1 << page))) {
+			continue;
+		}
+
+		off_t offset = page * FLASH_PAGE_SIZE;
+		if (pwrite(emulator_flash_fd, emulator_flash_base + offset, FLASH_PAGE_SIZE, offset) != FLASH_PAGE_SIZE) {
+			perror("Failed to write flash emulation file");
+			exit(1);
+		}
+
+		flash_dirty &= ~((uint64_t) 1 << page);
+	}
+}
+
+void emulatorFlashSnapshot(void) {
+	if (flash_snapshot == NULL) {
+		flash_snapshot = malloc(FLASH_TOTAL_SIZE);
+		if (flash_snapshot == NULL) {
+			perror("Failed to allocate flash snapshot");
+			exit(1);
+		}
+	}
+
+	memcpy(flash_snapshot, emulator_flash_base, FLASH_TOTAL_SIZE);
+}
+
+void emulatorFlashRestore(void) {
+	if (flash_snapshot == NULL) {
+		return;
+	}
+
+	for (size_t page = 0; page < FLASH_PAGE_COUNT; page++) {
+		size_t offset = page * FLASH_PAGE_SIZE;
+		if (memcmp(emulator_flash_base + offset, flash_snapshot + offset, FLASH_PAGE_SIZE) != 0) {
+			memcpy(emulator_flash_base + offset, flash_snapshot + offset, FLASH_PAGE_SIZE);
+			flash_mark_dirty(offset, FLASH_PAGE_SIZE);
+		}
+	}
+
+	flash_restored = true;
+}
+
+/* True once after a restore, the firmware has to reload its storage. */
+bool emulatorFlashRestored(void) {
+	bool restored = flash_restored;
+	flash_restored = false;
+	return restored;
+}
+
 void flash_lock(void) {}
 void flash_unlock(void) {}
 
@@ -97,20 +169,24 @@ void flash_erase_sector(uint8_t sector, uint32_t program_size) {
 	}
 
 	memset(address, 0xFF, size);
+	flash_mark_dirty(sector_to_offset(sector), size);
 }
 
 void flash_erase_all_sectors(uint32_t program_size) {
 	(void) program_size;
 
 	memset(emulator_flash_base, 0xFF, FLASH_TOTAL_SIZE);
+	flash_mark_dirty(0, FLASH_TOTAL_SIZE);
 }
 
 void flash_program_word(uint32_t address, uint32_t data) {
 	*(volatile uint32_t *)FLASH_PTR(address) = data;
+	flash_mark_dirty(address - FLASH_ORIGIN, sizeof(data));
 }
 
 void flash_program_byte(uint32_t address, uint8_t data) {
 	*(volatile uint8_t *)FLASH_PTR(address) = data;
+	flash_mark_dirty(address - FLASH_ORIGIN, sizeof(data));
 }
 
 static bool flash_locked = true;
@@ -122,14 +198,32 @@ void svc_flash_program(uint32_t size) {
 	(void) size;
 	assert (!flash_locked);
 }
+void svc_flash_program_block(uint32_t dst, const void *src, uint32_t len) {
+	assert (!flash_locked);
+	assert (((dst | len) & 3) == 0);
+	assert (dst >= FLASH_STORAGE_START && dst + len <= FLASH_META_START + FLASH_META_LEN);
+	const uint32_t *words = src;
+	for (uint32_t i = 0; i < len / sizeof(uint32_t); i++) {
+		flash_program_word(dst + i * sizeof(uint32_t), words[i]);
+	}
+}
 void svc_flash_erase_sector(uint16_t sector) {
 	assert (!flash_locked);
 	assert (sector >= FLASH_META_SECTOR_FIRST &&
 			sector <= FLASH_META_SECTOR_LAST);
+	if (sector != FLASH_META_SECTOR_FIRST) {
+		flash_erase_sector(sector, 3);
+		return;
+	}
+	// like the supervisor, keep the firmware header
+	uint8_t header[FLASH_META_DESC_LEN];
+	memcpy(header, FLASH_PTR(FLASH_META_START), sizeof(header));
 	flash_erase_sector(sector, 3);
+	memcpy((uint8_t *)FLASH_PTR(FLASH_META_START), header, sizeof(header));
 }
 uint32_t svc_flash_lock(void) {
 	assert (!flash_locked);
 	flash_locked = true;
+	emulatorFlashFlush();
 	return 0;
 }
@@ -29,9 +29,17 @@ void emulatorPoll(void) {}
 
 #include <SDL.h>
 
+#include "timer.h"
+
 static SDL_Renderer *renderer = NULL;
 static SDL_Texture *texture = NULL;
 
+/* Present at most once per display refresh */
+#define EMULATOR_FRAME_MS 16
+
+static bool present_pending = false;
+static uint32_t present_last = 0;
+
 #define ENV_OLED_SCALE "TREZOR_OLED_SCALE"
 
 static int emulatorScale(void) {
@@ -82,6 +90,17 @@ void oledInit(void) {
 	oledRefresh();
 }
 
+static void emulatorPresent(void) {
+	if (!present_pending || !timer_expired(present_last + EMULATOR_FRAME_MS)) {
+		return;
+	}
+
+	SDL_RenderCopy(renderer, texture, NULL, NULL);
+	SDL_RenderPresent(renderer);
+	present_pending = false;
+	present_last = timer_ms();
+}
+
 void oledRefresh(void) {
 	/* Draw triangle in upper right corner */
 	oledInvertDebugLink();
@@ -90,25 +109,42 @@ void oledRefresh(void) {
 
 	static uint32_t data[OLED_HEIGHT][OLED_WIDTH];
 
-	for (size_t i = 0; i < OLED_BUFSIZE; i++) {
-		int x = (OLED_BUFSIZE - 1 - i) % OLED_WIDTH;
-		int y = (OLED_BUFSIZE - 1 - i) / OLED_WIDTH * 8 + 7;
+	/* Only convert and upload the columns that changed */
+	for (int page = 0; page < OLED_HEIGHT / 8; page++) {
+		int first, last;
+		if (!oledPageChanged(page, &first, &last)) {
+			continue;
+		}
+
+		for (size_t i = page * OLED_WIDTH + first; i <= (size_t) (page * OLED_WIDTH + last); i++) {
+			int x = (OLED_BUFSIZE - 1 - i) % OLED_WIDTH;
+			int y = (OLED_BUFSIZE - 1 - i) / OLED_WIDTH * 8 + 7;
 
-		for (uint8_t shift = 0; shift < 8; shift++, y--) {
-			bool set = (buffer[i] >> shift) & 1;
-			data[y][x] = set ? 0xFFFFFFFF : 0xFF000000;
+			for (uint8_t shift = 0; shift < 8; shift++, y--) {
+				bool set = (buffer[i] >> shift) & 1;
+				data[y][x] = set ? 0xFFFFFFFF : 0xFF000000;
+			}
 		}
+
+		SDL_Rect rect = {
+			.x = OLED_WIDTH - 1 - last,
+			.y = (OLED_HEIGHT / 8 - 1 - page) * 8,
+			.w = last - first + 1,
+			.h = 8,
+		};
+		SDL_UpdateTexture(texture, &rect, &data[rect.y][rect.x], OLED_WIDTH * sizeof(uint32_t));
+		present_pending = true;
 	}
 
-	SDL_UpdateTexture(texture, NULL, data, OLED_WIDTH * sizeof(uint32_t));
-	SDL_RenderCopy(renderer, texture, NULL, NULL);
-	SDL_RenderPresent(renderer);
+	emulatorPresent();
 
 	/* Return it back */
 	oledInvertDebugLink();
 }
 
 void emulatorPoll(void) {
+	emulatorPresent();
+
 	SDL_Event event;
 
 	if (SDL_PollEvent(&event)) {
@@ -26,6 +26,7 @@
 
 #include <libopencm3/stm32/flash.h>
 
+#include "emulator.h"
 #include "memory.h"
 #include "oled.h"
 #include "rng.h"
@@ -34,7 +35,10 @@
 
 #define EMULATOR_FLASH_FILE "emulator.img"
 
+#define ENV_FLASH_FILE "TREZOR_FLASH_FILE"
+
 uint8_t *emulator_flash_base = NULL;
+int emulator_flash_fd = -1;
 
 uint32_t __stack_chk_guard;
 
@@ -68,8 +72,13 @@ static void setup_urandom(void) {
 	}
 }
 
+/*
+ * The flash image lives in anonymous memory.  Sectors written since the
+ * last flush are written back to the file by svc_flash_lock() and at exit.
+ */
 static void setup_flash(void) {
-	int fd = open(EMULATOR_FLASH_FILE, O_RDWR | O_SYNC | O_CREAT, 0644);
+	const char *path = getenv(ENV_FLASH_FILE);
+	int fd = open(path ? path : EMULATOR_FLASH_FILE, O_RDWR | O_CREAT, 0644);
 	if (fd < 0) {
 		perror("Failed to open flash emulation file");
 		exit(1);
@@ -81,12 +90,14 @@ static void setup_flash(void) {
 		exit(1);
 	}
 
-	emulator_flash_base = mmap(NULL, FLASH_TOTAL_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	emulator_flash_base = mmap(NULL, FLASH_TOTAL_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
 	if (emulator_flash_base == MAP_FAILED) {
-		perror("Failed to map flash emulation file");
+		perror("Failed to map flash emulation memory");
 		exit(1);
 	}
 
+	emulator_flash_fd = fd;
+
 	if (length < FLASH_TOTAL_SIZE) {
 		if (ftruncate(fd, FLASH_TOTAL_SIZE) != 0) {
 			perror("Failed to initialize flash emulation file");
@@ -95,5 +106,11 @@ static void setup_flash(void) {
 
 		/* Initialize the flash */
 		flash_erase_all_sectors(FLASH_CR_PROGRAM_X32);
+		emulatorFlashFlush();
+	} else if (pread(fd, emulator_flash_base, FLASH_TOTAL_SIZE, 0) != FLASH_TOTAL_SIZE) {
+		perror("Failed to read flash emulation file");
+		exit(1);
 	}
+
+	atexit(emulatorFlashFlush);
 }
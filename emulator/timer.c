@@ -17,10 +17,18 @@
  * along with this library.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <stdbool.h>
+#include <stdlib.h>
 #include <time.h>
 
+#include "emulator.h"
 #include "timer.h"
 
+#define ENV_VIRTUAL_TIME "TREZOR_VIRTUAL_TIME"
+
+/* Time skipped while idle-waiting in virtual time mode */
+static uint32_t timer_offset = 0;
+
 void timer_init(void) {}
 
 uint32_t timer_ms(void) {
@@ -28,5 +36,18 @@ uint32_t timer_ms(void) {
 	clock_gettime(CLOCK_MONOTONIC, &t);
 
         uint32_t msec = t.tv_sec * 1000 + (t.tv_nsec / 1000000);
-	return msec;
+	return msec + timer_offset;
+}
+
+bool emulatorVirtualTime(void) {
+	static int enabled = -1;
+	if (enabled < 0) {
+		const char *variable = getenv(ENV_VIRTUAL_TIME);
+		enabled = variable && atoi(variable) != 0;
+	}
+	return enabled;
+}
+
+void emulatorTimerAdvance(uint32_t millis) {
+	timer_offset += millis;
 }
@@ -19,13 +19,18 @@
 
 #include <arpa/inet.h>
 #include <errno.h>
+#include <poll.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/socket.h>
 
+#include "emulator.h"
+
 #define TREZOR_UDP_PORT 21324
 
+#define ENV_UDP_PORT "TREZOR_UDP_PORT"
+
 struct usb_socket {
 	int fd;
 	struct sockaddr_in from;
@@ -86,13 +91,47 @@ static size_t socket_read(struct usb_socket *sock, void *buffer, size_t size) {
 		return 0;
 	}
 
+	/* Tests save the flash on the debug port and go back to it later
+	 * instead of setting up the device again.  The command is echoed
+	 * once it is done. */
+	static const char msg_save[] = { 'S', 'N', 'A', 'P', 'S', 'A', 'V', 'E' };
+	static const char msg_load[] = { 'S', 'N', 'A', 'P', 'L', 'O', 'A', 'D' };
+
+	if (sock == &usb_debug && n == sizeof(msg_save) && memcmp(buffer, msg_save, sizeof(msg_save)) == 0) {
+		emulatorFlashSnapshot();
+		socket_write(sock, msg_save, sizeof(msg_save));
+		return 0;
+	}
+	if (sock == &usb_debug && n == sizeof(msg_load) && memcmp(buffer, msg_load, sizeof(msg_load)) == 0) {
+		emulatorFlashRestore();
+		socket_write(sock, msg_load, sizeof(msg_load));
+		return 0;
+	}
+
 	return n;
 }
 
+/*
+ * Many emulators can run side by side, each given its own port pair
+ * (and flash file) through the environment.
+ */
+static int emulatorPort(void) {
+	const char *variable = getenv(ENV_UDP_PORT);
+	if (!variable) {
+		return TREZOR_UDP_PORT;
+	}
+	int port = atoi(variable);
+	if (port > 0 && port < 65535) {
+		return port;
+	}
+	return TREZOR_UDP_PORT;
+}
+
 void emulatorSocketInit(void) {
-	usb_main.fd = socket_setup(TREZOR_UDP_PORT);
+	int port = emulatorPort();
+	usb_main.fd = socket_setup(port);
 	usb_main.fromlen = 0;
-	usb_debug.fd = socket_setup(TREZOR_UDP_PORT + 1);
+	usb_debug.fd = socket_setup(port + 1);
 	usb_debug.fromlen = 0;
 }
 
@@ -112,6 +151,26 @@ size_t emulatorSocketRead(int *iface, void *buffer, size_t size) {
 	return 0;
 }
 
+/*
+ * Waits for up to timeout milliseconds for a packet.  In virtual time mode
+ * nothing blocks: if no packet is ready, the clock jumps ahead instead.
+ */
+void emulatorSocketWait(uint32_t timeout) {
+	struct pollfd fds[] = {
+		{ .fd = usb_main.fd, .events = POLLIN },
+		{ .fd = usb_debug.fd, .events = POLLIN },
+	};
+
+	bool virtual_time = emulatorVirtualTime();
+	int n = poll(fds, sizeof(fds) / sizeof(fds[0]), virtual_time ? 0 : (int) timeout);
+	if (n < 0 && errno != EINTR) {
+		perror("Failed to poll sockets");
+	}
+	if (n == 0 && virtual_time) {
+		emulatorTimerAdvance(timeout);
+	}
+}
+
 size_t emulatorSocketWrite(int iface, const void *buffer, size_t size) {
 	if (iface == 0) {
 		return socket_write(&usb_main, buffer, size);
@@ -1,6 +1,7 @@
 #!/usr/bin/env python2
 import json
 import os
+import sys
 
 import collections
 
@@ -20,6 +21,11 @@ HEADER_TEMPLATE = """
 
 extern const CoinInfo coins[COINS_COUNT];
 
+// indices into coins[] sorted by coin_name, address_type and coin_type
+extern const uint16_t coins_by_name[COINS_COUNT];
+extern const uint16_t coins_by_address_type[COINS_COUNT];
+extern const uint16_t coins_by_coin_type[COINS_COUNT];
+
 #endif
 """.lstrip()
 
@@ -37,7 +43,17 @@ const CoinInfo coins[COINS_COUNT] = {{
 {debug}
 #endif
 }};
-""".lstrip()
+{indices}""".lstrip()
+
+INDEX_TEMPLATE = """
+const uint16_t coins_by_{key}[COINS_COUNT] = {{
+#if DEBUG_LINK
+{debug}
+#else
+{stable}
+#endif
+}};
+"""
 
 
 def format_bool(value):
@@ -112,21 +128,61 @@ def format_coins(coins):
     return "\n".join("{},".format(format_coin(coin)) for coin in coins)
 
 
+# sort keys, these have to compare like the lookups in coins.c
+INDEX_KEYS = collections.OrderedDict((
+    ("name",         lambda coin: coin["coin_name"].encode("utf-8")),
+    ("address_type", lambda coin: coin["address_type"] or 0),
+    ("coin_type",    lambda coin: (coin["bip44"] or 0) | 0x80000000),
+))
+
+
+def format_index(coins, key):
+    # ties keep table order, so that the first matching coin is found
+    order = sorted(range(len(coins)), key=lambda i: (key(coins[i]), i))
+    return "\t" + ", ".join(str(i) for i in order) + ","
+
+
+def format_indices(coins):
+    return "".join(INDEX_TEMPLATE.format(
+        key=name,
+        stable=format_index(coins["stable"], key),
+        debug=format_index(coins["stable"] + coins["debug"], key),
+    ) for name, key in INDEX_KEYS.items())
+
+
+def parse_whitelist(args):
+    # coin_info.py [coin_name,...] keeps only the listed coins, in the order
+    # of coins.json, so that coins[0] stays the first one there
+    names = [n.strip() for arg in args for n in arg.split(",") if n.strip()]
+    return set(names) if names else None
+
+
 if __name__ == "__main__":
     os.chdir(os.path.abspath(os.path.dirname(__file__)))
 
-    coins = collections.defaultdict(list)
+    # both groups are used by the templates, even if the whitelist empties one
+    coins = collections.defaultdict(list, stable=[], debug=[])
+    whitelist = parse_whitelist(sys.argv[1:])
 
     for coin in json.load(open("coins.json")):
+        if whitelist is not None and coin["coin_name"] not in whitelist:
+            continue
         firmware = coin["firmware"]
         coins[firmware].append(coin)
 
+    if whitelist is not None:
+        found = set(coin["coin_name"] for group in coins.values() for coin in group)
+        if whitelist - found:
+            raise Exception("Unknown coins: %s" % ", ".join(sorted(whitelist - found)))
+        if not coins["stable"]:
+            raise Exception("No stable coin in the whitelist")
+
     with open("coin_info.h", "w+") as f:
         f.write(HEADER_TEMPLATE.format(**{
             k: format_number(len(v)) for k, v in coins.items()
         }))
 
     with open("coin_info.c", "w+") as f:
-        f.write(CODE_TEMPLATE.format(**{
-            k: format_coins(v) for k, v in coins.items()
-        }))
+        code = {k: format_coins(v) for k, v in coins.items()}
+        code["indices"] = format_indices(coins)
+        f.write(CODE_TEMPLATE.format(**code))
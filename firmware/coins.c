@@ -22,43 +22,122 @@
 #include "address.h"
 #include "ecdsa.h"
 #include "base58.h"
+#include "sha2.h"
 
-const CoinInfo *coinByName(const char *name)
+/* Lower bound in one of the sorted coin indices.  Ties are ordered by
+ * position in coins[], so this finds the same coin as a linear scan.
+ */
+static const CoinInfo *coinBySortedIndex(const uint16_t *index, int (*cmp)(const CoinInfo *, const void *), const void *key)
 {
-	if (!name) return 0;
-	for (int i = 0; i < COINS_COUNT; i++) {
-		if (strcmp(name, coins[i].coin_name) == 0) {
-			return &(coins[i]);
+	int lo = 0, hi = COINS_COUNT;
+	while (lo < hi) {
+		int mid = (lo + hi) / 2;
+		if (cmp(&coins[index[mid]], key) < 0) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
 		}
 	}
+	if (lo < COINS_COUNT && cmp(&coins[index[lo]], key) == 0) {
+		return &(coins[index[lo]]);
+	}
 	return 0;
 }
 
+static int coinCmpName(const CoinInfo *coin, const void *key)
+{
+	return strcmp(coin->coin_name, key);
+}
+
+static int coinCmpAddressType(const CoinInfo *coin, const void *key)
+{
+	uint32_t address_type = *(const uint32_t *)key;
+	return (coin->address_type > address_type) - (coin->address_type < address_type);
+}
+
+static int coinCmpCoinType(const CoinInfo *coin, const void *key)
+{
+	uint32_t coin_type = *(const uint32_t *)key;
+	return (coin->coin_type > coin_type) - (coin->coin_type < coin_type);
+}
+
+const CoinInfo *coinByName(const char *name)
+{
+	if (!name) return 0;
+	return coinBySortedIndex(coins_by_name, coinCmpName, name);
+}
+
 const CoinInfo *coinByAddressType(uint32_t address_type)
 {
-	for (int i = 0; i < COINS_COUNT; i++) {
-		if (address_type == coins[i].address_type) {
-			return &(coins[i]);
-		}
-	}
-	return 0;
+	return coinBySortedIndex(coins_by_address_type, coinCmpAddressType, &address_type);
 }
 
 const CoinInfo *coinByCoinType(uint32_t coin_type)
 {
-	for (int i = 0; i < COINS_COUNT; i++) {
-		if (coin_type == coins[i].coin_type) {
-			return &(coins[i]);
+	return coinBySortedIndex(coins_by_coin_type, coinCmpCoinType, &coin_type);
+}
+
+/* The last few base58 addresses decoded, keyed by the SHA-256 of the
+ * address and the base58 hasher of the coin.  A transaction compiles
+ * every output in phase 1 and again in phase 2, often paying the same
+ * address more than once.  Failed decodes (bech32 and derived
+ * addresses) are kept as well.  Addresses are public, the cache only
+ * has to be cleared to bound its use to one signing session.
+ */
+#define ADDRESS_CACHE_SIZE 4
+
+static struct {
+	bool set;
+	HasherType hasher;
+	uint8_t key[SHA256_DIGEST_LENGTH];
+	int len;
+	uint8_t raw[MAX_ADDR_RAW_SIZE];
+	uint32_t age;
+} address_cache[ADDRESS_CACHE_SIZE];
+
+static uint32_t address_cache_age;
+
+int coinDecodeAddress(const CoinInfo *coin, const char *addr, uint8_t *addr_raw)
+{
+	HasherType hasher = coin->curve->hasher_base58;
+	uint8_t key[SHA256_DIGEST_LENGTH];
+	sha256_Raw((const uint8_t *)addr, strlen(addr), key);
+
+	int slot = 0;
+	for (int i = 0; i < ADDRESS_CACHE_SIZE; i++) {
+		if (address_cache[i].set && address_cache[i].hasher == hasher
+			&& memcmp(address_cache[i].key, key, sizeof(key)) == 0) {
+			memcpy(addr_raw, address_cache[i].raw, address_cache[i].len);
+			address_cache[i].age = ++address_cache_age;
+			return address_cache[i].len;
+		}
+		if (!address_cache[i].set
+			|| (address_cache[slot].set && address_cache[i].age < address_cache[slot].age)) {
+			slot = i;
 		}
 	}
-	return 0;
+
+	int len = base58_decode_check(addr, hasher, addr_raw, MAX_ADDR_RAW_SIZE);
+	address_cache[slot].set = true;
+	address_cache[slot].hasher = hasher;
+	memcpy(address_cache[slot].key, key, sizeof(key));
+	address_cache[slot].len = len;
+	memcpy(address_cache[slot].raw, addr_raw, len);
+	address_cache[slot].age = ++address_cache_age;
+	return len;
+}
+
+void coinAddressCacheClear(void)
+{
+	memset(address_cache, 0, sizeof(address_cache));
+	address_cache_age = 0;
 }
 
 bool coinExtractAddressType(const CoinInfo *coin, const char *addr, uint32_t *address_type)
 {
 	if (!addr) return false;
 	uint8_t addr_raw[MAX_ADDR_RAW_SIZE];
-	int len = base58_decode_check(addr, coin->curve->hasher_base58, addr_raw, MAX_ADDR_RAW_SIZE);
+	int len = coinDecodeAddress(coin, addr, addr_raw);
 	if (len >= 21) {
 		return coinExtractAddressTypeRaw(coin, addr_raw, address_type);
 	}
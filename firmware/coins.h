@@ -57,4 +57,9 @@ const CoinInfo *coinByCoinType(uint32_t coin_type);
 bool coinExtractAddressType(const CoinInfo *coin, const char *addr, uint32_t *address_type);
 bool coinExtractAddressTypeRaw(const CoinInfo *coin, const uint8_t *addr_raw, uint32_t *address_type);
 
+// base58_decode_check() into MAX_ADDR_RAW_SIZE bytes with the coin's hasher,
+// remembering recent addresses
+int coinDecodeAddress(const CoinInfo *coin, const char *addr, uint8_t *addr_raw);
+void coinAddressCacheClear(void);
+
 #endif
@@ -25,13 +25,16 @@
 #include "aes/aes.h"
 #include "hmac.h"
 #include "bip32.h"
-#include "layout.h"
+#include "layout2.h"
 #include "curves.h"
 #include "secp256k1.h"
 #include "address.h"
 #include "coins.h"
 #include "base58.h"
 #include "segwit_addr.h"
+#include "memzero.h"
+#include "profile.h"
+#include "timer.h"
 
 uint32_t ser_length(uint32_t len, uint8_t *out)
 {
@@ -55,20 +58,10 @@ uint32_t ser_length(uint32_t len, uint8_t *out)
 
 uint32_t ser_length_hash(Hasher *hasher, uint32_t len)
 {
-	if (len < 253) {
-		hasher_Update(hasher, (const uint8_t *)&len, 1);
-		return 1;
-	}
-	if (len < 0x10000) {
-		uint8_t d = 253;
-		hasher_Update(hasher, &d, 1);
-		hasher_Update(hasher, (const uint8_t *)&len, 2);
-		return 3;
-	}
-	uint8_t d = 254;
-	hasher_Update(hasher, &d, 1);
-	hasher_Update(hasher, (const uint8_t *)&len, 4);
-	return 5;
+	uint8_t d[5];
+	uint32_t r = ser_length(len, d);
+	hasher_Update(hasher, d, r);
+	return r;
 }
 
 uint32_t deser_length(const uint8_t *in, uint32_t *out)
@@ -327,23 +320,150 @@ int cryptoMessageDecrypt(curve_point *nonce, uint8_t *payload, size_t payload_le
 }
 */
 
+/*
+ * Cosigner keys of a signing session.
+ *
+ * Multisig scripts are compiled several times per input, and every time
+ * each cosigner key is derived from its xpub.  Entries are keyed by a
+ * hash of the xpub and the path.  pubkey_cache holds derived keys and
+ * parent_cache the nodes one level above them, which are shared by the
+ * addresses of a cosigner chain.  The keys are public, so both survive
+ * from one SignTx to the next and a batch of transactions from the same
+ * multisig wallet derives every cosigner key once.  session_clear()
+ * drops them with cryptoPubkeyCacheClear().
+ */
+#define PUBKEY_CACHE_SIZE 16
+#define PARENT_CACHE_SIZE 8
+
+static struct {
+	bool set;
+	uint32_t age;
+	uint8_t key[SHA256_DIGEST_LENGTH];
+	uint8_t public_key[33];
+} pubkey_cache[PUBKEY_CACHE_SIZE];
+
+static struct {
+	bool set;
+	uint32_t age;
+	uint8_t key[SHA256_DIGEST_LENGTH];
+	HDNode node;
+} parent_cache[PARENT_CACHE_SIZE];
+
+static uint32_t pubkey_cache_age = 0;
+
+// returns the entry for key, or the one to replace with *hit = false
+static int pubkey_cache_find(const uint8_t *key, bool *hit)
+{
+	int slot = 0;
+	*hit = false;
+	for (int i = 0; i < PUBKEY_CACHE_SIZE; i++) {
+		if (pubkey_cache[i].set && memcmp(pubkey_cache[i].key, key, SHA256_DIGEST_LENGTH) == 0) {
+			slot = i;
+			*hit = true;
+			break;
+		}
+		if (pubkey_cache[slot].set && (!pubkey_cache[i].set || pubkey_cache[i].age < pubkey_cache[slot].age)) {
+			slot = i;
+		}
+	}
+	pubkey_cache[slot].age = ++pubkey_cache_age;
+	return slot;
+}
+
+static int parent_cache_find(const uint8_t *key, bool *hit)
+{
+	int slot = 0;
+	*hit = false;
+	for (int i = 0; i < PARENT_CACHE_SIZE; i++) {
+		if (parent_cache[i].set && memcmp(parent_cache[i].key, key, SHA256_DIGEST_LENGTH) == 0) {
+			slot = i;
+			*hit = true;
+			break;
+		}
+		if (parent_cache[slot].set && (!parent_cache[i].set || parent_cache[i].age < parent_cache[slot].age)) {
+			slot = i;
+		}
+	}
+	parent_cache[slot].age = ++pubkey_cache_age;
+	return slot;
+}
+
 uint8_t *cryptoHDNodePathToPubkey(const CoinInfo *coin, const HDNodePathType *hdnodepath)
 {
 	if (!hdnodepath->node.has_public_key || hdnodepath->node.public_key.size != 33) return 0;
 	static HDNode node;
-	if (hdnode_from_xpub(hdnodepath->node.depth, hdnodepath->node.child_num, hdnodepath->node.chain_code.bytes, hdnodepath->node.public_key.bytes, coin->curve_name, &node) == 0) {
-		return 0;
+
+	const uint32_t count = hdnodepath->address_n_count;
+	uint8_t parent_key[SHA256_DIGEST_LENGTH], key[SHA256_DIGEST_LENGTH];
+	SHA256_CTX ctx;
+	sha256_Init(&ctx);
+	sha256_Update(&ctx, (const uint8_t *)coin->curve_name, strlen(coin->curve_name) + 1);
+	sha256_Update(&ctx, (const uint8_t *)&(hdnodepath->node.depth), sizeof(uint32_t));
+	sha256_Update(&ctx, (const uint8_t *)&(hdnodepath->node.child_num), sizeof(uint32_t));
+	sha256_Update(&ctx, hdnodepath->node.chain_code.bytes, 32);
+	sha256_Update(&ctx, hdnodepath->node.public_key.bytes, 33);
+	sha256_Update(&ctx, (const uint8_t *)&count, sizeof(uint32_t));
+	if (count > 0) {
+		sha256_Update(&ctx, (const uint8_t *)hdnodepath->address_n, (count - 1) * sizeof(uint32_t));
+	}
+	SHA256_CTX parent_ctx = ctx;
+	sha256_Final(&parent_ctx, parent_key);
+	if (count > 0) {
+		sha256_Update(&ctx, (const uint8_t *)&(hdnodepath->address_n[count - 1]), sizeof(uint32_t));
 	}
-	layoutProgressUpdate(true);
-	for (uint32_t i = 0; i < hdnodepath->address_n_count; i++) {
+	sha256_Final(&ctx, key);
+
+	bool hit;
+	int slot = pubkey_cache_find(key, &hit);
+	if (hit) {
+		memcpy(node.public_key, pubkey_cache[slot].public_key, 33);
+		layoutProgressTick();
+		return node.public_key;
+	}
+
+	uint32_t i = 0;
+	bool parent_hit = false;
+	int parent_slot = -1;
+	if (count > 0) {
+		parent_slot = parent_cache_find(parent_key, &parent_hit);
+	}
+	if (parent_hit) {
+		memcpy(&node, &parent_cache[parent_slot].node, sizeof(HDNode));
+		i = count - 1;
+	} else {
+		if (parent_slot >= 0) {
+			parent_cache[parent_slot].set = false;
+		}
+		if (hdnode_from_xpub(hdnodepath->node.depth, hdnodepath->node.child_num, hdnodepath->node.chain_code.bytes, hdnodepath->node.public_key.bytes, coin->curve_name, &node) == 0) {
+			return 0;
+		}
+	}
+	layoutProgressTick();
+	for (; i < count; i++) {
+		if (i == count - 1 && !parent_hit) {
+			parent_cache[parent_slot].set = true;
+			memcpy(parent_cache[parent_slot].key, parent_key, SHA256_DIGEST_LENGTH);
+			memcpy(&parent_cache[parent_slot].node, &node, sizeof(HDNode));
+		}
 		if (hdnode_public_ckd(&node, hdnodepath->address_n[i]) == 0) {
 			return 0;
 		}
-		layoutProgressUpdate(true);
+		layoutProgressTick();
 	}
+
+	pubkey_cache[slot].set = true;
+	memcpy(pubkey_cache[slot].key, key, SHA256_DIGEST_LENGTH);
+	memcpy(pubkey_cache[slot].public_key, node.public_key, 33);
 	return node.public_key;
 }
 
+void cryptoPubkeyCacheClear(void)
+{
+	memzero(pubkey_cache, sizeof(pubkey_cache));
+	memzero(parent_cache, sizeof(parent_cache));
+	pubkey_cache_age = 0;
+}
+
 int cryptoMultisigPubkeyIndex(const CoinInfo *coin, const MultisigRedeemScriptType *multisig, const uint8_t *pubkey)
 {
 	for (size_t i = 0; i < multisig->pubkeys_count; i++) {
@@ -355,6 +475,57 @@ int cryptoMultisigPubkeyIndex(const CoinInfo *coin, const MultisigRedeemScriptTy
 	return -1;
 }
 
+/*
+ * The inputs and change outputs of a transaction usually share one
+ * multisig setup, so the last fingerprint is kept together with the
+ * fields it was computed from.  An exact match returns it without
+ * sorting and hashing again.
+ */
+static struct {
+	bool set;
+	uint32_t m, n;
+	struct {
+		uint32_t depth, fingerprint, child_num;
+		uint8_t chain_code[32];
+		uint8_t public_key[33];
+	} keys[15];
+	uint8_t hash[32];
+} multisig_fp_cache;
+
+static bool multisig_fp_cache_matches(const MultisigRedeemScriptType *multisig)
+{
+	if (!multisig_fp_cache.set || multisig_fp_cache.m != multisig->m || multisig_fp_cache.n != multisig->pubkeys_count) {
+		return false;
+	}
+	for (uint32_t i = 0; i < multisig->pubkeys_count; i++) {
+		const HDNodeType *node = &(multisig->pubkeys[i].node);
+		if (multisig_fp_cache.keys[i].depth != node->depth
+			|| multisig_fp_cache.keys[i].fingerprint != node->fingerprint
+			|| multisig_fp_cache.keys[i].child_num != node->child_num
+			|| memcmp(multisig_fp_cache.keys[i].chain_code, node->chain_code.bytes, 32) != 0
+			|| memcmp(multisig_fp_cache.keys[i].public_key, node->public_key.bytes, 33) != 0) {
+			return false;
+		}
+	}
+	return true;
+}
+
+static void multisig_fp_cache_store(const MultisigRedeemScriptType *multisig, const uint8_t *hash)
+{
+	multisig_fp_cache.m = multisig->m;
+	multisig_fp_cache.n = multisig->pubkeys_count;
+	for (uint32_t i = 0; i < multisig->pubkeys_count; i++) {
+		const HDNodeType *node = &(multisig->pubkeys[i].node);
+		multisig_fp_cache.keys[i].depth = node->depth;
+		multisig_fp_cache.keys[i].fingerprint = node->fingerprint;
+		multisig_fp_cache.keys[i].child_num = node->child_num;
+		memcpy(multisig_fp_cache.keys[i].chain_code, node->chain_code.bytes, 32);
+		memcpy(multisig_fp_cache.keys[i].public_key, node->public_key.bytes, 33);
+	}
+	memcpy(multisig_fp_cache.hash, hash, 32);
+	multisig_fp_cache.set = true;
+}
+
 int cryptoMultisigFingerprint(const MultisigRedeemScriptType *multisig, uint8_t *hash)
 {
 	static const HDNodePathType *ptr[15], *swap;
@@ -369,6 +540,11 @@ int cryptoMultisigFingerprint(const MultisigRedeemScriptType *multisig, uint8_t
 		if (!ptr[i]->node.has_public_key || ptr[i]->node.public_key.size != 33) return 0;
 		if (ptr[i]->node.chain_code.size != 32) return 0;
 	}
+	if (multisig_fp_cache_matches(multisig)) {
+		memcpy(hash, multisig_fp_cache.hash, 32);
+		layoutProgressTick();
+		return 1;
+	}
 	// minsort according to pubkey
 	for (uint32_t i = 0; i < n - 1; i++) {
 		for (uint32_t j = n - 1; j > i; j--) {
@@ -392,7 +568,8 @@ int cryptoMultisigFingerprint(const MultisigRedeemScriptType *multisig, uint8_t
 	}
 	sha256_Update(&ctx, (const uint8_t *)&n, sizeof(uint32_t));
 	sha256_Final(&ctx, hash);
-	layoutProgressUpdate(true);
+	multisig_fp_cache_store(multisig, hash);
+	layoutProgressTick();
 	return 1;
 }
 
@@ -422,3 +599,335 @@ int cryptoIdentityFingerprint(const IdentityType *identity, uint8_t *hash)
 	sha256_Final(&ctx, hash);
 	return 1;
 }
+
+/*
+ * Session cache of derived HD nodes.
+ *
+ * Every entry remembers a node by the chain code of the root it was derived
+ * from and its path.  cryptoDeriveNode() starts at the longest cached prefix
+ * of the requested path, so repeated derivations below the same account
+ * only take the last one or two CKD steps.  The cache holds private keys
+ * and is wiped by cryptoNodeCacheClear() from session_clear().
+ *
+ * A non-hardened CKD step needs the public key of the parent.  It is kept
+ * with the cached parent, so that deriving the addresses of an account
+ * costs one scalar multiplication each (for the child's public key)
+ * instead of two.
+ *
+ * cryptoDerivePublicNode() fills the public key of the node at the end of
+ * the path in its cache entry as well.  NEM and CoSi sign with the same
+ * ed25519 account many times in a row, and a repeated request then skips
+ * the base point multiplication.
+ */
+#define NODE_CACHE_SIZE      8
+#define NODE_CACHE_MAXDEPTH  8
+
+static CONFIDENTIAL struct {
+	bool set;
+	bool has_fingerprint;
+	uint32_t age;
+	uint8_t root_chain_code[32];
+	size_t depth;
+	uint32_t path[NODE_CACHE_MAXDEPTH];
+	uint32_t fingerprint;	// fingerprint of node itself
+	HDNode node;
+} node_cache[NODE_CACHE_SIZE];
+static uint32_t node_cache_age = 0;
+
+// find the longest cached prefix of path not deeper than max_depth
+static int node_cache_find(const HDNode *root, const uint32_t *path, size_t max_depth)
+{
+	int best = -1;
+	for (int i = 0; i < NODE_CACHE_SIZE; i++) {
+		if (!node_cache[i].set
+			|| node_cache[i].depth > max_depth
+			|| node_cache[i].node.curve != root->curve
+			|| (best >= 0 && node_cache[i].depth <= node_cache[best].depth)
+			|| memcmp(node_cache[i].root_chain_code, root->chain_code, 32) != 0
+			|| memcmp(node_cache[i].path, path, node_cache[i].depth * sizeof(uint32_t)) != 0) {
+			continue;
+		}
+		best = i;
+	}
+	return best;
+}
+
+static int node_cache_store(const uint8_t *root_chain_code, const uint32_t *path, size_t depth, const HDNode *node)
+{
+	int slot = 0;
+	for (int i = 0; i < NODE_CACHE_SIZE; i++) {
+		if (!node_cache[i].set) {
+			slot = i;
+			break;
+		}
+		if (node_cache[i].age < node_cache[slot].age) {
+			slot = i;
+		}
+	}
+	node_cache[slot].set = true;
+	node_cache[slot].has_fingerprint = false;
+	node_cache[slot].age = ++node_cache_age;
+	memcpy(node_cache[slot].root_chain_code, root_chain_code, 32);
+	node_cache[slot].depth = depth;
+	memcpy(node_cache[slot].path, path, depth * sizeof(uint32_t));
+	memcpy(&node_cache[slot].node, node, sizeof(HDNode));
+	return slot;
+}
+
+#if SEED_WARMUP
+/*
+ * Hardened account prefix of the last secp256k1 derivation.  Unlike the
+ * nodes it is kept over cryptoNodeCacheClear(), so that the seed warm-up
+ * after the next PIN unlock can derive the account again.
+ */
+#define NODE_WARM_DEPTH 3
+
+static uint32_t node_warm_path[NODE_WARM_DEPTH];
+static bool node_warm_set;
+
+static void node_warm_remember(const HDNode *node, const uint32_t *address_n, size_t address_n_count)
+{
+	if (address_n_count < NODE_WARM_DEPTH || node->curve != get_curve_by_name(SECP256K1_NAME)) {
+		return;
+	}
+	for (int i = 0; i < NODE_WARM_DEPTH; i++) {
+		if ((address_n[i] & 0x80000000) == 0) {
+			return;
+		}
+	}
+	memcpy(node_warm_path, address_n, sizeof(node_warm_path));
+	node_warm_set = true;
+}
+
+void cryptoNodeCacheWarm(const HDNode *root)
+{
+	if (!node_warm_set) {
+		return;
+	}
+	static CONFIDENTIAL HDNode node;
+	memcpy(&node, root, sizeof(HDNode));
+	cryptoDeriveNode(&node, node_warm_path, NODE_WARM_DEPTH, NULL);
+	memzero(&node, sizeof(node));
+}
+#endif
+
+// returns the cache entry of the derived node, or -1 if it is not cached
+static int node_cache_derive(HDNode *node, const uint32_t *address_n, size_t address_n_count, uint32_t *fingerprint, int *res)
+{
+	*res = 1;
+	if (address_n_count == 0) {
+		return -1;
+	}
+#if SEED_WARMUP
+	node_warm_remember(node, address_n, address_n_count);
+#endif
+	if (address_n_count > NODE_CACHE_MAXDEPTH) {
+		uint32_t start = profileStart();
+		*res = hdnode_private_ckd_cached(node, address_n, address_n_count, fingerprint);
+		profileEnd(PROFILE_CKD, start);
+		return -1;
+	}
+
+	uint8_t root_chain_code[32];
+	memcpy(root_chain_code, node->chain_code, 32);
+
+	// the parent fingerprint needs the parent node, so stop one level early
+	int e = node_cache_find(node, address_n, fingerprint ? address_n_count - 1 : address_n_count);
+	size_t depth = 0;
+	if (e >= 0) {
+		memcpy(node, &node_cache[e].node, sizeof(HDNode));
+		depth = node_cache[e].depth;
+		node_cache[e].age = ++node_cache_age;
+	}
+
+	for (;;) {
+		if (fingerprint && depth == address_n_count - 1) {
+			if (e < 0) {
+				*fingerprint = hdnode_fingerprint(node);
+			} else {
+				if (!node_cache[e].has_fingerprint) {
+					node_cache[e].fingerprint = hdnode_fingerprint(node);
+					node_cache[e].has_fingerprint = true;
+				}
+				*fingerprint = node_cache[e].fingerprint;
+			}
+		}
+		if (depth == address_n_count) {
+			break;
+		}
+		if (e >= 0 && (address_n[depth] & 0x80000000) == 0) {
+			hdnode_fill_public_key(&node_cache[e].node);
+			memcpy(node->public_key, node_cache[e].node.public_key, sizeof(node->public_key));
+		}
+		uint32_t start = profileStart();
+		*res = hdnode_private_ckd(node, address_n[depth]);
+		profileEnd(PROFILE_CKD, start);
+		if (*res == 0) {
+			return -1;
+		}
+		depth++;
+		// keep the account, chain and address level of the path
+		e = (depth + 2 >= address_n_count) ? node_cache_store(root_chain_code, address_n, depth, node) : -1;
+	}
+	return e;
+}
+
+int cryptoDeriveNode(HDNode *node, const uint32_t *address_n, size_t address_n_count, uint32_t *fingerprint)
+{
+	int res;
+	node_cache_derive(node, address_n, address_n_count, fingerprint, &res);
+	return res;
+}
+
+int cryptoDerivePublicNode(HDNode *node, const uint32_t *address_n, size_t address_n_count)
+{
+	int res;
+	int e = node_cache_derive(node, address_n, address_n_count, NULL, &res);
+	if (res == 0) {
+		return 0;
+	}
+	if (e < 0) {
+		hdnode_fill_public_key(node);
+	} else {
+		hdnode_fill_public_key(&node_cache[e].node);
+		memcpy(node->public_key, node_cache[e].node.public_key, sizeof(node->public_key));
+	}
+	return 1;
+}
+
+/*
+ * Session cache of identity nodes.
+ *
+ * SignIdentity and GetECDHSessionKey derive a five level hardened path
+ * from the identity hash, and SSH or GPG agents repeat them for the same
+ * few identities.  These nodes are kept apart from node_cache, so that
+ * address derivations do not push them out, and with their public key
+ * filled in.  A repeated request then only signs.  The cache is wiped
+ * together with node_cache.
+ */
+#define IDENTITY_CACHE_SIZE  4
+#define IDENTITY_PATH_DEPTH  5
+
+static CONFIDENTIAL struct {
+	bool set;
+	uint32_t age;
+	uint8_t root_chain_code[32];
+	uint32_t path[IDENTITY_PATH_DEPTH];
+	HDNode node;
+} identity_cache[IDENTITY_CACHE_SIZE];
+static uint32_t identity_cache_age = 0;
+
+int cryptoDeriveIdentityNode(HDNode *node, const uint32_t address_n[5])
+{
+	for (int i = 0; i < IDENTITY_CACHE_SIZE; i++) {
+		if (identity_cache[i].set
+			&& identity_cache[i].node.curve == node->curve
+			&& memcmp(identity_cache[i].root_chain_code, node->chain_code, 32) == 0
+			&& memcmp(identity_cache[i].path, address_n, sizeof(identity_cache[i].path)) == 0) {
+			identity_cache[i].age = ++identity_cache_age;
+			memcpy(node, &identity_cache[i].node, sizeof(HDNode));
+			return 1;
+		}
+	}
+
+	uint8_t root_chain_code[32];
+	memcpy(root_chain_code, node->chain_code, 32);
+	if (cryptoDeriveNode(node, address_n, IDENTITY_PATH_DEPTH, NULL) == 0) {
+		return 0;
+	}
+	hdnode_fill_public_key(node);
+
+	int slot = 0;
+	for (int i = 0; i < IDENTITY_CACHE_SIZE; i++) {
+		if (!identity_cache[i].set) {
+			slot = i;
+			break;
+		}
+		if (identity_cache[i].age < identity_cache[slot].age) {
+			slot = i;
+		}
+	}
+	identity_cache[slot].set = true;
+	identity_cache[slot].age = ++identity_cache_age;
+	memcpy(identity_cache[slot].root_chain_code, root_chain_code, 32);
+	memcpy(identity_cache[slot].path, address_n, sizeof(identity_cache[slot].path));
+	memcpy(&identity_cache[slot].node, node, sizeof(HDNode));
+	return 1;
+}
+
+void cryptoNodeCacheClear(void)
+{
+	memzero(node_cache, sizeof(node_cache));
+	node_cache_age = 0;
+	memzero(identity_cache, sizeof(identity_cache));
+	identity_cache_age = 0;
+	cryptoCipherSessionClear();
+}
+
+/*
+ * CipherKeyValue batch.
+ *
+ * The AES key schedule and default IV of the last CipherKeyValue are kept
+ * while the host sends more values for the same key, path and flags, so a
+ * batch of values costs one derivation, one HMAC and one confirmation.
+ * The batch ends with any other message, after CIPHER_SESSION_TIMEOUT ms
+ * without a value, or when the nodes are wiped by session_clear().
+ */
+#define CIPHER_SESSION_TIMEOUT  10000
+
+static CONFIDENTIAL struct {
+	bool set;
+	bool encrypt;
+	uint32_t expires;
+	uint8_t id[32];
+	uint8_t iv[16];
+	union {
+		aes_encrypt_ctx enc;
+		aes_decrypt_ctx dec;
+	} ctx;
+} cipher_session;
+
+bool cryptoCipherSessionMatch(const uint8_t *id, bool encrypt)
+{
+	if (!cipher_session.set
+		|| cipher_session.encrypt != encrypt
+		|| timer_expired(cipher_session.expires)
+		|| memcmp(cipher_session.id, id, 32) != 0) {
+		cryptoCipherSessionClear();
+		return false;
+	}
+	cipher_session.expires = timer_ms() + CIPHER_SESSION_TIMEOUT;
+	return true;
+}
+
+// key: 32 bytes of AES-256 key followed by the 16 bytes of the default IV
+void cryptoCipherSessionStart(const uint8_t *id, bool encrypt, const uint8_t *key)
+{
+	cipher_session.set = true;
+	cipher_session.encrypt = encrypt;
+	cipher_session.expires = timer_ms() + CIPHER_SESSION_TIMEOUT;
+	memcpy(cipher_session.id, id, 32);
+	memcpy(cipher_session.iv, key + 32, 16);
+	if (encrypt) {
+		aes_encrypt_key256(key, &cipher_session.ctx.enc);
+	} else {
+		aes_decrypt_key256(key, &cipher_session.ctx.dec);
+	}
+}
+
+// iv: NULL for the default IV of the session
+void cryptoCipherSessionCrypt(const uint8_t *iv, const uint8_t *in, uint8_t *out, size_t len)
+{
+	uint8_t cbc[16];
+	memcpy(cbc, iv ? iv : cipher_session.iv, 16);
+	if (cipher_session.encrypt) {
+		aes_cbc_encrypt(in, out, len, cbc, &cipher_session.ctx.enc);
+	} else {
+		aes_cbc_decrypt(in, out, len, cbc, &cipher_session.ctx.dec);
+	}
+}
+
+void cryptoCipherSessionClear(void)
+{
+	memzero(&cipher_session, sizeof(cipher_session));
+}
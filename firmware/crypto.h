@@ -53,10 +53,32 @@ int cryptoMessageDecrypt(curve_point *nonce, uint8_t *payload, size_t payload_le
 
 uint8_t *cryptoHDNodePathToPubkey(const CoinInfo *coin, const HDNodePathType *hdnodepath);
 
+void cryptoPubkeyCacheClear(void);
+
 int cryptoMultisigPubkeyIndex(const CoinInfo *coin, const MultisigRedeemScriptType *multisig, const uint8_t *pubkey);
 
 int cryptoMultisigFingerprint(const MultisigRedeemScriptType *multisig, uint8_t *hash);
 
 int cryptoIdentityFingerprint(const IdentityType *identity, uint8_t *hash);
 
+int cryptoDeriveNode(HDNode *node, const uint32_t *address_n, size_t address_n_count, uint32_t *fingerprint);
+
+int cryptoDerivePublicNode(HDNode *node, const uint32_t *address_n, size_t address_n_count);
+
+int cryptoDeriveIdentityNode(HDNode *node, const uint32_t address_n[5]);
+
+void cryptoNodeCacheClear(void);
+
+#if SEED_WARMUP
+void cryptoNodeCacheWarm(const HDNode *root);
+#endif
+
+bool cryptoCipherSessionMatch(const uint8_t *id, bool encrypt);
+
+void cryptoCipherSessionStart(const uint8_t *id, bool encrypt, const uint8_t *key);
+
+void cryptoCipherSessionCrypt(const uint8_t *iv, const uint8_t *in, uint8_t *out, size_t len);
+
+void cryptoCipherSessionClear(void);
+
 #endif
@@ -17,44 +17,102 @@
  * along with this library.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <string.h>
+
 #include "trezor.h"
 #include "debug.h"
 #include "oled.h"
 #include "util.h"
+#include "messages.h"
+#include "messages.pb.h"
 
 #if DEBUG_LOG
 
-void oledDebug(const char *line)
+/*
+ * debugLog() only copies the line into a ring in RAM, the lines are
+ * written out by debugLogFlush() from the main loop: as DebugLinkLog
+ * messages on the debug link, to stdout on the emulator and otherwise on
+ * the screen.  When the ring is full the oldest line is overwritten.
+ */
+#define DEBUG_LOG_LINES 32
+#define DEBUG_LOG_TEXT 64
+
+// lines written by one debugLogFlush() call
+#define DEBUG_LOG_FLUSH 4
+
+struct debugLogLine {
+	uint8_t level;
+	char bucket[16];
+	char text[DEBUG_LOG_TEXT];
+};
+
+static struct debugLogLine log_lines[DEBUG_LOG_LINES];
+static uint32_t log_head = 0;
+static uint32_t log_tail = 0;
+
+#if !DEBUG_LINK && !EMULATOR
+
+static void oledDebug(const char *line)
 {
-	static const char *lines[8] = {0, 0, 0, 0, 0, 0, 0, 0};
+	static char lines[8][22];
 	static char id = 3;
-	for (int i = 0; i < 7; i++) {
-		lines[i] = lines[i + 1];
-	}
-	lines[7] = line;
+	memmove(lines[0], lines[1], sizeof(lines) - sizeof(lines[0]));
+	strlcpy(lines[7], line, sizeof(lines[7]));
 	oledClear();
 	for (int i = 0; i < 8; i++) {
-		if (lines[i]) {
+		if (lines[i][0]) {
 			oledDrawChar(0, i * 8, '0' + (id + i) % 10, FONT_STANDARD);
 			oledDrawString(8, i * 8, lines[i], FONT_STANDARD);
 		}
 	}
-	oledRefresh();
 	id = (id + 1) % 10;
 }
 
+#endif
+
 void __attribute__ ((noinline)) debugLog(int level, const char *bucket, const char *text)
 {
 #if DEBUG_GDB
 	asm volatile(""::"r" (level), "r" (bucket), "r" (text)); // to prevent the compiler from optimizing away calls to the function
 #else
-	(void)level;
-	(void)bucket;
+	struct debugLogLine *line = &log_lines[log_head];
+	line->level = level;
+	strlcpy(line->bucket, bucket, sizeof(line->bucket));
+	strlcpy(line->text, text, sizeof(line->text));
+	log_head = (log_head + 1) % DEBUG_LOG_LINES;
+	if (log_head == log_tail) {
+		log_tail = (log_tail + 1) % DEBUG_LOG_LINES;
+	}
+#endif
+}
+
+void debugLogFlush(void)
+{
+	if (log_tail == log_head) {
+		return;
+	}
+	for (int i = 0; i < DEBUG_LOG_FLUSH && log_tail != log_head; i++) {
+		const struct debugLogLine *line = &log_lines[log_tail];
+#if DEBUG_LINK
+		DebugLinkLog msg;
+		memset(&msg, 0, sizeof(msg));
+		msg.has_level = true;
+		msg.level = line->level;
+		msg.has_bucket = true;
+		strlcpy(msg.bucket, line->bucket, sizeof(msg.bucket));
+		msg.has_text = true;
+		strlcpy(msg.text, line->text, sizeof(msg.text));
+		msg_debug_write(MessageType_MessageType_DebugLinkLog, &msg);
+#endif
 #if EMULATOR
-	puts(text);
-#else
-	oledDebug(text);
+		puts(line->text);
+#elif !DEBUG_LINK
+		oledDebug(line->text);
 #endif
+		log_tail = (log_tail + 1) % DEBUG_LOG_LINES;
+	}
+#if !DEBUG_LINK && !EMULATOR
+	oledRefresh();
 #endif
 }
 
@@ -86,7 +144,6 @@ void debugHexDump(const char *text, const uint8_t *p, const uint8_t len)
 {
 	{
 		static char s[256];
-#include <string.h>
 		strcpy(s, text);
 		char *hex_string = s + strlen(s);
 
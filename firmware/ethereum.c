@@ -35,20 +35,41 @@
 #include "gettext.h"
 #include "ethereum_tokens.h"
 #include "memzero.h"
+#include "pb_decode.h"
+#include "scratch.h"
 
 /* maximum supported chain id.  v must fit in an uint32_t. */
 #define MAX_CHAIN_ID 2147483630
 
+/* size of the data chunks requested from the host.  Chunks are hashed
+ * while they are decoded, so this is not bounded by MSG_IN_SIZE. */
+#define ETHEREUM_DATA_CHUNK (8 * 1024)
+
 static bool ethereum_signing = false;
 static uint32_t data_total, data_left;
-static EthereumTxRequest msg_tx_request;
+static uint32_t data_chunk_size;
+static bool data_chunk_overflow;
+// the signing state lives in the shared workflow arena
+static EthereumTxRequest * const msg_tx_request = &scratch_arena.ethereum.msg_tx_request;
 static CONFIDENTIAL uint8_t privkey[32];
 static uint32_t chain_id;
-struct SHA3_CTX keccak_ctx;
+static struct SHA3_CTX * const keccak_ctx = &scratch_arena.ethereum.keccak_ctx;
+
+/*
+ * A transaction that fits into EthereumSignTx is hashed before it is
+ * shown, and ethereum_signing_idle() signs it while the confirmation
+ * screens wait for the user.  The signature is only sent once they are
+ * all confirmed.
+ */
+static bool sig_deferred, sig_computed;
+static int sig_computed_res;
+static uint8_t sig_deferred_hash[32];
+static CONFIDENTIAL uint8_t sig_computed_sig[64];
+static uint8_t sig_computed_v;
 
 static inline void hash_data(const uint8_t *buf, size_t size)
 {
-	sha3_Update(&keccak_ctx, buf, size);
+	sha3_Update(keccak_ctx, buf, size);
 }
 
 /*
@@ -162,10 +183,10 @@ static void send_request_chunk(void)
 	int progress = 1000 - (data_total > 1000000
 						   ? data_left / (data_total/800)
 						   : data_left * 800 / data_total);
-	layoutProgress(_("Signing"), progress);
-	msg_tx_request.has_data_length = true;
-	msg_tx_request.data_length = data_left <= 1024 ? data_left : 1024;
-	msg_write(MessageType_MessageType_EthereumTxRequest, &msg_tx_request);
+	layoutProgressSet(_("Signing"), progress);
+	msg_tx_request->has_data_length = true;
+	msg_tx_request->data_length = data_left <= ETHEREUM_DATA_CHUNK ? data_left : ETHEREUM_DATA_CHUNK;
+	msg_write(MessageType_MessageType_EthereumTxRequest, msg_tx_request);
 }
 
 static int ethereum_is_canonic(uint8_t v, uint8_t signature[64])
@@ -174,12 +195,8 @@ static int ethereum_is_canonic(uint8_t v, uint8_t signature[64])
 	return (v & 2) == 0;
 }
 
-static void send_signature(void)
+static void hash_final(uint8_t hash[32])
 {
-	uint8_t hash[32], sig[64];
-	uint8_t v;
-	layoutProgress(_("Signing"), 1000);
-
 	/* eip-155 replay protection */
 	if (chain_id != 0) {
 		/* hash v=chain_id, r=0, s=0 */
@@ -188,8 +205,31 @@ static void send_signature(void)
 		hash_rlp_length(0, 0);
 	}
 
-	keccak_Final(&keccak_ctx, hash);
-	if (ecdsa_sign_digest(&secp256k1, privkey, hash, sig, &v, ethereum_is_canonic) != 0) {
+	keccak_Final(keccak_ctx, hash);
+}
+
+void ethereum_signing_idle(void)
+{
+	if (ethereum_signing && sig_deferred && !sig_computed) {
+		sig_computed_res = ecdsa_sign_digest(&secp256k1, privkey, sig_deferred_hash, sig_computed_sig, &sig_computed_v, ethereum_is_canonic);
+		sig_computed = true;
+	}
+}
+
+static void send_signature(void)
+{
+	uint8_t sig[64];
+	uint8_t v;
+	layoutProgressSet(_("Signing"), 1000);
+
+	if (!sig_deferred) {
+		hash_final(sig_deferred_hash);
+		sig_deferred = true;
+	}
+	ethereum_signing_idle();
+	memcpy(sig, sig_computed_sig, sizeof(sig));
+	v = sig_computed_v;
+	if (sig_computed_res != 0) {
 		fsm_sendFailure(FailureType_Failure_ProcessError, _("Signing failed"));
 		ethereum_signing_abort();
 		return;
@@ -198,24 +238,25 @@ static void send_signature(void)
 	memzero(privkey, sizeof(privkey));
 
 	/* Send back the result */
-	msg_tx_request.has_data_length = false;
+	msg_tx_request->has_data_length = false;
 
-	msg_tx_request.has_signature_v = true;
+	msg_tx_request->has_signature_v = true;
 	if (chain_id) {
-		msg_tx_request.signature_v = v + 2 * chain_id + 35;
+		msg_tx_request->signature_v = v + 2 * chain_id + 35;
 	} else {
-		msg_tx_request.signature_v = v + 27;
+		msg_tx_request->signature_v = v + 27;
 	}
 
-	msg_tx_request.has_signature_r = true;
-	msg_tx_request.signature_r.size = 32;
-	memcpy(msg_tx_request.signature_r.bytes, sig, 32);
+	msg_tx_request->has_signature_r = true;
+	msg_tx_request->signature_r.size = 32;
+	memcpy(msg_tx_request->signature_r.bytes, sig, 32);
 
-	msg_tx_request.has_signature_s = true;
-	msg_tx_request.signature_s.size = 32;
-	memcpy(msg_tx_request.signature_s.bytes, sig + 32, 32);
+	msg_tx_request->has_signature_s = true;
+	msg_tx_request->signature_s.size = 32;
+	memcpy(msg_tx_request->signature_s.bytes, sig + 32, 32);
+	memzero(sig, sizeof(sig));
 
-	msg_write(MessageType_MessageType_EthereumTxRequest, &msg_tx_request);
+	msg_write(MessageType_MessageType_EthereumTxRequest, msg_tx_request);
 
 	ethereum_signing_abort();
 }
@@ -428,10 +469,12 @@ static bool ethereum_signing_check(EthereumSignTx *msg)
 
 void ethereum_signing_init(EthereumSignTx *msg, const HDNode *node)
 {
+	scratch_claim(SCRATCH_ETHEREUM, ethereum_signing_abort);
 	ethereum_signing = true;
-	sha3_256_Init(&keccak_ctx);
+	sig_deferred = false;
+	sig_computed = false;
+	sha3_256_Init(keccak_ctx);
 
-	memset(&msg_tx_request, 0, sizeof(EthereumTxRequest));
 	/* set fields to 0, to avoid conditions later */
 	if (!msg->has_value)
 		msg->value.size = 0;
@@ -485,6 +528,39 @@ void ethereum_signing_init(EthereumSignTx *msg, const HDNode *node)
 		return;
 	}
 
+	/* Stage 1: Calculate total RLP length */
+	uint32_t rlp_length = 0;
+
+	rlp_length += rlp_calculate_length(msg->nonce.size, msg->nonce.bytes[0]);
+	rlp_length += rlp_calculate_length(msg->gas_price.size, msg->gas_price.bytes[0]);
+	rlp_length += rlp_calculate_length(msg->gas_limit.size, msg->gas_limit.bytes[0]);
+	rlp_length += rlp_calculate_length(msg->to.size, msg->to.bytes[0]);
+	rlp_length += rlp_calculate_length(msg->value.size, msg->value.bytes[0]);
+	rlp_length += rlp_calculate_length(data_total, msg->data_initial_chunk.bytes[0]);
+	if (chain_id) {
+		rlp_length += rlp_calculate_length(1, chain_id);
+		rlp_length += rlp_calculate_length(0, 0);
+		rlp_length += rlp_calculate_length(0, 0);
+	}
+
+	/* Stage 2: Store header fields */
+	hash_rlp_list_length(rlp_length);
+
+	hash_rlp_field(msg->nonce.bytes, msg->nonce.size);
+	hash_rlp_field(msg->gas_price.bytes, msg->gas_price.size);
+	hash_rlp_field(msg->gas_limit.bytes, msg->gas_limit.size);
+	hash_rlp_field(msg->to.bytes, msg->to.size);
+	hash_rlp_field(msg->value.bytes, msg->value.size);
+	hash_rlp_length(data_total, msg->data_initial_chunk.bytes[0]);
+	hash_data(msg->data_initial_chunk.bytes, msg->data_initial_chunk.size);
+	data_left = data_total - msg->data_initial_chunk.size;
+
+	memcpy(privkey, node->private_key, 32);
+	if (data_left == 0) {
+		hash_final(sig_deferred_hash);
+		sig_deferred = true;
+	}
+
 	const TokenType *token = NULL;
 
 	// detect ERC-20 token
@@ -523,38 +599,7 @@ void ethereum_signing_init(EthereumSignTx *msg, const HDNode *node)
 		return;
 	}
 	
-	/* Stage 1: Calculate total RLP length */
-	uint32_t rlp_length = 0;
-
-	layoutProgress(_("Signing"), 0);
-
-	rlp_length += rlp_calculate_length(msg->nonce.size, msg->nonce.bytes[0]);
-	rlp_length += rlp_calculate_length(msg->gas_price.size, msg->gas_price.bytes[0]);
-	rlp_length += rlp_calculate_length(msg->gas_limit.size, msg->gas_limit.bytes[0]);
-	rlp_length += rlp_calculate_length(msg->to.size, msg->to.bytes[0]);
-	rlp_length += rlp_calculate_length(msg->value.size, msg->value.bytes[0]);
-	rlp_length += rlp_calculate_length(data_total, msg->data_initial_chunk.bytes[0]);
-	if (chain_id) {
-		rlp_length += rlp_calculate_length(1, chain_id);
-		rlp_length += rlp_calculate_length(0, 0);
-		rlp_length += rlp_calculate_length(0, 0);
-	}
-
-	/* Stage 2: Store header fields */
-	hash_rlp_list_length(rlp_length);
-
-	layoutProgress(_("Signing"), 100);
-
-	hash_rlp_field(msg->nonce.bytes, msg->nonce.size);
-	hash_rlp_field(msg->gas_price.bytes, msg->gas_price.size);
-	hash_rlp_field(msg->gas_limit.bytes, msg->gas_limit.size);
-	hash_rlp_field(msg->to.bytes, msg->to.size);
-	hash_rlp_field(msg->value.bytes, msg->value.size);
-	hash_rlp_length(data_total, msg->data_initial_chunk.bytes[0]);
-	hash_data(msg->data_initial_chunk.bytes, msg->data_initial_chunk.size);
-	data_left = data_total - msg->data_initial_chunk.size;
-
-	memcpy(privkey, node->private_key, 32);
+	layoutProgressSet(_("Signing"), 0);
 
 	if (data_left > 0) {
 		send_request_chunk();
@@ -563,30 +608,61 @@ void ethereum_signing_init(EthereumSignTx *msg, const HDNode *node)
 	}
 }
 
+/*
+ * Hash the data chunk of an EthereumTxAck straight from the input stream.
+ * The hash cannot be rewound, so a message that fails to decode after
+ * this has run aborts the signing (see msg_process()).
+ */
+static bool ethereum_data_chunk_decode(pb_istream_t *stream, const pb_field_t *field, void **arg)
+{
+	(void)field;
+	(void)arg;
+	if (!ethereum_signing || stream->bytes_left > data_left) {
+		data_chunk_overflow = true;
+		return pb_read(stream, NULL, stream->bytes_left);
+	}
+	uint8_t buf[64];
+	while (stream->bytes_left > 0) {
+		size_t n = MIN(stream->bytes_left, sizeof(buf));
+		if (!pb_read(stream, buf, n)) {
+			return false;
+		}
+		hash_data(buf, n);
+		data_left -= n;
+		data_chunk_size += n;
+	}
+	return true;
+}
+
+void ethereum_signing_txack_prepare(EthereumTxAck *tx)
+{
+	data_chunk_size = 0;
+	data_chunk_overflow = false;
+	tx->data_chunk.funcs.decode = ethereum_data_chunk_decode;
+}
+
 void ethereum_signing_txack(EthereumTxAck *tx)
 {
+	(void)tx;
+
 	if (!ethereum_signing) {
 		fsm_sendFailure(FailureType_Failure_UnexpectedMessage, _("Not in Ethereum signing mode"));
 		layoutHome();
 		return;
 	}
 
-	if (tx->data_chunk.size > data_left) {
+	if (data_chunk_overflow) {
 		fsm_sendFailure(FailureType_Failure_DataError, _("Too much data"));
 		ethereum_signing_abort();
 		return;
 	}
 
-	if (data_left > 0 && (!tx->has_data_chunk || tx->data_chunk.size == 0)) {
+	if (data_left > 0 && data_chunk_size == 0) {
 		fsm_sendFailure(FailureType_Failure_DataError, _("Empty data chunk received"));
 		ethereum_signing_abort();
 		return;
 	}
 
-	hash_data(tx->data_chunk.bytes, tx->data_chunk.size);
-
-	data_left -= tx->data_chunk.size;
-
 	if (data_left > 0) {
 		send_request_chunk();
 	} else {
@@ -596,6 +672,10 @@ void ethereum_signing_txack(EthereumTxAck *tx)
 
 void ethereum_signing_abort(void)
 {
+	scratch_release(SCRATCH_ETHEREUM);
+	sig_deferred = false;
+	sig_computed = false;
+	memzero(sig_computed_sig, sizeof(sig_computed_sig));
 	if (ethereum_signing) {
 		memzero(privkey, sizeof(privkey));
 		layoutHome();
@@ -44,18 +44,25 @@
 #include "signing.h"
 #include "aes/aes.h"
 #include "hmac.h"
+#include "memzero.h"
 #include "crypto.h"
 #include "base58.h"
 #include "bip39.h"
 #include "ripemd160.h"
 #include "curves.h"
 #include "secp256k1.h"
+#if USE_ETHEREUM
 #include "ethereum.h"
+#endif
+#if USE_NEM
 #include "nem.h"
 #include "nem2.h"
+#endif
 #include "rfc6979.h"
 #include "gettext.h"
 #include "supervise.h"
+#include "timer.h"
+#include "timers.h"
 
 // message methods
 
@@ -201,21 +208,32 @@ static const CoinInfo *fsm_getCoin(bool has_name, const char *name)
 	return coin;
 }
 
-static HDNode *fsm_getDerivedNode(const char *curve, const uint32_t *address_n, size_t address_n_count, uint32_t *fingerprint)
+// public_key: fill the public key of the node, see cryptoDerivePublicNode()
+static HDNode *fsm_deriveNode(const char *curve, const uint32_t *address_n, size_t address_n_count, uint32_t *fingerprint, bool public_key)
 {
 	static CONFIDENTIAL HDNode node;
 	if (fingerprint) {
 		*fingerprint = 0;
 	}
 	if (!storage_getRootNode(&node, curve, true)) {
-		fsm_sendFailure(FailureType_Failure_NotInitialized, _("Device not initialized or passphrase request cancelled or unsupported curve"));
+		if (storage_seedDerivationCancelled()) {
+			fsm_sendFailure(FailureType_Failure_ActionCancelled, NULL);
+		} else {
+			fsm_sendFailure(FailureType_Failure_NotInitialized, _("Device not initialized or passphrase request cancelled or unsupported curve"));
+		}
 		layoutHome();
 		return 0;
 	}
 	if (!address_n || address_n_count == 0) {
+		if (public_key) {
+			hdnode_fill_public_key(&node);
+		}
 		return &node;
 	}
-	if (hdnode_private_ckd_cached(&node, address_n, address_n_count, fingerprint) == 0) {
+	int res = public_key
+		? cryptoDerivePublicNode(&node, address_n, address_n_count)
+		: cryptoDeriveNode(&node, address_n, address_n_count, fingerprint);
+	if (res == 0) {
 		fsm_sendFailure(FailureType_Failure_ProcessError, _("Failed to derive private key"));
 		layoutHome();
 		return 0;
@@ -223,6 +241,42 @@ static HDNode *fsm_getDerivedNode(const char *curve, const uint32_t *address_n,
 	return &node;
 }
 
+static HDNode *fsm_getDerivedNode(const char *curve, const uint32_t *address_n, size_t address_n_count, uint32_t *fingerprint)
+{
+	return fsm_deriveNode(curve, address_n, address_n_count, fingerprint, false);
+}
+
+// node with its public key, which is cached for the session
+static HDNode *fsm_getDerivedPublicNode(const char *curve, const uint32_t *address_n, size_t address_n_count)
+{
+	return fsm_deriveNode(curve, address_n, address_n_count, NULL, true);
+}
+
+// root node derived to the identity path, see cryptoDeriveIdentityNode()
+static HDNode *fsm_getIdentityNode(const char *curve, const uint32_t address_n[5])
+{
+	HDNode *node = fsm_getDerivedNode(curve, NULL, 0, NULL);
+	if (!node) {
+		return 0;
+	}
+	if (cryptoDeriveIdentityNode(node, address_n) == 0) {
+		fsm_sendFailure(FailureType_Failure_ProcessError, _("Failed to derive private key"));
+		layoutHome();
+		return 0;
+	}
+	return node;
+}
+
+// confirm the SHA-256 of a message that did not fit on the previous screen
+static bool fsm_confirmMessageDigest(const uint8_t *msg, uint32_t len, bool verified)
+{
+	if (len <= LAYOUT_MESSAGE_MAXLEN) {
+		return true;
+	}
+	layoutMessageDigest(msg, len, verified);
+	return protectButton(verified ? ButtonRequestType_ButtonRequest_Other : ButtonRequestType_ButtonRequest_ProtectCall, false);
+}
+
 static bool fsm_layoutAddress(const char *address, const char *desc, bool ignorecase, const uint32_t *address_n, size_t address_n_count)
 {
 	bool qrcode = false;
@@ -252,14 +306,8 @@ void fsm_msgInitialize(Initialize *msg)
 	recovery_abort();
 	signing_abort();
 	if (msg && msg->has_state && msg->state.size == 64) {
-		uint8_t i_state[64];
-		if (!session_getState(msg->state.bytes, i_state, NULL)) {
-			session_clear(false); // do not clear PIN
-		} else {
-			if (0 != memcmp(msg->state.bytes, i_state, 64)) {
-				session_clear(false); // do not clear PIN
-			}
-		}
+		// keeps or restores a wallet of this session, or clears it
+		session_switchState(msg->state.bytes);
 	} else {
 		session_clear(false); // do not clear PIN
 	}
@@ -456,29 +504,64 @@ void fsm_msgWipeDevice(WipeDevice *msg)
 	layoutHome();
 }
 
+/*
+ * Entropy stream.  After one confirmation further GetEntropy requests
+ * are answered right away while the stream screen is up, so that tools
+ * collecting large amounts can read the RNG at the USB rate.  The
+ * stream ends when another message changes the screen or when no
+ * request came for ENTROPY_STREAM_IDLE_MS.  The words come from the RNG
+ * pool, which drops any output flagged by the seed and clock error
+ * checks and repeated words.
+ */
+#define ENTROPY_STREAM_IDLE_MS  2000
+#define ENTROPY_STREAM_SHOW_MS  250
+
+static SoftTimer entropy_timer;
+static uint32_t entropy_start, entropy_shown, entropy_sent;
+
+static void fsm_entropyStreamEnd(void)
+{
+	if (layoutLast == layoutEntropyStream) {
+		layoutHome();
+	}
+}
+
 void fsm_msgGetEntropy(GetEntropy *msg)
 {
+	if (layoutLast != layoutEntropyStream) {
 #if !DEBUG_RNG
-	layoutDialogSplit(&bmp_icon_question, _("Cancel"), _("Confirm"), NULL,
-		// DISPLAY: 5 lines
-		_("Do you really want to send entropy?")
-	);
+		layoutDialogSplit(&bmp_icon_question, _("Cancel"), _("Confirm"), NULL,
+			// DISPLAY: 5 lines
+			_("Do you really want to send entropy?")
+		);
 
-	if (!protectButton(ButtonRequestType_ButtonRequest_ProtectCall, false)) {
-		fsm_sendFailure(FailureType_Failure_ActionCancelled, NULL);
-		layoutHome();
-		return;
-	}
+		if (!protectButton(ButtonRequestType_ButtonRequest_ProtectCall, false)) {
+			fsm_sendFailure(FailureType_Failure_ActionCancelled, NULL);
+			layoutHome();
+			return;
+		}
 #endif
+		entropy_start = entropy_shown = timer_ms();
+		entropy_sent = 0;
+		layoutEntropyStream(0, 0);
+	}
 	RESP_INIT(Entropy);
 	uint32_t len = msg->size;
-	if (len > 1024) {
-		len = 1024;
+	if (len > sizeof(resp->entropy.bytes)) {
+		len = sizeof(resp->entropy.bytes);
 	}
 	resp->entropy.size = len;
 	random_buffer(resp->entropy.bytes, len);
 	msg_write(MessageType_MessageType_Entropy, resp);
-	layoutHome();
+	memzero(resp->entropy.bytes, len);
+
+	entropy_sent += len;
+	uint32_t now = timer_ms();
+	if (now - entropy_shown >= ENTROPY_STREAM_SHOW_MS) {
+		entropy_shown = now;
+		layoutEntropyStream(entropy_sent, (uint64_t)entropy_sent * 1000 / (now - entropy_start));
+	}
+	timerStart(&entropy_timer, ENTROPY_STREAM_IDLE_MS, fsm_entropyStreamEnd);
 }
 
 void fsm_msgGetPublicKey(GetPublicKey *msg)
@@ -626,10 +709,14 @@ void fsm_msgCancel(Cancel *msg)
 	(void)msg;
 	recovery_abort();
 	signing_abort();
+#if USE_ETHEREUM
 	ethereum_signing_abort();
+#endif
 	fsm_sendFailure(FailureType_Failure_ActionCancelled, NULL);
 }
 
+#if USE_ETHEREUM
+
 void fsm_msgEthereumSignTx(EthereumSignTx *msg)
 {
 	CHECK_INITIALIZED
@@ -647,6 +734,8 @@ void fsm_msgEthereumTxAck(EthereumTxAck *msg)
 	ethereum_signing_txack(msg);
 }
 
+#endif
+
 void fsm_msgCipherKeyValue(CipherKeyValue *msg)
 {
 	CHECK_INITIALIZED
@@ -657,38 +746,43 @@ void fsm_msgCipherKeyValue(CipherKeyValue *msg)
 
 	CHECK_PIN
 
-	const HDNode *node = fsm_getDerivedNode(SECP256K1_NAME, msg->address_n, msg->address_n_count, NULL);
-	if (!node) return;
-
 	bool encrypt = msg->has_encrypt && msg->encrypt;
 	bool ask_on_encrypt = msg->has_ask_on_encrypt && msg->ask_on_encrypt;
 	bool ask_on_decrypt = msg->has_ask_on_decrypt && msg->ask_on_decrypt;
-	if ((encrypt && ask_on_encrypt) || (!encrypt && ask_on_decrypt)) {
-		layoutCipherKeyValue(encrypt, msg->key);
-		if (!protectButton(ButtonRequestType_ButtonRequest_Other, false)) {
-			fsm_sendFailure(FailureType_Failure_ActionCancelled, NULL);
-			layoutHome();
-			return;
-		}
-	}
 
 	uint8_t data[256 + 4];
 	strlcpy((char *)data, msg->key, sizeof(data));
 	strlcat((char *)data, ask_on_encrypt ? "E1" : "E0", sizeof(data));
 	strlcat((char *)data, ask_on_decrypt ? "D1" : "D0", sizeof(data));
 
-	hmac_sha512(node->private_key, 32, data, strlen((char *)data), data);
+	// consecutive values for the same key and path reuse the AES key
+	uint8_t id[32];
+	SHA256_CTX ctx;
+	sha256_Init(&ctx);
+	sha256_Update(&ctx, (const uint8_t *)msg->address_n, msg->address_n_count * sizeof(uint32_t));
+	sha256_Update(&ctx, data, strlen((char *)data) + 1);
+	sha256_Final(&ctx, id);
 
-	RESP_INIT(CipheredKeyValue);
-	if (encrypt) {
-		aes_encrypt_ctx ctx;
-		aes_encrypt_key256(data, &ctx);
-		aes_cbc_encrypt(msg->value.bytes, resp->value.bytes, msg->value.size, ((msg->iv.size == 16) ? (msg->iv.bytes) : (data + 32)), &ctx);
-	} else {
-		aes_decrypt_ctx ctx;
-		aes_decrypt_key256(data, &ctx);
-		aes_cbc_decrypt(msg->value.bytes, resp->value.bytes, msg->value.size, ((msg->iv.size == 16) ? (msg->iv.bytes) : (data + 32)), &ctx);
+	if (!cryptoCipherSessionMatch(id, encrypt)) {
+		const HDNode *node = fsm_getDerivedNode(SECP256K1_NAME, msg->address_n, msg->address_n_count, NULL);
+		if (!node) return;
+
+		if ((encrypt && ask_on_encrypt) || (!encrypt && ask_on_decrypt)) {
+			layoutCipherKeyValue(encrypt, msg->key);
+			if (!protectButton(ButtonRequestType_ButtonRequest_Other, false)) {
+				fsm_sendFailure(FailureType_Failure_ActionCancelled, NULL);
+				layoutHome();
+				return;
+			}
+		}
+
+		hmac_sha512(node->private_key, 32, data, strlen((char *)data), data);
+		cryptoCipherSessionStart(id, encrypt, data);
+		memzero(data, sizeof(data));
 	}
+
+	RESP_INIT(CipheredKeyValue);
+	cryptoCipherSessionCrypt((msg->iv.size == 16) ? msg->iv.bytes : NULL, msg->value.bytes, resp->value.bytes, msg->value.size);
 	resp->has_value = true;
 	resp->value.size = msg->value.size;
 	msg_write(MessageType_MessageType_CipheredKeyValue, resp);
@@ -920,6 +1014,8 @@ void fsm_msgGetAddress(GetAddress *msg)
 	layoutHome();
 }
 
+#if USE_ETHEREUM
+
 void fsm_msgEthereumGetAddress(EthereumGetAddress *msg)
 {
 	RESP_INIT(EthereumAddress);
@@ -959,7 +1055,8 @@ void fsm_msgEthereumSignMessage(EthereumSignMessage *msg)
 	CHECK_INITIALIZED
 
 	layoutSignMessage(msg->message.bytes, msg->message.size);
-	if (!protectButton(ButtonRequestType_ButtonRequest_ProtectCall, false)) {
+	if (!protectButton(ButtonRequestType_ButtonRequest_ProtectCall, false)
+		|| !fsm_confirmMessageDigest(msg->message.bytes, msg->message.size, false)) {
 		fsm_sendFailure(FailureType_Failure_ActionCancelled, NULL);
 		layoutHome();
 		return;
@@ -993,7 +1090,8 @@ void fsm_msgEthereumVerifyMessage(EthereumVerifyMessage *msg)
 		return;
 	}
 	layoutVerifyMessage(msg->message.bytes, msg->message.size);
-	if (!protectButton(ButtonRequestType_ButtonRequest_Other, false)) {
+	if (!protectButton(ButtonRequestType_ButtonRequest_Other, false)
+		|| !fsm_confirmMessageDigest(msg->message.bytes, msg->message.size, true)) {
 		fsm_sendFailure(FailureType_Failure_ActionCancelled, NULL);
 		layoutHome();
 		return;
@@ -1003,6 +1101,8 @@ void fsm_msgEthereumVerifyMessage(EthereumVerifyMessage *msg)
 	layoutHome();
 }
 
+#endif
+
 void fsm_msgEntropyAck(EntropyAck *msg)
 {
 	if (msg->has_entropy) {
@@ -1019,7 +1119,8 @@ void fsm_msgSignMessage(SignMessage *msg)
 	CHECK_INITIALIZED
 
 	layoutSignMessage(msg->message.bytes, msg->message.size);
-	if (!protectButton(ButtonRequestType_ButtonRequest_ProtectCall, false)) {
+	if (!protectButton(ButtonRequestType_ButtonRequest_ProtectCall, false)
+		|| !fsm_confirmMessageDigest(msg->message.bytes, msg->message.size, false)) {
 		fsm_sendFailure(FailureType_Failure_ActionCancelled, NULL);
 		layoutHome();
 		return;
@@ -1066,7 +1167,8 @@ void fsm_msgVerifyMessage(VerifyMessage *msg)
 			return;
 		}
 		layoutVerifyMessage(msg->message.bytes, msg->message.size);
-		if (!protectButton(ButtonRequestType_ButtonRequest_Other, false)) {
+		if (!protectButton(ButtonRequestType_ButtonRequest_Other, false)
+			|| !fsm_confirmMessageDigest(msg->message.bytes, msg->message.size, true)) {
 			fsm_sendFailure(FailureType_Failure_ActionCancelled, NULL);
 			layoutHome();
 			return;
@@ -1111,7 +1213,7 @@ void fsm_msgSignIdentity(SignIdentity *msg)
 	if (msg->has_ecdsa_curve_name) {
 		curve = msg->ecdsa_curve_name;
 	}
-	HDNode *node = fsm_getDerivedNode(curve, address_n, 5, NULL);
+	HDNode *node = fsm_getIdentityNode(curve, address_n);
 	if (!node) return;
 
 	bool sign_ssh = msg->identity.has_proto && (strcmp(msg->identity.proto, "ssh") == 0);
@@ -1189,7 +1291,7 @@ void fsm_msgGetECDHSessionKey(GetECDHSessionKey *msg)
 		curve = msg->ecdsa_curve_name;
 	}
 
-	const HDNode *node = fsm_getDerivedNode(curve, address_n, 5, NULL);
+	const HDNode *node = fsm_getIdentityNode(curve, address_n);
 	if (!node) return;
 
 	int result_size = 0;
@@ -1356,6 +1458,8 @@ void fsm_msgSetU2FCounter(SetU2FCounter *msg)
 	layoutHome();
 }
 
+#if USE_NEM
+
 void fsm_msgNEMGetAddress(NEMGetAddress *msg)
 {
 	if (!msg->has_network) {
@@ -1370,7 +1474,7 @@ void fsm_msgNEMGetAddress(NEMGetAddress *msg)
 
 	RESP_INIT(NEMAddress);
 
-	HDNode *node = fsm_getDerivedNode(ED25519_KECCAK_NAME, msg->address_n, msg->address_n_count, NULL);
+	HDNode *node = fsm_getDerivedPublicNode(ED25519_KECCAK_NAME, msg->address_n, msg->address_n_count);
 	if (!node) return;
 
 	if (!hdnode_get_nem_address(node, msg->network, resp->address))
@@ -1443,11 +1547,9 @@ void fsm_msgNEMSignTx(NEMSignTx *msg) {
 
 	RESP_INIT(NEMSignedTx);
 
-	HDNode *node = fsm_getDerivedNode(ED25519_KECCAK_NAME, msg->transaction.address_n, msg->transaction.address_n_count, NULL);
+	HDNode *node = fsm_getDerivedPublicNode(ED25519_KECCAK_NAME, msg->transaction.address_n, msg->transaction.address_n_count);
 	if (!node) return;
 
-	hdnode_fill_public_key(node);
-
 	const NEMTransactionCommon *common = msg->has_multisig ? &msg->multisig : &msg->transaction;
 
 	char address[NEM_ADDRESS_SIZE + 1];
@@ -1646,6 +1748,8 @@ void fsm_msgNEMDecryptMessage(NEMDecryptMessage *msg)
 	layoutHome();
 }
 
+#endif
+
 void fsm_msgCosiCommit(CosiCommit *msg)
 {
 	RESP_INIT(CosiCommitment);
@@ -1663,7 +1767,7 @@ void fsm_msgCosiCommit(CosiCommit *msg)
 
 	CHECK_PIN
 
-	const HDNode *node = fsm_getDerivedNode(ED25519_NAME, msg->address_n, msg->address_n_count, NULL);
+	const HDNode *node = fsm_getDerivedPublicNode(ED25519_NAME, msg->address_n, msg->address_n_count);
 	if (!node) return;
 
 	uint8_t nonce[32];
@@ -1678,7 +1782,7 @@ void fsm_msgCosiCommit(CosiCommit *msg)
 	resp->pubkey.size = 32;
 
 	ed25519_publickey(nonce, resp->commitment.bytes);
-	ed25519_publickey(node->private_key, resp->pubkey.bytes);
+	memcpy(resp->pubkey.bytes, &node->public_key[1], 32);
 
 	msg_write(MessageType_MessageType_CosiCommitment, resp);
 	layoutHome();
@@ -1799,7 +1903,7 @@ void fsm_msgDebugLinkMemoryWrite(DebugLinkMemoryWrite *msg)
 		for (uint32_t i = 0; i < length; i += 4) {
 			uint32_t word;
 			memcpy(&word, msg->memory.bytes + i, 4);
-			flash_write32(msg->address + i, word);
+			svc_flash_program_block(msg->address + i, &word, sizeof(word));
 		}
 		svc_flash_lock();
 	} else {
@@ -5,22 +5,42 @@
 #include "storage.h"
 #include "intl/intl.h"
 
-char const * strGetTrad(const char * str) {
-    const char * language = storage_getLanguage();
+/* index into lang_strings of the configured language, -1 if none */
+static int strLanguage = -1;
+
+// FNV-1a, keep in sync with strHash() in generate_translation_headers.py
+static uint32_t strHash(const char *str)
+{
+    uint32_t h = 2166136261u;
+    while (*str) {
+        h = (h ^ (uint8_t)*str++) * 16777619u;
+    }
+    return h;
+}
+
+void strSetLanguage(const char * language) {
+    strLanguage = -1;
     if (language) {
-        for(int i = 0; i < STR_NUM; i++)
-        {
-            if (strcmp(str, en_strings[i]) == 0) {
-                if (strcmp(language, "FR") == 0) {
-                    return fr_strings[i];
-                } else if (strcmp(language, "EN") == 0) {
-                    return en_strings[i];
-                } else if (strcmp(language, "DE") == 0) {
-                    return de_strings[i];
-                }
+        for (int i = 0; i < LANG_NUM; i++) {
+            if (strcmp(language, lang_codes[i]) == 0) {
+                strLanguage = i;
                 break;
             }
         }
     }
+}
+
+char const * strGetTrad(const char * str) {
+    if (strLanguage < 0) {
+        return str;
+    }
+    uint32_t slot = strHash(str) & (STR_HASH_SIZE - 1);
+    while (str_hash[slot] != 0) {
+        int i = str_hash[slot] - 1;
+        if (strcmp(str, en_strings[i]) == 0) {
+            return lang_strings[strLanguage][i];
+        }
+        slot = (slot + 1) & (STR_HASH_SIZE - 1);
+    }
     return str;
-}
\ No newline at end of file
+}
@@ -23,5 +23,6 @@
 #define _(X) strGetTrad(X)
 
 char const * strGetTrad(char const * str);
+void strSetLanguage(char const * language);
 
 #endif
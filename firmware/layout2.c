@@ -33,9 +33,12 @@
 #include "timer.h"
 #include "bignum.h"
 #include "secp256k1.h"
+#if USE_NEM
 #include "nem2.h"
+#endif
 #include "gettext.h"
 #include "fonts.h"
+#include "sha2.h"
 
 #define LINES_ON_SCREEN 6
 
@@ -193,6 +196,29 @@ void layoutDialogSwipe(const BITMAP *icon, const char *btnNo, const char *btnYes
 	layoutDialog(icon, btnNo, btnYes, desc, line1, line2, line3, line4, line5, line6);
 }
 
+/*
+ * Progress screen service.
+ *
+ * layoutProgressSet() and layoutProgressTick() record the state of the
+ * progress screen and redraw it at most every PROGRESS_REFRESH_MS, so a hot
+ * loop may call them on every iteration without paying for a full screen
+ * transfer each time.  The first frame and the completed bar are drawn
+ * right away, layoutProgressFlush() from the main loop draws the rest.
+ */
+#define PROGRESS_REFRESH_MS 100
+
+static const char *progress_desc;
+static int progress_permil;
+static bool progress_pending;
+static uint32_t progress_drawn;
+
+static void layoutProgressDraw(void)
+{
+	layoutProgress(progress_desc, progress_permil);
+	progress_pending = false;
+	progress_drawn = timer_ms();
+}
+
 void layoutProgressSwipe(const char *desc, int permil)
 {
 	if (layoutLast == layoutProgressSwipe) {
@@ -201,7 +227,43 @@ void layoutProgressSwipe(const char *desc, int permil)
 		layoutLast = layoutProgressSwipe;
 		layoutSwipe();
 	}
-	layoutProgress(desc, permil);
+	progress_desc = desc;
+	progress_permil = permil;
+	layoutProgressDraw();
+}
+
+void layoutProgressSet(const char *desc, int permil)
+{
+	bool shown = layoutLast == layoutProgressSwipe && desc == progress_desc;
+	progress_desc = desc;
+	progress_permil = permil;
+	progress_pending = true;
+	if (!shown || permil >= 1000 || timer_expired(progress_drawn + PROGRESS_REFRESH_MS)) {
+		layoutLast = layoutProgressSwipe;
+		layoutProgressDraw();
+	}
+}
+
+void layoutProgressTick(void)
+{
+	if (!timer_expired(progress_drawn + PROGRESS_REFRESH_MS)) {
+		progress_pending = progress_pending || layoutLast == layoutProgressSwipe;
+		return;
+	}
+	if (layoutLast == layoutProgressSwipe) {
+		layoutProgressDraw();
+	} else {
+		// only the gears on top of some other screen
+		layoutProgressUpdate(true);
+		progress_drawn = timer_ms();
+	}
+}
+
+void layoutProgressFlush(void)
+{
+	if (progress_pending && layoutLast == layoutProgressSwipe) {
+		layoutProgressDraw();
+	}
 }
 
 void layoutScreensaver(void)
@@ -211,6 +273,20 @@ void layoutScreensaver(void)
 	oledRefresh();
 }
 
+/*
+ * The home screen only depends on the stored settings, so the rendered
+ * screen is kept until a storage commit calls layoutHomeInvalidate().
+ * Returning home after an operation is then a copy of the buffer, and
+ * oledRefresh() sends nothing if the screen was home already.
+ */
+static uint8_t home_cache_screen[OLED_BUFSIZE];
+static bool home_cache_valid;
+
+void layoutHomeInvalidate(void)
+{
+	home_cache_valid = false;
+}
+
 void layoutHome(void)
 {
 	if (layoutLast == layoutHome || layoutLast == layoutScreensaver) {
@@ -219,6 +295,12 @@ void layoutHome(void)
 		layoutSwipe();
 	}
 	layoutLast = layoutHome;
+	if (home_cache_valid) {
+		oledSetBuffer(home_cache_screen);
+		oledRefresh();
+		autolockRestart();
+		return;
+	}
 	// DISPLAY : 1 line
 	const char *label = storage_isInitialized() ? storage_getLabel() : _("Go to safe-t.io/start");
 #if CRYPTOMEM
@@ -229,6 +311,7 @@ void layoutHome(void)
 		BITMAP b;
 		b.width = 128;
 		b.height = 64;
+		b.format = BITMAP_ROWS;
 		b.data = homescreen;
 		oledDrawBitmap(0, 0, &b);
 	} else {
@@ -244,6 +327,8 @@ void layoutHome(void)
 		// DISPLAY : 1 line
 		oledDrawStringCenter(0, _("NEEDS BACKUP!"), FONT_STANDARD);
 	}
+	memcpy(home_cache_screen, oledGetBuffer(), sizeof(home_cache_screen));
+	home_cache_valid = true;
 #if CRYPTOMEM
 	} else {
 		layoutDialog(&bmp_icon_error, NULL, NULL, NULL, "Secure storage zones", "exhausted.", NULL, "Device unusable.", NULL, _("Go to safe-t.io/start"));
@@ -251,7 +336,7 @@ void layoutHome(void)
 #endif
 	oledRefresh();
 	// Reset lock screen timeout
-	system_millis_lock_start = timer_ms();
+	autolockRestart();
 }
 
 void layoutConfirmOutput(const CoinInfo *coin, const TxOutputType *out)
@@ -387,6 +472,31 @@ void layoutVerifyMessage(const uint8_t *msg, uint32_t len)
 		str[0], str[1], str[2], str[3], NULL, NULL);
 }
 
+void layoutMessageDigest(const uint8_t *msg, uint32_t len, bool verified)
+{
+	uint8_t digest[SHA256_DIGEST_LENGTH];
+	char hex[SHA256_DIGEST_LENGTH * 2 + 1];
+	sha256_Raw(msg, len, digest);
+	data2hex(digest, sizeof(digest), hex);
+	const char **str = split_message((const uint8_t *)hex, strlen(hex), 16);
+	layoutDialogSwipe(verified ? &bmp_icon_info : &bmp_icon_question, _("Cancel"), _("Confirm"),
+		// DISPLAY : 1 line
+		_("Message SHA-256:"),
+		str[0], str[1], str[2], str[3], NULL, NULL);
+}
+
+void layoutEntropyStream(uint32_t bytes, uint32_t rate)
+{
+	char str_bytes[24], str_rate[24];
+	bn_format_uint64(bytes, NULL, " bytes", 0, 0, false, str_bytes, sizeof(str_bytes));
+	bn_format_uint64(rate, NULL, " bytes/s", 0, 0, false, str_rate, sizeof(str_rate));
+	layoutDialog(&bmp_icon_info, NULL, NULL, NULL,
+		// DISPLAY : 1 line
+		_("Sending entropy"),
+		str_bytes, str_rate, NULL, NULL, NULL);
+	layoutLast = layoutEntropyStream;
+}
+
 void layoutCipherKeyValue(bool encrypt, const char *key)
 {
 	const char **str = split_message((const uint8_t *)key, strlen(key), 16);
@@ -474,6 +584,65 @@ void layoutResetWord(const char *word, int pass, int word_pos, bool last)
 	oledRefresh();
 }
 
+/*
+ * The QR code view is drawn again for every brightness change and every
+ * switch back from the text view.  Keep the rendered code of the last
+ * address so that only the encoding of a new address pays for qr_encode().
+ */
+static uint8_t qr_cache_screen[OLED_BUFSIZE];
+static char qr_cache_address[130];
+static bool qr_cache_ignorecase;
+
+static void layoutAddressQR(const char *address, uint32_t addrlen, bool ignorecase)
+{
+	bool cacheable = addrlen < sizeof(qr_cache_address);
+	if (cacheable && qr_cache_ignorecase == ignorecase && strcmp(qr_cache_address, address) == 0) {
+		oledSetBuffer(qr_cache_screen);
+		return;
+	}
+
+	static unsigned char bitdata[QR_MAX_BITDATA];
+	char address_upcase[addrlen + 1];
+	if (ignorecase) {
+		for (uint32_t i = 0; i < addrlen + 1; i++) {
+			address_upcase[i] = address[i] >= 'a' && address[i] <= 'z' ?
+				address[i] + 'A' - 'a' : address[i];
+		}
+	}
+	int side = qr_encode(addrlen <= (ignorecase ? 60 : 40) ? QR_LEVEL_M : QR_LEVEL_L, 0,
+						 ignorecase ? address_upcase : address, 0, bitdata);
+
+	oledInvert(0, 0, 63, 63);
+	if (side > 0 && side <= 29) {
+		int offset = 32 - side;
+		for (int i = 0; i < side; i++) {
+			for (int j = 0; j< side; j++) {
+				int a = j * side + i;
+				if (bitdata[a / 8] & (1 << (7 - a % 8))) {
+					oledBox(offset + i * 2, offset + j * 2,
+							offset + 1 + i * 2, offset + 1 + j * 2, false);
+				}
+			}
+		}
+	} else if (side > 0 && side <= 60) {
+		int offset = 32 - (side / 2); 
+		for (int i = 0; i < side; i++) {
+			for (int j = 0; j< side; j++) {
+				int a = j * side + i;
+				if (bitdata[a / 8] & (1 << (7 - a % 8))) {
+					oledClearPixel(offset + i, offset + j);
+				}
+			}
+		}
+	}
+
+	if (cacheable) {
+		memcpy(qr_cache_screen, oledGetBuffer(), sizeof(qr_cache_screen));
+		strlcpy(qr_cache_address, address, sizeof(qr_cache_address));
+		qr_cache_ignorecase = ignorecase;
+	}
+}
+
 void layoutAddress(const char *address, const char *desc, bool qrcode, bool ignorecase, const uint32_t *address_n, size_t address_n_count)
 {
 	if (layoutLast != layoutAddress) {
@@ -485,40 +654,7 @@ void layoutAddress(const char *address, const char *desc, bool qrcode, bool igno
 
 	uint32_t addrlen = strlen(address);
 	if (qrcode) {
-		static unsigned char bitdata[QR_MAX_BITDATA];
-		char address_upcase[addrlen + 1];
-		if (ignorecase) {
-			for (uint32_t i = 0; i < addrlen + 1; i++) {
-				address_upcase[i] = address[i] >= 'a' && address[i] <= 'z' ?
-					address[i] + 'A' - 'a' : address[i];
-			}
-		}
-		int side = qr_encode(addrlen <= (ignorecase ? 60 : 40) ? QR_LEVEL_M : QR_LEVEL_L, 0,
-							 ignorecase ? address_upcase : address, 0, bitdata);
-
-		oledInvert(0, 0, 63, 63);
-		if (side > 0 && side <= 29) {
-			int offset = 32 - side;
-			for (int i = 0; i < side; i++) {
-				for (int j = 0; j< side; j++) {
-					int a = j * side + i;
-					if (bitdata[a / 8] & (1 << (7 - a % 8))) {
-						oledBox(offset + i * 2, offset + j * 2,
-								offset + 1 + i * 2, offset + 1 + j * 2, false);
-					}
-				}
-			}
-		} else if (side > 0 && side <= 60) {
-			int offset = 32 - (side / 2); 
-			for (int i = 0; i < side; i++) {
-				for (int j = 0; j< side; j++) {
-					int a = j * side + i;
-					if (bitdata[a / 8] & (1 << (7 - a % 8))) {
-						oledClearPixel(offset + i, offset + j);
-					}
-				}
-			}
-		}
+		layoutAddressQR(address, addrlen, ignorecase);
 	} else {
 		uint32_t rowlen = (addrlen - 1) / (addrlen <= 42 ? 2 : addrlen <= 63 ? 3 : 4) + 1;
 		const char **str = split_message((const uint8_t *)address, addrlen, rowlen);
@@ -680,6 +816,8 @@ void layoutU2FDialog(const char *verb, const char *appname, const BITMAP *appico
 	layoutDialog(appicon, NULL, verb, NULL, verb, _("U2F security key?"), NULL, appname, NULL, NULL);
 }
 
+#if USE_NEM
+
 void layoutNEMDialog(const BITMAP *icon, const char *btnNo, const char *btnYes, const char *desc, const char *line1, const char *address) {
 	static char first_third[NEM_ADDRESS_SIZE / 3 + 1];
 	strlcpy(first_third, address, sizeof(first_third));
@@ -881,6 +1019,8 @@ void layoutNEMLevy(const NEMMosaicDefinition *definition, uint8_t network) {
 	}
 }
 
+#endif
+
 static inline bool is_slip18(const uint32_t *address_n, size_t address_n_count)
 {
 	return address_n_count == 2 && address_n[0] == (0x80000000 + 10018) && (address_n[1] & 0x80000000) && (address_n[1] & 0x7FFFFFFF) <= 9;
@@ -923,25 +1063,40 @@ void layoutCosiCommitSign(const uint32_t *address_n, size_t address_n_count, con
 		str[0], str[1], str[2], str[3], NULL, NULL);
 }
 
-void layoutDialogSplit(const BITMAP *icon, const char *btnNo, const char *btnYes, const char *desc, const char *string) {
-    int lineIndex = 0;
+/* Text last wrapped by layoutDialogSplit and its lines.  Dialogs are
+ * redrawn with the same text after button presses and while waiting,
+ * those redraws reuse the line breaks instead of measuring again.
+ */
+static CONFIDENTIAL char splitText[LINES_ON_SCREEN * MAX_LENGTH_LINE];
+static CONFIDENTIAL char splitLines[LINES_ON_SCREEN][MAX_LENGTH_LINE];
+static bool splitCached;
+
+static void split_append(char *line, const char *src, int n)
+{
+	int room = MAX_LENGTH_LINE - 1 - (int) strlen(line);
+	strncat(line, src, MIN(n, room));
+}
+
+static void split_lines(const char *string, int len)
+{
+	int lineIndex = 0;
 	int wordPixelLen = 0;
 	int linePixelLen = 0;
 	int start = 0;
-	char lines[LINES_ON_SCREEN][MAX_LENGTH_LINE] = {{0}};
 
-	for(int i = 0; i < (int) strlen(string); i++)
+	memset(splitLines, 0, sizeof(splitLines));
+	for (int i = 0; i < len; i++)
 	{
 		wordPixelLen += fontCharWidth(FONT_STANDARD & 0x7f, string[i]) + 1;
 		if (string[i+1] == ' ' || string[i+1] == '\0' || string[i+1] == '\n') {
 			if(linePixelLen + wordPixelLen <= PIXEL_LINE_WIDTH) {
 				linePixelLen += wordPixelLen;
-				strncat(lines[lineIndex], &string[start], (int) (strlen(&string[start]) - strlen(&string[i+1])));
+				split_append(splitLines[lineIndex], &string[start], i + 1 - start);
 				start = i + 1;
 			} else if (lineIndex < LINES_ON_SCREEN - 1) {
 				lineIndex++;
 				linePixelLen = wordPixelLen;
-				strncat(lines[lineIndex], &string[start + 1], (int) (strlen(&string[start + 1]) - strlen(&string[i+1])));
+				split_append(splitLines[lineIndex], &string[start + 1], i - start);
 				start = i + 1;
 			}
 			wordPixelLen = 0;
@@ -951,7 +1106,18 @@ void layoutDialogSplit(const BITMAP *icon, const char *btnNo, const char *btnYes
 			}
 		}
 	}
-	layoutDialogSwipe(icon, btnNo, btnYes, desc, lines[0], lines[1], lines[2], lines[3], lines[4], lines[5]);
+}
+
+void layoutDialogSplit(const BITMAP *icon, const char *btnNo, const char *btnYes, const char *desc, const char *string) {
+	size_t len = strlen(string);
+	if (!splitCached || len >= sizeof(splitText) || strcmp(string, splitText) != 0) {
+		split_lines(string, (int) len);
+		splitCached = len < sizeof(splitText);
+		if (splitCached) {
+			memcpy(splitText, string, len + 1);
+		}
+	}
+	layoutDialogSwipe(icon, btnNo, btnYes, desc, splitLines[0], splitLines[1], splitLines[2], splitLines[3], splitLines[4], splitLines[5]);
 }
 
 void layoutDialogSplitFormat(const BITMAP *icon, const char *btnNo, const char *btnYes, const char *desc, const char *format, ...) {
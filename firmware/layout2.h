@@ -43,9 +43,13 @@ void layoutDialogSplit(const BITMAP *icon, const char *btnNo, const char *btnYes
 void layoutDialogSplitFormat(const BITMAP *icon, const char *btnNo, const char *btnYes, const char *desc, const char *format, ...);
 
 void layoutProgressSwipe(const char *desc, int permil);
+void layoutProgressSet(const char *desc, int permil);
+void layoutProgressTick(void);
+void layoutProgressFlush(void);
 
 void layoutScreensaver(void);
 void layoutHome(void);
+void layoutHomeInvalidate(void);
 void layoutConfirmOutput(const CoinInfo *coin, const TxOutputType *out);
 void layoutConfirmOpReturn(const uint8_t *data, uint32_t size);
 void layoutConfirmTx(const CoinInfo *coin, uint64_t amount_out, uint64_t amount_fee);
@@ -53,6 +57,10 @@ void layoutFeeOverThreshold(const CoinInfo *coin, uint64_t fee);
 void layoutSignMessage(const uint8_t *msg, uint32_t len);
 void layoutVerifyAddress(const char *address);
 void layoutVerifyMessage(const uint8_t *msg, uint32_t len);
+// longer messages do not fit on the screens above, confirm their digest as well
+#define LAYOUT_MESSAGE_MAXLEN (4 * 16)
+void layoutMessageDigest(const uint8_t *msg, uint32_t len, bool verified);
+void layoutEntropyStream(uint32_t bytes, uint32_t rate);
 void layoutCipherKeyValue(bool encrypt, const char *key);
 void layoutEncryptMessage(const uint8_t *msg, uint32_t len, bool signing);
 void layoutDecryptMessage(const uint8_t *msg, uint32_t len, const char *address);
@@ -63,6 +71,7 @@ void layoutSignIdentity(const IdentityType *identity, const char *challenge);
 void layoutDecryptIdentity(const IdentityType *identity);
 void layoutU2FDialog(const char *verb, const char *appname, const BITMAP *appicon);
 
+#if USE_NEM
 void layoutNEMDialog(const BITMAP *icon, const char *btnNo, const char *btnYes, const char *desc, const char *line1, const char *address);
 void layoutNEMTransferXEM(const char *desc, uint64_t quantity, const bignum256 *multiplier, uint64_t fee);
 void layoutNEMNetworkFee(const char *desc, bool confirm, const char *fee1_desc, uint64_t fee1, const char *fee2_desc, uint64_t fee2);
@@ -71,6 +80,7 @@ void layoutNEMTransferUnknownMosaic(const char *namespace, const char *mosaic, u
 void layoutNEMTransferPayload(const uint8_t *payload, size_t length, bool encrypted);
 void layoutNEMMosaicDescription(const char *description);
 void layoutNEMLevy(const NEMMosaicDefinition *definition, uint8_t network);
+#endif
 
 void layoutCosiCommitSign(const uint32_t *address_n, size_t address_n_count, const uint8_t *data, uint32_t len, bool final_sign);
 
@@ -23,8 +23,17 @@
 #include "messages.h"
 #include "debug.h"
 #include "fsm.h"
+#if USE_ETHEREUM
+#include "ethereum.h"
+#endif
 #include "util.h"
 #include "gettext.h"
+#include "usb.h"
+#include "timer.h"
+#include "memzero.h"
+#include "profile.h"
+#include "stats.h"
+#include "crypto.h"
 
 #include "pb_decode.h"
 #include "pb_encode.h"
@@ -35,44 +44,90 @@ struct MessagesMap_t {
 	char dir; 	// i = in, o = out
 	uint16_t msg_id;
 	const pb_field_t *fields;
+	uint32_t size;
 	void (*process_func)(void *ptr);
 };
 
 static const struct MessagesMap_t MessagesMap[] = {
 #include "messages_map.h"
 	// end
-	{0, 0, 0, 0, 0}
+	{0, 0, 0, 0, 0, 0}
 };
 
-const pb_field_t *MessageFields(char type, char dir, uint16_t msg_id)
+#include "messages_map_index.h"
+
+// constant time lookup through the generated MessagesIndex_* tables
+static const struct MessagesMap_t *MessageEntry(char type, char dir, uint16_t msg_id)
 {
-	const struct MessagesMap_t *m = MessagesMap;
-	while (m->type) {
-		if (type == m->type && dir == m->dir && msg_id == m->msg_id) {
-			return m->fields;
-		}
-		m++;
+	const uint8_t *index;
+	size_t count;
+	if (type == 'n' && dir == 'i') {
+		index = MessagesIndex_ni;
+		count = sizeof(MessagesIndex_ni);
+	} else
+	if (type == 'n' && dir == 'o') {
+		index = MessagesIndex_no;
+		count = sizeof(MessagesIndex_no);
+	} else
+#if DEBUG_LINK
+	if (type == 'd' && dir == 'i') {
+		index = MessagesIndex_di;
+		count = sizeof(MessagesIndex_di);
+	} else
+	if (type == 'd' && dir == 'o') {
+		index = MessagesIndex_do;
+		count = sizeof(MessagesIndex_do);
+	} else
+#endif
+	{
+		return 0;
+	}
+	if (msg_id >= count || index[msg_id] == 0) {
+		return 0;
 	}
-	return 0;
+	return &MessagesMap[index[msg_id] - 1];
+}
+
+const pb_field_t *MessageFields(char type, char dir, uint16_t msg_id)
+{
+	const struct MessagesMap_t *m = MessageEntry(type, dir, msg_id);
+	return m ? m->fields : 0;
 }
 
 void MessageProcessFunc(char type, char dir, uint16_t msg_id, void *ptr)
 {
-	const struct MessagesMap_t *m = MessagesMap;
-	while (m->type) {
-		if (type == m->type && dir == m->dir && msg_id == m->msg_id) {
-			m->process_func(ptr);
-			return;
-		}
-		m++;
+	const struct MessagesMap_t *m = MessageEntry(type, dir, msg_id);
+	if (m && m->process_func) {
+		m->process_func(ptr);
 	}
 }
 
+#define MSG_OUT_FRAMES (MSG_OUT_SIZE / 64)
+
 static uint32_t msg_out_start = 0;
 static uint32_t msg_out_end = 0;
 static uint32_t msg_out_cur = 0;
 static uint8_t msg_out[MSG_OUT_SIZE];
 
+/*
+ * Responses are encoded in a single pass: the header goes out with a zero
+ * length that is patched once the encoder is done.  Until then the frames
+ * of the response are held back from the host, msg_out_ready marks the end
+ * of the frames that may be sent.  A response that does not fit into the
+ * free part of the ring is measured with a sizing pass instead, so that
+ * its frames can be handed out while it is still being encoded.
+ */
+static uint32_t msg_out_ready = 0;
+static uint32_t msg_out_header = 0;
+static bool msg_out_sized = true;
+static const pb_field_t *msg_out_fields;
+static const void *msg_out_ptr;
+
+static struct msgOutStats msg_out_stat;
+static bool msg_out_draining = false;
+static bool msg_out_stalled = false;
+static bool msg_out_truncated = false;	// a frame of this response was dropped
+
 #if DEBUG_LINK
 
 static uint32_t msg_debug_out_start = 0;
@@ -82,22 +137,93 @@ static uint8_t msg_debug_out[MSG_DEBUG_OUT_SIZE];
 
 #endif
 
-static inline void msg_out_append(uint8_t c)
+const struct msgOutStats *msg_out_stats(void)
+{
+	return &msg_out_stat;
+}
+
+/*
+ * The ring is full: let the host pick up frames before the encoder
+ * continues.  Only tiny messages are accepted meanwhile so that no new
+ * request is dispatched while a response is half written.
+ */
+static bool msg_out_wait(uint32_t next)
 {
-	if (msg_out_cur == 0) {
-		msg_out[msg_out_end * 64] = '?';
-		msg_out_cur = 1;
+	if (msg_out_stalled) {
+		return false;
 	}
-	msg_out[msg_out_end * 64 + msg_out_cur] = c;
-	msg_out_cur++;
-	if (msg_out_cur == 64) {
-		msg_out_cur = 0;
-		msg_out_end = (msg_out_end + 1) % (MSG_OUT_SIZE / 64);
+	msg_out_stat.stalls++;
+	msg_out_draining = true;
+	char oldTiny = usbTiny(1);
+	uint32_t deadline = timer_ms() + MSG_OUT_STALL_TIMEOUT;
+	while (msg_out_start == next && !timer_expired(deadline)) {
+		usbPoll();
+	}
+	usbTiny(oldTiny);
+	msg_out_draining = false;
+	if (msg_out_start == next) {
+		// host is not reading, do not wait again until the next message
+		msg_out_stalled = true;
+		return false;
+	}
+	return true;
+}
+
+static void msg_out_set_length(uint32_t len)
+{
+	uint8_t *header = msg_out + msg_out_header * 64;
+	header[5] = (len >> 24) & 0xFF;
+	header[6] = (len >> 16) & 0xFF;
+	header[7] = (len >> 8) & 0xFF;
+	header[8] = len & 0xFF;
+	msg_out_sized = true;
+}
+
+static void msg_out_commit(void)
+{
+	msg_out_cur = 0;
+	if (msg_out_truncated) {
+		// the rest of a truncated response would only corrupt the stream
+		msg_out_stat.dropped++;
+		return;
+	}
+	uint32_t next = (msg_out_end + 1) % MSG_OUT_FRAMES;
+	if (next == msg_out_start && !msg_out_sized && msg_out_ready == msg_out_start) {
+		// the ring holds only this response, the host cannot drain it unseen
+		pb_ostream_t sizestream = {0, 0, SIZE_MAX, 0, 0};
+		pb_encode(&sizestream, msg_out_fields, msg_out_ptr);
+		msg_out_set_length(sizestream.bytes_written);
+		msg_out_ready = msg_out_end;
+	}
+	if (next == msg_out_start && !msg_out_wait(next)) {
+		// drop the frame, never overwrite frames that were not sent yet
+		msg_out_stat.dropped++;
+		msg_out_truncated = true;
+		return;
+	}
+	msg_out_end = next;
+	if (msg_out_sized) {
+		msg_out_ready = msg_out_end;
+	}
+	uint32_t queued = (msg_out_end + MSG_OUT_FRAMES - msg_out_start) % MSG_OUT_FRAMES;
+	if (queued > msg_out_stat.highwater) {
+		msg_out_stat.highwater = queued;
 	}
 }
 
 #if DEBUG_LINK
 
+// the debug link is not flow controlled, a full ring drops the newest frame
+static void msg_debug_out_commit(void)
+{
+	msg_debug_out_cur = 0;
+	uint32_t next = (msg_debug_out_end + 1) % (MSG_DEBUG_OUT_SIZE / 64);
+	if (next == msg_debug_out_start) {
+		return;
+	}
+	msg_debug_out_end = next;
+}
+
 static inline void msg_debug_out_append(uint8_t c)
 {
 	if (msg_debug_out_cur == 0) {
@@ -107,8 +233,7 @@ static inline void msg_debug_out_append(uint8_t c)
 	msg_debug_out[msg_debug_out_end * 64 + msg_debug_out_cur] = c;
 	msg_debug_out_cur++;
 	if (msg_debug_out_cur == 64) {
-		msg_debug_out_cur = 0;
-		msg_debug_out_end = (msg_debug_out_end + 1) % (MSG_DEBUG_OUT_SIZE / 64);
+		msg_debug_out_commit();
 	}
 }
 
@@ -121,8 +246,7 @@ static inline void msg_out_pad(void)
 		msg_out[msg_out_end * 64 + msg_out_cur] = 0;
 		msg_out_cur++;
 	}
-	msg_out_cur = 0;
-	msg_out_end = (msg_out_end + 1) % (MSG_OUT_SIZE / 64);
+	msg_out_commit();
 }
 
 #if DEBUG_LINK
@@ -134,8 +258,7 @@ static inline void msg_debug_out_pad(void)
 		msg_debug_out[msg_debug_out_end * 64 + msg_debug_out_cur] = 0;
 		msg_debug_out_cur++;
 	}
-	msg_debug_out_cur = 0;
-	msg_debug_out_end = (msg_debug_out_end + 1) % (MSG_DEBUG_OUT_SIZE / 64);
+	msg_debug_out_commit();
 }
 
 #endif
@@ -143,8 +266,19 @@ static inline void msg_debug_out_pad(void)
 static bool pb_callback_out(pb_ostream_t *stream, const uint8_t *buf, size_t count)
 {
 	(void)stream;
-	for (size_t i = 0; i < count; i++) {
-		msg_out_append(buf[i]);
+	while (count > 0) {
+		if (msg_out_cur == 0) {
+			msg_out[msg_out_end * 64] = '?';
+			msg_out_cur = 1;
+		}
+		size_t n = MIN(count, 64 - msg_out_cur);
+		memcpy(msg_out + msg_out_end * 64 + msg_out_cur, buf, n);
+		msg_out_cur += n;
+		buf += n;
+		count -= n;
+		if (msg_out_cur == 64) {
+			msg_out_commit();
+		}
 	}
 	return true;
 }
@@ -162,132 +296,284 @@ static bool pb_debug_callback_out(pb_ostream_t *stream, const uint8_t *buf, size
 
 #endif
 
-bool msg_write_common(char type, uint16_t msg_id, const void *msg_ptr)
+static bool msg_write_normal(uint16_t msg_id, const pb_field_t *fields, const void *msg_ptr)
 {
-	const pb_field_t *fields = MessageFields(type, 'o', msg_id);
-	if (!fields) { // unknown message
+	if (msg_out_draining) { // no replies while a response is half written
+		return false;
+	}
+	msg_out_stalled = false;
+	msg_out_truncated = false;
+
+	msg_out_header = msg_out_end;
+	msg_out_sized = false;
+	msg_out_fields = fields;
+	msg_out_ptr = msg_ptr;
+	const uint8_t header[8] = { '#', '#', (msg_id >> 8) & 0xFF, msg_id & 0xFF, 0, 0, 0, 0 };
+	pb_ostream_t stream = {pb_callback_out, 0, SIZE_MAX, 0, 0};
+	pb_callback_out(&stream, header, sizeof(header));
+	bool status = pb_encode(&stream, fields, msg_ptr);
+	if (msg_out_truncated) {
+		msg_out_cur = 0;
+		if (!msg_out_sized) {
+			// none of its frames were handed out, take them back
+			msg_out_end = msg_out_header;
+			msg_out_sized = true;
+		}
+		msg_out_ready = msg_out_end;
 		return false;
 	}
+	if (!msg_out_sized) {
+		if (!status) {
+			// nothing was handed out yet, drop the partial response
+			msg_out_end = msg_out_header;
+			msg_out_cur = 0;
+			msg_out_sized = true;
+			return false;
+		}
+		msg_out_set_length(stream.bytes_written);
+	}
+	msg_out_pad();
+	msg_out_ready = msg_out_end;
+	return status;
+}
 
-	pb_ostream_t sizestream = {0, 0, SIZE_MAX, 0, 0};
-	bool status = pb_encode(&sizestream, fields, msg_ptr);
+#if DEBUG_LINK
 
-	if (!status) {
+static bool msg_write_debug(uint16_t msg_id, const pb_field_t *fields, const void *msg_ptr)
+{
+	pb_ostream_t sizestream = {0, 0, SIZE_MAX, 0, 0};
+	if (!pb_encode(&sizestream, fields, msg_ptr)) {
 		return false;
 	}
 
-	void (*append)(uint8_t);
-	bool (*pb_callback)(pb_ostream_t *, const uint8_t *, size_t);
+	uint32_t len = sizestream.bytes_written;
+	msg_debug_out_append('#');
+	msg_debug_out_append('#');
+	msg_debug_out_append((msg_id >> 8) & 0xFF);
+	msg_debug_out_append(msg_id & 0xFF);
+	msg_debug_out_append((len >> 24) & 0xFF);
+	msg_debug_out_append((len >> 16) & 0xFF);
+	msg_debug_out_append((len >> 8) & 0xFF);
+	msg_debug_out_append(len & 0xFF);
+	pb_ostream_t stream = {pb_debug_callback_out, 0, SIZE_MAX, 0, 0};
+	bool status = pb_encode(&stream, fields, msg_ptr);
+	msg_debug_out_pad();
+	return status;
+}
 
-	if (type == 'n') {
-		append = msg_out_append;
-		pb_callback = pb_callback_out;
-	} else
-#if DEBUG_LINK
-	if (type == 'd') {
-		append = msg_debug_out_append;
-		pb_callback = pb_debug_callback_out;
-	} else
 #endif
-	{
+
+bool msg_write_common(char type, uint16_t msg_id, const void *msg_ptr)
+{
+	const pb_field_t *fields = MessageFields(type, 'o', msg_id);
+	if (!fields) { // unknown message
 		return false;
 	}
 
-	uint32_t len = sizestream.bytes_written;
-	append('#');
-	append('#');
-	append((msg_id >> 8) & 0xFF);
-	append(msg_id & 0xFF);
-	append((len >> 24) & 0xFF);
-	append((len >> 16) & 0xFF);
-	append((len >> 8) & 0xFF);
-	append(len & 0xFF);
-	pb_ostream_t stream = {pb_callback, 0, SIZE_MAX, 0, 0};
-	status = pb_encode(&stream, fields, msg_ptr);
 	if (type == 'n') {
-		msg_out_pad();
+		return msg_write_normal(msg_id, fields, msg_ptr);
 	}
 #if DEBUG_LINK
-	else if (type == 'd') {
-		msg_debug_out_pad();
+	if (type == 'd') {
+		return msg_write_debug(msg_id, fields, msg_ptr);
 	}
 #endif
-	return status;
+	return false;
 }
 
 enum {
 	READSTATE_IDLE,
-	READSTATE_READING,
+	READSTATE_STREAMING,
+	READSTATE_SKIPPING,
 };
 
-void msg_process(char type, uint16_t msg_id, const pb_field_t *fields, uint8_t *msg_raw, uint32_t msg_size)
+/*
+ * Incoming messages are decoded while their frames arrive: the first frame
+ * starts pb_decode() and the input stream pulls every further frame from
+ * the endpoint by pumping usbPoll().  Only the current 64 byte frame is
+ * buffered, the raw message is never assembled in RAM.  usbPoll() hands
+ * packets on only after the USB stack has returned, so the decoder does
+ * not run inside it.  Frames of the other interface that arrive meanwhile
+ * are read as tiny messages, see msg_read_frame().
+ */
+static char msg_in_type;
+static CONFIDENTIAL uint8_t msg_in_frame[64];
+static uint32_t msg_in_frame_pos;
+static uint32_t msg_in_frames;
+static bool msg_in_waiting = false;
+static bool msg_in_busy = false;		// a message is decoded or processed
+static bool msg_in_ready = false;
+
+static bool pb_callback_in(pb_istream_t *stream, uint8_t *buf, size_t count)
+{
+	(void)stream;
+	while (count > 0) {
+		if (msg_in_frame_pos == 64) {
+			msg_in_ready = false;
+			msg_in_waiting = true;
+			uint32_t deadline = timer_ms() + MSG_IN_FRAME_TIMEOUT;
+			while (!msg_in_ready && !timer_expired(deadline)) {
+				usbPoll();
+			}
+			msg_in_waiting = false;
+			if (!msg_in_ready || msg_in_frame[0] != '?') { // timeout or invalid contents
+				return false;
+			}
+			msg_in_frames++;
+			msg_in_frame_pos = 1;
+		}
+		size_t n = MIN(count, 64 - msg_in_frame_pos);
+		if (buf) {
+			memcpy(buf, msg_in_frame + msg_in_frame_pos, n);
+			buf += n;
+		}
+		msg_in_frame_pos += n;
+		count -= n;
+	}
+	return true;
+}
+
+/*
+ * All messages are decoded into msg_data, which is as large as the largest
+ * of them (union MessagesIn, generated with the map).  Only the part used
+ * by the previous message is cleared, the rest of the buffer is still
+ * zero; pb_decode() sets every field of the new message to its default
+ * anyway.
+ */
+static void msg_process(char type, uint16_t msg_id, const struct MessagesMap_t *m, uint32_t msg_size)
 {
-	static CONFIDENTIAL uint8_t msg_data[MSG_IN_SIZE];
-	memset(msg_data, 0, sizeof(msg_data));
-	pb_istream_t stream = pb_istream_from_buffer(msg_raw, msg_size);
-	bool status = pb_decode(&stream, fields, msg_data);
+	static CONFIDENTIAL union MessagesIn msg_in_data;
+	uint8_t *msg_data = (uint8_t *)&msg_in_data;
+	static uint32_t msg_data_used = 0;
+	uint32_t start_ms = timer_ms();
+	profileStackStart();
+	// an abort from before this request does not apply to it
+	msg_abort_id = 0xFFFF;
+	memzero(msg_data, msg_data_used);
+	msg_data_used = m->size;
+#if USE_ETHEREUM
+	// the data chunk is hashed while it is decoded
+	if (type == 'n' && msg_id == MessageType_MessageType_EthereumTxAck) {
+		ethereum_signing_txack_prepare((EthereumTxAck *)msg_data);
+	}
+#endif
+	pb_istream_t stream = {pb_callback_in, 0, msg_size, 0};
+	bool status = pb_decode(&stream, m->fields, msg_data);
+	memzero(msg_in_frame, sizeof(msg_in_frame));
 	if (status) {
+		// a CipherKeyValue batch ends with any other message
+		if (type == 'n' && msg_id != MessageType_MessageType_CipherKeyValue) {
+			cryptoCipherSessionClear();
+		}
 		MessageProcessFunc(type, 'i', msg_id, msg_data);
 	} else {
 		fsm_sendFailure(FailureType_Failure_DataError, stream.errmsg);
+#if USE_ETHEREUM
+		// part of the data chunk may be hashed already, the hash is lost
+		if (type == 'n' && msg_id == MessageType_MessageType_EthereumTxAck) {
+			ethereum_signing_abort();
+		}
+#endif
 	}
+	profileStackEnd(msg_id);
+	statsMessage(msg_id, start_ms);
 }
 
-void msg_read_common(char type, const uint8_t *buf, int len)
-{
-	static char read_state = READSTATE_IDLE;
-	static CONFIDENTIAL uint8_t msg_in[MSG_IN_SIZE];
-	static uint16_t msg_id = 0xFFFF;
-	static uint32_t msg_size = 0;
-	static uint32_t msg_pos = 0;
-	static const pb_field_t *fields = 0;
+// read state of each interface, normal and debug messages are framed apart
+static struct {
+	char state;
+	uint32_t skip_frames;
+} msg_in_if[2];
 
+static void msg_read_frame(char type, const uint8_t *buf, int len)
+{
 	if (len != 64) return;
 
-	if (read_state == READSTATE_IDLE) {
-		if (buf[0] != '?' || buf[1] != '#' || buf[2] != '#') {	// invalid start - discard
-			return;
-		}
-		msg_id = (buf[3] << 8) + buf[4];
-		msg_size = ((uint32_t) buf[5] << 24)+ (buf[6] << 16) + (buf[7] << 8) + buf[8];
+	if (msg_in_busy && type != msg_in_type) {
+		// msg_data holds the message of the other interface, only tiny
+		// messages can be taken from this one now
+		msg_read_tiny(buf, len);
+		return;
+	}
 
-		fields = MessageFields(type, 'i', msg_id);
-		if (!fields) { // unknown message
-			fsm_sendFailure(FailureType_Failure_UnexpectedMessage, _("Unknown message"));
-			return;
+	char *read_state = &msg_in_if[type == 'd'].state;
+	uint32_t *skip_frames = &msg_in_if[type == 'd'].skip_frames;
+
+	if (*read_state == READSTATE_STREAMING) {
+		// next frame of the message being decoded
+		if (msg_in_waiting) {
+			memcpy(msg_in_frame, buf, 64);
+			msg_in_ready = true;
 		}
-		if (msg_size > MSG_IN_SIZE) { // message is too big :(
-			fsm_sendFailure(FailureType_Failure_DataError, _("Message too big"));
+		return;
+	}
+
+	if (*read_state == READSTATE_SKIPPING) {
+		// rest of a message the decoder did not consume
+		if (buf[0] == '?' && buf[1] == '#' && buf[2] == '#') {
+			*read_state = READSTATE_IDLE;
+		} else {
+			if (buf[0] != '?' || --*skip_frames == 0) {
+				*read_state = READSTATE_IDLE;
+			}
 			return;
 		}
+	}
 
-		read_state = READSTATE_READING;
+	if (buf[0] != '?' || buf[1] != '#' || buf[2] != '#') {	// invalid start - discard
+		return;
+	}
+	uint16_t msg_id = (buf[3] << 8) + buf[4];
+	uint32_t msg_size = ((uint32_t) buf[5] << 24)+ (buf[6] << 16) + (buf[7] << 8) + buf[8];
 
-		memcpy(msg_in, buf + 9, len - 9);
-		msg_pos = len - 9;
-	} else
-	if (read_state == READSTATE_READING) {
-		if (buf[0] != '?') {	// invalid contents
-			read_state = READSTATE_IDLE;
-			return;
+	const struct MessagesMap_t *m = MessageEntry(type, 'i', msg_id);
+	if (!m || !m->process_func) { // unknown message, or not in this build
+		fsm_sendFailure(FailureType_Failure_UnexpectedMessage, _("Unknown message"));
+		return;
+	}
+
+	// frames needed for the whole message: 55 payload bytes in the first, 63 in the others
+	uint32_t total_frames = msg_size <= 55 ? 1 : 1 + (msg_size - 55 + 62) / 63;
+
+	if (msg_size > MSG_IN_SIZE) { // message is too big :(
+		fsm_sendFailure(FailureType_Failure_DataError, _("Message too big"));
+		if (total_frames > 1) {
+			*skip_frames = total_frames - 1;
+			*read_state = READSTATE_SKIPPING;
 		}
-		memcpy(msg_in + msg_pos, buf + 1, len - 1);
-		msg_pos += len - 1;
+		return;
 	}
 
-	if (msg_pos >= msg_size) {
-		msg_process(type, msg_id, fields, msg_in, msg_size);
-		msg_pos = 0;
-		read_state = READSTATE_IDLE;
+	*read_state = READSTATE_STREAMING;
+	msg_in_type = type;
+	memcpy(msg_in_frame, buf, 64);
+	msg_in_frame_pos = 9;
+	msg_in_frames = 1;
+
+	msg_in_busy = true;
+	msg_process(type, msg_id, m, msg_size);
+	msg_in_busy = false;
+
+	if (msg_in_frames < total_frames) {
+		*skip_frames = total_frames - msg_in_frames;
+		*read_state = READSTATE_SKIPPING;
+	} else {
+		*read_state = READSTATE_IDLE;
 	}
 }
 
+void msg_read_common(char type, const uint8_t *buf, int len)
+{
+	uint32_t start = profileStart();
+	msg_read_frame(type, buf, len);
+	profileEnd(PROFILE_MSG_READ, start);
+}
+
 const uint8_t *msg_out_data(void)
 {
-	if (msg_out_start == msg_out_end) return 0;
+	if (msg_out_start == msg_out_ready) return 0;
 	uint8_t *data = msg_out + (msg_out_start * 64);
-	msg_out_start = (msg_out_start + 1) % (MSG_OUT_SIZE / 64);
-	debugLog(0, "", "msg_out_data");
+	msg_out_start = (msg_out_start + 1) % MSG_OUT_FRAMES;
 	return data;
 }
 
@@ -298,7 +584,6 @@ const uint8_t *msg_debug_out_data(void)
 	if (msg_debug_out_start == msg_debug_out_end) return 0;
 	uint8_t *data = msg_debug_out + (msg_debug_out_start * 64);
 	msg_debug_out_start = (msg_debug_out_start + 1) % (MSG_DEBUG_OUT_SIZE / 64);
-	debugLog(0, "", "msg_debug_out_data");
 	return data;
 }
 
@@ -316,6 +601,13 @@ _Static_assert(sizeof(msg_tiny) >= sizeof(DebugLinkGetState), "msg_tiny too tiny
 #endif
 uint16_t msg_tiny_id = 0xFFFF;
 
+/*
+ * Cancel or Initialize seen in tiny mode, taken from the frame header
+ * before anything is decoded.  Unlike msg_tiny_id it is not overwritten
+ * by a later tiny message, see protectAbortRequested().
+ */
+volatile uint16_t msg_abort_id = 0xFFFF;
+
 void msg_read_tiny(const uint8_t *buf, int len)
 {
 	if (len != 64) return;
@@ -323,6 +615,9 @@ void msg_read_tiny(const uint8_t *buf, int len)
 		return;
 	}
 	uint16_t msg_id = (buf[3] << 8) + buf[4];
+	if (msg_id == MessageType_MessageType_Cancel || msg_id == MessageType_MessageType_Initialize) {
+		msg_abort_id = msg_id;
+	}
 	uint32_t msg_size = ((uint32_t) buf[5] << 24) + (buf[6] << 16) + (buf[7] << 8) + buf[8];
 	if (msg_size > 64 || len - msg_size < 9) {
 		return;
@@ -24,13 +24,28 @@
 #include <stdbool.h>
 #include "trezor.h"
 
+// largest encoded message accepted, messages are decoded while they arrive
+// into a buffer sized for the largest decoded message (see messages.c)
 #define MSG_IN_SIZE (12*1024)
 
+// how long the decoder waits for the next frame of a message
+#define MSG_IN_FRAME_TIMEOUT 1000
+
 #define MSG_OUT_SIZE (12*1024)
 
+// how long the encoder waits for the host to drain a full output ring
+#define MSG_OUT_STALL_TIMEOUT 1000
+
+struct msgOutStats {
+	uint32_t highwater;	// most frames queued at once
+	uint32_t stalls;	// encoder had to wait for the host
+	uint32_t dropped;	// frames dropped after a stall timeout
+};
+
 #define msg_read(buf, len) msg_read_common('n', (buf), (len))
 #define msg_write(id, ptr) msg_write_common('n', (id), (ptr))
 const uint8_t *msg_out_data(void);
+const struct msgOutStats *msg_out_stats(void);
 
 #if DEBUG_LINK
 
@@ -49,5 +64,6 @@ void msg_read_tiny(const uint8_t *buf, int len);
 void msg_debug_read_tiny(const uint8_t *buf, int len);
 extern uint8_t msg_tiny[128];
 extern uint16_t msg_tiny_id;
+extern volatile uint16_t msg_abort_id;
 
 #endif
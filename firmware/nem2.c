@@ -733,9 +733,30 @@ bool nem_fsmMultisig(nem_transaction_ctx *context, const NEMTransactionCommon *c
 	return true;
 }
 
+static int nem_mosaicCompareName(const NEMMosaicDefinition *definition, const char *namespace, const char *mosaic) {
+	int r = strcmp(definition->namespace, namespace);
+	return r ? r : strcmp(definition->mosaic, mosaic);
+}
+
 const NEMMosaicDefinition *nem_mosaicByName(const char *namespace, const char *mosaic, uint8_t network) {
-	for (size_t i = 0; i < NEM_MOSAIC_DEFINITIONS_COUNT; i++) {
-		const NEMMosaicDefinition *definition = &NEM_MOSAIC_DEFINITIONS[i];
+	// Find the first definition with this name
+	size_t lo = 0, hi = NEM_MOSAIC_DEFINITIONS_COUNT;
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		if (nem_mosaicCompareName(&NEM_MOSAIC_DEFINITIONS[NEM_MOSAIC_DEFINITIONS_BY_NAME[mid]], namespace, mosaic) < 0) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+
+	// Definitions with the same name only differ by network
+	for (size_t i = lo; i < NEM_MOSAIC_DEFINITIONS_COUNT; i++) {
+		const NEMMosaicDefinition *definition = &NEM_MOSAIC_DEFINITIONS[NEM_MOSAIC_DEFINITIONS_BY_NAME[i]];
+
+		if (nem_mosaicCompareName(definition, namespace, mosaic) != 0) {
+			break;
+		}
 
 		if (nem_mosaicMatches(definition, namespace, mosaic, network)) {
 			return definition;
@@ -764,56 +785,78 @@ static inline size_t format_amount(const NEMMosaicDefinition *definition, const
 		size);
 }
 
+#define NEM_MAX_MOSAICS (sizeof(((NEMTransfer *) NULL)->mosaics) / sizeof(NEMMosaic))
+
 size_t nem_canonicalizeMosaics(NEMMosaic *mosaics, size_t mosaics_count) {
 	if (mosaics_count <= 1) {
 		return mosaics_count;
 	}
 
-	size_t actual_count = 0;
+	if (mosaics_count > NEM_MAX_MOSAICS) {
+		mosaics_count = NEM_MAX_MOSAICS;
+	}
 
-	bool skip[mosaics_count];
-	memset(skip, 0, sizeof(skip));
+	uint8_t order[NEM_MAX_MOSAICS];
+	uint8_t merged[NEM_MAX_MOSAICS];
 
-	// Merge duplicates
 	for (size_t i = 0; i < mosaics_count; i++) {
-		if (skip[i]) continue;
-
-		NEMMosaic *mosaic = &mosaics[actual_count];
-
-		if (actual_count++ != i) {
-			memcpy(mosaic, &mosaics[i], sizeof(NEMMosaic));
+		order[i] = i;
+	}
+
+	// Sort indices (bottom-up merge sort)
+	for (size_t width = 1; width < mosaics_count; width *= 2) {
+		for (size_t lo = 0; lo < mosaics_count; lo += 2 * width) {
+			size_t mid = lo + width < mosaics_count ? lo + width : mosaics_count;
+			size_t hi = lo + 2 * width < mosaics_count ? lo + 2 * width : mosaics_count;
+			size_t i = lo, j = mid, k = lo;
+
+			while (i < mid && j < hi) {
+				if (nem_mosaicCompare(&mosaics[order[j]], &mosaics[order[i]]) < 0) {
+					merged[k++] = order[j++];
+				} else {
+					merged[k++] = order[i++];
+				}
+			}
+			while (i < mid) merged[k++] = order[i++];
+			while (j < hi) merged[k++] = order[j++];
 		}
+		memcpy(order, merged, mosaics_count);
+	}
 
-		for (size_t j = i + 1; j < mosaics_count; j++) {
-			if (skip[j]) continue;
+	NEMMosaic temp;
 
-			const NEMMosaic *new_mosaic = &mosaics[j];
+	// Move mosaics into sorted order, one cycle of the permutation at a time
+	for (size_t i = 0; i < mosaics_count; i++) {
+		if (order[i] == i) continue;
 
-			if (nem_mosaicCompare(mosaic, new_mosaic) == 0) {
-				skip[j] = true;
-				mosaic->quantity += new_mosaic->quantity;
-			}
+		memcpy(&temp, &mosaics[i], sizeof(NEMMosaic));
+
+		size_t j = i;
+		while (order[j] != i) {
+			size_t k = order[j];
+			memcpy(&mosaics[j], &mosaics[k], sizeof(NEMMosaic));
+			order[j] = j;
+			j = k;
 		}
-	}
 
-	NEMMosaic temp;
+		memcpy(&mosaics[j], &temp, sizeof(NEMMosaic));
+		order[j] = j;
+	}
 
-	// Sort mosaics
-	for (size_t i = 0; i < actual_count - 1; i++) {
-		NEMMosaic *a = &mosaics[i];
+	// Merge duplicates, which are now adjacent
+	size_t actual_count = 0;
 
-		for (size_t j = i + 1; j < actual_count; j++) {
-			NEMMosaic *b = &mosaics[j];
+	for (size_t i = 1; i < mosaics_count; i++) {
+		NEMMosaic *mosaic = &mosaics[actual_count];
 
-			if (nem_mosaicCompare(a, b) > 0) {
-				memcpy(&temp, a, sizeof(NEMMosaic));
-				memcpy(a, b, sizeof(NEMMosaic));
-				memcpy(b, &temp, sizeof(NEMMosaic));
-			}
+		if (nem_mosaicCompare(mosaic, &mosaics[i]) == 0) {
+			mosaic->quantity += mosaics[i].quantity;
+		} else if (++actual_count != i) {
+			memcpy(&mosaics[actual_count], &mosaics[i], sizeof(NEMMosaic));
 		}
 	}
 
-	return actual_count;
+	return actual_count + 1;
 }
 
 void nem_mosaicFormatAmount(const NEMMosaicDefinition *definition, uint64_t quantity, const bignum256 *multiplier, char *str_out, size_t size) {
@@ -27,6 +27,9 @@ HEADER_TEMPLATE = """
 extern const NEMMosaicDefinition NEM_MOSAIC_DEFINITIONS[NEM_MOSAIC_DEFINITIONS_COUNT];
 extern const NEMMosaicDefinition *NEM_MOSAIC_DEFINITION_XEM;
 
+// indices into NEM_MOSAIC_DEFINITIONS sorted by (namespace, mosaic)
+extern const uint16_t NEM_MOSAIC_DEFINITIONS_BY_NAME[NEM_MOSAIC_DEFINITIONS_COUNT];
+
 #endif
 """.lstrip()  # noqa: E501
 
@@ -38,6 +41,8 @@ CODE_TEMPLATE = """
 const NEMMosaicDefinition NEM_MOSAIC_DEFINITIONS[NEM_MOSAIC_DEFINITIONS_COUNT] = {code};
 
 const NEMMosaicDefinition *NEM_MOSAIC_DEFINITION_XEM = NEM_MOSAIC_DEFINITIONS;
+
+const uint16_t NEM_MOSAIC_DEFINITIONS_BY_NAME[NEM_MOSAIC_DEFINITIONS_COUNT] = {by_name};
 """.lstrip()  # noqa: E501
 
 
@@ -97,6 +102,17 @@ def format_message(message, proto):
     return format_struct(message_to_struct(message, proto))
 
 
+def sorted_by_name(messages):
+    # same order as strcmp; sorted() is stable, so ties keep table order
+    return sorted(
+        range(len(messages)),
+        key=lambda i: (
+            messages[i]["namespace"].encode("utf-8"),
+            messages[i]["mosaic"].encode("utf-8"),
+        ),
+    )
+
+
 def format_messages(messages, proto):
     return "{" + ",\n".join(
         format_message(message, proto) for message in messages
@@ -118,5 +134,6 @@ if __name__ == "__main__":
 
     with open("nem_mosaics.c", "w+") as f:
         f.write(CODE_TEMPLATE.format(
-            code=format_messages(messages, types.NEMMosaicDefinition))
+            code=format_messages(messages, types.NEMMosaicDefinition),
+            by_name=format_primitive(sorted_by_name(messages)))
         )
@@ -15,6 +15,9 @@ fontCharWidth = [0]*256
 
 translations_fit = True;
 
+# English strings in the order of the string tables, used for the lookup hash
+originalStrings = []
+
 # 128 wide OLED, icon needs 16 pixels + 4 pixels space
 PIXEL_LINE_WIDTH=128-20
 
@@ -102,6 +105,43 @@ def writeEnd(filePointer):
         "#endif // !" + fileVar + "\n"
     ])
 
+# Value of a C string literal as bytes, so that the hash computed here
+# matches the one computed by strGetTrad() at runtime
+def cStringBytes(literal):
+    escapes = {'n': b'\n', 't': b'\t', 'r': b'\r', '"': b'"', '\'': b'\'', '\\': b'\\'}
+    result = b''
+    body = literal[1:-1]
+    i = 0
+    while i < len(body):
+        if body[i] == '\\' and i + 1 < len(body):
+            result += escapes.get(body[i + 1], body[i + 1].encode('utf-8'))
+            i += 2
+        else:
+            result += body[i].encode('utf-8')
+            i += 1
+    return result
+
+# FNV-1a, keep in sync with strHash() in gettext.c
+def strHash(data):
+    h = 2166136261
+    for b in data:
+        h = ((h ^ b) * 16777619) & 0xffffffff
+    return h
+
+# Open addressing table mapping the hash of an English string to its
+# index + 1, 0 marks an empty slot
+def buildHashTable(strings):
+    size = 1
+    while size < 2 * len(strings):
+        size *= 2
+    table = [0] * size
+    for index, string in enumerate(strings):
+        slot = strHash(cStringBytes(string)) & (size - 1)
+        while table[slot] != 0:
+            slot = (slot + 1) & (size - 1)
+        table[slot] = index + 1
+    return table
+
 def writeIntlFile(languages, originalLength):
     intlFile = open(intlDirectory + "intl.h", "w+")
     fileVar = getFileVar(getFileName(intlFile))
@@ -118,7 +158,35 @@ def writeIntlFile(languages, originalLength):
     for language in languages:
         intlFile.write("#include \"" + language + ".h\"\n")
 
+    codes = ["en"] + languages
     intlFile.writelines([
+        "\n",
+        "#define LANG_NUM " + str(len(codes)) + "\n",
+        "\n",
+        "static const char * const lang_codes[LANG_NUM] = {\n"
+    ])
+    for code in codes:
+        intlFile.write("\t\"" + code.upper() + "\",\n")
+    intlFile.writelines([
+        "};\n",
+        "\n",
+        "static const char * const * const lang_strings[LANG_NUM] = {\n"
+    ])
+    for code in codes:
+        intlFile.write("\t" + code + "_strings,\n")
+    intlFile.write("};\n")
+
+    table = buildHashTable(originalStrings)
+    intlFile.writelines([
+        "\n",
+        "#define STR_HASH_SIZE " + str(len(table)) + "\n",
+        "\n",
+        "static const uint16_t str_hash[STR_HASH_SIZE] = {\n"
+    ])
+    for i in range(0, len(table), 16):
+        intlFile.write("\t" + ", ".join(str(v) for v in table[i:i + 16]) + ",\n")
+    intlFile.writelines([
+        "};\n",
         "\n",
         "#endif // !" + fileVar + "\n"
     ])
@@ -151,6 +219,7 @@ def writeTranslationFiles(language):
 
     writeEnd(originalHeader)
     writeEnd(translationHeader)
+    originalStrings[:] = original[1:]
     originalHeader.close
     translationHeader.close
     return originalLength-1
@@ -0,0 +1,137 @@
+/*
+ * This file is part of the TREZOR project, https://trezor.io/
+ *
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "profile.h"
+
+#if PROFILE
+
+#if EMULATOR
+#include <time.h>
+#else
+#include <libopencm3/cm3/dwt.h>
+#include <libopencm3/cm3/scs.h>
+#include "supervise.h"
+#include "util.h"
+#endif
+
+ProfileTable profile_table = {
+	.magic = PROFILE_MAGIC,
+	.count = PROFILE_COUNT,
+	.stack_slots = PROFILE_STACK_SLOTS,
+};
+
+static uint32_t profile_boot_start;
+
+/* has to be called in privileged mode */
+void profileInit(void)
+{
+#if !EMULATOR
+	SCS_DEMCR |= SCS_DEMCR_TRCENA;
+	DWT_CYCCNT = 0;
+	DWT_CTRL |= DWT_CTRL_CYCCNTENA;
+	stack_paint();
+#endif
+	profile_boot_start = profileStart();
+}
+
+uint32_t profileStart(void)
+{
+#if EMULATOR
+	// nanoseconds stand in for cycles
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec * 1000000000 + t.tv_nsec;
+#else
+	return svc_cycle_count();
+#endif
+}
+
+void profileEnd(ProfileProbe probe, uint32_t start)
+{
+	uint32_t cycles = profileStart() - start;
+	ProfileCounter *counter = &profile_table.counters[probe];
+
+	counter->calls++;
+	counter->cycles += cycles;
+	if (cycles > counter->max) {
+		counter->max = cycles;
+	}
+
+	int bucket = cycles ? (31 - __builtin_clz(cycles)) / 2 : 0;
+	counter->histogram[bucket]++;
+}
+
+void profileBoot(ProfileBootStage stage)
+{
+	// only the first time, USB may be configured again later
+	if (profile_table.boot[stage] == 0) {
+		profile_table.boot[stage] = profileStart() - profile_boot_start;
+	}
+}
+
+#if !EMULATOR
+
+static void profileStackMax(uint32_t used)
+{
+	if (used > profile_table.stack_max) {
+		profile_table.stack_max = used;
+	}
+}
+
+void profileStackStart(void)
+{
+	// whatever ran since the last message
+	profileStackMax(stack_used());
+	stack_paint();
+}
+
+void profileStackEnd(uint16_t msg_id)
+{
+	uint32_t used = stack_used();
+	profileStackMax(used);
+
+	// find the slot of this message type or take the first free one
+	for (int i = 0; i < PROFILE_STACK_SLOTS; i++) {
+		ProfileStack *slot = &profile_table.stack[i];
+		if (slot->calls == 0 || slot->msg_id == msg_id) {
+			slot->msg_id = msg_id;
+			if (slot->calls < UINT16_MAX) {
+				slot->calls++;
+			}
+			if (used > slot->max) {
+				slot->max = used;
+			}
+			return;
+		}
+	}
+}
+
+#else
+
+// the emulator runs on the host stack, which cannot be painted
+void profileStackStart(void)
+{
+}
+
+void profileStackEnd(uint16_t msg_id)
+{
+	(void)msg_id;
+}
+
+#endif
+
+#endif
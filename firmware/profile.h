@@ -0,0 +1,112 @@
+/*
+ * This file is part of the TREZOR project, https://trezor.io/
+ *
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __PROFILE_H__
+#define __PROFILE_H__
+
+#include <stdint.h>
+
+/*
+ * Cycle count profiler, enabled with PROFILE=1.
+ *
+ * Every probe counts calls, total and maximum cycles, and keeps a
+ * histogram where bucket b holds durations of 4^b to 4^(b+1) cycles.
+ * The table is read from the profile_table symbol with
+ * DebugLinkMemoryRead and can be reset with DebugLinkMemoryWrite.
+ *
+ * On the device the table also holds the stack high-water mark: the
+ * free stack is painted at boot and again before every message, and
+ * the bytes touched by the handler are recorded per message type.
+ * stack_max covers everything, including the main loop between
+ * messages.
+ *
+ * boot[] holds the cycle count at the end of each boot stage, counted
+ * from profileInit() at the start of main(); a stage that did not run
+ * yet reads 0.
+ */
+
+typedef enum {
+	PROFILE_MNEMONIC_TO_SEED,
+	PROFILE_CKD,
+	PROFILE_SIGN_DIGEST,
+	PROFILE_CM_AES_KEY,
+	PROFILE_STORAGE_COMMIT,
+	PROFILE_MSG_READ,
+	PROFILE_COUNT
+} ProfileProbe;
+
+typedef enum {
+	PROFILE_BOOT_BOOTLOADER,	// bootloader check
+	PROFILE_BOOT_SETUP,		// clocks, timers, MPU
+	PROFILE_BOOT_STORAGE,		// storage loaded from flash
+	PROFILE_BOOT_HOME,		// home screen shown
+	PROFILE_BOOT_USB,		// USB connected
+	PROFILE_BOOT_DEFERRED,		// CryptoMemory and other deferred work done
+	PROFILE_BOOT_CONFIGURED,	// host selected the USB configuration
+	PROFILE_BOOT_COUNT
+} ProfileBootStage;
+
+#if PROFILE
+
+#define PROFILE_MAGIC   0x666f7270 // 'prof'
+#define PROFILE_BUCKETS 16
+#define PROFILE_STACK_SLOTS 48
+
+typedef struct {
+	uint32_t calls;
+	uint32_t max;
+	uint64_t cycles;
+	uint32_t histogram[PROFILE_BUCKETS];
+} ProfileCounter;
+
+typedef struct {
+	uint16_t msg_id;
+	uint16_t calls;
+	uint32_t max;
+} ProfileStack;
+
+typedef struct {
+	uint32_t magic;
+	uint32_t count;
+	ProfileCounter counters[PROFILE_COUNT];
+	uint32_t stack_max;
+	uint32_t stack_slots;
+	ProfileStack stack[PROFILE_STACK_SLOTS];
+	uint32_t boot[PROFILE_BOOT_COUNT];
+} ProfileTable;
+
+extern ProfileTable profile_table;
+
+void profileInit(void);
+uint32_t profileStart(void);
+void profileEnd(ProfileProbe probe, uint32_t start);
+void profileStackStart(void);
+void profileStackEnd(uint16_t msg_id);
+void profileBoot(ProfileBootStage stage);
+
+#else
+
+#define profileInit() do{}while(0)
+#define profileStart() 0
+#define profileEnd(P, S) (void)(S)
+#define profileStackStart() do{}while(0)
+#define profileStackEnd(M) do{}while(0)
+#define profileBoot(S) do{}while(0)
+
+#endif
+
+#endif
@@ -26,8 +26,10 @@
 #include "buttons.h"
 #include "pinmatrix.h"
 #include "fsm.h"
+#include "tasks.h"
 #include "layout2.h"
 #include "util.h"
+#include "timer.h"
 #include "debug.h"
 #include "gettext.h"
 #include "memzero.h"
@@ -36,6 +38,36 @@
 
 bool protectAbortedByInitialize = false;
 
+/*
+ * For work that runs for a while without a dialog.  USB is serviced in
+ * tiny mode at most every PROTECT_ABORT_POLL_MS, so the check may sit in
+ * a hot loop; a Cancel or Initialize from the host is reported once.
+ */
+#define PROTECT_ABORT_POLL_MS 5
+
+bool protectAbortRequested(void)
+{
+	static uint32_t polled;
+	if (msg_abort_id == 0xFFFF && timer_expired(polled + PROTECT_ABORT_POLL_MS)) {
+		char oldTiny = usbTiny(1);
+		usbPoll();
+		usbTiny(oldTiny);
+		polled = timer_ms();
+	}
+	uint16_t id = msg_abort_id;
+	if (id == 0xFFFF) {
+		return false;
+	}
+	if (id == MessageType_MessageType_Initialize) {
+		protectAbortedByInitialize = true;
+	}
+	msg_abort_id = 0xFFFF;
+	if (msg_tiny_id == id) {
+		msg_tiny_id = 0xFFFF;
+	}
+	return true;
+}
+
 bool protectButton(ButtonRequestType type, bool confirm_only)
 {
 	ButtonRequest resp;
@@ -49,11 +81,12 @@ bool protectButton(ButtonRequestType type, bool confirm_only)
 	resp.has_code = true;
 	resp.code = type;
 	usbTiny(1);
-	buttonUpdate(); // Clear button state
+	buttonFlush(); // Clear button state
 	msg_write(MessageType_MessageType_ButtonRequest, &resp);
 
 	for (;;) {
 		usbPoll();
+		tasksRun(TASKS_NESTED);
 
 		// check for ButtonAck
 		if (msg_tiny_id == MessageType_MessageType_ButtonAck) {
@@ -121,6 +154,7 @@ const char *requestPin(PinMatrixRequestType type, const char *text)
 	pinmatrix_start(text);
 	for (;;) {
 		usbPoll();
+		tasksRun(TASKS_NESTED);
 		if (msg_tiny_id == MessageType_MessageType_PinMatrixAck) {
 			msg_tiny_id = 0xFFFF;
 			PinMatrixAck *pma = (PinMatrixAck *)msg_tiny;
@@ -332,6 +366,7 @@ bool protectPassphrase(void)
 	bool result;
 	for (;;) {
 		usbPoll();
+		tasksRun(TASKS_NESTED);
 		// TODO: correctly process PassphraseAck with state field set (mismatch => Failure)
 		if (msg_tiny_id == MessageType_MessageType_PassphraseAck) {
 			msg_tiny_id = 0xFFFF;
@@ -27,6 +27,7 @@ bool protectButton(ButtonRequestType type, bool confirm_only);
 bool protectPin(bool use_cached);
 bool protectChangePin(char *changed_pin, size_t changed_pin_size);
 bool protectPassphrase(void);
+bool protectAbortRequested(void);
 
 extern bool protectAbortedByInitialize;
 
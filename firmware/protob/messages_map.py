@@ -1,4 +1,5 @@
 #!/usr/bin/env python
+import sys
 from collections import defaultdict
 from messages_pb2 import MessageType
 
@@ -7,7 +8,13 @@ from types_pb2 import wire_debug_in, wire_debug_out
 from types_pb2 import wire_bootloader, wire_tiny
 
 # len("MessageType_MessageType_") - len("_fields") == 17
-TEMPLATE = "\t{{ {type} {dir} {msg_id:46} {fields:29} {process_func} }},"
+TEMPLATE = "\t{{ {type} {dir} {msg_id:46} {fields:29} {size:31} {process_func} }},"
+
+# handlers that only exist when the firmware is built with the feature
+FEATURES = (
+    ("Ethereum", "USE_ETHEREUM"),
+    ("NEM", "USE_NEM"),
+)
 
 LABELS = {
     wire_in: "in messages",
@@ -36,22 +43,95 @@ def handle_message(message, extension):
     if tiny:
         return '\t// Message %s is used in tiny mode' % short_name
 
-    if direction == "i":
-        process_func = "(void (*)(void *)) fsm_msg%s" % short_name
-    else:
-        process_func = "0"
+    def entry(process_func):
+        return TEMPLATE.format(
+            type="'%c'," % interface,
+            dir="'%c'," % direction,
+            msg_id="MessageType_%s," % name,
+            fields="%s_fields," % short_name,
+            size="sizeof(%s)," % short_name,
+            process_func=process_func,
+        )
+
+    if direction != "i":
+        return entry("0")
+
+    process_func = "(void (*)(void *)) fsm_msg%s" % short_name
+    for prefix, flag in FEATURES:
+        if short_name.startswith(prefix):
+            # the entry stays, so MessagesIndex does not depend on the flag;
+            # without a handler messages.c rejects the message as unknown
+            return "#if {flag}\n{on}\n#else\n{off}\n#endif".format(
+                flag=flag, on=entry(process_func), off=entry("0"))
+    return entry(process_func)
+
+
+def print_map():
+    print("\t// This file is automatically generated"
+          "by messages_map.py -- DO NOT EDIT!")
+
+    for extension in (wire_in, wire_out, wire_debug_in, wire_debug_out):
+        if extension == wire_debug_in:
+            print("\n#if DEBUG_LINK")
+
+        print("\n\t// {label}\n".format(label=LABELS[extension]))
+
+        for message in messages[extension]:
+            print(handle_message(message, extension))
 
-    return TEMPLATE.format(
-        type="'%c'," % interface,
-        dir="'%c'," % direction,
-        msg_id="MessageType_%s," % name,
-        fields="%s_fields," % short_name,
-        process_func=process_func,
-    )
+        if extension == wire_debug_out:
+            print("\n#endif")
 
 
-print("\t// This file is automatically generated"
-      "by messages_map.py -- DO NOT EDIT!")
+def print_index():
+    # MessagesIndex_<type><dir>[msg_id] is the position of the message in
+    # MessagesMap plus one, zero means there is no entry for this msg_id.
+    # Debug messages follow the normal ones in MessagesMap, so leaving them
+    # out with DEBUG_LINK=0 does not move any other entry.
+    print("// This file is automatically generated "
+          "by messages_map.py -- DO NOT EDIT!")
+
+    position = 0
+    for extension in (wire_in, wire_out, wire_debug_in, wire_debug_out):
+        interface = "d" if extension in (wire_debug_in, wire_debug_out) else "n"
+        direction = "i" if extension in (wire_in, wire_debug_in) else "o"
+
+        if extension == wire_debug_in:
+            print("\n#if DEBUG_LINK")
+
+        print("\n// {label}\n".format(label=LABELS[extension]))
+        print("static const uint8_t MessagesIndex_%s%s[] = {" % (interface, direction))
+        entries = 0
+        for message in messages[extension]:
+            if handle_message(message, extension).startswith("\t//"):
+                continue
+            position += 1
+            entries += 1
+            print("\t[MessageType_%s] = %d," % (message.name, position))
+        if not entries:
+            print("\t0,")
+        print("};")
+
+        if extension == wire_debug_out:
+            print("\n#endif")
+
+    assert position < 256, "MessagesIndex entries do not fit into uint8_t"
+
+    # msg_data in messages.c holds any of the messages that are decoded there
+    print("\n// every message decoded by msg_process()\n")
+    print("union MessagesIn {")
+    for extension in (wire_in, wire_debug_in):
+        if extension == wire_debug_in:
+            print("#if DEBUG_LINK")
+        for message in messages[extension]:
+            if handle_message(message, extension).startswith("\t//"):
+                continue
+            short_name = message.name.split("MessageType_", 1).pop()
+            print("\t{0} {0};".format(short_name))
+        if extension == wire_debug_in:
+            print("#endif")
+    print("};")
+
 
 messages = defaultdict(list)
 
@@ -62,14 +142,7 @@ for message in MessageType.DESCRIPTOR.values:
         if extensions[extension]:
             messages[extension].append(message)
 
-for extension in (wire_in, wire_out, wire_debug_in, wire_debug_out):
-    if extension == wire_debug_in:
-        print("\n#if DEBUG_LINK")
-
-    print("\n\t// {label}\n".format(label=LABELS[extension]))
-
-    for message in messages[extension]:
-        print(handle_message(message, extension))
-
-    if extension == wire_debug_out:
-        print("\n#endif")
+if len(sys.argv) > 1 and sys.argv[1] == "--index":
+    print_index()
+else:
+    print_map()
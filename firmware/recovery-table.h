@@ -110,3 +110,136 @@ static const uint16_t word_table2[631] =
     14293, 18394, 18399, 14305, 14310, 14315, 10224,  6134,  6140,
      2048,
 };
+
+static const char word_label0[9][4] =
+{
+    "A-B",     "C",       "D-E",     "F-G",     "H-L",     "M-O",
+    "P-R",     "S",       "T-Z",
+};
+
+static const char word_label1[81][8] =
+{
+    "AB-AC",   "AD-AI",   "AL-AN",   "AP-AR",   "AS-AX",   "BA-BE",
+    "BI-BL",   "BO-BR",   "BU",      "CA B-M",  "CA N-V",  "CE",
+    "CH",      "CI",      "CL",      "CO",      "CR",      "CU-CY",
+    "DA",      "DE A-M",  "DE N-V",  "DI",      "DO",      "DR-DY",
+    "EA-EM",   "EN-ES",   "ET-EY",   "FA",      "FE",      "FI",
+    "FL-FO",   "FR-FU",   "GA",      "GE-GI",   "GL-GO",   "GR-GY",
+    "HA-HE",   "HI-HO",   "HU-HY",   "IC-IM",   "IN-IV",   "J",
+    "K",       "LA-LE",   "LI-LY",   "MA",      "ME",      "MI",
+    "MO-MY",   "NA-NE",   "NI-NU",   "OA-OK",   "OL-OP",   "OR-OZ",
+    "PA-PH",   "PI-PO",   "PR",      "PU-PY",   "Q",       "RA",
+    "RE A-M",  "RE N-W",  "RH-RU",   "SA-SC",   "SE",      "SH",
+    "SI-SL",   "SM-SO",   "SP-SQ",   "ST",      "SU",      "SW-SY",
+    "TA-TE",   "TH-TI",   "TO",      "TR",      "TU-TY",   "U",
+    "V",       "WA-WH",   "WI-Z",
+};
+
+static const char word_label2[630][8] =
+{
+    "AB A-O",  "ABS",     "ABU",     "ACC",     "AC H-I",  "AC O-Q",
+    "ACR",     "ACT",     "ADA",     "ADD",     "AD J-V",  "AE",
+    "AF",      "AG",      "AH",      "AI",      "AL A-C",  "AL E-L",
+    "AL M-P",  "AL R-W",  "AM",      "AN A-C",  "AN G-I",  "AN K-O",
+    "AN S-Y",  "AP",      "ARC",     "ARE",     "ARG",     "ARM",
+    "ARO",     "ARR",     "ART",     "AS K-P",  "ASS",     "AST",
+    "AT",      "AU C-G",  "AU N-T",  "AV",      "AW",      "AX",
+    "BA B-D",  "BA G-M",  "BA N-R",  "BA S-T",  "BE A-C",  "BE E-G",
+    "BE H-L",  "BE N-S",  "BE T-Y",  "BI C-D",  "BI K-O",  "BI R-T",
+    "BLA",     "BL E-I",  "BLO",     "BLU",     "BO A-I",  "BO M-O",
+    "BO R-S",  "BO T-Y",  "BRA",     "BRE",     "BRI",     "BRO",
+    "BRU",     "BU B-I",  "BUL",     "BUN",     "BUR",     "BUS",
+    "BU T-Z",  "CAB",     "CAC",     "CAG",     "CAK",     "CAL",
+    "CAM",     "CAN -D",  "CAN N-Y", "CAP",     "CAR -G",  "CAR P-T",
+    "CAS",     "CAT",     "CAU",     "CAV",     "CEI",     "CEL",
+    "CEM",     "CEN",     "CER",     "CHA I-M", "CHA N-T", "CHE",
+    "CHI",     "CHO",     "CHR",     "CHU",     "CIG",     "CIN",
+    "CIR",     "CIT",     "CIV",     "CLA",     "CLE",     "CLI",
+    "CLO",     "CLU",     "CO A-F",  "CO I-L",  "COM",     "CON C-G",
+    "CON N-V", "CO O-P",  "CO R-T",  "COU",     "CO V-Y",  "CRA C-M",
+    "CRA N-Z", "CRE",     "CRI",     "CRO",     "CRU",     "CRY",
+    "CUB",     "CUL",     "CUP",     "CUR",     "CUS",     "CUT",
+    "CY",      "DAD",     "DAM",     "DAN",     "DAR",     "DAS",
+    "DAU",     "DAW",     "DAY",     "DEA",     "DEB",     "DEC",
+    "DEE",     "DEF",     "DEG",     "DEL",     "DEM",     "DEN",
+    "DEP",     "DER",     "DES",     "DET",     "DEV",     "DIA",
+    "DI C-E",  "DI F-L",  "DIN",     "DIR",     "DIS A-M", "DIS O-T",
+    "DIV",     "DIZ",     "DOC",     "DOG",     "DOL",     "DOM",
+    "DON",     "DOO",     "DOS",     "DOU",     "DOV",     "DRA",
+    "DRE",     "DRI",     "DR O-Y",  "DU C-M",  "DU N-T",  "DW",
+    "DY",      "EAG",     "EA R-S",  "EC-ED",   "EF-EI",   "EL B-D",
+    "ELE",     "EL I-S",  "EM B-E",  "EM O-P",  "ENA",     "END",
+    "EN E-G",  "EN H-L",  "EN O-S",  "EN T-V",  "EP-EQ",   "ER",
+    "ES",      "ET",      "EV",      "EXA",     "EXC",     "EX E-H",
+    "EX I-O",  "EXP",     "EXT",     "EY",      "FA B-C",  "FAD",
+    "FAI",     "FAL",     "FAM",     "FAN",     "FA R-S",  "FAT",
+    "FA U-V",  "FE A-D",  "FEE",     "FE M-W",  "FI B-G",  "FIL",
+    "FIN",     "FIR",     "FI S-X",  "FLA",     "FL E-I",  "FLO",
+    "FL U-Y",  "FO A-I",  "FO L-O",  "FOR C-K", "FOR T-W", "FO S-X",
+    "FRA",     "FRE",     "FRI",     "FRO",     "FRU",     "FU",
+    "GA D-I",  "GAL",     "GA M-P",  "GAR",     "GAS",     "GAT",
+    "GA U-Z",  "GE",      "GH",      "GIA",     "GIF",     "GIG",
+    "GIN",     "GIR",     "GIV",     "GLA",     "GLI",     "GLO",
+    "GLU",     "GO A-D",  "GO L-O",  "GO R-S",  "GO V-W",  "GRA B-I",
+    "GRA N-V", "GRE",     "GRI",     "GRO",     "GRU",     "GU",
+    "GY",      "HA B-I",  "HA L-M",  "HA N-P",  "HAR",     "HA T-Z",
+    "HEA",     "HE D-I",  "HEL",     "HE N-R",  "HI D-G",  "HI L-N",
+    "HI P-S",  "HO B-C",  "HOL",     "HO M-P",  "HOR",     "HO S-V",
+    "HUB",     "HUG",     "HUM",     "HUN",     "HUR",     "HUS",
+    "HY",      "IC",      "ID",      "IG",      "IL",      "IMA",
+    "IMI",     "IMM",     "IMP",     "INC",     "IND",     "INF",
+    "IN H-I",  "IN J-M",  "IN N-Q",  "INS",     "IN T-V",  "IR-IV",
+    "JA",      "JE",      "JO",      "JUD",     "JUI",     "JUM",
+    "JUN",     "JUS",     "KA",      "KE",      "KIC",     "KID",
+    "KIN",     "KIS",     "KIT",     "KIW",     "KN",      "LA B-D",
+    "LA K-N",  "LA P-T",  "LA U-V",  "LA W-Z",  "LEA",     "LE C-G",
+    "LE I-N",  "LE O-V",  "LI A-C",  "LI F-K",  "LI M-O",  "LI Q-Z",
+    "LO A-C",  "LO G-O",  "LO T-Y",  "LU",      "LY",      "MA C-G",
+    "MAI",     "MA J-M",  "MAN",     "MAP",     "MAR",     "MAS",
+    "MAT",     "MA X-Z",  "MEA",     "MEC",     "MED",     "MEL",
+    "MEM",     "MEN",     "MER",     "MES",     "MET",     "MID",
+    "MIL",     "MIM",     "MIN",     "MIR",     "MIS",     "MIX",
+    "MO B-M",  "MON",     "MO O-R",  "MO S-T",  "MO U-V",  "MU C-L",
+    "MUS",     "MUT",     "MY",      "NA I-M",  "NA P-R",  "NA S-T",
+    "NE A-C",  "NE E-G",  "NE I-P",  "NE R-S",  "NE T-U",  "NE V-X",
+    "NI",      "NO B-O",  "NOR",     "NOS",     "NOT",     "NO V-W",
+    "NU",      "OA",      "OB E-L",  "OB S-V",  "OC",      "OD",
+    "OF",      "OI",      "OK",      "OL",      "OM",      "ON",
+    "OP",      "OR A-G",  "OR I-P",  "OS",      "OT",      "OU",
+    "OV",      "OW",      "OX-OZ",   "PA C-L",  "PA N-P",  "PA R-S",
+    "PAT",     "PA U-Y",  "PEA",     "PE L-O",  "PE P-T",  "PH",
+    "PI A-E",  "PI G-N",  "PI O-Z",  "PLA",     "PL E-U",  "PO E-I",
+    "PO L-N",  "PO O-S",  "PO T-W",  "PRA",     "PRE",     "PRI C-M",
+    "PRI N-Z", "PRO B-F", "PRO G-P", "PRO S-V", "PU B-D",  "PUL",
+    "PU M-N",  "PUP",     "PUR",     "PU S-Z",  "PY",      "QUA",
+    "QUE",     "QUI",     "QUO",     "RAB",     "RAC",     "RAD",
+    "RAI",     "RA L-M",  "RAN",     "RA P-R",  "RAT",     "RA V-Z",
+    "REA",     "REB",     "REC",     "RED",     "REF",     "REG",
+    "REJ",     "REL",     "REM",     "REN",     "REO",     "REP",
+    "REQ",     "RES",     "RET",     "REU",     "REV",     "REW",
+    "RH",      "RI B-D",  "RI F-O",  "RI P-V",  "RO A-C",  "RO M-S",
+    "RO T-Y",  "RU B-G",  "RU L-R",  "SA D-I",  "SAL",     "SA M-N",
+    "SA T-U",  "SA V-Y",  "SCA",     "SC E-H",  "SC I-O",  "SCR",
+    "SEA",     "SEC",     "SE E-M",  "SEN",     "SE R-V",  "SHA",
+    "SHE",     "SHI",     "SHO C-E", "SHO O-V", "SHR",     "SHU",
+    "SHY",     "SI B-E",  "SI G-L",  "SI M-N",  "SI R-Z",  "SK A-E",
+    "SK I-U",  "SL A-E",  "SLI",     "SL O-U",  "SM",      "SN",
+    "SOA",     "SOC",     "SO D-F",  "SOL",     "SO M-O",  "SOR",
+    "SOU",     "SPA",     "SPE",     "SPH",     "SPI",     "SPL",
+    "SPO",     "SPR",     "SPY",     "SQ",      "STA B-M", "STA N-Y",
+    "STE",     "STI",     "STO",     "STR",     "STU",     "STY",
+    "SUB",     "SUC",     "SU D-G",  "SU I-M",  "SUN",     "SUP",
+    "SUR",     "SUS",     "SWA",     "SWE",     "SWI",     "SWO",
+    "SY",      "TA B-I",  "TA L-R",  "TA S-X",  "TE A-L",  "TEN",
+    "TE R-X",  "THA",     "THE",     "TH I-O",  "THR",     "THU",
+    "TI C-D",  "TI G-M",  "TI N-P",  "TI R-T",  "TO A-D",  "TO E-I",
+    "TO K-M",  "TON",     "TOO",     "TOP",     "TOR",     "TO S-U",
+    "TO W-Y",  "TRA C-I", "TRA N-Y", "TRE",     "TRI",     "TRO",
+    "TRU",     "TRY",     "TU B-N",  "TUR",     "TW",      "TY",
+    "UG-UM",   "UN A-C",  "UN D-H",  "UNI",     "UN K-V",  "UP",
+    "UR",      "US",      "UT",      "VA C-L",  "VA N-U",  "VE H-N",
+    "VE R-T",  "VI A-D",  "VI E-R",  "VI S-V",  "VO C-I",  "VO L-Y",
+    "WA G-I",  "WA L-N",  "WAR",     "WA S-Y",  "WEA",     "WE B-E",
+    "WE I-T",  "WH A-E",  "WHI",     "WI D-L",  "WIN -K",  "WIN N-T",
+    "WI R-T",  "WO L-O",  "WOR",     "WR",      "Y",       "Z",
+};
@@ -18,7 +18,6 @@
  * along with this library.  If not, see <http://www.gnu.org/licenses/>.
  */
 
-#include <ctype.h>
 #include "recovery.h"
 #include "fsm.h"
 #include "storage.h"
@@ -34,6 +33,7 @@
 #include "types.pb.h"
 #include "recovery-table.h"
 #include "memzero.h"
+#include "scratch.h"
 
 /* number of words expected in the new seed */
 static uint32_t word_count;
@@ -83,9 +83,10 @@ static uint32_t word_index;
  */
 static char word_order[24];
 
-/* The recovered seed.  This is filled during the recovery process.
+/* The recovered seed.  This is filled during the recovery process
+ * and lives in the shared workflow arena.
  */
-static char words[24][12];
+static char (* const words)[12] = scratch_arena.recovery.words;
 
 /* The "pincode" of the current word.  This is basically the "pin"
  * that the user would have entered for the current word if the words
@@ -121,6 +122,11 @@ static uint8_t word_matrix[9];
  * of significant letters for the corresponding choice.  There is no
  * prefix length or table for the very first level, as the prefix length
  * is always one and there are always nine choices on the second level.
+ *
+ * The strings shown for the choices of the first three levels are
+ * precomputed by the table generator as well: word_label0 holds the
+ * nine ranges of the first level, word_label1 and word_label2 are
+ * indexed like TABLE1 and TABLE2.  The last level shows the words.
  */
 #define MASK_IDX(x) ((x) & 0xfff)
 #define TABLE1(x) MASK_IDX(word_table1[x])
@@ -210,58 +216,16 @@ static void recovery_done(void) {
 		fsm_sendFailure(FailureType_Failure_DataError, _("Invalid seed, are words in correct order?"));
 	}
 	awaiting_word = 0;
+	scratch_release(SCRATCH_RECOVERY);
 	layoutHome();
 }
 
-/* Helper function for matrix recovery:
- * Formats a string describing the word range from first to last where
- * prefixlen gives the number of characters in first and last that are
- * significant, i.e. the word before first or the word after last differ
- * exactly at the prefixlen-th character.
- *
- * Invariants:
- *  memcmp("first - 1", first, prefixlen) != 0
- *  memcmp(last, "last + 1", prefixlen) != 0
- *  first[prefixlen-2] == last[prefixlen-2]  except for range WI-Z.
- */
-static void add_choice(char choice[12], int prefixlen, const char *first, const char *last) {
-	// assert 1 <= prefixlen <= 4
-	char *dest = choice;
-	for (int i = 0; i < prefixlen; i++) {
-		*dest++ = toupper((int) first[i]);
-	}
-	if (first[0] != last[0]) {
-		/* special case WI-Z; also used for T-Z, etc. */
-		*dest++ = '-';
-		*dest++ = toupper((int) last[0]);
-	} else if (last[prefixlen-1] == first[prefixlen-1]) {
-		/* single prefix */
-	} else if (prefixlen < 3) {
-		/* AB-AC, etc. */
-		*dest++ = '-';
-		for (int i = 0; i < prefixlen; i++) {
-			*dest++ = toupper((int) last[i]);
-		}
-	} else {
-		/* RE[A-M] etc. */
-		/* remove last and replace with space */
-		dest[-1] = ' ';
-		if (first[prefixlen - 1]) {
-			/* handle special case: CAN[-D] */
-			*dest++ = toupper((int)first[prefixlen - 1]);
-		}
-		*dest++ = '-';
-		*dest++ = toupper((int) last[prefixlen - 1]);
-	}
-	*dest++ = 0;
-}
-
 /* Helper function for matrix recovery:
  * Display the recovery matrix given in choices.  If twoColumn is set
  * use 2x3 layout, otherwise 3x3 layout.  Also generates a random
  * scrambling and stores it in word_matrix.
  */
-static void display_choices(bool twoColumn, char choices[9][12], int num)
+static void display_choices(bool twoColumn, const char *choices[9], int num)
 {
 	const int nColumns = twoColumn ? 2 : 3;
 	const int displayedChoices = nColumns * 3;
@@ -314,13 +278,13 @@ static void display_choices(bool twoColumn, char choices[9][12], int num)
  */
 static void next_matrix(void) {
 	const char * const *wl = mnemonic_wordlist();
-	char word_choices[9][12];
+	const char *word_choices[9];
 	uint32_t idx, num;
 	bool last = (word_index % 4) == 3;
 
 	/* Build the matrix:
 	 * num: number of choices
-	 * word_choices[][]: the strings containing the choices
+	 * word_choices[]: the strings containing the choices
 	 */
 	switch (word_index % 4) {
 	case 3:
@@ -332,7 +296,7 @@ static void next_matrix(void) {
 		const uint32_t first = TABLE2(idx);
 		num = TABLE2(idx + 1) - first;
 		for (uint32_t i = 0; i < num; i++) {
-			strlcpy(word_choices[i], wl[first + i], sizeof(word_choices[i]));
+			word_choices[i] = wl[first + i];
 		}
 		break;
 
@@ -343,9 +307,7 @@ static void next_matrix(void) {
 		idx = TABLE1(word_pincode);
 		num = TABLE1(word_pincode + 1) - idx;
 		for (uint32_t i = 0; i < num; i++) {
-			add_choice(word_choices[i], (word_table2[idx + i] >> 12),
-					   wl[TABLE2(idx + i)],
-					   wl[TABLE2(idx + i + 1) - 1]);
+			word_choices[i] = word_label2[idx + i];
 		}
 		break;
 
@@ -356,9 +318,7 @@ static void next_matrix(void) {
 		idx = word_pincode * 9;
 		num = 9;
 		for (uint32_t i = 0; i < num; i++) {
-			add_choice(word_choices[i], (word_table1[idx + i] >> 12),
-					   wl[TABLE2(TABLE1(idx + i))],
-					   wl[TABLE2(TABLE1(idx + i + 1)) - 1]);
+			word_choices[i] = word_label1[idx + i];
 		}
 		break;
 
@@ -367,9 +327,7 @@ static void next_matrix(void) {
 		/* num: the number of choices. */
 		num = 9;
 		for (uint32_t i = 0; i < num; i++) {
-			add_choice(word_choices[i], 1,
-					   wl[TABLE2(TABLE1(9*i))],
-					   wl[TABLE2(TABLE1(9*(i+1)))-1]);
+			word_choices[i] = word_label0[i];
 		}
 		break;
 	}
@@ -478,6 +436,7 @@ void recovery_init(uint32_t _word_count, bool passphrase_protection, bool pin_pr
 		storage_update();
 	}
 
+	scratch_claim(SCRATCH_RECOVERY, recovery_abort);
 	if ((type & RecoveryDeviceType_RecoveryDeviceType_Matrix) != 0) {
 		awaiting_word = 2;
 		word_index = 0;
@@ -497,6 +456,28 @@ void recovery_init(uint32_t _word_count, bool passphrase_protection, bool pin_pr
 	}
 }
 
+/* The BIP-0039 wordlist is sorted, so a word is found by bisection
+ * in 11 comparisons instead of a walk over all 2048 words.
+ */
+static bool recovery_wordlist_contains(const char *word)
+{
+	const char * const *wl = mnemonic_wordlist();
+	int lo = 0, hi = 2047;
+	while (lo <= hi) {
+		int mid = (lo + hi) / 2;
+		int cmp = strcmp(word, wl[mid]);
+		if (cmp == 0) {
+			return true;
+		}
+		if (cmp < 0) {
+			hi = mid - 1;
+		} else {
+			lo = mid + 1;
+		}
+	}
+	return false;
+}
+
 static void recovery_scrambledword(const char *word)
 {
 	if (word_pos == 0) { // fake word
@@ -510,16 +491,7 @@ static void recovery_scrambledword(const char *word)
 		}
 	} else { // real word
 		if (enforce_wordlist) { // check if word is valid
-			const char * const *wl = mnemonic_wordlist();
-			bool found = false;
-			while (*wl) {
-				if (strcmp(word, *wl) == 0) {
-					found = true;
-					break;
-				}
-				wl++;
-			}
-			if (!found) {
+			if (!recovery_wordlist_contains(word)) {
 				if (!dry_run) {
 					session_clear(true);
 				}
@@ -565,6 +537,7 @@ void recovery_abort(void)
 		layoutHome();
 		awaiting_word = 0;
 	}
+	scratch_release(SCRATCH_RECOVERY);
 }
 
 #if DEBUG_LINK
@@ -0,0 +1,44 @@
+/*
+ * This file is part of the TREZOR project, https://trezor.io/
+ *
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "scratch.h"
+#include "memzero.h"
+
+ScratchArena scratch_arena;
+
+static ScratchOwner scratch_owner = SCRATCH_FREE;
+static void (*scratch_abort)(void);
+
+void scratch_claim(ScratchOwner owner, void (*abort)(void))
+{
+	if (scratch_owner != SCRATCH_FREE && scratch_owner != owner) {
+		scratch_abort();
+	}
+	memzero(&scratch_arena, sizeof(scratch_arena));
+	scratch_owner = owner;
+	scratch_abort = abort;
+}
+
+void scratch_release(ScratchOwner owner)
+{
+	if (scratch_owner != owner) {
+		return;
+	}
+	memzero(&scratch_arena, sizeof(scratch_arena));
+	scratch_owner = SCRATCH_FREE;
+	scratch_abort = 0;
+}
@@ -0,0 +1,79 @@
+/*
+ * This file is part of the TREZOR project, https://trezor.io/
+ *
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __SCRATCH_H__
+#define __SCRATCH_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "hasher.h"
+#include "sha3.h"
+#include "transaction.h"
+#include "types.pb.h"
+#include "messages.pb.h"
+
+/*
+ * Working storage of the multi message workflows.  Only one of them runs
+ * at a time, so they share one union.  A workflow claims the arena when
+ * it starts and releases it when it ends; claiming it while another
+ * workflow owns it aborts that one first.  The arena is wiped whenever
+ * it changes hands.
+ */
+typedef enum {
+	SCRATCH_FREE = 0,
+	SCRATCH_SIGNING,
+	SCRATCH_ETHEREUM,
+	SCRATCH_RECOVERY,
+} ScratchOwner;
+
+/* amounts of a previous transaction whose hash has been verified */
+#define PREVTX_CACHE_SIZE    4
+#define PREVTX_CACHE_OUTPUTS 16
+
+typedef struct {
+	bool verified;
+	uint8_t hash[32];
+	uint32_t outputs_count;
+	uint64_t amounts[PREVTX_CACHE_OUTPUTS];
+} PrevTxCacheEntry;
+
+typedef union {
+	struct {
+		TxStruct to, tp, ti;
+		Hasher hashers[3];
+		TxInputType input;
+		PrevTxCacheEntry prevtx_cache[PREVTX_CACHE_SIZE];
+#if LEGACY_SIGHASH_MIDSTATE
+		TxStruct tc;
+		Hasher check;
+#endif
+	} signing;
+	struct {
+		struct SHA3_CTX keccak_ctx;
+		EthereumTxRequest msg_tx_request;
+	} ethereum;
+	struct {
+		char words[24][12];
+	} recovery;
+} ScratchArena;
+
+extern ScratchArena scratch_arena;
+
+void scratch_claim(ScratchOwner owner, void (*abort)(void));
+void scratch_release(ScratchOwner owner);
+
+#endif
@@ -0,0 +1,397 @@
+/*
+ * This file is part of the TREZOR project, https://trezor.io/
+ *
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * SHA-3 and Keccak with a bit-interleaved Keccak-f[1600] for 32-bit
+ * cores, a drop-in for trezor-crypto's sha3.c (same API and context).
+ *
+ * Every 64-bit lane is kept as two 32-bit words, one holding the even
+ * and one the odd bits, so the lane rotations of the permutation become
+ * single 32-bit rotations instead of the multi-instruction 64-bit shifts
+ * of the portable code.  Lanes are interleaved as blocks are absorbed
+ * and put back together when the digest is read out; in between the
+ * state in SHA3_CTX.hash is interleaved (odd bits in the high word).
+ * The round itself is unrolled.
+ */
+
+#include <string.h>
+#include "sha3.h"
+#include "memzero.h"
+
+#define ROL32(x, n) (((x) << (n)) | ((x) >> (32 - (n))))
+
+// round constants, even and odd bits
+static const uint32_t keccak_rc[24][2] = {
+	{ 0x00000001, 0x00000000 },
+	{ 0x00000000, 0x00000089 },
+	{ 0x00000000, 0x8000008b },
+	{ 0x00000000, 0x80008080 },
+	{ 0x00000001, 0x0000008b },
+	{ 0x00000001, 0x00008000 },
+	{ 0x00000001, 0x80008088 },
+	{ 0x00000001, 0x80000082 },
+	{ 0x00000000, 0x0000000b },
+	{ 0x00000000, 0x0000000a },
+	{ 0x00000001, 0x00008082 },
+	{ 0x00000000, 0x00008003 },
+	{ 0x00000001, 0x0000808b },
+	{ 0x00000001, 0x8000000b },
+	{ 0x00000001, 0x8000008a },
+	{ 0x00000001, 0x80000081 },
+	{ 0x00000000, 0x80000081 },
+	{ 0x00000000, 0x80000008 },
+	{ 0x00000000, 0x00000083 },
+	{ 0x00000000, 0x80008003 },
+	{ 0x00000001, 0x80008088 },
+	{ 0x00000000, 0x80000088 },
+	{ 0x00000001, 0x00008000 },
+	{ 0x00000000, 0x80008082 },
+};
+
+static uint32_t keccak_compact(uint32_t x)
+{
+	x &= 0x55555555;
+	x = (x | (x >> 1)) & 0x33333333;
+	x = (x | (x >> 2)) & 0x0f0f0f0f;
+	x = (x | (x >> 4)) & 0x00ff00ff;
+	x = (x | (x >> 8)) & 0x0000ffff;
+	return x;
+}
+
+static uint32_t keccak_spread(uint32_t x)
+{
+	x &= 0x0000ffff;
+	x = (x | (x << 8)) & 0x00ff00ff;
+	x = (x | (x << 4)) & 0x0f0f0f0f;
+	x = (x | (x << 2)) & 0x33333333;
+	x = (x | (x << 1)) & 0x55555555;
+	return x;
+}
+
+// XOR a little endian lane into the interleaved state
+static void keccak_absorb_lane(uint64_t *lane, const uint8_t *p)
+{
+	uint32_t lo = p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+	uint32_t hi = p[4] | (p[5] << 8) | (p[6] << 16) | ((uint32_t)p[7] << 24);
+	uint32_t e = keccak_compact(lo) | (keccak_compact(hi) << 16);
+	uint32_t o = keccak_compact(lo >> 1) | (keccak_compact(hi >> 1) << 16);
+	*lane ^= ((uint64_t)o << 32) | e;
+}
+
+static void keccak_squeeze_lane(const uint64_t *lane, uint8_t *p, size_t len)
+{
+	uint32_t e = (uint32_t)*lane, o = (uint32_t)(*lane >> 32);
+	uint32_t lo = keccak_spread(e) | (keccak_spread(o) << 1);
+	uint32_t hi = keccak_spread(e >> 16) | (keccak_spread(o >> 16) << 1);
+	for (size_t i = 0; i < len; i++) {
+		p[i] = (i < 4 ? lo >> (8 * i) : hi >> (8 * (i - 4))) & 0xff;
+	}
+}
+
+static void keccak_permutation(uint64_t state[25])
+{
+	uint32_t a[50];
+	uint32_t c0e, c0o, c1e, c1o, c2e, c2o, c3e, c3o, c4e, c4o;
+	uint32_t d0e, d0o, d1e, d1o, d2e, d2o, d3e, d3o, d4e, d4o;
+	uint32_t te, to;
+	uint32_t b0e, b0o, b1e, b1o, b2e, b2o, b3e, b3o, b4e, b4o;
+	uint32_t b5e, b5o, b6e, b6o, b7e, b7o, b8e, b8o, b9e, b9o;
+	uint32_t b10e, b10o, b11e, b11o, b12e, b12o, b13e, b13o, b14e, b14o;
+	uint32_t b15e, b15o, b16e, b16o, b17e, b17o, b18e, b18o, b19e, b19o;
+	uint32_t b20e, b20o, b21e, b21o, b22e, b22o, b23e, b23o, b24e, b24o;
+
+	for (int i = 0; i < 25; i++) {
+		a[2 * i] = (uint32_t)state[i];
+		a[2 * i + 1] = (uint32_t)(state[i] >> 32);
+	}
+
+	for (int rnd = 0; rnd < 24; rnd++) {
+		c0e = a[0] ^ a[10] ^ a[20] ^ a[30] ^ a[40];
+		c0o = a[1] ^ a[11] ^ a[21] ^ a[31] ^ a[41];
+		c1e = a[2] ^ a[12] ^ a[22] ^ a[32] ^ a[42];
+		c1o = a[3] ^ a[13] ^ a[23] ^ a[33] ^ a[43];
+		c2e = a[4] ^ a[14] ^ a[24] ^ a[34] ^ a[44];
+		c2o = a[5] ^ a[15] ^ a[25] ^ a[35] ^ a[45];
+		c3e = a[6] ^ a[16] ^ a[26] ^ a[36] ^ a[46];
+		c3o = a[7] ^ a[17] ^ a[27] ^ a[37] ^ a[47];
+		c4e = a[8] ^ a[18] ^ a[28] ^ a[38] ^ a[48];
+		c4o = a[9] ^ a[19] ^ a[29] ^ a[39] ^ a[49];
+		d0e = c4e ^ ROL32(c1o, 1);
+		d0o = c4o ^ c1e;
+		d1e = c0e ^ ROL32(c2o, 1);
+		d1o = c0o ^ c2e;
+		d2e = c1e ^ ROL32(c3o, 1);
+		d2o = c1o ^ c3e;
+		d3e = c2e ^ ROL32(c4o, 1);
+		d3o = c2o ^ c4e;
+		d4e = c3e ^ ROL32(c0o, 1);
+		d4o = c3o ^ c0e;
+		te = a[0] ^ d0e; to = a[1] ^ d0o;
+		b0e = te;
+		b0o = to;
+		te = a[10] ^ d0e; to = a[11] ^ d0o;
+		b16e = ROL32(te, 18);
+		b16o = ROL32(to, 18);
+		te = a[20] ^ d0e; to = a[21] ^ d0o;
+		b7e = ROL32(to, 2);
+		b7o = ROL32(te, 1);
+		te = a[30] ^ d0e; to = a[31] ^ d0o;
+		b23e = ROL32(to, 21);
+		b23o = ROL32(te, 20);
+		te = a[40] ^ d0e; to = a[41] ^ d0o;
+		b14e = ROL32(te, 9);
+		b14o = ROL32(to, 9);
+		te = a[2] ^ d1e; to = a[3] ^ d1o;
+		b10e = ROL32(to, 1);
+		b10o = te;
+		te = a[12] ^ d1e; to = a[13] ^ d1o;
+		b1e = ROL32(te, 22);
+		b1o = ROL32(to, 22);
+		te = a[22] ^ d1e; to = a[23] ^ d1o;
+		b17e = ROL32(te, 5);
+		b17o = ROL32(to, 5);
+		te = a[32] ^ d1e; to = a[33] ^ d1o;
+		b8e = ROL32(to, 23);
+		b8o = ROL32(te, 22);
+		te = a[42] ^ d1e; to = a[43] ^ d1o;
+		b24e = ROL32(te, 1);
+		b24o = ROL32(to, 1);
+		te = a[4] ^ d2e; to = a[5] ^ d2o;
+		b20e = ROL32(te, 31);
+		b20o = ROL32(to, 31);
+		te = a[14] ^ d2e; to = a[15] ^ d2o;
+		b11e = ROL32(te, 3);
+		b11o = ROL32(to, 3);
+		te = a[24] ^ d2e; to = a[25] ^ d2o;
+		b2e = ROL32(to, 22);
+		b2o = ROL32(te, 21);
+		te = a[34] ^ d2e; to = a[35] ^ d2o;
+		b18e = ROL32(to, 8);
+		b18o = ROL32(te, 7);
+		te = a[44] ^ d2e; to = a[45] ^ d2o;
+		b9e = ROL32(to, 31);
+		b9o = ROL32(te, 30);
+		te = a[6] ^ d3e; to = a[7] ^ d3o;
+		b5e = ROL32(te, 14);
+		b5o = ROL32(to, 14);
+		te = a[16] ^ d3e; to = a[17] ^ d3o;
+		b21e = ROL32(to, 28);
+		b21o = ROL32(te, 27);
+		te = a[26] ^ d3e; to = a[27] ^ d3o;
+		b12e = ROL32(to, 13);
+		b12o = ROL32(te, 12);
+		te = a[36] ^ d3e; to = a[37] ^ d3o;
+		b3e = ROL32(to, 11);
+		b3o = ROL32(te, 10);
+		te = a[46] ^ d3e; to = a[47] ^ d3o;
+		b19e = ROL32(te, 28);
+		b19o = ROL32(to, 28);
+		te = a[8] ^ d4e; to = a[9] ^ d4o;
+		b15e = ROL32(to, 14);
+		b15o = ROL32(te, 13);
+		te = a[18] ^ d4e; to = a[19] ^ d4o;
+		b6e = ROL32(te, 10);
+		b6o = ROL32(to, 10);
+		te = a[28] ^ d4e; to = a[29] ^ d4o;
+		b22e = ROL32(to, 20);
+		b22o = ROL32(te, 19);
+		te = a[38] ^ d4e; to = a[39] ^ d4o;
+		b13e = ROL32(te, 4);
+		b13o = ROL32(to, 4);
+		te = a[48] ^ d4e; to = a[49] ^ d4o;
+		b4e = ROL32(te, 7);
+		b4o = ROL32(to, 7);
+		a[0] = b0e ^ (~b1e & b2e);
+		a[1] = b0o ^ (~b1o & b2o);
+		a[2] = b1e ^ (~b2e & b3e);
+		a[3] = b1o ^ (~b2o & b3o);
+		a[4] = b2e ^ (~b3e & b4e);
+		a[5] = b2o ^ (~b3o & b4o);
+		a[6] = b3e ^ (~b4e & b0e);
+		a[7] = b3o ^ (~b4o & b0o);
+		a[8] = b4e ^ (~b0e & b1e);
+		a[9] = b4o ^ (~b0o & b1o);
+		a[10] = b5e ^ (~b6e & b7e);
+		a[11] = b5o ^ (~b6o & b7o);
+		a[12] = b6e ^ (~b7e & b8e);
+		a[13] = b6o ^ (~b7o & b8o);
+		a[14] = b7e ^ (~b8e & b9e);
+		a[15] = b7o ^ (~b8o & b9o);
+		a[16] = b8e ^ (~b9e & b5e);
+		a[17] = b8o ^ (~b9o & b5o);
+		a[18] = b9e ^ (~b5e & b6e);
+		a[19] = b9o ^ (~b5o & b6o);
+		a[20] = b10e ^ (~b11e & b12e);
+		a[21] = b10o ^ (~b11o & b12o);
+		a[22] = b11e ^ (~b12e & b13e);
+		a[23] = b11o ^ (~b12o & b13o);
+		a[24] = b12e ^ (~b13e & b14e);
+		a[25] = b12o ^ (~b13o & b14o);
+		a[26] = b13e ^ (~b14e & b10e);
+		a[27] = b13o ^ (~b14o & b10o);
+		a[28] = b14e ^ (~b10e & b11e);
+		a[29] = b14o ^ (~b10o & b11o);
+		a[30] = b15e ^ (~b16e & b17e);
+		a[31] = b15o ^ (~b16o & b17o);
+		a[32] = b16e ^ (~b17e & b18e);
+		a[33] = b16o ^ (~b17o & b18o);
+		a[34] = b17e ^ (~b18e & b19e);
+		a[35] = b17o ^ (~b18o & b19o);
+		a[36] = b18e ^ (~b19e & b15e);
+		a[37] = b18o ^ (~b19o & b15o);
+		a[38] = b19e ^ (~b15e & b16e);
+		a[39] = b19o ^ (~b15o & b16o);
+		a[40] = b20e ^ (~b21e & b22e);
+		a[41] = b20o ^ (~b21o & b22o);
+		a[42] = b21e ^ (~b22e & b23e);
+		a[43] = b21o ^ (~b22o & b23o);
+		a[44] = b22e ^ (~b23e & b24e);
+		a[45] = b22o ^ (~b23o & b24o);
+		a[46] = b23e ^ (~b24e & b20e);
+		a[47] = b23o ^ (~b24o & b20o);
+		a[48] = b24e ^ (~b20e & b21e);
+		a[49] = b24o ^ (~b20o & b21o);
+		a[0] ^= keccak_rc[rnd][0];
+		a[1] ^= keccak_rc[rnd][1];
+	}
+
+	for (int i = 0; i < 25; i++) {
+		state[i] = ((uint64_t)a[2 * i + 1] << 32) | a[2 * i];
+	}
+}
+
+static void keccak_Init(SHA3_CTX *ctx, unsigned bits)
+{
+	memset(ctx, 0, sizeof(SHA3_CTX));
+	ctx->block_size = (1600 - bits * 2) / 8;
+}
+
+void sha3_224_Init(SHA3_CTX *ctx)
+{
+	keccak_Init(ctx, 224);
+}
+
+void sha3_256_Init(SHA3_CTX *ctx)
+{
+	keccak_Init(ctx, 256);
+}
+
+void sha3_384_Init(SHA3_CTX *ctx)
+{
+	keccak_Init(ctx, 384);
+}
+
+void sha3_512_Init(SHA3_CTX *ctx)
+{
+	keccak_Init(ctx, 512);
+}
+
+static void keccak_process_block(SHA3_CTX *ctx, const uint8_t *block)
+{
+	for (unsigned i = 0; i < ctx->block_size / 8; i++) {
+		keccak_absorb_lane(&ctx->hash[i], block + 8 * i);
+	}
+	keccak_permutation(ctx->hash);
+}
+
+void sha3_Update(SHA3_CTX *ctx, const unsigned char *msg, size_t size)
+{
+	uint8_t *buffer = (uint8_t *)ctx->message;
+	size_t idx = ctx->rest;
+	ctx->rest = (unsigned)((ctx->rest + size) % ctx->block_size);
+
+	if (idx) {
+		size_t left = ctx->block_size - idx;
+		memcpy(buffer + idx, msg, size < left ? size : left);
+		if (size < left) {
+			return;
+		}
+		keccak_process_block(ctx, buffer);
+		msg += left;
+		size -= left;
+	}
+	while (size >= ctx->block_size) {
+		keccak_process_block(ctx, msg);
+		msg += ctx->block_size;
+		size -= ctx->block_size;
+	}
+	if (size) {
+		memcpy(buffer, msg, size);
+	}
+}
+
+static void keccak_finish(SHA3_CTX *ctx, uint8_t pad, unsigned char *result)
+{
+	uint8_t *buffer = (uint8_t *)ctx->message;
+	const unsigned digest_length = 100 - ctx->block_size / 2;
+
+	memset(buffer + ctx->rest, 0, ctx->block_size - ctx->rest);
+	buffer[ctx->rest] |= pad;
+	buffer[ctx->block_size - 1] |= 0x80;
+	keccak_process_block(ctx, buffer);
+
+	if (result) {
+		for (unsigned i = 0; i < digest_length; i += 8) {
+			keccak_squeeze_lane(&ctx->hash[i / 8], result + i, digest_length - i < 8 ? digest_length - i : 8);
+		}
+	}
+	memzero(ctx, sizeof(SHA3_CTX));
+}
+
+void sha3_Final(SHA3_CTX *ctx, unsigned char *result)
+{
+	keccak_finish(ctx, 0x06, result);
+}
+
+#if USE_KECCAK
+void keccak_Final(SHA3_CTX *ctx, unsigned char *result)
+{
+	keccak_finish(ctx, 0x01, result);
+}
+
+void keccak_256(const unsigned char *data, size_t len, unsigned char *digest)
+{
+	SHA3_CTX ctx;
+	keccak_256_Init(&ctx);
+	keccak_Update(&ctx, data, len);
+	keccak_Final(&ctx, digest);
+}
+
+void keccak_512(const unsigned char *data, size_t len, unsigned char *digest)
+{
+	SHA3_CTX ctx;
+	keccak_512_Init(&ctx);
+	keccak_Update(&ctx, data, len);
+	keccak_Final(&ctx, digest);
+}
+#endif
+
+void sha3_256(const unsigned char *data, size_t len, unsigned char *digest)
+{
+	SHA3_CTX ctx;
+	sha3_256_Init(&ctx);
+	sha3_Update(&ctx, data, len);
+	sha3_Final(&ctx, digest);
+}
+
+void sha3_512(const unsigned char *data, size_t len, unsigned char *digest)
+{
+	SHA3_CTX ctx;
+	sha3_512_Init(&ctx);
+	sha3_Update(&ctx, data, len);
+	sha3_Final(&ctx, digest);
+}
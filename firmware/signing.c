@@ -27,6 +27,8 @@
 #include "crypto.h"
 #include "secp256k1.h"
 #include "gettext.h"
+#include "profile.h"
+#include "scratch.h"
 
 static uint8_t preblock_hash[32];
 static uint32_t inputs_count;
@@ -51,10 +53,23 @@ enum {
 static uint32_t idx1, idx2;
 static uint32_t signatures;
 static TxRequest resp;
-static TxInputType input;
 static TxOutputBinType bin_output;
-static TxStruct to, tp, ti;
-static Hasher hashers[3];
+// the bulky state lives in the shared workflow arena
+static TxStruct * const to = &scratch_arena.signing.to;
+static TxStruct * const tp = &scratch_arena.signing.tp;
+static TxStruct * const ti = &scratch_arena.signing.ti;
+static Hasher * const hashers = scratch_arena.signing.hashers;
+static TxInputType * const input = &scratch_arena.signing.input;
+static PrevTxCacheEntry * const prevtx_cache = scratch_arena.signing.prevtx_cache;
+#if LEGACY_SIGHASH_MIDSTATE
+// legacy sighash and transaction checksum over the first midstate_inputs
+// inputs, all with empty scripts
+static TxStruct * const tc = &scratch_arena.signing.tc;
+static Hasher * const check = &scratch_arena.signing.check;
+static uint32_t midstate_inputs;
+#endif
+static PrevTxCacheEntry *prevtx_pending;
+static uint32_t prevtx_cache_next;
 static uint8_t CONFIDENTIAL privkey[32];
 static uint8_t pubkey[33], sig[64];
 static uint8_t hash_prevouts[32], hash_sequence[32],hash_outputs[32];
@@ -69,6 +84,10 @@ static uint8_t multisig_fp[32];
 static uint32_t in_address_n[8];
 static size_t in_address_n_count;
 static uint32_t tx_weight;
+static bool sig_deferred, sig_computed;
+static int sig_computed_res;
+static uint32_t sig_deferred_index;
+static uint8_t sig_deferred_hash[32];
 
 /* A marker for in_address_n_count to indicate a mismatch in bip32 paths in
    input */
@@ -107,6 +126,9 @@ The STAGE_ constants describe the signing_stage when request is sent.
 I - input
 O - output
 
+A TxAck may carry several consecutive items of the requested kind, see
+send_req() for which requests can be answered in a batch.
+
 Phase1 - check inputs, previous transactions, and outputs
        - ask for confirmations
        - check fee
@@ -137,6 +159,13 @@ Ask for confirmation
 Phase2: sign inputs, check that nothing changed
 ===============================================
 
+Segwit (and force_bip143) inputs are signed with the BIP143 digests
+hash_prevouts, hash_sequence and hash_outputs computed in phase 1, so they
+only request the input itself (once here, once in phase 3).  Only inputs
+that need the legacy sighash re-request all inputs and outputs, and
+next_nonsegwit_input makes phase 2 skip straight to the next such input.
+A transaction without legacy inputs is therefore streamed in linear time.
+
 foreach I (idx1):  // input to sign
     if (idx1 is segwit)
         Request I                                                     STAGE_REQUEST_SEGWIT_INPUT
@@ -161,6 +190,19 @@ foreach I (idx1):  // input to sign
         Sign StreamTransactionSign
         Return signed chunk
 
+With LEGACY_SIGHASH_MIDSTATE the inputs before the next legacy input,
+which it hashes with empty scripts, are also hashed into a checkpoint of
+StreamTransactionSign and TransactionChecksum.  That input then resumes
+from the checkpoint and only requests the inputs from its own on, so
+signing many legacy inputs no longer costs quadratic hashing.  The
+checkpoint is only used after the pass that built it matched the
+checksum of phase 1.
+
+If the next input to sign is a legacy input as well, the request for it is
+sent before the signature is computed.  The signature is computed from the
+main loop while the host prepares its answer (signing_idle()) and the signed
+chunk is returned with the request that follows.
+
 foreach O (idx1):
     Request O                                                         STAGE_REQUEST_5_OUTPUT
     Rewrite change address
@@ -177,6 +219,67 @@ foreach I (idx1):  // input to sign
     Return witness
 */
 
+/*
+ * Batched requests: a host may answer a TxRequest with more than one
+ * consecutive item (inputs, prev outputs or outputs) in a single TxAck.
+ * Every request that can be answered this way announces how many items
+ * its TxAck may carry in details.extra_data_len, which is otherwise only
+ * set for TXEXTRADATA.  A host that does not know about batching ignores
+ * it and sends one item per TxAck as before, one that does opts in by
+ * sending up to that many.  While the next requested item is already part
+ * of the TxAck and no serialized data has to be returned, the request is
+ * not sent and the item is processed right away.
+ */
+static TransactionType *batch_tx;
+static uint32_t batch_stage;
+static pb_size_t batch_next;
+static bool batch_pending;
+
+static bool batch_has_next(void)
+{
+	if (!batch_tx || batch_stage != signing_stage || resp.has_serialized) {
+		return false;
+	}
+	switch (signing_stage) {
+		case STAGE_REQUEST_1_INPUT:
+		case STAGE_REQUEST_2_PREV_INPUT:
+		case STAGE_REQUEST_4_INPUT:
+			return batch_next + 1 < batch_tx->inputs_count;
+		case STAGE_REQUEST_2_PREV_OUTPUT:
+			return batch_next + 1 < batch_tx->bin_outputs_count;
+		case STAGE_REQUEST_3_OUTPUT:
+		case STAGE_REQUEST_4_OUTPUT:
+			return batch_next + 1 < batch_tx->outputs_count;
+		default:
+			return false;
+	}
+}
+
+// items of the current request a TxAck can hold, see types.options
+static uint32_t batch_capacity(void)
+{
+	switch (signing_stage) {
+		case STAGE_REQUEST_2_PREV_OUTPUT:
+			return pb_arraysize(TransactionType, bin_outputs);
+		case STAGE_REQUEST_3_OUTPUT:
+		case STAGE_REQUEST_4_OUTPUT:
+			return pb_arraysize(TransactionType, outputs);
+		default:
+			return pb_arraysize(TransactionType, inputs);
+	}
+}
+
+static void send_req(void)
+{
+	if (batch_has_next()) {
+		batch_pending = true;
+		return;
+	}
+	resp.details.has_extra_data_len = true;
+	resp.details.extra_data_len = batch_capacity();
+	msg_write(MessageType_MessageType_TxRequest, &resp);
+}
+
 void send_req_1_input(void)
 {
 	signing_stage = STAGE_REQUEST_1_INPUT;
@@ -185,7 +288,7 @@ void send_req_1_input(void)
 	resp.has_details = true;
 	resp.details.has_request_index = true;
 	resp.details.request_index = idx1;
-	msg_write(MessageType_MessageType_TxRequest, &resp);
+	send_req();
 }
 
 void send_req_2_prev_meta(void)
@@ -195,8 +298,8 @@ void send_req_2_prev_meta(void)
 	resp.request_type = RequestType_TXMETA;
 	resp.has_details = true;
 	resp.details.has_tx_hash = true;
-	resp.details.tx_hash.size = input.prev_hash.size;
-	memcpy(resp.details.tx_hash.bytes, input.prev_hash.bytes, input.prev_hash.size);
+	resp.details.tx_hash.size = input->prev_hash.size;
+	memcpy(resp.details.tx_hash.bytes, input->prev_hash.bytes, input->prev_hash.size);
 	msg_write(MessageType_MessageType_TxRequest, &resp);
 }
 
@@ -209,9 +312,9 @@ void send_req_2_prev_input(void)
 	resp.details.has_request_index = true;
 	resp.details.request_index = idx2;
 	resp.details.has_tx_hash = true;
-	resp.details.tx_hash.size = input.prev_hash.size;
-	memcpy(resp.details.tx_hash.bytes, input.prev_hash.bytes, resp.details.tx_hash.size);
-	msg_write(MessageType_MessageType_TxRequest, &resp);
+	resp.details.tx_hash.size = input->prev_hash.size;
+	memcpy(resp.details.tx_hash.bytes, input->prev_hash.bytes, resp.details.tx_hash.size);
+	send_req();
 }
 
 void send_req_2_prev_output(void)
@@ -223,9 +326,9 @@ void send_req_2_prev_output(void)
 	resp.details.has_request_index = true;
 	resp.details.request_index = idx2;
 	resp.details.has_tx_hash = true;
-	resp.details.tx_hash.size = input.prev_hash.size;
-	memcpy(resp.details.tx_hash.bytes, input.prev_hash.bytes, resp.details.tx_hash.size);
-	msg_write(MessageType_MessageType_TxRequest, &resp);
+	resp.details.tx_hash.size = input->prev_hash.size;
+	memcpy(resp.details.tx_hash.bytes, input->prev_hash.bytes, resp.details.tx_hash.size);
+	send_req();
 }
 
 void send_req_2_prev_extradata(uint32_t chunk_offset, uint32_t chunk_len)
@@ -239,8 +342,8 @@ void send_req_2_prev_extradata(uint32_t chunk_offset, uint32_t chunk_len)
 	resp.details.has_extra_data_len = true;
 	resp.details.extra_data_len = chunk_len;
 	resp.details.has_tx_hash = true;
-	resp.details.tx_hash.size = input.prev_hash.size;
-	memcpy(resp.details.tx_hash.bytes, input.prev_hash.bytes, resp.details.tx_hash.size);
+	resp.details.tx_hash.size = input->prev_hash.size;
+	memcpy(resp.details.tx_hash.bytes, input->prev_hash.bytes, resp.details.tx_hash.size);
 	msg_write(MessageType_MessageType_TxRequest, &resp);
 }
 
@@ -252,7 +355,7 @@ void send_req_3_output(void)
 	resp.has_details = true;
 	resp.details.has_request_index = true;
 	resp.details.request_index = idx1;
-	msg_write(MessageType_MessageType_TxRequest, &resp);
+	send_req();
 }
 
 void send_req_4_input(void)
@@ -263,7 +366,7 @@ void send_req_4_input(void)
 	resp.has_details = true;
 	resp.details.has_request_index = true;
 	resp.details.request_index = idx2;
-	msg_write(MessageType_MessageType_TxRequest, &resp);
+	send_req();
 }
 
 void send_req_4_output(void)
@@ -274,7 +377,7 @@ void send_req_4_output(void)
 	resp.has_details = true;
 	resp.details.has_request_index = true;
 	resp.details.request_index = idx2;
-	msg_write(MessageType_MessageType_TxRequest, &resp);
+	send_req();
 }
 
 void send_req_segwit_input(void)
@@ -338,6 +441,13 @@ void phase2_request_next_input(void)
 {
 	if (idx1 == next_nonsegwit_input) {
 		idx2 = 0;
+#if LEGACY_SIGHASH_MIDSTATE
+		if (idx1 > 0 && midstate_inputs == idx1) {
+			memcpy(ti, tc, sizeof(TxStruct));
+			memcpy(&hashers[0], check, sizeof(Hasher));
+			idx2 = idx1;
+		}
+#endif
 		send_req_4_input();
 	} else {
 		send_req_segwit_input();
@@ -416,7 +526,7 @@ bool compile_input_script_sig(TxInputType *tinput)
 		}
 	}
 	memcpy(&node, root, sizeof(HDNode));
-	if (hdnode_private_ckd_cached(&node, tinput->address_n, tinput->address_n_count, NULL) == 0) {
+	if (cryptoDeriveNode(&node, tinput->address_n, tinput->address_n_count, NULL) == 0) {
 		// Failed to derive private key
 		return false;
 	}
@@ -453,8 +563,13 @@ void signing_init(const SignTx *msg, const CoinInfo *_coin, const HDNode *_root)
 	spending = 0;
 	change_spend = 0;
 	authorized_amount = 0;
-	memset(&input, 0, sizeof(TxInputType));
+	scratch_claim(SCRATCH_SIGNING, signing_abort);
 	memset(&resp, 0, sizeof(TxRequest));
+	sig_deferred = false;
+	sig_computed = false;
+	prevtx_pending = NULL;
+	prevtx_cache_next = 0;
+	coinAddressCacheClear();
 
 	signing = true;
 	progress = 0;
@@ -466,8 +581,11 @@ void signing_init(const SignTx *msg, const CoinInfo *_coin, const HDNode *_root)
 	multisig_fp_set = false;
 	multisig_fp_mismatch = false;
 	next_nonsegwit_input = 0xffffffff;
+#if LEGACY_SIGHASH_MIDSTATE
+	midstate_inputs = 0;
+#endif
 
-	tx_init(&to, preblock_hash, inputs_count, outputs_count, version, lock_time, 0, coin->curve->hasher_sign);
+	tx_init(to, preblock_hash, inputs_count, outputs_count, version, lock_time, 0, coin->curve->hasher_sign);
 
 	// segwit hashes for hashPrevouts and hashSequence
 	hasher_Init(&hashers[0], coin->curve->hasher_sign);
@@ -515,15 +633,72 @@ static bool signing_check_input(TxInputType *txinput) {
 	return true;
 }
 
+/*
+ * Inputs often spend several outputs of the same previous transaction.
+ * The amounts of a streamed previous transaction are collected in the
+ * next cache slot, which becomes usable once the hash has been checked,
+ * so that later inputs spending the same transaction are not streamed
+ * again.  Transactions with more than PREVTX_CACHE_OUTPUTS outputs are
+ * not cached.
+ */
+static const PrevTxCacheEntry *prevtx_cache_find(const TxInputType *txinput) {
+	if (txinput->prev_hash.size != 32) {
+		return NULL;
+	}
+	for (int i = 0; i < PREVTX_CACHE_SIZE; i++) {
+		if (prevtx_cache[i].verified && memcmp(prevtx_cache[i].hash, txinput->prev_hash.bytes, 32) == 0) {
+			return &prevtx_cache[i];
+		}
+	}
+	return NULL;
+}
+
+static void prevtx_cache_start(uint32_t prev_outputs_count) {
+	prevtx_pending = NULL;
+	if (prev_outputs_count <= PREVTX_CACHE_OUTPUTS) {
+		prevtx_pending = &prevtx_cache[prevtx_cache_next];
+		memset(prevtx_pending, 0, sizeof(PrevTxCacheEntry));
+		prevtx_pending->outputs_count = prev_outputs_count;
+	}
+}
+
+static void prevtx_cache_verified(const uint8_t *hash) {
+	if (prevtx_pending) {
+		memcpy(prevtx_pending->hash, hash, 32);
+		prevtx_pending->verified = true;
+		prevtx_pending = NULL;
+		prevtx_cache_next = (prevtx_cache_next + 1) % PREVTX_CACHE_SIZE;
+	}
+}
+
+// adds the spent output of a cached previous transaction
+static bool signing_spend_cached_prevtx(const PrevTxCacheEntry *cached) {
+	if (cached->outputs_count <= input->prev_index) {
+		fsm_sendFailure(FailureType_Failure_DataError, _("Not enough outputs in previous transaction."));
+		signing_abort();
+		return false;
+	}
+	uint64_t amount = cached->amounts[input->prev_index];
+	if (to_spend + amount < to_spend) {
+		fsm_sendFailure(FailureType_Failure_DataError, _("Value overflow"));
+		signing_abort();
+		return false;
+	}
+	to_spend += amount;
+	phase1_request_next_input();
+	return true;
+}
+
 // check if the hash of the prevtx matches
 static bool signing_check_prevtx_hash(void) {
 	uint8_t hash[32];
-	tx_hash_final(&tp, hash, true);
-	if (memcmp(hash, input.prev_hash.bytes, 32) != 0) {
+	tx_hash_final(tp, hash, true);
+	if (memcmp(hash, input->prev_hash.bytes, 32) != 0) {
 		fsm_sendFailure(FailureType_Failure_DataError, _("Encountered invalid prevhash"));
 		signing_abort();
 		return false;
 	}
+	prevtx_cache_verified(hash);
 	phase1_request_next_input();
 	return true;
 }
@@ -585,7 +760,7 @@ static bool signing_check_output(TxOutputType *txoutput) {
 	int co = compile_output(coin, root, txoutput, &bin_output, !is_change);
 	if (!is_change) {
 		// DISPLAY : 1 line
-		layoutProgress(_("Signing transaction"), progress);
+		layoutProgressSet(_("Signing transaction"), progress);
 	}
 	if (co < 0) {
 		fsm_sendFailure(FailureType_Failure_ActionCancelled, NULL);
@@ -649,7 +824,7 @@ static void phase1_request_next_output(void) {
 		// Everything was checked, now phase 2 begins and the transaction is signed.
 		progress_meta_step = progress_step / (inputs_count + outputs_count);
 		// DISPLAY : 1 line
-		layoutProgress(_("Signing transaction"), progress);
+		layoutProgressSet(_("Signing transaction"), progress);
 		idx1 = 0;
 		phase2_request_next_input();
 	}
@@ -671,16 +846,15 @@ static void signing_hash_bip143(const TxInputType *txinput, uint8_t *hash) {
 	hasher_Final(&hashers[0], hash);
 }
 
-static bool signing_sign_hash(TxInputType *txinput, const uint8_t* private_key, const uint8_t *public_key, const uint8_t *hash) {
-	resp.serialized.has_signature_index = true;
-	resp.serialized.signature_index = idx1;
-	resp.serialized.has_signature = true;
-	resp.serialized.has_serialized_tx = true;
-	if (ecdsa_sign_digest(coin->curve->params, private_key, hash, sig, NULL, NULL) != 0) {
-		fsm_sendFailure(FailureType_Failure_ProcessError, _("Signing failed"));
-		signing_abort();
-		return false;
-	}
+static int signing_sign_digest(const uint8_t *private_key, const uint8_t *hash) {
+	uint32_t start = profileStart();
+	int res = ecdsa_sign_digest(coin->curve->params, private_key, hash, sig, NULL, NULL);
+	profileEnd(PROFILE_SIGN_DIGEST, start);
+	return res;
+}
+
+// encodes sig into the response and fills in the scriptSig of txinput
+static bool signing_fill_signature(TxInputType *txinput, const uint8_t *public_key) {
 	resp.serialized.signature.size = ecdsa_sig_to_der(sig, resp.serialized.signature.bytes);
 
 	uint8_t sighash = signing_hash_type() & 0xff;
@@ -706,8 +880,21 @@ static bool signing_sign_hash(TxInputType *txinput, const uint8_t* private_key,
 	return true;
 }
 
-static bool signing_sign_input(void) {
-	uint8_t hash[32];
+static bool signing_sign_hash(TxInputType *txinput, const uint8_t* private_key, const uint8_t *public_key, const uint8_t *hash) {
+	resp.serialized.has_signature_index = true;
+	resp.serialized.signature_index = idx1;
+	resp.serialized.has_signature = true;
+	resp.serialized.has_serialized_tx = true;
+	if (signing_sign_digest(private_key, hash) != 0) {
+		fsm_sendFailure(FailureType_Failure_ProcessError, _("Signing failed"));
+		signing_abort();
+		return false;
+	}
+	return signing_fill_signature(txinput, public_key);
+}
+
+// computes the legacy sighash of the input idx1 after all outputs were streamed
+static bool signing_hash_input(uint8_t *hash) {
 	hasher_Final(&hashers[0], hash);
 	if (memcmp(hash, hash_outputs, 32) != 0) {
 		fsm_sendFailure(FailureType_Failure_DataError, _("Transaction has changed during signing"));
@@ -716,12 +903,60 @@ static bool signing_sign_input(void) {
 	}
 
 	uint32_t hash_type = signing_hash_type();
-	hasher_Update(&ti.hasher, (const uint8_t *)&hash_type, 4);
-	tx_hash_final(&ti, hash, false);
+	hasher_Update(&ti->hasher, (const uint8_t *)&hash_type, 4);
+	tx_hash_final(ti, hash, false);
+	return true;
+}
+
+static bool signing_sign_input(void) {
+	uint8_t hash[32];
+	if (!signing_hash_input(hash))
+		return false;
 	resp.has_serialized = true;
-	if (!signing_sign_hash(&input, privkey, pubkey, hash))
+	if (!signing_sign_hash(input, privkey, pubkey, hash))
 		return false;
-	resp.serialized.serialized_tx.size = tx_serialize_input(&to, &input, resp.serialized.serialized_tx.bytes);
+	resp.serialized.serialized_tx.size = tx_serialize_input(to, input, resp.serialized.serialized_tx.bytes);
+	return true;
+}
+
+/*
+ * Deferred signature of a legacy input.  The sighash is final once the last
+ * output was streamed, and input, privkey and pubkey are not touched again
+ * until the first input of the next legacy pass arrives.  So the request for
+ * that input goes out first and the ECDSA runs while the host answers it.
+ */
+static bool signing_defer_input(void) {
+	if (!signing_hash_input(sig_deferred_hash))
+		return false;
+	sig_deferred = true;
+	sig_computed = false;
+	sig_deferred_index = idx1;
+	return true;
+}
+
+// returns the deferred signature with the response to the current TxAck
+static bool signing_deliver_input(void) {
+	if (!sig_computed) {
+		sig_computed_res = signing_sign_digest(privkey, sig_deferred_hash);
+	}
+	sig_deferred = false;
+	sig_computed = false;
+	if (sig_computed_res != 0) {
+		fsm_sendFailure(FailureType_Failure_ProcessError, _("Signing failed"));
+		signing_abort();
+		return false;
+	}
+	resp.has_serialized = true;
+	resp.serialized.has_signature_index = true;
+	resp.serialized.signature_index = sig_deferred_index;
+	resp.serialized.has_signature = true;
+	resp.serialized.has_serialized_tx = true;
+	if (!signing_fill_signature(input, pubkey))
+		return false;
+	resp.serialized.serialized_tx.size = tx_serialize_input(to, input, resp.serialized.serialized_tx.bytes);
+	signatures++;
+	// DISPLAY : 1 line
+	layoutProgressSet(_("Signing transaction"), 500 + ((signatures * progress_step) >> PROGRESS_PRECISION));
 	return true;
 }
 
@@ -787,7 +1022,7 @@ static bool signing_sign_segwit_input(TxInputType *txinput) {
 	//  if last witness add tx footer
 	if (idx1 == inputs_count - 1) {
 		uint32_t r = resp.serialized.serialized_tx.size;
-		r += tx_serialize_footer(&to, resp.serialized.serialized_tx.bytes + r);
+		r += tx_serialize_footer(to, resp.serialized.serialized_tx.bytes + r);
 		resp.serialized.serialized_tx.size = r;
 	}
 	return true;
@@ -795,33 +1030,23 @@ static bool signing_sign_segwit_input(TxInputType *txinput) {
 
 #define ENABLE_SEGWIT_NONSEGWIT_MIXING  1
 
-void signing_txack(TransactionType *tx)
+static void signing_txack_item(TransactionType *tx)
 {
-	if (!signing) {
-		fsm_sendFailure(FailureType_Failure_UnexpectedMessage, _("Not in Signing mode"));
-		layoutHome();
-		return;
-	}
-
-	static int update_ctr = 0;
-	if (update_ctr++ == 20) {
-		// DISPLAY : 1 line
-		layoutProgress(_("Signing transaction"), progress);
-		update_ctr = 0;
-	}
+	// DISPLAY : 1 line
+	layoutProgressSet(_("Signing transaction"), progress);
 
 	memset(&resp, 0, sizeof(TxRequest));
 
 	switch (signing_stage) {
 		case STAGE_REQUEST_1_INPUT:
-			signing_check_input(&tx->inputs[0]);
-			tx_weight += tx_input_weight(coin, &tx->inputs[0]);
-			if (tx->inputs[0].script_type == InputScriptType_SPENDMULTISIG
-				|| tx->inputs[0].script_type == InputScriptType_SPENDADDRESS) {
-				memcpy(&input, tx->inputs, sizeof(TxInputType));
+			signing_check_input(&tx->inputs[batch_next]);
+			tx_weight += tx_input_weight(coin, &tx->inputs[batch_next]);
+			if (tx->inputs[batch_next].script_type == InputScriptType_SPENDMULTISIG
+				|| tx->inputs[batch_next].script_type == InputScriptType_SPENDADDRESS) {
+				memcpy(input, &tx->inputs[batch_next], sizeof(TxInputType));
 #if !ENABLE_SEGWIT_NONSEGWIT_MIXING
 				// don't mix segwit and non-segwit inputs
-				if (idx1 > 0 && to.is_segwit == true) {
+				if (idx1 > 0 && to->is_segwit == true) {
 					fsm_sendFailure(FailureType_Failure_DataError, _("Mixing segwit and non-segwit inputs is not allowed"));
 					signing_abort();
 					return;
@@ -829,60 +1054,65 @@ void signing_txack(TransactionType *tx)
 #endif
 
 				if (coin->force_bip143) {
-					if (!tx->inputs[0].has_amount) {
+					if (!tx->inputs[batch_next].has_amount) {
 						fsm_sendFailure(FailureType_Failure_DataError, _("BIP 143 input without amount"));
 						signing_abort();
 						return;
 					}
-					if (to_spend + tx->inputs[0].amount < to_spend) {
+					if (to_spend + tx->inputs[batch_next].amount < to_spend) {
 						fsm_sendFailure(FailureType_Failure_DataError, _("Value overflow"));
 						signing_abort();
 						return;
 					}
-					to_spend += tx->inputs[0].amount;
-					authorized_amount += tx->inputs[0].amount;
+					to_spend += tx->inputs[batch_next].amount;
+					authorized_amount += tx->inputs[batch_next].amount;
 					phase1_request_next_input();
 				} else {
 					// remember the first non-segwit input -- this is the first input
 					// we need to sign during phase2
 					if (next_nonsegwit_input == 0xffffffff)
 						next_nonsegwit_input = idx1;
-					send_req_2_prev_meta();
+					const PrevTxCacheEntry *cached = prevtx_cache_find(input);
+					if (cached) {
+						signing_spend_cached_prevtx(cached);
+					} else {
+						send_req_2_prev_meta();
+					}
 				}
-			} else if  (tx->inputs[0].script_type == InputScriptType_SPENDWITNESS
-						|| tx->inputs[0].script_type == InputScriptType_SPENDP2SHWITNESS) {
+			} else if  (tx->inputs[batch_next].script_type == InputScriptType_SPENDWITNESS
+						|| tx->inputs[batch_next].script_type == InputScriptType_SPENDP2SHWITNESS) {
 				if (!coin->has_segwit) {
 					fsm_sendFailure(FailureType_Failure_DataError, _("Segwit not enabled on this coin"));
 					signing_abort();
 					return;
 				}
-				if (!tx->inputs[0].has_amount) {
+				if (!tx->inputs[batch_next].has_amount) {
 					fsm_sendFailure(FailureType_Failure_DataError, _("Segwit input without amount"));
 					signing_abort();
 					return;
 				}
-				if (to_spend + tx->inputs[0].amount < to_spend) {
+				if (to_spend + tx->inputs[batch_next].amount < to_spend) {
 					fsm_sendFailure(FailureType_Failure_DataError, _("Value overflow"));
 					signing_abort();
 					return;
 				}
-				if (!to.is_segwit) {
-					tx_weight += TXSIZE_SEGWIT_OVERHEAD + to.inputs_len;
+				if (!to->is_segwit) {
+					tx_weight += TXSIZE_SEGWIT_OVERHEAD + to->inputs_len;
 				}
 #if !ENABLE_SEGWIT_NONSEGWIT_MIXING
 				// don't mix segwit and non-segwit inputs
 				if (idx1 == 0) {
-					to.is_segwit = true;
-				} else if (to.is_segwit == false) {
+					to->is_segwit = true;
+				} else if (to->is_segwit == false) {
 					fsm_sendFailure(FailureType_Failure_DataError, _("Mixing segwit and non-segwit inputs is not allowed"));
 					signing_abort();
 					return;
 				}
 #else
-				to.is_segwit = true;
+				to->is_segwit = true;
 #endif
-				to_spend += tx->inputs[0].amount;
-				authorized_amount += tx->inputs[0].amount;
+				to_spend += tx->inputs[batch_next].amount;
+				authorized_amount += tx->inputs[batch_next].amount;
 				phase1_request_next_input();
 			} else {
 				fsm_sendFailure(FailureType_Failure_DataError, _("Wrong input script type"));
@@ -891,7 +1121,7 @@ void signing_txack(TransactionType *tx)
 			}
 			return;
 		case STAGE_REQUEST_2_PREV_META:
-			if (tx->outputs_cnt <= input.prev_index) {
+			if (tx->outputs_cnt <= input->prev_index) {
 				fsm_sendFailure(FailureType_Failure_DataError, _("Not enough outputs in previous transaction."));
 				signing_abort();
 				return;
@@ -901,24 +1131,25 @@ void signing_txack(TransactionType *tx)
 				signing_abort();
 				return;
 			}
-			tx_init(&tp, tx->preblock_hash.bytes, tx->inputs_cnt, tx->outputs_cnt, tx->version, tx->lock_time, tx->extra_data_len, coin->curve->hasher_sign);
-			progress_meta_step = progress_step / (tp.inputs_len + tp.outputs_len);
+			tx_init(tp, tx->preblock_hash.bytes, tx->inputs_cnt, tx->outputs_cnt, tx->version, tx->lock_time, tx->extra_data_len, coin->curve->hasher_sign);
+			prevtx_cache_start(tx->outputs_cnt);
+			progress_meta_step = progress_step / (tp->inputs_len + tp->outputs_len);
 			idx2 = 0;
-			if (tp.inputs_len > 0) {
+			if (tp->inputs_len > 0) {
 				send_req_2_prev_input();
 			} else {
-				tx_serialize_header_hash(&tp);
+				tx_serialize_header_hash(tp);
 				send_req_2_prev_output();
 			}
 			return;
 		case STAGE_REQUEST_2_PREV_INPUT:
 			progress = (idx1 * progress_step + idx2 * progress_meta_step) >> PROGRESS_PRECISION;
-			if (!tx_serialize_input_hash(&tp, tx->inputs)) {
+			if (!tx_serialize_input_hash(tp, &tx->inputs[batch_next])) {
 				fsm_sendFailure(FailureType_Failure_ProcessError, _("Failed to serialize input"));
 				signing_abort();
 				return;
 			}
-			if (idx2 < tp.inputs_len - 1) {
+			if (idx2 < tp->inputs_len - 1) {
 				idx2++;
 				send_req_2_prev_input();
 			} else {
@@ -927,26 +1158,29 @@ void signing_txack(TransactionType *tx)
 			}
 			return;
 		case STAGE_REQUEST_2_PREV_OUTPUT:
-			progress = (idx1 * progress_step + (tp.inputs_len + idx2) * progress_meta_step) >> PROGRESS_PRECISION;
-			if (!tx_serialize_output_hash(&tp, tx->bin_outputs)) {
+			progress = (idx1 * progress_step + (tp->inputs_len + idx2) * progress_meta_step) >> PROGRESS_PRECISION;
+			if (!tx_serialize_output_hash(tp, &tx->bin_outputs[batch_next])) {
 				fsm_sendFailure(FailureType_Failure_ProcessError, _("Failed to serialize output"));
 				signing_abort();
 				return;
 			}
-			if (idx2 == input.prev_index) {
-				if (to_spend + tx->bin_outputs[0].amount < to_spend) {
+			if (prevtx_pending) {
+				prevtx_pending->amounts[idx2] = tx->bin_outputs[batch_next].amount;
+			}
+			if (idx2 == input->prev_index) {
+				if (to_spend + tx->bin_outputs[batch_next].amount < to_spend) {
 					fsm_sendFailure(FailureType_Failure_DataError, _("Value overflow"));
 					signing_abort();
 					return;
 				}
-				to_spend += tx->bin_outputs[0].amount;
+				to_spend += tx->bin_outputs[batch_next].amount;
 			}
-			if (idx2 < tp.outputs_len - 1) {
+			if (idx2 < tp->outputs_len - 1) {
 				/* Check prevtx of next input */
 				idx2++;
 				send_req_2_prev_output();
-			} else if (tp.extra_data_len > 0) { // has extra data
-				send_req_2_prev_extradata(0, MIN(1024, tp.extra_data_len));
+			} else if (tp->extra_data_len > 0) { // has extra data
+				send_req_2_prev_extradata(0, MIN(1024, tp->extra_data_len));
 				return;
 			} else {
 				/* prevtx is done */
@@ -954,51 +1188,76 @@ void signing_txack(TransactionType *tx)
 			}
 			return;
 		case STAGE_REQUEST_2_PREV_EXTRADATA:
-			if (!tx_serialize_extra_data_hash(&tp, tx->extra_data.bytes, tx->extra_data.size)) {
+			if (!tx_serialize_extra_data_hash(tp, tx->extra_data.bytes, tx->extra_data.size)) {
 				fsm_sendFailure(FailureType_Failure_ProcessError, _("Failed to serialize extra data"));
 				signing_abort();
 				return;
 			}
-			if (tp.extra_data_received < tp.extra_data_len) { // still some data remanining
-				send_req_2_prev_extradata(tp.extra_data_received, MIN(1024, tp.extra_data_len - tp.extra_data_received));
+			if (tp->extra_data_received < tp->extra_data_len) { // still some data remanining
+				send_req_2_prev_extradata(tp->extra_data_received, MIN(1024, tp->extra_data_len - tp->extra_data_received));
 			} else {
 				signing_check_prevtx_hash();
 			}
 			return;
 		case STAGE_REQUEST_3_OUTPUT:
-			if (!signing_check_output(&tx->outputs[0])) {
+			if (!signing_check_output(&tx->outputs[batch_next])) {
 				return;
 			}
-			tx_weight += tx_output_weight(coin, &tx->outputs[0]);
+			tx_weight += tx_output_weight(coin, &tx->outputs[batch_next]);
 			phase1_request_next_output();
 			return;
 		case STAGE_REQUEST_4_INPUT:
+			// serialized data disables batching, so this is always the first item
+			if (sig_deferred && !signing_deliver_input()) {
+				return;
+			}
 			progress = 500 + ((signatures * progress_step + idx2 * progress_meta_step) >> PROGRESS_PRECISION);
 			if (idx2 == 0) {
-				tx_init(&ti, preblock_hash, inputs_count, outputs_count, version, lock_time, 0, coin->curve->hasher_sign);
+				tx_init(ti, preblock_hash, inputs_count, outputs_count, version, lock_time, 0, coin->curve->hasher_sign);
 				hasher_Reset(&hashers[0]);
 			}
 			// check prevouts and script type
-			tx_prevout_hash(&hashers[0], tx->inputs);
-			hasher_Update(&hashers[0], (const uint8_t *) &tx->inputs[0].script_type, sizeof(&tx->inputs[0].script_type));
+			tx_prevout_hash(&hashers[0], &tx->inputs[batch_next]);
+			hasher_Update(&hashers[0], (const uint8_t *) &tx->inputs[batch_next].script_type, sizeof(&tx->inputs[batch_next].script_type));
 			if (idx2 == idx1) {
-				if (!compile_input_script_sig(&tx->inputs[0])) {
+				if (!compile_input_script_sig(&tx->inputs[batch_next])) {
 					fsm_sendFailure(FailureType_Failure_ProcessError, _("Failed to compile input"));
 					signing_abort();
 					return;
 				}
-				memcpy(&input, &tx->inputs[0], sizeof(input));
+				memcpy(input, &tx->inputs[batch_next], sizeof(TxInputType));
 				memcpy(privkey, node.private_key, 32);
 				memcpy(pubkey, node.public_key, 33);
 			} else {
 				if (next_nonsegwit_input == idx1 && idx2 > idx1
-					&& (tx->inputs[0].script_type == InputScriptType_SPENDADDRESS
-						|| tx->inputs[0].script_type == InputScriptType_SPENDMULTISIG)) {
+					&& (tx->inputs[batch_next].script_type == InputScriptType_SPENDADDRESS
+						|| tx->inputs[batch_next].script_type == InputScriptType_SPENDMULTISIG)) {
 					next_nonsegwit_input = idx2;
 				}
-				tx->inputs[0].script_sig.size = 0;
+				tx->inputs[batch_next].script_sig.size = 0;
+			}
+#if LEGACY_SIGHASH_MIDSTATE
+			if (idx2 == idx1) {
+				// the signed input has an empty script for the inputs after it
+				memcpy(tc, ti, sizeof(TxStruct));
+				midstate_inputs = idx1;
+			}
+			// extend it up to the next legacy input
+			if (idx2 >= idx1 && midstate_inputs == idx2 && (idx2 == idx1 || next_nonsegwit_input != idx2)) {
+				pb_size_t script_size = tx->inputs[batch_next].script_sig.size;
+				tx->inputs[batch_next].script_sig.size = 0;
+				bool ok = tx_serialize_input_hash(tc, &tx->inputs[batch_next]);
+				tx->inputs[batch_next].script_sig.size = script_size;
+				if (!ok) {
+					fsm_sendFailure(FailureType_Failure_ProcessError, _("Failed to serialize input"));
+					signing_abort();
+					return;
+				}
+				memcpy(check, &hashers[0], sizeof(Hasher));
+				midstate_inputs++;
 			}
-			if (!tx_serialize_input_hash(&ti, tx->inputs)) {
+#endif
+			if (!tx_serialize_input_hash(ti, &tx->inputs[batch_next])) {
 				fsm_sendFailure(FailureType_Failure_ProcessError, _("Failed to serialize input"));
 				signing_abort();
 				return;
@@ -1021,14 +1280,14 @@ void signing_txack(TransactionType *tx)
 			return;
 		case STAGE_REQUEST_4_OUTPUT:
 			progress = 500 + ((signatures * progress_step + (inputs_count + idx2) * progress_meta_step) >> PROGRESS_PRECISION);
-			if (compile_output(coin, root, tx->outputs, &bin_output, false) <= 0) {
+			if (compile_output(coin, root, &tx->outputs[batch_next], &bin_output, false) <= 0) {
 				fsm_sendFailure(FailureType_Failure_ProcessError, _("Failed to compile output"));
 				signing_abort();
 				return;
 			}
 			//  check hashOutputs
 			tx_output_hash(&hashers[0], &bin_output);
-			if (!tx_serialize_output_hash(&ti, &bin_output)) {
+			if (!tx_serialize_output_hash(ti, &bin_output)) {
 				fsm_sendFailure(FailureType_Failure_ProcessError, _("Failed to serialize output"));
 				signing_abort();
 				return;
@@ -1036,6 +1295,12 @@ void signing_txack(TransactionType *tx)
 			if (idx2 < outputs_count - 1) {
 				idx2++;
 				send_req_4_output();
+			} else if (idx1 + 1 < inputs_count && next_nonsegwit_input == idx1 + 1) {
+				if (!signing_defer_input()) {
+					return;
+				}
+				idx1++;
+				phase2_request_next_input();
 			} else {
 				if (!signing_sign_input()) {
 					return;
@@ -1044,8 +1309,7 @@ void signing_txack(TransactionType *tx)
 				signatures++;
 				progress = 500 + ((signatures * progress_step) >> PROGRESS_PRECISION);
 				// DISPLAY : 1 line
-				layoutProgress(_("Signing transaction"), progress);
-				update_ctr = 0;
+				layoutProgressSet(_("Signing transaction"), progress);
 				if (idx1 < inputs_count - 1) {
 					idx1++;
 					phase2_request_next_input();
@@ -1061,38 +1325,37 @@ void signing_txack(TransactionType *tx)
 			resp.serialized.has_signature_index = false;
 			resp.serialized.has_signature = false;
 			resp.serialized.has_serialized_tx = true;
-			if (tx->inputs[0].script_type == InputScriptType_SPENDMULTISIG
-				|| tx->inputs[0].script_type == InputScriptType_SPENDADDRESS) {
+			if (tx->inputs[batch_next].script_type == InputScriptType_SPENDMULTISIG
+				|| tx->inputs[batch_next].script_type == InputScriptType_SPENDADDRESS) {
 				if (!coin->force_bip143) {
 					fsm_sendFailure(FailureType_Failure_DataError, _("Transaction has changed during signing"));
 					signing_abort();
 					return;
 				}
-				if (!compile_input_script_sig(&tx->inputs[0])) {
+				if (!compile_input_script_sig(&tx->inputs[batch_next])) {
 					fsm_sendFailure(FailureType_Failure_ProcessError, _("Failed to compile input"));
 					signing_abort();
 					return;
 				}
-				if (tx->inputs[0].amount > authorized_amount) {
+				if (tx->inputs[batch_next].amount > authorized_amount) {
 					fsm_sendFailure(FailureType_Failure_DataError, _("Transaction has changed during signing"));
 					signing_abort();
 					return;
 				}
-				authorized_amount -= tx->inputs[0].amount;
+				authorized_amount -= tx->inputs[batch_next].amount;
 
 				uint8_t hash[32];
-				signing_hash_bip143(&tx->inputs[0], hash);
-				if (!signing_sign_hash(&tx->inputs[0], node.private_key, node.public_key, hash))
+				signing_hash_bip143(&tx->inputs[batch_next], hash);
+				if (!signing_sign_hash(&tx->inputs[batch_next], node.private_key, node.public_key, hash))
 					return;
 				// since this took a longer time, update progress
 				signatures++;
 				progress = 500 + ((signatures * progress_step) >> PROGRESS_PRECISION);
 				// DISPLAY : 1 line
-				layoutProgress(_("Signing transaction"), progress);
-				update_ctr = 0;
-			} else if (tx->inputs[0].script_type == InputScriptType_SPENDP2SHWITNESS
-					   && !tx->inputs[0].has_multisig) {
-				if (!compile_input_script_sig(&tx->inputs[0])) {
+				layoutProgressSet(_("Signing transaction"), progress);
+			} else if (tx->inputs[batch_next].script_type == InputScriptType_SPENDP2SHWITNESS
+					   && !tx->inputs[batch_next].has_multisig) {
+				if (!compile_input_script_sig(&tx->inputs[batch_next])) {
 					fsm_sendFailure(FailureType_Failure_ProcessError, _("Failed to compile input"));
 					signing_abort();
 					return;
@@ -1100,27 +1363,27 @@ void signing_txack(TransactionType *tx)
 				// fixup normal p2pkh script into witness 0 p2wpkh script for p2sh
 				// we convert 76 A9 14 <digest> 88 AC  to 16 00 14 <digest>
 				// P2SH input pushes witness 0 script
-				tx->inputs[0].script_sig.size = 0x17; // drops last 2 bytes.
-				tx->inputs[0].script_sig.bytes[0] = 0x16; // push 22 bytes; replaces OP_DUP
-				tx->inputs[0].script_sig.bytes[1] = 0x00; // witness 0 script ; replaces OP_HASH160
+				tx->inputs[batch_next].script_sig.size = 0x17; // drops last 2 bytes.
+				tx->inputs[batch_next].script_sig.bytes[0] = 0x16; // push 22 bytes; replaces OP_DUP
+				tx->inputs[batch_next].script_sig.bytes[1] = 0x00; // witness 0 script ; replaces OP_HASH160
 				// digest is already in right place.
-			} else if (tx->inputs[0].script_type == InputScriptType_SPENDP2SHWITNESS) {
+			} else if (tx->inputs[batch_next].script_type == InputScriptType_SPENDP2SHWITNESS) {
 				// Prepare P2SH witness script.
-				tx->inputs[0].script_sig.size = 0x23; // 35 bytes long:
-				tx->inputs[0].script_sig.bytes[0] = 0x22; // push 34 bytes (full witness script)
-				tx->inputs[0].script_sig.bytes[1] = 0x00; // witness 0 script
-				tx->inputs[0].script_sig.bytes[2] = 0x20; // push 32 bytes (digest)
+				tx->inputs[batch_next].script_sig.size = 0x23; // 35 bytes long:
+				tx->inputs[batch_next].script_sig.bytes[0] = 0x22; // push 34 bytes (full witness script)
+				tx->inputs[batch_next].script_sig.bytes[1] = 0x00; // witness 0 script
+				tx->inputs[batch_next].script_sig.bytes[2] = 0x20; // push 32 bytes (digest)
 				// compute digest of multisig script
-				if (!compile_script_multisig_hash(coin, &tx->inputs[0].multisig, tx->inputs[0].script_sig.bytes + 3)) {
+				if (!compile_script_multisig_hash(coin, &tx->inputs[batch_next].multisig, tx->inputs[batch_next].script_sig.bytes + 3)) {
 					fsm_sendFailure(FailureType_Failure_ProcessError, _("Failed to compile input"));
 					signing_abort();
 					return;
 				}
 			} else {
 				// direct witness scripts require zero scriptSig
-				tx->inputs[0].script_sig.size = 0;
+				tx->inputs[batch_next].script_sig.size = 0;
 			}
-			resp.serialized.serialized_tx.size = tx_serialize_input(&to, &tx->inputs[0], resp.serialized.serialized_tx.bytes);
+			resp.serialized.serialized_tx.size = tx_serialize_input(to, &tx->inputs[batch_next], resp.serialized.serialized_tx.bytes);
 			if (idx1 < inputs_count - 1) {
 				idx1++;
 				phase2_request_next_input();
@@ -1131,18 +1394,18 @@ void signing_txack(TransactionType *tx)
 			return;
 
 		case STAGE_REQUEST_5_OUTPUT:
-			if (compile_output(coin, root, tx->outputs, &bin_output,false) <= 0) {
+			if (compile_output(coin, root, &tx->outputs[batch_next], &bin_output,false) <= 0) {
 				fsm_sendFailure(FailureType_Failure_ProcessError, _("Failed to compile output"));
 				signing_abort();
 				return;
 			}
 			resp.has_serialized = true;
 			resp.serialized.has_serialized_tx = true;
-			resp.serialized.serialized_tx.size = tx_serialize_output(&to, &bin_output, resp.serialized.serialized_tx.bytes);
+			resp.serialized.serialized_tx.size = tx_serialize_output(to, &bin_output, resp.serialized.serialized_tx.bytes);
 			if (idx1 < outputs_count - 1) {
 				idx1++;
 				send_req_5_output();
-			} else if (to.is_segwit) {
+			} else if (to->is_segwit) {
 				idx1 = 0;
 				send_req_segwit_witness();
 			} else {
@@ -1152,14 +1415,13 @@ void signing_txack(TransactionType *tx)
 			return;
 
 		case STAGE_REQUEST_SEGWIT_WITNESS:
-			if (!signing_sign_segwit_input(&tx->inputs[0])) {
+			if (!signing_sign_segwit_input(&tx->inputs[batch_next])) {
 				return;
 			}
 			signatures++;
 			progress = 500 + ((signatures * progress_step) >> PROGRESS_PRECISION);
 			// DISPLAY : 1 line
-			layoutProgress(_("Signing transaction"), progress);
-			update_ctr = 0;
+			layoutProgressSet(_("Signing transaction"), progress);
 			if (idx1 < inputs_count - 1) {
 				idx1++;
 				send_req_segwit_witness();
@@ -1174,8 +1436,46 @@ void signing_txack(TransactionType *tx)
 	signing_abort();
 }
 
+void signing_txack(TransactionType *tx)
+{
+	if (!signing) {
+		fsm_sendFailure(FailureType_Failure_UnexpectedMessage, _("Not in Signing mode"));
+		layoutHome();
+		return;
+	}
+
+	batch_tx = tx;
+	batch_stage = signing_stage;
+	batch_next = 0;
+	for (;;) {
+		batch_pending = false;
+		signing_txack_item(tx);
+		if (!batch_pending || !signing) {
+			break;
+		}
+		batch_next++;
+	}
+	batch_tx = NULL;
+}
+
+/*
+ * Called from the main loop after the pending request was handed to the
+ * USB stack.  Computes a deferred signature while the host is busy with the
+ * request, so it is ready when the answer arrives.
+ */
+void signing_idle(void)
+{
+	if (signing && sig_deferred && !sig_computed) {
+		sig_computed_res = signing_sign_digest(privkey, sig_deferred_hash);
+		sig_computed = true;
+	}
+}
+
 void signing_abort(void)
 {
+	scratch_release(SCRATCH_SIGNING);
+	sig_deferred = false;
+	sig_computed = false;
 	if (signing) {
 		layoutHome();
 		signing = false;
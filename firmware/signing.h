@@ -31,5 +31,6 @@
 void signing_init(const SignTx *msg, const CoinInfo *_coin, const HDNode *_root);
 void signing_abort(void);
 void signing_txack(TransactionType *tx);
+void signing_idle(void);
 
 #endif
@@ -0,0 +1,65 @@
+/*
+ * This file is part of the TREZOR project, https://trezor.io/
+ *
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "stats.h"
+#include "memory.h"
+#include "timer.h"
+
+StatsTable stats_table = {
+	.magic = STATS_MAGIC,
+	.msg_slots = STATS_MSG_SLOTS,
+};
+
+void statsMessage(uint16_t msg_id, uint32_t start_ms)
+{
+	uint32_t ms = timer_ms() - start_ms;
+	int bucket = 0;
+	while (bucket < STATS_LATENCY_BUCKETS - 1 && ms >= (1u << bucket)) {
+		bucket++;
+	}
+
+	// find the slot of this message type or take the first free one
+	for (int i = 0; i < STATS_MSG_SLOTS; i++) {
+		StatsMessage *slot = &stats_table.msg[i];
+		if (slot->calls == 0 || slot->msg_id == msg_id) {
+			slot->msg_id = msg_id;
+			slot->calls++;
+			if (slot->latency[bucket] < UINT16_MAX) {
+				slot->latency[bucket]++;
+			}
+			if (ms > slot->max_ms) {
+				slot->max_ms = ms;
+			}
+			return;
+		}
+	}
+}
+
+void statsFlashErase(uint8_t sector)
+{
+	if (sector >= FLASH_META_SECTOR_FIRST && sector < FLASH_META_SECTOR_FIRST + STATS_FLASH_SECTORS) {
+		stats_table.flash_erase[sector - FLASH_META_SECTOR_FIRST]++;
+	}
+}
+
+void statsFlashWords(uint32_t addr, uint32_t nwords)
+{
+	// the two meta sectors are 16 KB each
+	if (addr >= FLASH_META_START && addr < FLASH_META_START + FLASH_META_LEN) {
+		stats_table.flash_words[(addr - FLASH_META_START) / (FLASH_META_LEN / STATS_FLASH_SECTORS)] += nwords;
+	}
+}
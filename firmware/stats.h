@@ -0,0 +1,77 @@
+/*
+ * This file is part of the TREZOR project, https://trezor.io/
+ *
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __STATS_H__
+#define __STATS_H__
+
+#include <stdint.h>
+
+/*
+ * Event counters, always compiled in.
+ *
+ * Unlike the PROFILE=1 cycle counters these cost one increment on paths
+ * that do far more work anyway, so release builds keep them.  They are
+ * kept in stats_table, which DebugLinkMemoryRead can read from debug
+ * builds and the emulator.  A release build has nothing to report them
+ * through until the protocol gets a message for them.  The table is
+ * not persisted, all counters start from zero at boot.
+ *
+ * msg[] has one slot per message type in the order seen, with the time
+ * from decoding to the end of the handler as a histogram: bucket b
+ * holds handlers that took less than 2^b ms, the last bucket everything
+ * longer.  User interaction is included in that time.
+ */
+
+typedef enum {
+	STATS_IF_MAIN,		// HID or UDP main interface
+	STATS_IF_U2F,
+	STATS_IF_DEBUG,
+	STATS_IF_BULK,
+	STATS_IF_COUNT
+} StatsInterface;
+
+#define STATS_MAGIC             0x74617473 // 'stat'
+#define STATS_MSG_SLOTS         32
+#define STATS_LATENCY_BUCKETS   12
+#define STATS_FLASH_SECTORS     2          // meta sectors 2 and 3
+
+typedef struct {
+	uint16_t msg_id;
+	uint16_t latency[STATS_LATENCY_BUCKETS];
+	uint32_t calls;
+	uint32_t max_ms;
+} StatsMessage;
+
+typedef struct {
+	uint32_t magic;
+	uint32_t bytes_in[STATS_IF_COUNT];
+	uint32_t bytes_out[STATS_IF_COUNT];
+	uint32_t flash_erase[STATS_FLASH_SECTORS];
+	uint32_t flash_words[STATS_FLASH_SECTORS];
+	uint32_t seed_hits;		// session seed or seed cache
+	uint32_t seed_misses;		// PBKDF2 run
+	uint32_t msg_slots;
+	StatsMessage msg[STATS_MSG_SLOTS];
+} StatsTable;
+
+extern StatsTable stats_table;
+
+void statsMessage(uint16_t msg_id, uint32_t start_ms);
+void statsFlashErase(uint8_t sector);
+void statsFlashWords(uint32_t addr, uint32_t nwords);
+
+#endif
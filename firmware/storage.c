@@ -39,12 +39,17 @@
 #include "debug.h"
 #include "protect.h"
 #include "layout2.h"
+#include "messages.h"
 #include "usb.h"
 #include "gettext.h"
 #include "u2f.h"
 #include "memzero.h"
+#include "profile.h"
 #include "supervise.h"
 #include "cryptomem.h"
+#include "crypto.h"
+#include "tasks.h"
+#include "stats.h"
 
 /* magic constant to check validity of storage block */
 static const uint32_t storage_magic = 0x726f7473;   // 'stor' as uint32_t
@@ -52,11 +57,108 @@ static const uint32_t storage_magic = 0x726f7473;   // 'stor' as uint32_t
 static uint32_t storage_uuid[12 / sizeof(uint32_t)];
 _Static_assert(sizeof(storage_uuid) == 12, "storage_uuid has wrong size");
 
-Storage CONFIDENTIAL storageUpdate __attribute__((aligned(4)));
-_Static_assert((sizeof(storageUpdate) & 3) == 0, "storage unaligned");
+_Static_assert((sizeof(Storage) & 3) == 0, "storage unaligned");
+
+/*
+ * Pending changes to the storage.  Instead of a full Storage copy only the
+ * fields set since the last commit are kept, each as a StorageChange
+ * header followed by the new value padded to a word.  A field in the
+ * change-set replaces the stored one, all others are taken from the
+ * current record when the new record is written.
+ */
+typedef enum {
+	FIELD_NODE,
+	FIELD_MNEMONIC,
+	FIELD_PASSPHRASE_PROTECTION,
+	FIELD_PIN,
+	FIELD_LANGUAGE,
+	FIELD_LABEL,
+	FIELD_IMPORTED,
+	FIELD_HOMESCREEN,
+	FIELD_U2F_COUNTER,
+	FIELD_NEEDS_BACKUP,
+	FIELD_FLAGS,
+#if CRYPTOMEM
+	FIELD_SEED,
+#endif
+	FIELD_COUNT
+} StorageField;
+
+typedef struct {
+	uint16_t has;       // offset of the has_ flag
+	uint16_t offset;    // offset of the value
+	uint16_t size;      // size of the value
+} StorageFieldInfo;
+
+#define FIELD_INFO(NAME) { offsetof(Storage, has_##NAME), offsetof(Storage, NAME), pb_membersize(Storage, NAME) }
+
+static const StorageFieldInfo storage_fields[FIELD_COUNT] = {
+	[FIELD_NODE]                  = FIELD_INFO(node),
+	[FIELD_MNEMONIC]              = FIELD_INFO(mnemonic),
+	[FIELD_PASSPHRASE_PROTECTION] = FIELD_INFO(passphrase_protection),
+	[FIELD_PIN]                   = FIELD_INFO(pin),
+	[FIELD_LANGUAGE]              = FIELD_INFO(language),
+	[FIELD_LABEL]                 = FIELD_INFO(label),
+	[FIELD_IMPORTED]              = FIELD_INFO(imported),
+	[FIELD_HOMESCREEN]            = FIELD_INFO(homescreen),
+	[FIELD_U2F_COUNTER]           = FIELD_INFO(u2f_counter),
+	[FIELD_NEEDS_BACKUP]          = FIELD_INFO(needs_backup),
+	[FIELD_FLAGS]                 = FIELD_INFO(flags),
+#if CRYPTOMEM
+	[FIELD_SEED]                  = FIELD_INFO(seed),
+#endif
+};
+
+typedef struct {
+	uint8_t field;
+	bool has;
+	uint16_t len;       // bytes of the value that follow, the rest is zero
+} StorageChange;
+
+/*
+ * A field is in the change-set at most once and never with more than its
+ * own size, so the change-set holds any update, even one of all fields.
+ * It is never flushed half way, that would commit part of an operation.
+ */
+#define CHANGE_MAX(NAME) (sizeof(StorageChange) + ((pb_membersize(Storage, NAME) + 3) & ~3u))
+
+#if CRYPTOMEM
+#define CHANGE_MAX_SEED CHANGE_MAX(seed)
+#else
+#define CHANGE_MAX_SEED 0
+#endif
+
+#define STORAGE_CHANGES_LEN (CHANGE_MAX(node) + CHANGE_MAX(mnemonic) + CHANGE_MAX(passphrase_protection) \
+	+ CHANGE_MAX(pin) + CHANGE_MAX(language) + CHANGE_MAX(label) + CHANGE_MAX(imported) \
+	+ CHANGE_MAX(homescreen) + CHANGE_MAX(u2f_counter) + CHANGE_MAX(needs_backup) \
+	+ CHANGE_MAX(flags) + CHANGE_MAX_SEED)
+
+_Static_assert(FIELD_COUNT == 11 + CRYPTOMEM, "STORAGE_CHANGES_LEN misses a field");
+_Static_assert(STORAGE_CHANGES_LEN % sizeof(uint32_t) == 0, "STORAGE_CHANGES_LEN is not word aligned");
+
+static uint32_t CONFIDENTIAL storage_changes[STORAGE_CHANGES_LEN / sizeof(uint32_t)];
+static uint32_t storage_changes_end;    // bytes in use
+
+/* marks a complete storage record appended behind the first one */
+static const uint32_t storage_record_magic = 0x64636572;   // 'recd' as uint32_t
+
+/* precedes every appended record, see the storage layout below */
+typedef struct {
+	uint16_t len;       // bytes of the Storage structure in the record
+	uint16_t version;   // STORAGE_RECORD_VERSION
+} StorageRecordHeader;
+
+#define STORAGE_RECORD_VERSION 1
 
 #define FLASH_STORAGE (FLASH_STORAGE_START + sizeof(storage_magic) + sizeof(storage_uuid))
-#define storageRom ((const Storage *) FLASH_PTR(FLASH_STORAGE))
+#define storageRom ((const Storage *) FLASH_PTR(storage_record))
+
+/* address and length of the storage record currently in use */
+static uint32_t storage_record = FLASH_STORAGE;
+static uint32_t storage_record_len = sizeof(Storage);
+
+/* where the next record is appended, 0 if the sector has to be rewritten */
+static uint32_t storage_log_end;
 
 char storage_uuid_str[25];
 
@@ -68,11 +170,27 @@ char storage_uuid_str[25];
  0x0000 |     4 bytes  |  magic = 'stor'
  0x0004 |    12 bytes  |  uuid
  0x0010 |     ? bytes  |  Storage structure
+    ... |     ? bytes  |  reserved, erased
+ 0x080c |     4 bytes  |  record header of the Storage structure
+ 0x0810 |     ? bytes  |  appended storage records
 --------+--------------+-------------------------------
  0x4000 |     4 kbytes |  area for pin failures
  0x5000 |   256 bytes  |  area for u2f counter updates
  0x5100 | 11.75 kbytes |  reserved
 
+Instead of erasing the sector for every update, a new copy of the
+Storage structure is appended behind the last one.  Each appended
+record is a StorageRecordHeader, the Storage structure of the length
+given there and storage_record_magic.  The record is only valid once
+this word is written, so a torn update keeps the previous record.
+The first record keeps its place at 0x0010 where older firmware looks
+for it, its header sits at the end of the space reserved for it.
+The sector is erased and the first record rewritten only when no free
+slot is left, or when it was written in an older layout.  When the
+first record gets outdated its version is cleared, so that an older
+firmware without this log wipes the storage instead of reading stale
+settings.  The secrets of an outdated record are cleared as well.
+
 The area for pin failures looks like this:
 0 ... 0 pinfail 0xffffffff .. 0xffffffff
 The pinfail is a binary number of the form 1...10...0,
@@ -91,18 +209,52 @@ be added to the storage u2f_counter to get the real counter value.
 #define FLASH_STORAGE_PINAREA_LEN (0x1000)
 #define FLASH_STORAGE_U2FAREA     (FLASH_STORAGE_PINAREA + FLASH_STORAGE_PINAREA_LEN)
 #define FLASH_STORAGE_U2FAREA_LEN (0x100)
-#define FLASH_STORAGE_REALLEN     (sizeof(storage_magic) + sizeof(storage_uuid) + sizeof(Storage))
+#define FLASH_STORAGE_FIRST_LEN   (0x800)
+#define FLASH_STORAGE_FIRST_HDR   (FLASH_STORAGE + FLASH_STORAGE_FIRST_LEN - sizeof(StorageRecordHeader))
+#define FLASH_STORAGE_LOG         (FLASH_STORAGE + FLASH_STORAGE_FIRST_LEN)
+#define FLASH_STORAGE_RECORD_LEN(len) (sizeof(StorageRecordHeader) + (len) + sizeof(storage_record_magic))
+
+_Static_assert(sizeof(Storage) + sizeof(StorageRecordHeader) <= FLASH_STORAGE_FIRST_LEN, "Storage struct is too large for its reserved space");
 
 #if !EMULATOR
 // TODO: Fix this for emulator
-_Static_assert(FLASH_STORAGE_START + FLASH_STORAGE_REALLEN <= FLASH_STORAGE_PINAREA, "Storage struct is too large for TREZOR flash");
+_Static_assert(FLASH_STORAGE_LOG + FLASH_STORAGE_RECORD_LEN(sizeof(Storage)) <= FLASH_STORAGE_PINAREA, "Storage struct is too large for TREZOR flash");
 #endif
 
 /* Current u2f offset, i.e. u2f counter is
  * storage.u2f_counter + storage_u2f_offset.
  * This corresponds to the number of cleared bits in the U2FAREA.
+ *
+ * Bits are cleared U2F_COUNTER_RESERVE at a time, which reserves that
+ * many counter values.  storage_u2f_next counts the values handed out;
+ * after a reset all reserved values count as used.
  */
+#define U2F_COUNTER_RESERVE 16
 static uint32_t storage_u2f_offset;
+static uint32_t storage_u2f_next;
+static bool storage_u2f_used;
+
+/* Flash address of the current PIN failure word, the first non-zero word
+ * in the PINAREA.  Found once in storage_from_flash() and then moved along
+ * by the functions that write the area.
+ */
+static uint32_t storage_pinfails_offset = FLASH_STORAGE_PINAREA;
+
+/* Word writes and erases of the meta sectors, counted for the flash wear
+ * statistics.  The MPU keeps the meta sectors read-only for unprivileged
+ * code, so words go through the range checked supervisor call as well.
+ */
+static void storage_write32(uint32_t addr, uint32_t word)
+{
+	svc_flash_program_block(addr, &word, sizeof(word));
+	statsFlashWords(addr, 1);
+}
+
+static void storage_erase_sector(uint8_t sector)
+{
+	svc_flash_erase_sector(sector);
+	statsFlashErase(sector);
+}
 
 static bool sessionSeedCached, sessionSeedUsesPassphrase;
 
@@ -110,11 +262,69 @@ static uint8_t CONFIDENTIAL sessionSeed[64];
 
 static bool sessionPinCached;
 
+/* the stored mnemonic passed mnemonic_check() since it was last written */
+static bool mnemonicVerified;
+
 static bool sessionPassphraseCached;
 static char CONFIDENTIAL sessionPassphrase[51];
 
+#if SEED_WARMUP
+/* seed derivation started by the PIN unlock, see storage_warmupSeed */
+static bool warmupActive;
+static uint32_t warmupRounds;
+static CONFIDENTIAL PBKDF2_HMAC_SHA512_CTX warmupCtx;
+
+static void storage_warmupDrop(void)
+{
+	warmupActive = false;
+	warmupRounds = 0;
+	memzero(&warmupCtx, sizeof(warmupCtx));
+}
+#endif
+
+/* storage node decrypted with the session passphrase, see storage_getRootNode */
+static bool sessionRootNodeCached;
+static HDNode CONFIDENTIAL sessionRootNode;
+
+/* Seeds derived during this session, so that switching back to a
+ * wallet that was already unlocked does not run PBKDF2 again.  Entries
+ * are looked up by a digest of the passphrase, or by the exact state an
+ * Initialize bound them to, see session_switchState.  The passphrase is
+ * kept so that the session can be restored from the entry.  The cache
+ * is wiped with the session.
+ */
+#define SEED_CACHE_SIZE 4
+
+static struct {
+	bool set;
+	bool usesPassphrase;
+	bool bound;         // state is set
+	uint32_t age;
+	uint8_t digest[32];
+	uint8_t state[64];
+	char passphrase[sizeof(sessionPassphrase)];
+	uint8_t seed[64];
+} CONFIDENTIAL seedCache[SEED_CACHE_SIZE];
+
+static uint32_t seedCacheAge;
+
 #if CRYPTOMEM
+static bool cm_init_done;
 static bool cm_init_successful;
+
+/* Expanded mnemonic key and ESSIV, kept while the zone stays open so
+ * that decoding the mnemonic does not need the CryptoMemory again.
+ */
+static bool mnemonicKeyCached;
+static CONFIDENTIAL aes_decrypt_ctx mnemonicKeyCtx;
+static CONFIDENTIAL uint8_t mnemonicKeyEssiv[32];
+
+static void storage_clearMnemonicKey(void)
+{
+	mnemonicKeyCached = false;
+	memzero(&mnemonicKeyCtx, sizeof(mnemonicKeyCtx));
+	memzero(mnemonicKeyEssiv, sizeof(mnemonicKeyEssiv));
+}
 #endif
 
 #define STORAGE_VERSION 0x10001
@@ -134,6 +344,206 @@ void storage_check_flash_errors(uint32_t status)
 	}
 }
 
+#define CHANGE_AT(pos)      ((StorageChange *)((uint8_t *)storage_changes + (pos)))
+#define CHANGE_LEN(change)  (sizeof(StorageChange) + (((change)->len + 3) & ~3u))
+
+static StorageChange *storage_findChange(StorageField field)
+{
+	for (uint32_t pos = 0; pos < storage_changes_end; pos += CHANGE_LEN(CHANGE_AT(pos))) {
+		if (CHANGE_AT(pos)->field == field) {
+			return CHANGE_AT(pos);
+		}
+	}
+	return 0;
+}
+
+static void storage_dropChange(StorageField field)
+{
+	StorageChange *change = storage_findChange(field);
+	if (!change) {
+		return;
+	}
+	uint32_t pos = (uint8_t *)change - (uint8_t *)storage_changes;
+	uint32_t len = CHANGE_LEN(change);
+	memmove(change, (uint8_t *)change + len, storage_changes_end - pos - len);
+	storage_changes_end -= len;
+	memzero(CHANGE_AT(storage_changes_end), len);
+}
+
+// Set a new value for the field, returns the len bytes of the value to fill in.
+static void *storage_change(StorageField field, bool has, uint32_t len)
+{
+	storage_dropChange(field);
+	if (len > storage_fields[field].size
+		|| storage_changes_end + sizeof(StorageChange) + ((len + 3) & ~3u) > sizeof(storage_changes)) {
+		// cannot happen, see STORAGE_CHANGES_LEN
+		storage_show_error();
+	}
+	StorageChange *change = CHANGE_AT(storage_changes_end);
+	change->field = field;
+	change->has = has;
+	change->len = len;
+	storage_changes_end += CHANGE_LEN(change);
+	return change + 1;
+}
+
+// Value of a field set in the change-set, 0 if it is not changed or unset.
+static const void *storage_pending(StorageField field)
+{
+	const StorageChange *change = storage_findChange(field);
+	return (change && change->has) ? change + 1 : 0;
+}
+
+static void storage_changeString(StorageField field, const char *str)
+{
+	uint32_t len = 0;
+	while (len + 1 < storage_fields[field].size && str[len]) {
+		len++;
+	}
+	memcpy(storage_change(field, len != 0, len + 1), str, len);
+}
+
+// the value of a STORAGE_BYTES field is its size followed by the bytes,
+// laid out as in the structure of the field
+#define BYTES_SIZE_LEN  pb_membersize(Storage, homescreen.size)
+#define BYTES_OFFSET    (offsetof(Storage, homescreen.bytes) - offsetof(Storage, homescreen))
+
+_Static_assert(BYTES_SIZE_LEN == sizeof(uint32_t), "STORAGE_BYTES size has wrong type");
+_Static_assert(BYTES_OFFSET + pb_membersize(Storage, homescreen.bytes) == pb_membersize(Storage, homescreen), "STORAGE_BYTES has wrong layout");
+#if CRYPTOMEM
+_Static_assert(offsetof(Storage, seed.bytes) - offsetof(Storage, seed) == BYTES_OFFSET, "STORAGE_BYTES has wrong layout");
+#endif
+
+static void storage_changeBytes(StorageField field, const uint8_t *data, uint32_t size)
+{
+	size = MIN(size, storage_fields[field].size - BYTES_OFFSET);
+	uint8_t *value = storage_change(field, size != 0, BYTES_OFFSET + size);
+	memcpy(value, &size, BYTES_SIZE_LEN);
+	memcpy(value + BYTES_OFFSET, data, size);
+}
+
+static void storage_changeBool(StorageField field, bool value)
+{
+	*(bool *)storage_change(field, true, sizeof(bool)) = value;
+}
+
+static void storage_changeUint32(StorageField field, uint32_t value)
+{
+	*(uint32_t *)storage_change(field, true, sizeof(uint32_t)) = value;
+}
+
+// Storage length of the record with the header at addr, 0 if there is none.
+static uint32_t storage_record_header(uint32_t addr)
+{
+	const StorageRecordHeader *header = (const StorageRecordHeader *)FLASH_PTR(addr);
+	if (header->version != STORAGE_RECORD_VERSION ||
+		header->len < sizeof(uint32_t) || (header->len & 3) ||
+		header->len + sizeof(StorageRecordHeader) > FLASH_STORAGE_FIRST_LEN) {
+		return 0;
+	}
+	return header->len;
+}
+
+/*
+ * Sectors written before the record headers hold the first record and, if
+ * written by this log, copies of the same size at a fixed stride.  That
+ * size is the Storage of the firmware that wrote them, so every size this
+ * layout had is tried.  A record shorter than Storage ends in erased flash.
+ */
+static void storage_find_legacy_record(void)
+{
+	static const uint32_t legacy_len[] = {
+		sizeof(Storage),
+#if CRYPTOMEM
+		// before the seed was kept
+		(offsetof(Storage, has_seed) + 3) & ~3,
+#endif
+	};
+	for (uint32_t i = 0; i < sizeof(legacy_len) / sizeof(legacy_len[0]); i++) {
+		const uint32_t len = legacy_len[i];
+		uint32_t slot = FLASH_STORAGE + len;
+		while (slot + len + sizeof(storage_record_magic) <= FLASH_STORAGE_PINAREA &&
+			   *(const uint32_t *)FLASH_PTR(slot + len) == storage_record_magic) {
+			storage_record = slot;
+			storage_record_len = len;
+			slot += len + sizeof(storage_record_magic);
+		}
+		if (storage_record != FLASH_STORAGE) {
+			return;
+		}
+	}
+	for (uint32_t i = 0; i < sizeof(legacy_len) / sizeof(legacy_len[0]); i++) {
+		uint32_t addr = FLASH_STORAGE + legacy_len[i];
+		while (addr < FLASH_STORAGE + sizeof(Storage) && *(const uint32_t *)FLASH_PTR(addr) == 0xffffffff) {
+			addr += sizeof(uint32_t);
+		}
+		if (addr == FLASH_STORAGE + sizeof(Storage)) {
+			storage_record_len = MIN(storage_record_len, legacy_len[i]);
+		}
+	}
+}
+
+// Locate the newest complete storage record.
+static void storage_find_record(void)
+{
+	storage_record = FLASH_STORAGE;
+	storage_record_len = storage_record_header(FLASH_STORAGE_FIRST_HDR);
+	storage_log_end = 0;
+	if (!storage_record_len) {
+		// the sector gets rewritten with headers on the next commit
+		storage_record_len = sizeof(Storage);
+		storage_find_legacy_record();
+		return;
+	}
+	uint32_t slot = FLASH_STORAGE_LOG;
+	uint32_t len;
+	while ((len = storage_record_header(slot)) != 0 &&
+		   slot + FLASH_STORAGE_RECORD_LEN(len) <= FLASH_STORAGE_PINAREA &&
+		   *(const uint32_t *)FLASH_PTR(slot + sizeof(StorageRecordHeader) + len) == storage_record_magic) {
+		storage_record = slot + sizeof(StorageRecordHeader);
+		storage_record_len = len;
+		slot += FLASH_STORAGE_RECORD_LEN(len);
+	}
+	storage_log_end = slot;
+}
+
+// Address of the next free record slot, or 0 if the sector has to be erased.
+static uint32_t storage_free_slot(void)
+{
+	if (*(const uint32_t *)FLASH_PTR(FLASH_STORAGE_START) != storage_magic) {
+		return 0;
+	}
+	const uint32_t slot = storage_log_end;
+	if (!slot || slot + FLASH_STORAGE_RECORD_LEN(sizeof(Storage)) > FLASH_STORAGE_PINAREA) {
+		return 0;
+	}
+	// torn updates leave garbage
+	for (uint32_t addr = slot; addr < slot + FLASH_STORAGE_RECORD_LEN(sizeof(Storage)); addr += sizeof(uint32_t)) {
+		if (*(const uint32_t *)FLASH_PTR(addr) != 0xffffffff) {
+			return 0;
+		}
+	}
+	return slot;
+}
+
+/*
+ * Both meta areas only ever clear words front to back and never clear
+ * their last word, so the first non-zero word is found by bisection.
+ */
+static uint32_t storage_find_nonzero_word(uint32_t start, uint32_t len)
+{
+	uint32_t lo = 0, hi = len / sizeof(uint32_t) - 1;
+	while (lo < hi) {
+		uint32_t mid = (lo + hi) / 2;
+		if (*(const uint32_t*)FLASH_PTR(start + mid * sizeof(uint32_t)) == 0) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	return start + lo * sizeof(uint32_t);
+}
+
 bool storage_from_flash(void)
 {
 	storage_clear_update();
@@ -142,6 +552,10 @@ bool storage_from_flash(void)
 		return false;
 	}
 
+	storage_find_record();
+	// records without header or of another layout are rewritten
+	const bool relayout = !storage_log_end || storage_record_len != sizeof(Storage);
+
 	const uint32_t version = storageRom->version;
 	// version 1: since 1.0.0
 	// version 2: since 1.2.1
@@ -152,7 +566,7 @@ bool storage_from_flash(void)
 	// version 7: since 1.5.1
 	// version 8: since 1.5.2
 	// version 9: since 1.6.1
-	if (version > STORAGE_VERSION) {
+	if (version > STORAGE_VERSION || storage_record_len > sizeof(Storage)) {
 		// downgrade -> clear storage
 		return false;
 	}
@@ -184,12 +598,12 @@ bool storage_from_flash(void)
 		old_storage_size = OLD_STORAGE_SIZE(u2froot);
 	}
 
-	// erase newly added fields
-	if (old_storage_size != sizeof(Storage)) {
+	// erase newly added fields, only the first record can be that old
+	if (old_storage_size != sizeof(Storage) && storage_record == FLASH_STORAGE) {
 		svc_flash_unlock();
 		svc_flash_program(FLASH_CR_PROGRAM_X32);
 		for (uint32_t offset = old_storage_size; offset < sizeof(Storage); offset += sizeof(uint32_t)) {
-			flash_write32(FLASH_STORAGE_START + sizeof(storage_magic) + sizeof(storage_uuid) + offset, 0);
+			storage_write32(FLASH_STORAGE_START + sizeof(storage_magic) + sizeof(storage_uuid) + offset, 0);
 		}
 		storage_check_flash_errors(svc_flash_lock());
 	}
@@ -202,55 +616,68 @@ bool storage_from_flash(void)
 		}
 		svc_flash_unlock();
 		// erase extra storage sector
-		svc_flash_erase_sector(FLASH_META_SECTOR_LAST);
+		storage_erase_sector(FLASH_META_SECTOR_LAST);
 		svc_flash_program(FLASH_CR_PROGRAM_X32);
-		flash_write32(FLASH_STORAGE_PINAREA, 0xffffffff << pinctr);
+		storage_write32(FLASH_STORAGE_PINAREA, 0xffffffff << pinctr);
 		// storageRom.has_pin_failed_attempts and storageRom.pin_failed_attempts
 		// are erased by storage_update below
 		storage_check_flash_errors(svc_flash_lock());
 	}
-	const uint32_t *u2fptr = (const uint32_t*) FLASH_PTR(FLASH_STORAGE_U2FAREA);
-	while (*u2fptr == 0) {
-		u2fptr++;
-	}
-	storage_u2f_offset = 32 * (u2fptr - (const uint32_t*) FLASH_PTR(FLASH_STORAGE_U2FAREA));
-	uint32_t u2fword = *u2fptr;
-	while ((u2fword & 1) == 0) {
-		storage_u2f_offset++;
-		u2fword >>= 1;
-	}
+	storage_pinfails_offset = storage_find_nonzero_word(FLASH_STORAGE_PINAREA, FLASH_STORAGE_PINAREA_LEN);
+	uint32_t u2fword_offset = storage_find_nonzero_word(FLASH_STORAGE_U2FAREA, FLASH_STORAGE_U2FAREA_LEN);
+	uint32_t u2fword = *(const uint32_t*) FLASH_PTR(u2fword_offset);
+	storage_u2f_offset = 8 * (u2fword_offset - FLASH_STORAGE_U2FAREA)
+		+ (u2fword ? (uint32_t) __builtin_ctz(u2fword) : 32);
+	storage_u2f_next = storage_u2f_offset;
 	// force recomputing u2f root for storage version < 9.
 	// this is done by re-setting the mnemonic, which triggers the computation
-	if (version < 9) {
-		storageUpdate.has_mnemonic = storageRom->has_mnemonic;
-		strlcpy(storageUpdate.mnemonic, storageRom->mnemonic, sizeof(storageUpdate.mnemonic));
+	if (version < 9 && storageRom->has_mnemonic) {
+		storage_changeString(FIELD_MNEMONIC, storageRom->mnemonic);
 	}
 	// update storage version on flash
-	if (version != STORAGE_VERSION) {
+	if (version != STORAGE_VERSION || relayout) {
 		storage_update();
 	}
 #else
 	if (version != STORAGE_VERSION) {
 		return false;
 	}
+	if (relayout) {
+		storage_update();
+	}
 #endif
 
+	strSetLanguage(storage_getLanguage());
 	return true;
 }
 
+/*
+ * Only the flash copy is loaded here, the CryptoMemory is powered up by
+ * storage_initCryptomem() once USB is up.  A wipe needs the chip, so a
+ * missing or invalid storage brings it up right away.
+ */
 void storage_init(void)
 {
+	if (!storage_from_flash()) {
 #if CRYPTOMEM
-	cm_init_successful = cm_init();
+		storage_initCryptomem();
 #endif
-	if (!storage_from_flash()) {
 		storage_wipe();
 	}
 }
 
 #if CRYPTOMEM
+void storage_initCryptomem(void)
+{
+	if (!cm_init_done) {
+		cm_init_successful = cm_init();
+		cm_init_done = true;
+	}
+}
+
+// true until storage_initCryptomem() found out otherwise
 bool storage_cm_init_successful(void) {
-	return cm_init_successful;
+	return !cm_init_done || cm_init_successful;
 }
 #endif
 
@@ -261,40 +688,152 @@ void storage_generate_uuid(void)
 	data2hex(storage_uuid, sizeof(storage_uuid), storage_uuid_str);
 }
 
-void session_clear(bool clear_pin)
+// digest = HMAC-SHA256(passphrase, device_id)
+static void session_passphraseDigest(const char *passphrase, uint8_t digest[32])
+{
+	hmac_sha256((const uint8_t *)passphrase, strlen(passphrase), (const uint8_t *)storage_uuid, sizeof(storage_uuid), digest);
+}
+
+static const uint8_t *session_lookupSeed(bool usePassphrase, const uint8_t digest[32])
 {
+	for (int i = 0; i < SEED_CACHE_SIZE; i++) {
+		if (seedCache[i].set && seedCache[i].usesPassphrase == usePassphrase
+			&& memcmp(seedCache[i].digest, digest, 32) == 0) {
+			seedCache[i].age = ++seedCacheAge;
+			return seedCache[i].seed;
+		}
+	}
+	return NULL;
+}
+
+static void session_insertSeed(bool usePassphrase, const uint8_t digest[32], const char *passphrase, const uint8_t *seed)
+{
+	int slot = 0;
+	for (int i = 0; i < SEED_CACHE_SIZE; i++) {
+		if (!seedCache[i].set) {
+			slot = i;
+			break;
+		}
+		if (seedCache[i].age < seedCache[slot].age) {
+			slot = i;
+		}
+	}
+	seedCache[slot].set = true;
+	seedCache[slot].usesPassphrase = usePassphrase;
+	seedCache[slot].age = ++seedCacheAge;
+	memcpy(seedCache[slot].digest, digest, 32);
+	strlcpy(seedCache[slot].passphrase, passphrase, sizeof(seedCache[slot].passphrase));
+	memcpy(seedCache[slot].seed, seed, 64);
+}
+
+/*
+ * Drops the current seed and every cached one, needed whenever the
+ * stored secret changes.
+ */
+static void session_clearRootNode(void)
+{
+	sessionRootNodeCached = false;
+	memzero(&sessionRootNode, sizeof(sessionRootNode));
+}
+
+static void session_clearSeeds(void)
+{
+	session_clearRootNode();
 	sessionSeedCached = false;
 	memzero(&sessionSeed, sizeof(sessionSeed));
+	memzero(seedCache, sizeof(seedCache));
+	seedCacheAge = 0;
+#if SEED_WARMUP
+	storage_warmupDrop();
+#endif
+}
+
+/*
+ * Initialize with a state.  A state of the current wallet (see
+ * session_getState) binds its cache entry to that state.  A state an
+ * earlier Initialize bound to another cached wallet switches to it.  Any
+ * other state ends the session like an Initialize without one, which
+ * wipes the seed cache.  The PIN is not touched.
+ */
+void session_switchState(const uint8_t *state)
+{
+	uint8_t i_state[64];
+	bool current = session_getState(state, i_state, NULL) && memcmp(state, i_state, 64) == 0;
+	memzero(i_state, sizeof(i_state));
+	if (current) {
+		uint8_t digest[32];
+		session_passphraseDigest(sessionPassphrase, digest);
+		for (int i = 0; i < SEED_CACHE_SIZE; i++) {
+			if (seedCache[i].set && seedCache[i].usesPassphrase
+				&& memcmp(seedCache[i].digest, digest, 32) == 0) {
+				memcpy(seedCache[i].state, state, 64);
+				seedCache[i].bound = true;
+			}
+		}
+		memzero(digest, sizeof(digest));
+		return;
+	}
+	for (int i = 0; i < SEED_CACHE_SIZE; i++) {
+		if (!seedCache[i].set || !seedCache[i].bound
+			|| memcmp(seedCache[i].state, state, 64) != 0) {
+			continue;
+		}
+		session_clearRootNode();
+		cryptoNodeCacheClear();
+		cryptoPubkeyCacheClear();
+		strlcpy(sessionPassphrase, seedCache[i].passphrase, sizeof(sessionPassphrase));
+		sessionPassphraseCached = true;
+		memcpy(sessionSeed, seedCache[i].seed, sizeof(sessionSeed));
+		sessionSeedCached = true;
+		sessionSeedUsesPassphrase = true;
+		seedCache[i].age = ++seedCacheAge;
+		return;
+	}
+	session_clear(false);
+}
+
+void session_clear(bool clear_pin)
+{
+	session_clearSeeds();
 	sessionPassphraseCached = false;
 	memzero(&sessionPassphrase, sizeof(sessionPassphrase));
+	cryptoNodeCacheClear();
+	cryptoPubkeyCacheClear();
 	if (clear_pin) {
 		sessionPinCached = false;
 #if CRYPTOMEM
+		storage_clearMnemonicKey();
 		cm_deactivate_security();
 #endif
 	}
 }
 
 static uint32_t storage_flash_words(uint32_t addr, const uint32_t *src, int nwords) {
-	for (int i = 0; i < nwords; i++) {
-		flash_write32(addr, *src++);
-		addr += sizeof(uint32_t);
-	}
-	return addr;
+	svc_flash_program_block(addr, src, nwords * sizeof(uint32_t));
+	statsFlashWords(addr, nwords);
+	return addr + nwords * sizeof(uint32_t);
 }
 
 static void get_u2froot_callback(uint32_t iter, uint32_t total)
 {
 	// DISPLAY : 1 line
-	layoutProgress(_("Updating"), 1000 * iter / total);
+	layoutProgressSet(_("Updating"), 1000 * iter / total);
 }
 
+/*
+ * Derives the U2F root of a new mnemonic.  The passphrase-less seed it
+ * needs is kept as the session seed, so that the first request after
+ * setting up the device does not run PBKDF2 again.
+ */
 static void storage_compute_u2froot(const char* mnemonic, StorageHDNode *u2froot) {
 	static CONFIDENTIAL HDNode node;
+	static CONFIDENTIAL uint8_t seed[64];
 	char oldTiny = usbTiny(1);
-	mnemonic_to_seed(mnemonic, "", sessionSeed, get_u2froot_callback); // BIP-0039
+	uint32_t start = profileStart();
+	mnemonic_to_seed(mnemonic, "", seed, get_u2froot_callback); // BIP-0039
+	profileEnd(PROFILE_MNEMONIC_TO_SEED, start);
 	usbTiny(oldTiny);
-	hdnode_from_seed(sessionSeed, 64, NIST256P1_NAME, &node);
+	hdnode_from_seed(seed, 64, NIST256P1_NAME, &node);
 	hdnode_private_ckd(&node, U2F_KEY_PATH);
 	u2froot->depth = node.depth;
 	u2froot->child_num = U2F_KEY_PATH;
@@ -305,130 +844,201 @@ static void storage_compute_u2froot(const char* mnemonic, StorageHDNode *u2froot
 	memcpy(u2froot->private_key.bytes, node.private_key, sizeof(node.private_key));
 	memzero(&node, sizeof(node));
 	session_clear(false); // invalidate seed cache
+
+	uint8_t digest[32];
+	session_passphraseDigest("", digest);
+	session_insertSeed(false, digest, "", seed);
+	memzero(digest, sizeof(digest));
+	memcpy(sessionSeed, seed, sizeof(sessionSeed));
+	sessionSeedCached = true;
+	sessionSeedUsesPassphrase = false;
+	memzero(seed, sizeof(seed));
 }
 
-// if storage is filled in - update fields that has has_field set to true
-// if storage is NULL - do not backup original content - essentially a wipe
-static void storage_commit_locked(bool update)
+// Copy len bytes of src (zeros if src is 0) to offset in the record,
+// clipped to the part [start, start + size) held in chunk.
+static void storage_record_put(uint8_t *chunk, uint32_t start, uint32_t size, uint32_t offset, const void *src, uint32_t len)
+{
+	uint32_t from = MAX(offset, start);
+	uint32_t to = MIN(offset + len, start + size);
+	if (from >= to) {
+		return;
+	}
+	if (src) {
+		memcpy(chunk + from - start, (const uint8_t *)src + from - offset, to - from);
+	} else {
+		memzero(chunk + from - start, to - from);
+	}
+}
+
+static void storage_record_clear(uint8_t *chunk, uint32_t start, uint32_t size, const StorageFieldInfo *info)
+{
+	storage_record_put(chunk, start, size, info->has, 0, info->offset + info->size - info->has);
+}
+
+// Build the bytes [start, start + size) of the new record: the current
+// record with the pending changes applied.
+static void storage_record_build(uint8_t *chunk, uint32_t start, uint32_t size, const StorageHDNode *u2froot)
+{
+	static const StorageFieldInfo u2froot_info = FIELD_INFO(u2froot);
+	const uint32_t version = STORAGE_VERSION;
+	const bool has = true;
+
+	// fields the current record is too short for are zero
+	memzero(chunk, size);
+	storage_record_put(chunk, start, size, 0, storageRom, storage_record_len);
+	storage_record_put(chunk, start, size, offsetof(Storage, version), &version, sizeof(version));
+#if CRYPTOMEM
+	static const StorageFieldInfo zone_info = FIELD_INFO(zone_is_initialized);
+	storage_record_clear(chunk, start, size, &zone_info);
+#endif
+	// a new node or mnemonic replaces everything derived from the old one
+	if (storage_findChange(FIELD_NODE) || storage_findChange(FIELD_MNEMONIC)) {
+		storage_record_clear(chunk, start, size, &storage_fields[FIELD_NODE]);
+		storage_record_clear(chunk, start, size, &storage_fields[FIELD_MNEMONIC]);
+		storage_record_clear(chunk, start, size, &u2froot_info);
+#if CRYPTOMEM
+		storage_record_clear(chunk, start, size, &storage_fields[FIELD_SEED]);
+#endif
+	}
+	if (u2froot) {
+		storage_record_put(chunk, start, size, u2froot_info.has, &has, sizeof(has));
+		storage_record_put(chunk, start, size, u2froot_info.offset, u2froot, sizeof(StorageHDNode));
+	}
+	for (uint32_t pos = 0; pos < storage_changes_end; pos += CHANGE_LEN(CHANGE_AT(pos))) {
+		const StorageChange *change = CHANGE_AT(pos);
+		const StorageFieldInfo *info = &storage_fields[change->field];
+		storage_record_clear(chunk, start, size, info);
+		storage_record_put(chunk, start, size, info->has, &change->has, sizeof(change->has));
+		storage_record_put(chunk, start, size, info->offset, change + 1, MIN(change->len, info->size));
+	}
+}
+
+// Clear the secrets of a record that has been replaced by a newer one.
+static void storage_record_wipe(uint32_t record, uint32_t len)
 {
+	static const StorageFieldInfo secrets[] = {
+		FIELD_INFO(node),
+		FIELD_INFO(mnemonic),
+		FIELD_INFO(pin),
+		FIELD_INFO(u2froot),
+#if CRYPTOMEM
+		FIELD_INFO(seed),
+#endif
+	};
+	for (uint32_t i = 0; i < sizeof(secrets) / sizeof(secrets[0]); i++) {
+		// whole words, neighbouring fields of an outdated record do not matter
+		const uint32_t from = secrets[i].has & ~3u;
+		const uint32_t to = MIN((secrets[i].offset + secrets[i].size + 3u) & ~3u, len);
+		for (uint32_t offset = from; offset < to; offset += sizeof(uint32_t)) {
+			storage_write32(record + offset, 0);
+		}
+	}
+}
+
+// write a new record with the pending changes applied,
+// or an empty one if update is false - essentially a wipe
+static void storage_commit_locked_raw(bool update)
+{
+	static CONFIDENTIAL StorageHDNode u2froot;
+	const StorageHDNode *new_u2froot = 0;
+
+	if (!update || storage_findChange(FIELD_NODE) || storage_findChange(FIELD_MNEMONIC)) {
+		mnemonicVerified = false;
+	}
 	if (update) {
-		if (storageUpdate.has_passphrase_protection) {
-			sessionSeedCached = false;
+		if (storage_findChange(FIELD_PASSPHRASE_PROTECTION)) {
+			session_clearSeeds();
 			sessionPassphraseCached = false;
 		}
-		if (storageUpdate.has_pin) {
+		if (storage_findChange(FIELD_PIN)) {
 			sessionPinCached = false;
 		}
-
-		storageUpdate.version = STORAGE_VERSION;
-		if (!storageUpdate.has_node && !storageUpdate.has_mnemonic) {
-			storageUpdate.has_node = storageRom->has_node;
-			memcpy(&storageUpdate.node, &storageRom->node, sizeof(StorageHDNode));
-			storageUpdate.has_mnemonic = storageRom->has_mnemonic;
+		if (storage_pending(FIELD_MNEMONIC)) {
 #if CRYPTOMEM
-			// after encryption we cannot use strcpy anymore... copy everything
-			memcpy(storageUpdate.mnemonic, storageRom->mnemonic, sizeof(storageUpdate.mnemonic));
-#else
-			strlcpy(storageUpdate.mnemonic, storageRom->mnemonic, sizeof(storageUpdate.mnemonic));
-#endif
-			storageUpdate.has_u2froot = storageRom->has_u2froot;
-			memcpy(&storageUpdate.u2froot, &storageRom->u2froot, sizeof(StorageHDNode));
-		} else if (storageUpdate.has_mnemonic) {
-			storageUpdate.has_u2froot = true;
-#if CRYPTOMEM
-
-			char mnemonic[ sizeof(storageUpdate.mnemonic) ] = { 0 };
+			char mnemonic[pb_membersize(Storage, mnemonic)] = { 0 };
 			storage_getMnemonic(mnemonic);
 			if (mnemonic[0]) {
-				storage_compute_u2froot(mnemonic, &storageUpdate.u2froot);
-			} else {
-				storageUpdate.has_u2froot = false;
+				storage_compute_u2froot(mnemonic, &u2froot);
+				new_u2froot = &u2froot;
 			}
 			memzero(mnemonic, sizeof(mnemonic));
 #else
-			storage_compute_u2froot(storageUpdate.mnemonic, &storageUpdate.u2froot);
-#endif
-		}
-		if (!storageUpdate.has_passphrase_protection) {
-			storageUpdate.has_passphrase_protection = storageRom->has_passphrase_protection;
-			storageUpdate.passphrase_protection = storageRom->passphrase_protection;
-		}
-		if (!storageUpdate.has_pin) {
-			storageUpdate.has_pin = storageRom->has_pin;
-#if CRYPTOMEM
-			storageUpdate.pin = storageRom->pin;
-#else
-			strlcpy(storageUpdate.pin, storageRom->pin, sizeof(storageUpdate.pin));
-		} else if (!storageUpdate.pin[0]) {
-			storageUpdate.has_pin = false;
+			storage_compute_u2froot(storage_pending(FIELD_MNEMONIC), &u2froot);
+			new_u2froot = &u2froot;
 #endif
 		}
+	}
 
-		if (!storageUpdate.has_language) {
-			storageUpdate.has_language = storageRom->has_language;
-			strlcpy(storageUpdate.language, storageRom->language, sizeof(storageUpdate.language));
-		}
-		if (!storageUpdate.has_label) {
-			storageUpdate.has_label = storageRom->has_label;
-			strlcpy(storageUpdate.label, storageRom->label, sizeof(storageUpdate.label));
-		} else if (!storageUpdate.label[0]) {
-			storageUpdate.has_label = false;
-		}
-		if (!storageUpdate.has_imported) {
-			storageUpdate.has_imported = storageRom->has_imported;
-			storageUpdate.imported = storageRom->imported;
-		}
-		if (!storageUpdate.has_homescreen) {
-			storageUpdate.has_homescreen = storageRom->has_homescreen;
-			memcpy(&storageUpdate.homescreen, &storageRom->homescreen, sizeof(storageUpdate.homescreen));
-		} else if (storageUpdate.homescreen.size == 0) {
-			storageUpdate.has_homescreen = false;
+	uint32_t slot = update ? storage_free_slot() : 0;
+	if (slot) {
+		// the current record stays in place, build the new one a chunk at a time
+		const StorageRecordHeader header __attribute__ ((aligned(4))) = { sizeof(Storage), STORAGE_RECORD_VERSION };
+		storage_flash_words(slot, (const uint32_t *)&header, sizeof(header) / sizeof(uint32_t));
+		uint32_t chunk[64];
+		for (uint32_t offset = 0; offset < sizeof(Storage); offset += sizeof(chunk)) {
+			uint32_t len = MIN(sizeof(chunk), sizeof(Storage) - offset);
+			storage_record_build((uint8_t *)chunk, offset, len, new_u2froot);
+			storage_flash_words(slot + sizeof(header) + offset, chunk, len / sizeof(uint32_t));
 		}
-		if (!storageUpdate.has_u2f_counter) {
-			storageUpdate.has_u2f_counter = storageRom->has_u2f_counter;
-			storageUpdate.u2f_counter = storageRom->u2f_counter;
+		memzero(chunk, sizeof(chunk));
+		// commit the record
+		storage_write32(slot + sizeof(StorageRecordHeader) + sizeof(Storage), storage_record_magic);
+		if (storage_record == FLASH_STORAGE) {
+			// first record is outdated
+			storage_write32(FLASH_STORAGE + offsetof(Storage, version), 0);
 		}
-		if (!storageUpdate.has_needs_backup) {
-			storageUpdate.has_needs_backup = storageRom->has_needs_backup;
-			storageUpdate.needs_backup = storageRom->needs_backup;
-		}
-		if (!storageUpdate.has_flags) {
-			storageUpdate.has_flags = storageRom->has_flags;
-			storageUpdate.flags = storageRom->flags;
+		storage_record_wipe(storage_record, storage_record_len);
+		storage_record = slot + sizeof(StorageRecordHeader);
+		storage_record_len = sizeof(Storage);
+		storage_log_end = slot + FLASH_STORAGE_RECORD_LEN(sizeof(Storage));
+	} else {
+		// the current record goes with the sector, build the new one first
+		Storage record;
+		if (update) {
+			storage_record_build((uint8_t *)&record, 0, sizeof(record), new_u2froot);
+		} else {
+			memzero(&record, sizeof(record));
 		}
-	}
-
-	// backup meta
-	uint32_t meta_backup[FLASH_META_DESC_LEN / sizeof(uint32_t)];
-	memcpy(meta_backup, FLASH_PTR(FLASH_META_START), FLASH_META_DESC_LEN);
-
-	// erase storage
-	svc_flash_erase_sector(FLASH_META_SECTOR_FIRST);
-	svc_flash_program(FLASH_CR_PROGRAM_X32);
 
-	// copy meta back
-	uint32_t flash = FLASH_META_START;
-	flash = storage_flash_words(flash, meta_backup, FLASH_META_DESC_LEN / sizeof(uint32_t));
-
-	// copy storage
-	flash = storage_flash_words(flash, &storage_magic, sizeof(storage_magic) / sizeof(uint32_t));
-	flash = storage_flash_words(flash, storage_uuid, sizeof(storage_uuid) / sizeof(uint32_t));
-
-	if (update) {
-		flash = storage_flash_words(flash, (const uint32_t *)&storageUpdate, sizeof(storageUpdate) / sizeof(uint32_t));
+		// storage header
+		uint32_t header[(sizeof(storage_magic) + sizeof(storage_uuid)) / sizeof(uint32_t)];
+		memcpy(header, &storage_magic, sizeof(storage_magic));
+		memcpy((uint8_t *)header + sizeof(storage_magic), storage_uuid, sizeof(storage_uuid));
+
+		// erase storage, the supervisor keeps the firmware header
+		storage_erase_sector(FLASH_META_SECTOR_FIRST);
+
+		uint32_t flash = FLASH_STORAGE_START;
+		flash = storage_flash_words(flash, header, sizeof(header) / sizeof(uint32_t));
+
+		// copy storage, the remainder stays erased for the records appended later
+		storage_flash_words(flash, (const uint32_t *)&record, sizeof(record) / sizeof(uint32_t));
+		memzero(&record, sizeof(record));
+		const StorageRecordHeader first __attribute__ ((aligned(4))) = { sizeof(Storage), STORAGE_RECORD_VERSION };
+		storage_flash_words(FLASH_STORAGE_FIRST_HDR, (const uint32_t *)&first, sizeof(first) / sizeof(uint32_t));
+		storage_record = FLASH_STORAGE;
+		storage_record_len = sizeof(Storage);
+		storage_log_end = FLASH_STORAGE_LOG;
 	}
+	memzero(&u2froot, sizeof(u2froot));
 	storage_clear_update();
+	strSetLanguage(storage_getLanguage());
+}
 
-	// fill remainder with zero for future extensions
-	while (flash < FLASH_STORAGE_PINAREA) {
-		flash_write32(flash, 0);
-		flash += sizeof(uint32_t);
-	}
+static void storage_commit_locked(bool update)
+{
+	uint32_t start = profileStart();
+	storage_commit_locked_raw(update);
+	profileEnd(PROFILE_STORAGE_COMMIT, start);
+	// label, homescreen, flags or language may have changed
+	layoutHomeInvalidate();
 }
 
 void storage_clear_update(void)
 {
-	memzero(&storageUpdate, sizeof(storageUpdate));
+	memzero(storage_changes, sizeof(storage_changes));
+	storage_changes_end = 0;
 }
 
 void storage_update(void)
@@ -439,17 +1049,18 @@ void storage_update(void)
 }
 
 static void storage_setNode(const HDNodeType *node) {
-	storageUpdate.node.depth = node->depth;
-	storageUpdate.node.fingerprint = node->fingerprint;
-	storageUpdate.node.child_num = node->child_num;
+	StorageHDNode *stored = storage_change(FIELD_NODE, true, sizeof(StorageHDNode));
+	stored->depth = node->depth;
+	stored->fingerprint = node->fingerprint;
+	stored->child_num = node->child_num;
 
-	storageUpdate.node.chain_code.size = 32;
-	memcpy(storageUpdate.node.chain_code.bytes, node->chain_code.bytes, 32);
+	stored->chain_code.size = 32;
+	memcpy(stored->chain_code.bytes, node->chain_code.bytes, 32);
 
 	if (node->has_private_key) {
-		storageUpdate.node.has_private_key = true;
-		storageUpdate.node.private_key.size = 32;
-		memcpy(storageUpdate.node.private_key.bytes, node->private_key.bytes, 32);
+		stored->has_private_key = true;
+		stored->private_key.size = 32;
+		memcpy(stored->private_key.bytes, node->private_key.bytes, 32);
 	}
 }
 
@@ -479,8 +1090,7 @@ void storage_loadDevice(LoadDevice *msg)
 {
 	session_clear(true);
 
-	storageUpdate.has_imported = true;
-	storageUpdate.imported = true;
+	storage_changeBool(FIELD_IMPORTED, true);
 
 	storage_setPin(msg->has_pin ? msg->pin : "");
 #if CRYPTOMEM
@@ -491,42 +1101,38 @@ void storage_loadDevice(LoadDevice *msg)
 		pw = PinStringToHex(msg->pin);
 	} else
 		pw = CM_DEFAULT_PW;
+	storage_clearMnemonicKey();
 	uint8_t cm_ret = cm_open_zone(pw);
 #endif
 	storage_setPassphraseProtection(msg->has_passphrase_protection && msg->passphrase_protection);
 
 	if (msg->has_node) {
-		storageUpdate.has_node = true;
-		storageUpdate.has_mnemonic = false;
+		storage_dropChange(FIELD_MNEMONIC);
 		storage_setNode(&(msg->node));
-		sessionSeedCached = false;
-		memzero(&sessionSeed, sizeof(sessionSeed));
+		session_clearSeeds();
 		// FIXME CRYPTOMEM: currently we only protect seeds by encryption, not nodes
 	} else if (msg->has_mnemonic) {
-		storageUpdate.has_mnemonic = true;
-		storageUpdate.has_node = false;
+		storage_dropChange(FIELD_NODE);
 		// FIXME CRYPTOMEM: how do we treat U2F node here?
 #if CRYPTOMEM
 		// send PIN if needed
 		if (cm_ret != CM_SUCCESS || !encrypt_and_store_mnemonic(msg->mnemonic))
-				storageUpdate.has_mnemonic = false;
+				storage_dropChange(FIELD_MNEMONIC);
 #else
-		strlcpy(storageUpdate.mnemonic, msg->mnemonic, sizeof(storageUpdate.mnemonic));
+		storage_changeString(FIELD_MNEMONIC, msg->mnemonic);
 #endif
-		sessionSeedCached = false;
-		memzero(&sessionSeed, sizeof(sessionSeed));
+		session_clearSeeds();
 	}
 
 	if (msg->has_language) {
-		storageUpdate.has_language = true;
-		strlcpy(storageUpdate.language, msg->language, sizeof(storageUpdate.language));
+		storage_changeString(FIELD_LANGUAGE, msg->language);
 	}
 
 	storage_setLabel(msg->has_label ? msg->label : "");
 
 	if (msg->has_u2f_counter) {
-		storageUpdate.has_u2f_counter = true;
-		storageUpdate.u2f_counter = msg->u2f_counter - storage_u2f_offset;
+		storage_changeUint32(FIELD_U2F_COUNTER, msg->u2f_counter - storage_u2f_offset);
+		storage_u2f_next = storage_u2f_offset;
 	}
 
 	storage_update();
@@ -534,9 +1140,8 @@ void storage_loadDevice(LoadDevice *msg)
 
 void storage_setLabel(const char *label)
 {
-	storageUpdate.has_label = true;
-	if (!label) return;
-	strlcpy(storageUpdate.label, label, sizeof(storageUpdate.label));
+	// an empty label clears it
+	storage_changeString(FIELD_LABEL, label ? label : "");
 }
 
 void storage_setLanguage(const char *lang)
@@ -544,24 +1149,21 @@ void storage_setLanguage(const char *lang)
 	if (!lang) return;
 	// legacy support
 	if (strcmp(lang, "english") == 0) {
-		storageUpdate.has_language = true;
-		strlcpy(storageUpdate.language, "EN", sizeof(storageUpdate.language));
+		storage_changeString(FIELD_LANGUAGE, "EN");
 		return;
 	}
 	// sanity check
 	if (strcmp(lang, "EN") == 0 || strcmp(lang, "FR") == 0 || strcmp(lang, "DE") == 0) {
-		storageUpdate.has_language = true;
-		strlcpy(storageUpdate.language, lang, sizeof(storageUpdate.language));
+		storage_changeString(FIELD_LANGUAGE, lang);
 	}	
 }
 
 void storage_setPassphraseProtection(bool passphrase_protection)
 {
-	sessionSeedCached = false;
+	session_clearSeeds();
 	sessionPassphraseCached = false;
 
-	storageUpdate.has_passphrase_protection = true;
-	storageUpdate.passphrase_protection = passphrase_protection;
+	storage_changeBool(FIELD_PASSPHRASE_PROTECTION, passphrase_protection);
 }
 
 bool storage_hasPassphraseProtection(void)
@@ -571,13 +1173,10 @@ bool storage_hasPassphraseProtection(void)
 
 void storage_setHomescreen(const uint8_t *data, uint32_t size)
 {
-	storageUpdate.has_homescreen = true;
 	if (data && size == 1024) {
-		memcpy(storageUpdate.homescreen.bytes, data, size);
-		storageUpdate.homescreen.size = size;
+		storage_changeBytes(FIELD_HOMESCREEN, data, size);
 	} else {
-		memset(storageUpdate.homescreen.bytes, 0, sizeof(storageUpdate.homescreen.bytes));
-		storageUpdate.homescreen.size = 0;
+		storage_change(FIELD_HOMESCREEN, false, 0);
 	}
 }
 
@@ -585,7 +1184,71 @@ static void get_root_node_callback(uint32_t iter, uint32_t total)
 {
 	usbSleep(1);
 	// DISPLAY : 1 line
-	layoutProgress(_("Waking up"), 1000 * iter / total);
+	layoutProgressSet(_("Waking up"), 1000 * iter / total);
+	tasksRun(TASKS_NESTED);
+}
+
+#define STORAGE_PBKDF2_SLICE (BIP39_PBKDF2_ROUNDS / 32)
+
+static bool seedDerivationCancelled;
+
+/*
+ * Runs the rounds of a PBKDF2 job in slices and services USB between
+ * two slices.  Cancel or Initialize from the host abort the job, in
+ * that case false is returned and the caller has to drop the context.
+ */
+static bool storage_pbkdf2_slices(PBKDF2_HMAC_SHA512_CTX *pctx, uint32_t rounds)
+{
+	seedDerivationCancelled = false;
+	char oldTiny = usbTiny(1);
+	get_root_node_callback(0, rounds);
+	for (uint32_t done = 0; done < rounds; done += STORAGE_PBKDF2_SLICE) {
+		pbkdf2_hmac_sha512_Update(pctx, STORAGE_PBKDF2_SLICE);
+		get_root_node_callback(done + STORAGE_PBKDF2_SLICE, rounds);
+		if (protectAbortRequested()) {
+			seedDerivationCancelled = true;
+			break;
+		}
+	}
+	usbTiny(oldTiny);
+	return !seedDerivationCancelled;
+}
+
+/*
+ * BIP-0039 mnemonic to seed, the same as mnemonic_to_seed() but it can
+ * be cancelled by the host.
+ */
+static bool storage_mnemonic_to_seed(const char *mnemonic, const char *passphrase, uint8_t seed[64])
+{
+#if SEED_WARMUP
+	// take over the warm-up, it runs for the same wallet without passphrase
+	if (warmupActive && passphrase[0] == 0) {
+		bool done = storage_pbkdf2_slices(&warmupCtx, BIP39_PBKDF2_ROUNDS - warmupRounds);
+		if (done) {
+			pbkdf2_hmac_sha512_Final(&warmupCtx, seed);
+		}
+		storage_warmupDrop();
+		return done;
+	}
+#endif
+	static CONFIDENTIAL PBKDF2_HMAC_SHA512_CTX pctx;
+	uint8_t salt[8 + sizeof(sessionPassphrase)];
+	size_t passlen = MIN(strlen(passphrase), sizeof(sessionPassphrase) - 1);
+	memcpy(salt, "mnemonic", 8);
+	memcpy(salt + 8, passphrase, passlen);
+	pbkdf2_hmac_sha512_Init(&pctx, (const uint8_t *)mnemonic, strlen(mnemonic), salt, 8 + passlen);
+	memzero(salt, sizeof(salt));
+	bool ok = storage_pbkdf2_slices(&pctx, BIP39_PBKDF2_ROUNDS);
+	if (ok) {
+		pbkdf2_hmac_sha512_Final(&pctx, seed);
+	}
+	memzero(&pctx, sizeof(pctx));
+	return ok;
+}
+
+bool storage_seedDerivationCancelled(void)
+{
+	return seedDerivationCancelled;
 }
 
 #if CRYPTOMEM
@@ -610,31 +1273,96 @@ static void storage_generate_essiv(const uint8_t secret[32], uint8_t essiv[32])
 
 }
 
-static void decode_mnemonic(const char *mnemonic_encrypted, char *mnemonic_decrypted)
+static bool storage_loadMnemonicKey(void)
 {
-	aes_decrypt_ctx dec_ctx;
+	if (!mnemonicKeyCached) {
+		uint8_t secret[32];
+		uint32_t start = profileStart();
+		int8_t status = cm_get_aes_key( secret );
+		profileEnd(PROFILE_CM_AES_KEY, start);
+		if (status != CM_SUCCESS) {
+			// could not get key
+			return false;
+		}
 
-	memset ( &dec_ctx, 0, sizeof(aes_decrypt_ctx));
+		// Use ESSIV generated from the MCUs serial number and the secret key used for encryption
+		storage_generate_essiv(secret, mnemonicKeyEssiv);
+		aes_decrypt_key256(secret, &mnemonicKeyCtx);
+		memzero( secret, 32);
+		mnemonicKeyCached = true;
+	}
+	return true;
+}
 
-	uint8_t secret[32], essiv[32];
-	if (cm_get_aes_key( secret ) != CM_SUCCESS) {
-		// could not get key
+static void decode_mnemonic(const char *mnemonic_encrypted, char *mnemonic_decrypted)
+{
+	uint8_t essiv[32];
+
+	if (!storage_loadMnemonicKey()) {
 		mnemonic_decrypted[0] = 0;
 		return;
 	}
 
-	// Use ESSIV generated from the MCUs serial number and the secret key used for encryption
-	storage_generate_essiv(secret, essiv);
-	aes_decrypt_key256(secret, &dec_ctx);
+	// CBC updates the IV, decrypt with a copy
+	memcpy(essiv, mnemonicKeyEssiv, sizeof(essiv));
 	aes_cbc_decrypt((const unsigned char *)mnemonic_encrypted,
-			(unsigned char *)mnemonic_decrypted, sizeof(storageRom->mnemonic), essiv, &dec_ctx);
+			(unsigned char *)mnemonic_decrypted, sizeof(storageRom->mnemonic), essiv, &mnemonicKeyCtx);
 
-	memzero( secret, 32);
 	memzero( essiv, 32);
-	memzero( &dec_ctx, sizeof(aes_decrypt_ctx));
 
 	mnemonic_decrypted[sizeof(storageRom->mnemonic) - 1] = 0; // force zero termination
 }
+
+#if PERSIST_SEED
+// The seed is encrypted with the mnemonic key, under an IV derived from the mnemonic ESSIV.
+static void storage_seed_iv(const uint8_t essiv[32], uint8_t iv[32])
+{
+	SHA256_CTX ctx;
+	sha256_Init(&ctx);
+	sha256_Update(&ctx, essiv, 32);
+	sha256_Update(&ctx, (const uint8_t *)"seed", 4);
+	sha256_Final(&ctx, iv);
+}
+
+static bool decode_seed(uint8_t *seed)
+{
+	if (!storageRom->has_seed || storageRom->seed.size != sizeof(storageRom->seed.bytes)) {
+		return false;
+	}
+	if (!storage_loadMnemonicKey()) {
+		return false;
+	}
+	uint8_t iv[32];
+	storage_seed_iv(mnemonicKeyEssiv, iv);
+	aes_cbc_decrypt(storageRom->seed.bytes, seed, sizeof(storageRom->seed.bytes), iv, &mnemonicKeyCtx);
+	memzero(iv, sizeof(iv));
+	return true;
+}
+
+static void encrypt_and_store_seed(const uint8_t *seed)
+{
+	aes_encrypt_ctx ctx;
+	uint8_t secret[32], essiv[32], iv[32];
+	uint8_t encrypted[pb_membersize(Storage, seed.bytes)];
+	uint32_t start = profileStart();
+	int8_t status = cm_get_aes_key( secret );
+	profileEnd(PROFILE_CM_AES_KEY, start);
+	if (status != CM_SUCCESS)
+		return;
+
+	aes_encrypt_key256(secret, &ctx);
+	storage_generate_essiv(secret, essiv);
+	storage_seed_iv(essiv, iv);
+	aes_cbc_encrypt(seed, encrypted, sizeof(encrypted), iv, &ctx);
+	storage_changeBytes(FIELD_SEED, encrypted, sizeof(encrypted));
+	memzero( encrypted, sizeof(encrypted));
+	memzero( secret, 32);
+	memzero( essiv, 32);
+	memzero( iv, 32);
+	memzero( &ctx, sizeof(aes_encrypt_ctx));
+	storage_update();
+}
+#endif
 #endif
 
 const uint8_t *storage_getSeed(bool usePassphrase)
@@ -642,6 +1370,7 @@ const uint8_t *storage_getSeed(bool usePassphrase)
 	// root node is properly cached
 	if (usePassphrase == sessionSeedUsesPassphrase
 		&& sessionSeedCached) {
+		stats_table.seed_hits++;
 		return sessionSeed;
 	}
 
@@ -650,30 +1379,65 @@ const uint8_t *storage_getSeed(bool usePassphrase)
 		if (usePassphrase && !protectPassphrase()) {
 			return NULL;
 		}
+		const char *passphrase = usePassphrase ? sessionPassphrase : "";
+		uint8_t digest[32];
+		session_passphraseDigest(passphrase, digest);
+		const uint8_t *cached = session_lookupSeed(usePassphrase, digest);
+		if (cached) {
+			stats_table.seed_hits++;
+			memcpy(sessionSeed, cached, sizeof(sessionSeed));
+			sessionSeedCached = true;
+			sessionSeedUsesPassphrase = usePassphrase;
+			memzero(digest, sizeof(digest));
+			return sessionSeed;
+		}
 #if CRYPTOMEM
 		if (!storage_hasPin()) {
 			cm_open_zone( CM_DEFAULT_PW ); // make sure cryptomem is open
 		}
+#if PERSIST_SEED
+		if (passphrase[0] == 0 && decode_seed(sessionSeed)) {
+			session_insertSeed(usePassphrase, digest, passphrase, sessionSeed);
+			memzero(digest, sizeof(digest));
+			sessionSeedCached = true;
+			sessionSeedUsesPassphrase = usePassphrase;
+			return sessionSeed;
+		}
+#endif
 		char mnemonic[ sizeof(storageRom->mnemonic) ];
 		decode_mnemonic(storageRom->mnemonic, mnemonic );
 #else
 		const char *mnemonic = storageRom->mnemonic;
 #endif
 		// if storage was not imported (i.e. it was properly generated or recovered)
-		if (!storageRom->has_imported || !storageRom->imported) {
-			// test whether mnemonic is a valid BIP-0039 mnemonic
+		// test once whether mnemonic is a valid BIP-0039 mnemonic
+		if ((!storageRom->has_imported || !storageRom->imported) && !mnemonicVerified) {
 			if (!mnemonic_check(mnemonic)) {
 				// and if not then halt the device
 				storage_show_error();
 			}
+			mnemonicVerified = true;
 		}
-		char oldTiny = usbTiny(1);
-		mnemonic_to_seed(mnemonic, usePassphrase ? sessionPassphrase : "", sessionSeed, get_root_node_callback); // BIP-0039
-		usbTiny(oldTiny);
-		sessionSeedCached = true;
-		sessionSeedUsesPassphrase = usePassphrase;
+		stats_table.seed_misses++;
+		uint32_t start = profileStart();
+		bool ok = storage_mnemonic_to_seed(mnemonic, passphrase, sessionSeed); // BIP-0039
+		profileEnd(PROFILE_MNEMONIC_TO_SEED, start);
 #if CRYPTOMEM
 		memzero( mnemonic, sizeof(mnemonic));
+#endif
+		if (!ok) {
+			memzero(sessionSeed, sizeof(sessionSeed));
+			memzero(digest, sizeof(digest));
+			return NULL;
+		}
+		session_insertSeed(usePassphrase, digest, passphrase, sessionSeed);
+		memzero(digest, sizeof(digest));
+		sessionSeedCached = true;
+		sessionSeedUsesPassphrase = usePassphrase;
+#if CRYPTOMEM && PERSIST_SEED
+		if (passphrase[0] == 0) {
+			encrypt_and_store_seed(sessionSeed);
+		}
 #endif
 		return sessionSeed;
 	}
@@ -692,11 +1456,18 @@ bool storage_getU2FRoot(HDNode *node)
 
 bool storage_getRootNode(HDNode *node, const char *curve, bool usePassphrase)
 {
+	seedDerivationCancelled = false;
 	// if storage has node, decrypt and use it
 	if (storageRom->has_node && strcmp(curve, SECP256K1_NAME) == 0) {
 		if (!protectPassphrase()) {
 			return false;
 		}
+		// the passphrase decryption is as slow as a seed derivation,
+		// keep the result for the following requests of the session
+		if (sessionRootNodeCached) {
+			memcpy(node, &sessionRootNode, sizeof(HDNode));
+			return true;
+		}
 		if (!storage_loadNode(&storageRom->node, curve, node)) {
 			return false;
 		}
@@ -705,10 +1476,10 @@ bool storage_getRootNode(HDNode *node, const char *curve, bool usePassphrase)
 			uint8_t secret[64];
 			PBKDF2_HMAC_SHA512_CTX pctx;
 			pbkdf2_hmac_sha512_Init(&pctx, (const uint8_t *)sessionPassphrase, strlen(sessionPassphrase), (const uint8_t *)"TREZORHD", 8);
-			get_root_node_callback(0, BIP39_PBKDF2_ROUNDS);
-			for (int i = 0; i < 8; i++) {
-				pbkdf2_hmac_sha512_Update(&pctx, BIP39_PBKDF2_ROUNDS / 8);
-				get_root_node_callback((i + 1) * BIP39_PBKDF2_ROUNDS / 8, BIP39_PBKDF2_ROUNDS);
+			if (!storage_pbkdf2_slices(&pctx, BIP39_PBKDF2_ROUNDS)) {
+				memzero(&pctx, sizeof(pctx));
+				memzero(node, sizeof(HDNode));
+				return false;
 			}
 			pbkdf2_hmac_sha512_Final(&pctx, secret);
 			aes_decrypt_ctx ctx;
@@ -716,6 +1487,8 @@ bool storage_getRootNode(HDNode *node, const char *curve, bool usePassphrase)
 			aes_cbc_decrypt(node->chain_code, node->chain_code, 32, secret + 32, &ctx);
 			aes_cbc_decrypt(node->private_key, node->private_key, 32, secret + 32, &ctx);
 		}
+		memcpy(&sessionRootNode, node, sizeof(HDNode));
+		sessionRootNodeCached = true;
 		return true;
 	}
 
@@ -745,27 +1518,32 @@ const uint8_t *storage_getHomescreen(void)
 #if CRYPTOMEM
 static bool encrypt_and_store_mnemonic(const char *mnemonic)
 {
-	if (!storageUpdate.zone_is_initialized) {
+	// the zone may get a new key
+	storage_clearMnemonicKey();
+	if (!storageRom->zone_is_initialized) {
 		if (cm_initialize_new_zone() != CM_SUCCESS)
 			return false;
 	}
 	aes_encrypt_ctx ctx;
 	uint8_t secret[32], essiv[32];
-	if (cm_get_aes_key( secret ) != CM_SUCCESS)
+	uint32_t start = profileStart();
+	int8_t status = cm_get_aes_key( secret );
+	profileEnd(PROFILE_CM_AES_KEY, start);
+	if (status != CM_SUCCESS)
 		return false;
 
 	aes_encrypt_key256(secret, &ctx);
 	// Use ESSIV generated from the MCUs serial number and the secret key used for encryption
 	storage_generate_essiv(secret, essiv);
 	// erase everything from the end of the string until the end of mnemonic memory
-	uint8_t mnemonic_plain[sizeof(storageUpdate.mnemonic)];
+	uint8_t mnemonic_plain[pb_membersize(Storage, mnemonic)];
 	size_t len = strlen(mnemonic);
-	if (len >= sizeof(storageUpdate.mnemonic))
+	if (len >= sizeof(mnemonic_plain))
 		return false; // should never happen...
 	memcpy(mnemonic_plain, mnemonic, len);
-	memzero( mnemonic_plain + len, sizeof(storageUpdate.mnemonic) - len);
+	memzero( mnemonic_plain + len, sizeof(mnemonic_plain) - len);
 	aes_cbc_encrypt((const unsigned char *)mnemonic_plain,
-			(unsigned char *)storageUpdate.mnemonic, sizeof(storageUpdate.mnemonic), essiv, &ctx);
+			storage_change(FIELD_MNEMONIC, true, sizeof(mnemonic_plain)), sizeof(mnemonic_plain), essiv, &ctx);
 	memzero( secret, 32);
 	memzero( essiv, 32);
 	memzero( &ctx, sizeof(aes_encrypt_ctx));
@@ -776,14 +1554,13 @@ static bool encrypt_and_store_mnemonic(const char *mnemonic)
 
 bool storage_setMnemonic(const char *mnemonic)
 {
-	storageUpdate.has_mnemonic = true;
 #if CRYPTOMEM
 	if (!encrypt_and_store_mnemonic(mnemonic)) {
-		storageUpdate.has_mnemonic = false; // something went wrong
+		storage_dropChange(FIELD_MNEMONIC); // something went wrong
 		return false;
 	}
 #else
-	strlcpy(storageUpdate.mnemonic, mnemonic, sizeof(storageUpdate.mnemonic));
+	storage_changeString(FIELD_MNEMONIC, mnemonic);
 #endif
 	return true;
 }
@@ -800,8 +1577,10 @@ bool storage_hasMnemonic(void)
 
 const char *storage_getMnemonic(char * decoded_mnemonic)
 {
-	const char *mnemonic = storageUpdate.has_mnemonic ? storageUpdate.mnemonic
-			: storageRom->has_mnemonic ? storageRom->mnemonic : 0;
+	const char *mnemonic = storage_pending(FIELD_MNEMONIC);
+	if (!mnemonic) {
+		mnemonic = storageRom->has_mnemonic ? storageRom->mnemonic : 0;
+	}
 #if CRYPTOMEM
 	//reset_backup() uses this
 	if (decoded_mnemonic && mnemonic) {
@@ -871,9 +1650,9 @@ bool storage_containsPin(const char *pin)
 #if CRYPTOMEM
 	uint32_t pw = PinStringToHex(pin);
 
-	cm_deactivate_security();
+	storage_clearMnemonicKey();
 
-	return (cm_open_zone( pw ) == CM_SUCCESS);
+	return (cm_check_PIN( pw ) == CM_SUCCESS);
 #else
 	/* The execution time of the following code only depends on the
 	 * (public) input.  This avoids timing attacks.
@@ -900,18 +1679,21 @@ bool storage_hasPin(void)
 
 void storage_setPin(const char *pin)
 {
-	storageUpdate.has_pin = true;
 #if CRYPTOMEM
 	uint32_t pw = PinStringToHex(pin);
 
-	// empty PIN ?
-	storageUpdate.pin = !(pw == CM_DEFAULT_PW);
-
+	if (cm_set_PIN(pw) == CM_SUCCESS) {
+		// empty PIN ?
+		storage_changeBool(FIELD_PIN, !(pw == CM_DEFAULT_PW));
+	} else {
+		storage_dropChange(FIELD_PIN); // did not work
+	}
 
-	if (cm_set_PIN(pw) != CM_SUCCESS)
-		storageUpdate.has_pin = false; // did not work
+	// drop the stored seed, it is re-encrypted on the next unlock
+	storage_change(FIELD_SEED, false, 0);
 #else
-	strlcpy(storageUpdate.pin, pin, sizeof(storageUpdate.pin));
+	// an empty PIN clears it
+	storage_changeString(FIELD_PIN, pin);
 #endif
 	sessionPinCached = false;
 
@@ -919,6 +1701,7 @@ void storage_setPin(const char *pin)
 
 void session_cachePassphrase(const char *passphrase)
 {
+	session_clearRootNode();
 	strlcpy(sessionPassphrase, passphrase, sizeof(sessionPassphrase));
 	sessionPassphraseCached = true;
 }
@@ -955,9 +1738,88 @@ bool session_getState(const uint8_t *salt, uint8_t *state, const char *passphras
 	return true;
 }
 
+#if SEED_WARMUP
+/*
+ * Seed warm-up, enabled with SEED_WARMUP=1.
+ *
+ * Unlocking a wallet without passphrase protection starts its seed
+ * derivation in the background.  storage_warmupSeed() runs from the main
+ * loop only and does one PBKDF2 slice per call, so a request from the
+ * host is picked up between two slices.  A storage_getSeed() in the
+ * meantime takes over the context and only runs the rounds that are
+ * left.  Once the seed is done, the last used account node is derived
+ * into the node cache as well, see cryptoNodeCacheWarm().
+ */
+static void storage_startSeedWarmup(void)
+{
+	if (warmupActive || sessionSeedCached || !storageRom->has_mnemonic
+		|| !storage_hasPin() || storage_hasPassphraseProtection()) {
+		return;
+	}
+#if CRYPTOMEM && PERSIST_SEED
+	// the seed can be decoded, nothing to stretch
+	return;
+#else
+#if CRYPTOMEM
+	char mnemonic[sizeof(storageRom->mnemonic)];
+	decode_mnemonic(storageRom->mnemonic, mnemonic);
+	if (mnemonic[0] == 0) {
+		// no key, leave it to storage_getSeed()
+		return;
+	}
+#else
+	const char *mnemonic = storageRom->mnemonic;
+#endif
+	if ((!storageRom->has_imported || !storageRom->imported) && !mnemonicVerified) {
+		if (!mnemonic_check(mnemonic)) {
+			storage_show_error();
+		}
+		mnemonicVerified = true;
+	}
+	pbkdf2_hmac_sha512_Init(&warmupCtx, (const uint8_t *)mnemonic, strlen(mnemonic), (const uint8_t *)"mnemonic", 8);
+#if CRYPTOMEM
+	memzero(mnemonic, sizeof(mnemonic));
+#endif
+	warmupRounds = 0;
+	warmupActive = true;
+#endif
+}
+
+void storage_warmupSeed(void)
+{
+	if (!warmupActive) {
+		return;
+	}
+	pbkdf2_hmac_sha512_Update(&warmupCtx, STORAGE_PBKDF2_SLICE);
+	warmupRounds += STORAGE_PBKDF2_SLICE;
+	if (warmupRounds < BIP39_PBKDF2_ROUNDS) {
+		return;
+	}
+
+	// the seed as storage_getSeed(true) leaves it for this wallet
+	pbkdf2_hmac_sha512_Final(&warmupCtx, sessionSeed);
+	storage_warmupDrop();
+	uint8_t digest[32];
+	session_passphraseDigest("", digest);
+	session_insertSeed(true, digest, "", sessionSeed);
+	memzero(digest, sizeof(digest));
+	sessionSeedCached = true;
+	sessionSeedUsesPassphrase = true;
+
+	static CONFIDENTIAL HDNode node;
+	if (hdnode_from_seed(sessionSeed, 64, SECP256K1_NAME, &node)) {
+		cryptoNodeCacheWarm(&node);
+	}
+	memzero(&node, sizeof(node));
+}
+#endif
+
 void session_cachePin(void)
 {
 	sessionPinCached = true;
+#if SEED_WARMUP
+	storage_startSeedWarmup();
+#endif
 }
 
 bool session_isPinCached(void)
@@ -968,9 +1830,11 @@ bool session_isPinCached(void)
 void storage_clearPinArea(void)
 {
 	svc_flash_unlock();
-	svc_flash_erase_sector(FLASH_META_SECTOR_LAST);
+	storage_erase_sector(FLASH_META_SECTOR_LAST);
 	storage_check_flash_errors(svc_flash_lock());
+	storage_pinfails_offset = FLASH_STORAGE_PINAREA;
 	storage_u2f_offset = 0;
+	storage_u2f_next = 0;
 }
 
 // called when u2f area or pin area overflows
@@ -979,22 +1843,24 @@ static void storage_area_recycle(uint32_t new_pinfails)
 	// first clear storage marker.  In case of a failure below it is better
 	// to clear the storage than to allow restarting with zero PIN failures
 	svc_flash_program(FLASH_CR_PROGRAM_X32);
-	flash_write32(FLASH_STORAGE_START, 0);
+	storage_write32(FLASH_STORAGE_START, 0);
 	if (*(const uint32_t *)FLASH_PTR(FLASH_STORAGE_START) != 0) {
 		storage_show_error();
 	}
 
 	// erase pinarea/u2f sector
-	svc_flash_erase_sector(FLASH_META_SECTOR_LAST);
-	flash_write32(FLASH_STORAGE_PINAREA, new_pinfails);
+	storage_erase_sector(FLASH_META_SECTOR_LAST);
+	storage_write32(FLASH_STORAGE_PINAREA, new_pinfails);
 	if (*(const volatile uint32_t *)FLASH_PTR(FLASH_STORAGE_PINAREA) != new_pinfails) {
 		storage_show_error();
 	}
+	storage_pinfails_offset = FLASH_STORAGE_PINAREA;
 
 	// restore storage sector
-	storageUpdate.has_u2f_counter = true;
-	storageUpdate.u2f_counter += storage_u2f_offset;
+	const uint32_t *u2f_counter = storage_pending(FIELD_U2F_COUNTER);
+	storage_changeUint32(FIELD_U2F_COUNTER, (u2f_counter ? *u2f_counter : storageRom->u2f_counter) + storage_u2f_offset);
 	storage_u2f_offset = 0;
+	storage_u2f_next = 0;
 	storage_commit_locked(true);
 }
 
@@ -1010,7 +1876,8 @@ void storage_resetPinFails(uint32_t flash_pinfails)
 		storage_area_recycle(0xffffffff);
 	} else {
 		svc_flash_program(FLASH_CR_PROGRAM_X32);
-		flash_write32(flash_pinfails, 0);
+		storage_write32(flash_pinfails, 0);
+		storage_pinfails_offset = flash_pinfails + sizeof(uint32_t);
 	}
 	storage_check_flash_errors(svc_flash_lock());
 #endif
@@ -1027,7 +1894,7 @@ bool storage_increasePinFails(uint32_t flash_pinfails)
 
 	svc_flash_unlock();
 	svc_flash_program(FLASH_CR_PROGRAM_X32);
-	flash_write32(flash_pinfails, newctr);
+	storage_write32(flash_pinfails, newctr);
 	storage_check_flash_errors(svc_flash_lock());
 
 	return *(const uint32_t*)FLASH_PTR(flash_pinfails) == newctr;
@@ -1055,10 +1922,7 @@ uint32_t storage_getPinWait(uint32_t flash_pinfails)
 
 uint32_t storage_getPinFailsOffset(void)
 {
-	uint32_t flash_pinfails = FLASH_STORAGE_PINAREA;
-	while (*(const uint32_t*)FLASH_PTR(flash_pinfails) == 0)
-		flash_pinfails += sizeof(uint32_t);
-	return flash_pinfails;
+	return storage_pinfails_offset;
 }
 
 bool storage_isInitialized(void)
@@ -1073,20 +1937,19 @@ bool storage_isImported(void)
 
 void storage_setImported(bool imported)
 {
-	storageUpdate.has_imported = true;
-	storageUpdate.imported = imported;
+	storage_changeBool(FIELD_IMPORTED, imported);
 }
 
 bool storage_needsBackup(void)
 {
-	return storageUpdate.has_needs_backup ? storageUpdate.needs_backup
+	const bool *needs_backup = storage_pending(FIELD_NEEDS_BACKUP);
+	return needs_backup ? *needs_backup
 		: storageRom->has_needs_backup && storageRom->needs_backup;
 }
 
 void storage_setNeedsBackup(bool needs_backup)
 {
-	storageUpdate.has_needs_backup = true;
-	storageUpdate.needs_backup = needs_backup;
+	storage_changeBool(FIELD_NEEDS_BACKUP, needs_backup);
 }
 
 void storage_applyFlags(uint32_t flags)
@@ -1094,8 +1957,8 @@ void storage_applyFlags(uint32_t flags)
 	if ((storageRom->flags | flags) == storageRom->flags) {
 		return; // no new flags
 	}
-	storageUpdate.has_flags = true;
-	storageUpdate.flags |= flags;
+	const uint32_t *pending = storage_pending(FIELD_FLAGS);
+	storage_changeUint32(FIELD_FLAGS, storageRom->flags | (pending ? *pending : 0) | flags);
 }
 
 uint32_t storage_getFlags(void)
@@ -1103,28 +1966,51 @@ uint32_t storage_getFlags(void)
 	return storageRom->has_flags ? storageRom->flags : 0;
 }
 
-uint32_t storage_nextU2FCounter(void)
+// reserve the next U2F_COUNTER_RESERVE counter values in flash
+static void storage_reserveU2FRange(void)
 {
 	uint32_t flash_u2f_offset = FLASH_STORAGE_U2FAREA +
 		sizeof(uint32_t) * (storage_u2f_offset / 32);
-	uint32_t newval = 0xfffffffe << (storage_u2f_offset & 31);
+	uint32_t end = (storage_u2f_offset + U2F_COUNTER_RESERVE) & ~(U2F_COUNTER_RESERVE - 1);
+	uint32_t newval = (end & 31) ? 0xffffffff << (end & 31) : 0;
 
 	svc_flash_unlock();
 	svc_flash_program(FLASH_CR_PROGRAM_X32);
-	flash_write32(flash_u2f_offset, newval);
-	storage_u2f_offset++;
+	storage_write32(flash_u2f_offset, newval);
+	storage_u2f_offset = end;
 	if (storage_u2f_offset >= 8 * FLASH_STORAGE_U2FAREA_LEN) {
 		storage_area_recycle(*(const uint32_t*)
 							 FLASH_PTR(storage_getPinFailsOffset()));
 	}
 	storage_check_flash_errors(svc_flash_lock());
-	return storageRom->u2f_counter + storage_u2f_offset;
+}
+
+uint32_t storage_nextU2FCounter(void)
+{
+	storage_u2f_used = true;
+	while (storage_u2f_next >= storage_u2f_offset) {
+		storage_reserveU2FRange();
+	}
+	storage_u2f_next++;
+	return storageRom->u2f_counter + storage_u2f_next;
+}
+
+/*
+ * Called while idle: once U2F has been used since boot, make sure the
+ * next counter value is already reserved, so that authentication does
+ * not have to write (or recycle) flash.
+ */
+void storage_reserveU2FCounter(void)
+{
+	if (storage_u2f_used && storage_u2f_next >= storage_u2f_offset) {
+		storage_reserveU2FRange();
+	}
 }
 
 void storage_setU2FCounter(uint32_t u2fcounter)
 {
-	storageUpdate.has_u2f_counter = true;
-	storageUpdate.u2f_counter = u2fcounter - storage_u2f_offset;
+	storage_changeUint32(FIELD_U2F_COUNTER, u2fcounter - storage_u2f_offset);
+	storage_u2f_next = storage_u2f_offset;
 }
 
 void storage_wipe(void)
@@ -81,11 +81,13 @@ typedef struct _Storage {
     STORAGE_BOOL   (needs_backup)
     STORAGE_UINT32 (flags)
     STORAGE_NODE   (u2froot)
+#if CRYPTOMEM
+    STORAGE_BYTES  (seed, 64)	// BIP-0039 seed without passphrase, encrypted (PERSIST_SEED)
+#endif
 } Storage;
 
-extern Storage storageUpdate;
-
 void storage_init(void);
+void storage_initCryptomem(void);
 bool storage_cm_init_successful(void);
 void storage_generate_uuid(void);
 void storage_clear_update(void);
@@ -95,6 +97,7 @@ void session_clear(bool clear_pin);
 void storage_loadDevice(LoadDevice *msg);
 
 const uint8_t *storage_getSeed(bool usePassphrase);
+bool storage_seedDerivationCancelled(void);
 
 bool storage_getU2FRoot(HDNode *node);
 bool storage_getRootNode(HDNode *node, const char *curve, bool usePassphrase);
@@ -114,6 +117,7 @@ void storage_setHomescreen(const uint8_t *data, uint32_t size);
 void session_cachePassphrase(const char *passphrase);
 bool session_isPassphraseCached(void);
 bool session_getState(const uint8_t *salt, uint8_t *state, const char *passphrase);
+void session_switchState(const uint8_t *state);
 
 bool storage_setMnemonic(const char *mnemonic);
 bool storage_containsMnemonic(const char *mnemonic);
@@ -129,6 +133,9 @@ bool storage_containsPin(const char *pin);
 bool storage_hasPin(void);
 void storage_setPin(const char *pin);
 void session_cachePin(void);
+#if SEED_WARMUP
+void storage_warmupSeed(void);
+#endif
 bool session_isPinCached(void);
 void storage_clearPinArea(void);
 void storage_resetPinFails(uint32_t flash_pinfails);
@@ -142,6 +149,7 @@ uint32_t storage_getPinWait(uint32_t flash_pinfails);
 uint32_t storage_getPinFailsOffset(void);
 
 uint32_t storage_nextU2FCounter(void);
+void storage_reserveU2FCounter(void);
 void storage_setU2FCounter(uint32_t u2fcounter);
 
 bool storage_isInitialized(void);
@@ -0,0 +1,92 @@
+/*
+ * This file is part of the TREZOR project, https://trezor.io/
+ *
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "tasks.h"
+#include "timer.h"
+#include "timers.h"
+#include "storage.h"
+#include "signing.h"
+#if USE_ETHEREUM
+#include "ethereum.h"
+#endif
+#include "layout2.h"
+#include "debug.h"
+#if CRYPTOMEM
+#include "cryptomem.h"
+#endif
+
+typedef struct {
+	void (*run)(void);
+	bool nested;		// may run while a handler waits
+	uint32_t period;	// ms between runs, 0 runs on every pass
+} Task;
+
+#if DEBUG_LOG
+static void tasks_debugLogFlush(void)
+{
+	debugLogFlush();
+}
+#endif
+
+static const Task tasks[] = {
+	{ timersRun, false, 0 },
+	{ storage_reserveU2FCounter, false, 0 },
+#if SEED_WARMUP
+	{ storage_warmupSeed, false, 0 },
+#endif
+#if CRYPTOMEM
+	{ cm_session_idle, true, 1000 },
+#endif
+	{ signing_idle, true, 0 },
+#if USE_ETHEREUM
+	{ ethereum_signing_idle, true, 0 },
+#endif
+	{ layoutProgressFlush, true, 0 },
+#if DEBUG_LOG
+	{ tasks_debugLogFlush, true, 0 },
+#endif
+};
+
+#define TASKS_COUNT (sizeof(tasks) / sizeof(*tasks))
+
+static uint32_t tasks_due[TASKS_COUNT];
+static bool tasks_running = false;
+
+void tasksRun(TasksContext context)
+{
+	// a task that ends up waiting itself must not run the others again
+	if (tasks_running) {
+		return;
+	}
+	tasks_running = true;
+	for (size_t i = 0; i < TASKS_COUNT; i++) {
+		if (context == TASKS_NESTED && !tasks[i].nested) {
+			continue;
+		}
+		if (tasks[i].period) {
+			if (!timer_expired(tasks_due[i])) {
+				continue;
+			}
+			tasks_due[i] = timer_ms() + tasks[i].period;
+		}
+		tasks[i].run();
+	}
+	tasks_running = false;
+}
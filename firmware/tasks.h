@@ -0,0 +1,38 @@
+/*
+ * This file is part of the TREZOR project, https://trezor.io/
+ *
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __TASKS_H__
+#define __TASKS_H__
+
+/*
+ * Cooperative background tasks.
+ *
+ * Work that has to make progress whatever message is being handled is
+ * listed in tasks.c and run by tasksRun(), from the main loop and from
+ * the loops that keep a handler waiting for the host or the user (button,
+ * PIN and passphrase requests, seed derivation).  Every task runs to
+ * completion and returns quickly.  Tasks that write the flash only run
+ * from the main loop, where no handler is in the middle of an update.
+ */
+typedef enum {
+	TASKS_MAIN,	// main loop, no handler active
+	TASKS_NESTED,	// inside a handler that waits
+} TasksContext;
+
+void tasksRun(TasksContext context);
+
+#endif
@@ -0,0 +1,107 @@
+/*
+ * This file is part of the TREZOR project, https://trezor.io/
+ *
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stddef.h>
+
+#include "timers.h"
+#include "timer.h"
+
+#define TIMER_WHEEL_SLOTS 64
+
+static SoftTimer *wheel[TIMER_WHEEL_SLOTS];
+
+// first millisecond not yet looked at by timersRun()
+static uint32_t wheel_now;
+static bool wheel_started = false;
+
+static void wheel_start(void)
+{
+	if (!wheel_started) {
+		wheel_now = timer_ms();
+		wheel_started = true;
+	}
+}
+
+void timerStop(SoftTimer *t)
+{
+	if (!t->armed) {
+		return;
+	}
+	SoftTimer **p = &wheel[t->deadline % TIMER_WHEEL_SLOTS];
+	while (*p != NULL && *p != t) {
+		p = &(*p)->next;
+	}
+	if (*p == t) {
+		*p = t->next;
+	}
+	t->next = NULL;
+	t->armed = false;
+}
+
+void timerStart(SoftTimer *t, uint32_t ms, void (*expired)(void))
+{
+	wheel_start();
+	timerStop(t);
+	t->deadline = timer_ms() + ms;
+	// a slot that was already passed would only come round again later
+	if ((int32_t)(t->deadline - wheel_now) < 0) {
+		t->deadline = wheel_now;
+	}
+	t->expired = expired;
+	t->armed = true;
+	SoftTimer **slot = &wheel[t->deadline % TIMER_WHEEL_SLOTS];
+	t->next = *slot;
+	*slot = t;
+}
+
+void timersRun(void)
+{
+	wheel_start();
+	uint32_t now = timer_ms();
+	if ((int32_t)(now - wheel_now) < 0) {
+		return;
+	}
+	uint32_t span = now - wheel_now + 1;
+	if (span > TIMER_WHEEL_SLOTS) {
+		span = TIMER_WHEEL_SLOTS;
+	}
+
+	// unlink everything that is due first, callbacks may rearm their timer
+	SoftTimer *due = NULL;
+	for (uint32_t i = 0; i < span; i++) {
+		SoftTimer **p = &wheel[(wheel_now + i) % TIMER_WHEEL_SLOTS];
+		while (*p != NULL) {
+			SoftTimer *t = *p;
+			if ((int32_t)(t->deadline - now) <= 0) {
+				*p = t->next;
+				t->next = due;
+				t->armed = false;
+				due = t;
+			} else {
+				p = &t->next;
+			}
+		}
+	}
+	wheel_now = now + 1;
+
+	while (due != NULL) {
+		SoftTimer *t = due;
+		due = t->next;
+		t->next = NULL;
+		t->expired();
+	}
+}
@@ -0,0 +1,53 @@
+/*
+ * This file is part of the TREZOR project, https://trezor.io/
+ *
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __TIMERS_H__
+#define __TIMERS_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Software timers on a timer wheel.
+ *
+ * A timer sits in the wheel slot of its deadline (in SysTick
+ * milliseconds, modulo the number of slots).  timersRun() only looks at
+ * the slots that have passed since its previous call, so the cost of a
+ * main loop pass does not grow with the number of armed timers.  The
+ * expiry callback runs from timersRun(), from the main loop, never from
+ * the interrupt.
+ *
+ * The SoftTimer is owned by the caller and must stay valid while armed.
+ */
+typedef struct SoftTimer {
+	struct SoftTimer *next;
+	uint32_t deadline;
+	void (*expired)(void);
+	bool armed;
+} SoftTimer;
+
+// (re)arm t to call expired in ms milliseconds
+void timerStart(SoftTimer *t, uint32_t ms, void (*expired)(void));
+void timerStop(SoftTimer *t);
+
+static inline bool timerArmed(const SoftTimer *t) {
+	return t->armed;
+}
+
+void timersRun(void);
+
+#endif
@@ -216,7 +216,7 @@ int compile_output(const CoinInfo *coin, const HDNode *root, TxOutputType *in, T
 				return 0; // failed to compile output
 		}
 		memcpy(&node, root, sizeof(HDNode));
-		if (hdnode_private_ckd_cached(&node, in->address_n, in->address_n_count, NULL) == 0) {
+		if (cryptoDeriveNode(&node, in->address_n, in->address_n_count, NULL) == 0) {
 			return 0; // failed to compile output
 		}
 		hdnode_fill_public_key(&node);
@@ -229,7 +229,7 @@ int compile_output(const CoinInfo *coin, const HDNode *root, TxOutputType *in, T
 		return 0; // failed to compile output
 	}
 
-	addr_raw_len = base58_decode_check(in->address, coin->curve->hasher_base58, addr_raw, MAX_ADDR_RAW_SIZE);
+	addr_raw_len = coinDecodeAddress(coin, in->address, addr_raw);
 	size_t prefix_len;
 	if (coin->has_address_type                                  // p2pkh
 		&& addr_raw_len == 20 + (prefix_len = address_prefix_bytes_len(coin->address_type))
@@ -377,11 +377,28 @@ uint32_t serialize_script_multisig(const CoinInfo *coin, const MultisigRedeemScr
 
 // tx methods
 
-uint32_t tx_prevout_hash(Hasher *hasher, const TxInputType *input)
+/*
+ * Inputs and outputs with a script of up to TX_INLINE_SCRIPT_SIZE bytes
+ * are laid out in a stack buffer and fed to the hasher in one update
+ * instead of four or five small ones.  This covers empty script_sigs,
+ * P2PKH script_sigs of previous transactions and all standard output
+ * scripts.  The length prefix is then a single byte.
+ */
+#define TX_INLINE_SCRIPT_SIZE  128
+
+// hashes are serialized in reversed byte order, feed them to the hasher in one piece
+static void hash_reversed_hash(Hasher *hasher, const uint8_t *hash)
 {
+	uint8_t buf[32];
 	for (int i = 0; i < 32; i++) {
-		hasher_Update(hasher, &(input->prev_hash.bytes[31 - i]), 1);
+		buf[i] = hash[31 - i];
 	}
+	hasher_Update(hasher, buf, 32);
+}
+
+uint32_t tx_prevout_hash(Hasher *hasher, const TxInputType *input)
+{
+	hash_reversed_hash(hasher, input->prev_hash.bytes);
 	hasher_Update(hasher, (const uint8_t *)&input->prev_index, 4);
 	return 36;
 }
@@ -401,6 +418,15 @@ uint32_t tx_sequence_hash(Hasher *hasher, const TxInputType *input)
 
 uint32_t tx_output_hash(Hasher *hasher, const TxOutputBinType *output)
 {
+	uint32_t size = output->script_pubkey.size;
+	if (size <= TX_INLINE_SCRIPT_SIZE) {
+		uint8_t buf[8 + 1 + TX_INLINE_SCRIPT_SIZE];
+		memcpy(buf, &output->amount, 8);
+		buf[8] = size;
+		memcpy(buf + 9, output->script_pubkey.bytes, size);
+		hasher_Update(hasher, buf, 9 + size);
+		return 9 + size;
+	}
 	uint32_t r = 0;
 	hasher_Update(hasher, (const uint8_t *)&output->amount, 8); r += 8;
 	r += tx_script_hash(hasher, output->script_pubkey.size, output->script_pubkey.bytes);
@@ -438,9 +464,7 @@ uint32_t tx_serialize_header_hash(TxStruct *tx)
 		r += 2;
 	}
 	if (tx->version == 12) {
-		for (int i = 0; i < 32; i++) {
-			hasher_Update(&(tx->hasher), &(tx->preblock_hash[31 - i]), 1);
-		}
+		hash_reversed_hash(&(tx->hasher), tx->preblock_hash);
 		r += 32;
 	}
 	return r + ser_length_hash(&(tx->hasher), tx->inputs_len);
@@ -480,9 +504,23 @@ uint32_t tx_serialize_input_hash(TxStruct *tx, const TxInputType *input)
 	if (tx->have_inputs == 0) {
 		r += tx_serialize_header_hash(tx);
 	}
-	r += tx_prevout_hash(&(tx->hasher), input);
-	r += tx_script_hash(&(tx->hasher), input->script_sig.size, input->script_sig.bytes);
-	r += tx_sequence_hash(&(tx->hasher), input);
+	uint32_t size = input->script_sig.size;
+	if (size <= TX_INLINE_SCRIPT_SIZE) {
+		uint8_t buf[36 + 1 + TX_INLINE_SCRIPT_SIZE + 4];
+		for (int i = 0; i < 32; i++) {
+			buf[i] = input->prev_hash.bytes[31 - i];
+		}
+		memcpy(buf + 32, &input->prev_index, 4);
+		buf[36] = size;
+		memcpy(buf + 37, input->script_sig.bytes, size);
+		memcpy(buf + 37 + size, &input->sequence, 4);
+		hasher_Update(&(tx->hasher), buf, 41 + size);
+		r += 41 + size;
+	} else {
+		r += tx_prevout_hash(&(tx->hasher), input);
+		r += tx_script_hash(&(tx->hasher), size, input->script_sig.bytes);
+		r += tx_sequence_hash(&(tx->hasher), input);
+	}
 
 	tx->have_inputs++;
 	tx->size += r;
@@ -670,7 +708,7 @@ uint32_t tx_output_weight(const CoinInfo *coin, const TxOutputType *txoutput) {
 			&& segwit_addr_decode(&witver, addr_raw, &addr_raw_len, coin->bech32_prefix, txoutput->address)) {
 			output_script_size = 2 + addr_raw_len;
 		} else {
-			addr_raw_len = base58_decode_check(txoutput->address, coin->curve->hasher_base58, addr_raw, MAX_ADDR_RAW_SIZE);
+			addr_raw_len = coinDecodeAddress(coin, txoutput->address, addr_raw);
 			if (coin->has_address_type
 				&& address_check_prefix(addr_raw, coin->address_type)) {
 				output_script_size = TXSIZE_P2PKHASH;
@@ -31,9 +31,43 @@
 #include "buttons.h"
 #include "gettext.h"
 #include "bl_check.h"
+#include "profile.h"
+#include "tasks.h"
+#include "timers.h"
 
 /* Screen timeout */
-uint32_t system_millis_lock_start;
+#define AUTOLOCK_MS (10 * 60 * 1000)
+static SoftTimer autolock_timer;
+
+/* Hold time of the No button that offers to lock the device */
+#define LOCK_HOLD_MS 2000
+
+// the home screen was shown for 10 minutes
+static void autolock(void)
+{
+	if (layoutLast == layoutHome) {
+		// lock the screen
+		session_clear(true);
+		layoutScreensaver();
+	}
+}
+
+void autolockRestart(void)
+{
+	timerStart(&autolock_timer, AUTOLOCK_MS, autolock);
+}
+
+static uint32_t oled_anim_now(void)
+{
+	return timer_ms();
+}
+
+// keep USB serviced between animation frames, but leave new messages
+// for the main loop
+static void oled_anim_idle(void)
+{
+	usbPollTx();
+}
 
 void check_lock_screen(void)
 {
@@ -45,8 +79,18 @@ void check_lock_screen(void)
 		return;
 	}
 
-	// button held for long enough (2 seconds)
-	if (layoutLast == layoutHome && button.NoDown >= 285000 * 2) {
+	// button held for long enough (2 seconds), timed by the clock since
+	// the main loop sleeps between passes
+	static bool no_held = false;
+	static uint32_t no_held_since;
+	if (!button.NoDown) {
+		no_held = false;
+	} else if (!no_held) {
+		no_held = true;
+		no_held_since = timer_ms();
+	}
+	if (layoutLast == layoutHome && no_held && timer_ms() - no_held_since >= LOCK_HOLD_MS) {
+		no_held = false;
 		layoutDialogSplit(
 			&bmp_icon_question,
 			_("Cancel"),
@@ -79,32 +123,54 @@ void check_lock_screen(void)
 			layoutHome();
 		}
 	}
+}
 
-	// if homescreen is shown for longer than 10 minutes, lock too
-	if (layoutLast == layoutHome) {
-		if (timer_expired(system_millis_lock_start + 600000)) {
-			// lock the screen
-			session_clear(true);
-			layoutScreensaver();
-		}
+/*
+ * Boot work that is not needed to show the home screen and to connect
+ * USB.  It runs right after USB is connected, while the host still
+ * debounces the attach, and before the first message is handled.
+ */
+static void boot_deferred(void)
+{
+#if CRYPTOMEM
+	storage_initCryptomem();
+	if (!storage_cm_init_successful()) {
+		layoutHome();
 	}
+#endif
+	profileBoot(PROFILE_BOOT_DEFERRED);
 }
 
 int main(void)
 {
+	/* start the cycle counter first, it times the boot stages */
+	if (check_mode_priviledged()) {
+		profileInit();
+	}
+
 #ifndef APPVER
 	setup();
 	__stack_chk_guard = random32(); // this supports compiler provided unpredictable stack protection checks
 	oledInit();
 #else
 	check_bootloader();
+	profileBoot(PROFILE_BOOT_BOOTLOADER);
 	setupApp();
 	__stack_chk_guard = random32(); // this supports compiler provided unpredictable stack protection checks
 #endif
 
+	/* only sleep in the main loop in privileged mode, usbIdle() sets up
+	 * the USB wakeup and SysTick keeps the timers going */
+	bool sleep_when_idle = false;
+
 	/* only call timer_init() if we are in privileged mode */
-	if (check_mode_priviledged())
+	if (check_mode_priviledged()) {
 		timer_init();
+		sleep_when_idle = true;
+		oledInitAsync();
+		rngInitPool();
+		buttonInitIRQ();
+	}
 
 #ifdef APPVER
 	// enable MPU (Memory Protection Unit)
@@ -112,6 +178,7 @@ int main(void)
 	if (check_mode_priviledged())
 		mpu_config();
 #endif
+	profileBoot(PROFILE_BOOT_SETUP);
 
 #if DEBUG_LINK
 	oledSetDebugLink(1);
@@ -122,15 +189,32 @@ int main(void)
 	oledRefresh();
 
 	storage_init();
+	profileBoot(PROFILE_BOOT_STORAGE);
 	layoutHome();
+	profileBoot(PROFILE_BOOT_HOME);
 
 #ifdef APPVER
 	setupUSB();
 #endif
 	usbInit();
+	profileBoot(PROFILE_BOOT_USB);
+	oledSetAnimationTimer(oled_anim_now, oled_anim_idle);
+	boot_deferred();
 	for (;;) {
 		usbPoll();
+#if EMULATOR
+		if (emulatorFlashRestored()) {
+			// the flash was rolled back under the running firmware
+			session_clear(true);
+			storage_init();
+			layoutHome();
+		}
+#endif
 		check_lock_screen();
+		tasksRun(TASKS_MAIN);
+		if (sleep_when_idle) {
+			usbIdle();
+		}
 	}
 
 	return 0;
@@ -37,7 +37,7 @@
 #define DEBUG_LOG 0
 #endif
 
-/* Screen timeout */
-extern uint32_t system_millis_lock_start;
+/* Screen timeout, restarted whenever the home screen is drawn */
+void autolockRestart(void);
 
 #endif
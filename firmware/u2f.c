@@ -33,6 +33,10 @@
 #include "hmac.h"
 #include "util.h"
 #include "gettext.h"
+#include "crypto.h"
+#include "bignum.h"
+#include "memzero.h"
+#include "timer.h"
 
 #include "u2f/u2f.h"
 #include "u2f/u2f_hid.h"
@@ -42,15 +46,34 @@
 
 // About 1/2 Second according to values used in protect.c
 #define U2F_TIMEOUT (800000/2)
-#define U2F_OUT_PKT_BUFFER_LEN 128
 
 // Initialise without a cid
 static uint32_t cid = 0;
 
-// Circular Output buffer
+// Responses are queued as messages and cut into INIT and CONT frames only
+// when the endpoint asks for the next one.  Payloads are copied into a
+// shared byte ring; a payload larger than the whole ring (a long PING
+// echo) is framed straight from the caller's buffer, and its sender waits
+// until the last frame is out.
+#define U2F_OUT_MSG_QUEUE_LEN 8
+#define U2F_OUT_DATA_LEN 1024
+
+typedef struct {
+	uint32_t cid;
+	uint32_t len;
+	uint32_t sent;
+	const uint8_t *data;	// payload outside the ring, or NULL
+	uint8_t cmd;
+	uint8_t frames;
+} U2F_OutMsg;
+
+static U2F_OutMsg u2f_out_msgs[U2F_OUT_MSG_QUEUE_LEN];
 static uint32_t u2f_out_start = 0;
 static uint32_t u2f_out_end = 0;
-static uint8_t u2f_out_packets[U2F_OUT_PKT_BUFFER_LEN][HID_RPT_SIZE];
+static uint8_t u2f_out_ring[U2F_OUT_DATA_LEN];
+static uint32_t u2f_out_head = 0;
+static uint32_t u2f_out_used = 0;
+static const uint8_t *u2f_out_extern = NULL;
 
 #define U2F_PUBKEY_LEN 65
 #define KEY_PATH_LEN 32
@@ -59,6 +82,10 @@ static uint8_t u2f_out_packets[U2F_OUT_PKT_BUFFER_LEN][HID_RPT_SIZE];
 // Derivation path is m/U2F'/r'/r'/r'/r'/r'/r'/r'/r'
 #define KEY_PATH_ENTRIES (KEY_PATH_LEN / sizeof(uint32_t))
 
+// Version 2 key handles start with this tag.  Its last byte has the high
+// bit clear, so it never passes as the first hardened index of a path.
+static const uint8_t key_handle_v2_tag[4] = { 'S', 'T', 'K', 0x02 };
+
 // Defined as UsbSignHandler.BOGUS_APP_ID_HASH
 // in https://github.com/google/u2f-ref-code/blob/master/u2f-chrome-extension/usbsignhandler.js#L118
 #define BOGUS_APPID "AAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAA"
@@ -110,6 +137,113 @@ typedef struct {
 
 U2F_ReadBuffer *reader;
 
+// While a request holds the active channel, short PING and WINK
+// transactions on other channels are reassembled here and answered
+// straight away instead of being rejected as busy.
+#define U2F_SIDE_CHANNELS 4
+#define U2F_SIDE_BUF_LEN (57 + 3 * 59)
+
+typedef struct {
+	uint32_t cid;
+	uint32_t deadline;
+	uint8_t buf[U2F_SIDE_BUF_LEN];
+	uint32_t len;
+	uint32_t got;
+	uint8_t seq;
+	uint8_t cmd;
+} U2F_SideChannel;
+
+static U2F_SideChannel side_channels[U2F_SIDE_CHANNELS];
+
+static void send_u2fhid_msg_cid(uint32_t fcid, const uint8_t cmd, const uint8_t *data, const uint32_t len);
+
+static U2F_SideChannel *u2fhid_side_find(uint32_t fcid)
+{
+	for (int i = 0; i < U2F_SIDE_CHANNELS; i++) {
+		U2F_SideChannel *c = &side_channels[i];
+		if (c->cid == 0) {
+			continue;
+		}
+		if (timer_expired(c->deadline)) {
+			send_u2fhid_error(c->cid, ERR_MSG_TIMEOUT);
+			c->cid = 0;
+			continue;
+		}
+		if (c->cid == fcid) {
+			return c;
+		}
+	}
+	return 0;
+}
+
+static void u2fhid_side_complete(U2F_SideChannel *c)
+{
+	if (c->cmd == U2FHID_PING) {
+		send_u2fhid_msg_cid(c->cid, U2FHID_PING, c->buf, c->len);
+	} else if (c->len > 0) {
+		send_u2fhid_error(c->cid, ERR_INVALID_LEN);
+	} else {
+		send_u2fhid_msg_cid(c->cid, U2FHID_WINK, c->buf, 0);
+	}
+	c->cid = 0;
+}
+
+static void u2fhid_side_read(const U2FHID_FRAME *f)
+{
+	U2F_SideChannel *c = u2fhid_side_find(f->cid);
+
+	if (f->type & TYPE_INIT) {
+		if (f->init.cmd != U2FHID_PING && f->init.cmd != U2FHID_WINK) {
+			send_u2fhid_error(f->cid, ERR_CHANNEL_BUSY);
+			return;
+		}
+		if (f->cid == CID_BROADCAST || f->cid == 0) {
+			send_u2fhid_error(f->cid, ERR_INVALID_CID);
+			return;
+		}
+		if ((unsigned)MSG_LEN(*f) > U2F_SIDE_BUF_LEN) {
+			send_u2fhid_error(f->cid, ERR_CHANNEL_BUSY);
+			return;
+		}
+		if (!c) {
+			for (int i = 0; i < U2F_SIDE_CHANNELS && !c; i++) {
+				if (side_channels[i].cid == 0) {
+					c = &side_channels[i];
+				}
+			}
+			if (!c) {
+				send_u2fhid_error(f->cid, ERR_CHANNEL_BUSY);
+				return;
+			}
+		}
+		c->cid = f->cid;
+		c->deadline = timer_ms() + U2FHID_TRANS_TIMEOUT;
+		c->cmd = f->init.cmd;
+		c->len = MSG_LEN(*f);
+		c->got = MIN(sizeof(f->init.data), c->len);
+		c->seq = 0;
+		memcpy(c->buf, f->init.data, c->got);
+	} else {
+		if (!c) {
+			send_u2fhid_error(f->cid, ERR_CHANNEL_BUSY);
+			return;
+		}
+		if (c->seq != f->cont.seq) {
+			send_u2fhid_error(f->cid, ERR_INVALID_SEQ);
+			c->cid = 0;
+			return;
+		}
+		uint32_t n = MIN(sizeof(f->cont.data), c->len - c->got);
+		memcpy(c->buf + c->got, f->cont.data, n);
+		c->got += n;
+		c->seq++;
+	}
+
+	if (c->got >= c->len) {
+		u2fhid_side_complete(c);
+	}
+}
+
 void u2fhid_read(char tiny, const U2FHID_FRAME *f)
 {
 	// Always handle init packets directly
@@ -127,7 +261,7 @@ void u2fhid_read(char tiny, const U2FHID_FRAME *f)
 	if (tiny) {
 		// read continue packet
 		if (reader == 0 || cid != f->cid) {
-			send_u2fhid_error(f->cid, ERR_CHANNEL_BUSY);
+			u2fhid_side_read(f);
 			return;
 		}
 
@@ -154,6 +288,12 @@ void u2fhid_read(char tiny, const U2FHID_FRAME *f)
 		return;
 	}
 
+	// finish a side transaction that outlived the active channel
+	if (!(f->type & TYPE_INIT) && u2fhid_side_find(f->cid)) {
+		u2fhid_side_read(f);
+		return;
+	}
+
 	u2fhid_read_start(f);
 }
 
@@ -270,18 +410,12 @@ void u2fhid_wink(const uint8_t *buf, uint32_t len)
 	if (dialog_timeout > 0)
 		dialog_timeout = U2F_TIMEOUT;
 
-	U2FHID_FRAME f;
-	memset(&f, 0, sizeof(f));
-	f.cid = cid;
-	f.init.cmd = U2FHID_WINK;
-	f.init.bcntl = 0;
-	queue_u2f_pkt(&f);
+	send_u2fhid_msg(U2FHID_WINK, NULL, 0);
 }
 
 void u2fhid_init(const U2FHID_FRAME *in)
 {
 	const U2FHID_INIT_REQ *init_req = (const U2FHID_INIT_REQ *)&in->init.data;
-	U2FHID_FRAME f;
 	U2FHID_INIT_RESP resp;
 
 	debugLog(0, "", "u2fhid_init");
@@ -291,12 +425,6 @@ void u2fhid_init(const U2FHID_FRAME *in)
 		return;
 	}
 
-	memset(&f, 0, sizeof(f));
-	f.cid = in->cid;
-	f.init.cmd = U2FHID_INIT;
-	f.init.bcnth = 0;
-	f.init.bcntl = U2FHID_INIT_RESP_SIZE;
-
 	memcpy(resp.nonce, init_req->nonce, sizeof(init_req->nonce));
 	resp.cid = in->cid == CID_BROADCAST ? next_cid() : in->cid;
 	resp.versionInterface = U2FHID_IF_VERSION;
@@ -304,31 +432,131 @@ void u2fhid_init(const U2FHID_FRAME *in)
 	resp.versionMinor = VERSION_MINOR;
 	resp.versionBuild = VERSION_PATCH;
 	resp.capFlags = CAPFLAG_WINK;
-	memcpy(&f.init.data, &resp, sizeof(resp));
 
-	queue_u2f_pkt(&f);
+	send_u2fhid_msg_cid(in->cid, U2FHID_INIT, (const uint8_t *)&resp, U2FHID_INIT_RESP_SIZE);
 }
 
-void queue_u2f_pkt(const U2FHID_FRAME *u2f_pkt)
+static bool u2f_out_full(uint32_t len)
 {
-	// debugLog(0, "", "u2f_write_pkt");
-	uint32_t next = (u2f_out_end + 1) % U2F_OUT_PKT_BUFFER_LEN;
-	if (u2f_out_start == next) {
-		debugLog(0, "", "u2f_write_pkt full");
-		return; // Buffer full :(
+	if ((u2f_out_end + 1) % U2F_OUT_MSG_QUEUE_LEN == u2f_out_start) {
+		return true;
 	}
-	memcpy(u2f_out_packets[u2f_out_end], u2f_pkt, HID_RPT_SIZE);
-	u2f_out_end = next;
+	if (len > U2F_OUT_DATA_LEN) {
+		return u2f_out_extern != NULL;
+	}
+	return u2f_out_used + len > U2F_OUT_DATA_LEN;
+}
+
+// Keep the endpoint going until the host has taken enough of the queue,
+// the same way u2fhid_read_start() waits for the rest of a request.
+static bool u2f_out_wait(bool (*busy)(uint32_t), uint32_t len)
+{
+	int counter = U2F_TIMEOUT;
+	while (busy(len)) {
+		if (counter-- == 0) {
+			return false;
+		}
+		usbPoll();
+	}
+	return true;
+}
+
+static bool u2f_out_extern_busy(uint32_t len)
+{
+	(void)len;
+	return u2f_out_extern != NULL;
 }
 
-uint8_t *u2f_out_data(void)
+static void u2f_out_queue(uint32_t fcid, uint8_t cmd, const uint8_t *data, uint32_t len)
 {
-	if (u2f_out_start == u2f_out_end)
-		return NULL; // No data
-	// debugLog(0, "", "u2f_out_data");
-	uint32_t t = u2f_out_start;
-	u2f_out_start = (u2f_out_start + 1) % U2F_OUT_PKT_BUFFER_LEN;
-	return u2f_out_packets[t];
+	if (!u2f_out_wait(u2f_out_full, len)) {
+		debugLog(0, "", "u2f_out_queue full");
+		return;
+	}
+
+	uint32_t idx = u2f_out_end;
+	U2F_OutMsg *m = &u2f_out_msgs[idx];
+	m->cid = fcid;
+	m->cmd = cmd;
+	m->len = len;
+	m->sent = 0;
+	m->frames = 0;
+	m->data = NULL;
+	if (len > U2F_OUT_DATA_LEN) {
+		m->data = data;
+		u2f_out_extern = data;
+	} else {
+		uint32_t tail = (u2f_out_head + u2f_out_used) % U2F_OUT_DATA_LEN;
+		uint32_t n = MIN(len, U2F_OUT_DATA_LEN - tail);
+		if (len > 0) {
+			memcpy(u2f_out_ring + tail, data, n);
+			memcpy(u2f_out_ring, data + n, len - n);
+		}
+		u2f_out_used += len;
+	}
+	u2f_out_end = (u2f_out_end + 1) % U2F_OUT_MSG_QUEUE_LEN;
+
+	if (m->data && !u2f_out_wait(u2f_out_extern_busy, 0)) {
+		// the caller's buffer goes away, end the message where it is
+		debugLog(0, "", "u2f_out_queue timeout");
+		if (u2f_out_msgs[idx].frames == 0) {
+			u2f_out_msgs[idx].frames = 1;
+		}
+		u2f_out_msgs[idx].len = u2f_out_msgs[idx].sent;
+		u2f_out_msgs[idx].data = NULL;
+		u2f_out_extern = NULL;
+	}
+}
+
+const uint8_t *u2f_out_data(void)
+{
+	static U2FHID_FRAME f;
+
+	while (u2f_out_start != u2f_out_end) {
+		U2F_OutMsg *m = &u2f_out_msgs[u2f_out_start];
+		if (m->frames > 0 && m->sent >= m->len) {
+			// dropped by a timed out sender
+			u2f_out_start = (u2f_out_start + 1) % U2F_OUT_MSG_QUEUE_LEN;
+			continue;
+		}
+
+		uint8_t *p;
+		uint32_t psz;
+		memset(&f, 0, sizeof(f));
+		f.cid = m->cid;
+		if (m->frames == 0) {
+			f.init.cmd = m->cmd;
+			f.init.bcnth = m->len >> 8;
+			f.init.bcntl = m->len & 0xff;
+			p = f.init.data;
+			psz = MIN(sizeof(f.init.data), m->len);
+		} else {
+			f.cont.seq = m->frames - 1;
+			p = f.cont.data;
+			psz = MIN(sizeof(f.cont.data), m->len - m->sent);
+		}
+
+		if (m->data) {
+			memcpy(p, m->data + m->sent, psz);
+		} else {
+			uint32_t n = MIN(psz, U2F_OUT_DATA_LEN - u2f_out_head);
+			memcpy(p, u2f_out_ring + u2f_out_head, n);
+			memcpy(p + n, u2f_out_ring, psz - n);
+			u2f_out_head = (u2f_out_head + psz) % U2F_OUT_DATA_LEN;
+			u2f_out_used -= psz;
+		}
+		m->sent += psz;
+		m->frames++;
+
+		if (m->sent >= m->len) {
+			if (m->data) {
+				u2f_out_extern = NULL;
+			}
+			u2f_out_start = (u2f_out_start + 1) % U2F_OUT_MSG_QUEUE_LEN;
+		}
+		return (const uint8_t *)&f;
+	}
+	return NULL; // No data
 }
 
 void u2fhid_msg(const APDU *a, uint32_t len)
@@ -363,53 +591,18 @@ void u2fhid_msg(const APDU *a, uint32_t len)
 
 void send_u2fhid_msg(const uint8_t cmd, const uint8_t *data, const uint32_t len)
 {
-	U2FHID_FRAME f;
-	uint8_t *p = (uint8_t *)data;
-	uint32_t l = len;
-	uint32_t psz;
-	uint8_t seq = 0;
+	send_u2fhid_msg_cid(cid, cmd, data, len);
+}
 
+static void send_u2fhid_msg_cid(uint32_t fcid, const uint8_t cmd, const uint8_t *data, const uint32_t len)
+{
 	// debugLog(0, "", "send_u2fhid_msg");
-
-	memset(&f, 0, sizeof(f));
-	f.cid = cid;
-	f.init.cmd = cmd;
-	f.init.bcnth = len >> 8;
-	f.init.bcntl = len & 0xff;
-
-	// Init packet
-	psz = MIN(sizeof(f.init.data), l);
-	memcpy(f.init.data, p, psz);
-	queue_u2f_pkt(&f);
-	l -= psz;
-	p += psz;
-
-	// Cont packet(s)
-	for (; l > 0; l -= psz, p += psz) {
-		// debugLog(0, "", "send_u2fhid_msg con");
-		memset(&f.cont.data, 0, sizeof(f.cont.data));
-		f.cont.seq = seq++;
-		psz = MIN(sizeof(f.cont.data), l);
-		memcpy(f.cont.data, p, psz);
-		queue_u2f_pkt(&f);
-	}
-
-	if (data + len != p) {
-		debugLog(0, "", "send_u2fhid_msg is bad");
-		debugInt(data + len - p);
-	}
+	u2f_out_queue(fcid, cmd, data, len);
 }
 
 void send_u2fhid_error(uint32_t fcid, uint8_t err)
 {
-	U2FHID_FRAME f;
-
-	memset(&f, 0, sizeof(f));
-	f.cid = fcid;
-	f.init.cmd = U2FHID_ERROR;
-	f.init.bcntl = 1;
-	f.init.data[0] = err;
-	queue_u2f_pkt(&f);
+	send_u2fhid_msg_cid(fcid, U2FHID_ERROR, &err, 1);
 }
 
 void u2f_version(const APDU *a)
@@ -456,48 +649,91 @@ static const HDNode *getDerivedNode(uint32_t *address_n, size_t address_n_count)
 	if (!address_n || address_n_count == 0) {
 		return &node;
 	}
-	for (size_t i = 0; i < address_n_count; i++) {
-		if (hdnode_private_ckd(&node, address_n[i]) == 0) {
-			layoutHome();
-			debugLog(0, "", "ERR: Derive private failed");
-			return 0;
-		}
+	if (cryptoDeriveNode(&node, address_n, address_n_count, NULL) == 0) {
+		layoutHome();
+		debugLog(0, "", "ERR: Derive private failed");
+		return 0;
 	}
 	return &node;
 }
 
-static const HDNode *generateKeyHandle(const uint8_t app_id[], uint8_t key_handle[])
+/*
+ * Version 2 key handles: tag, 28 random bytes and a MAC.  The key and the
+ * MAC are derived with one HMAC each from a master key, which is itself
+ * one HMAC of the U2F root.  This replaces the 8 CKD steps of the
+ * original handles, which are still accepted by validateKeyHandle.
+ */
+static void keyHandleDerive(const uint8_t master[32], uint8_t label, const uint8_t app_id[], const uint8_t key_handle[], uint8_t out[32])
 {
-	uint8_t keybase[U2F_APPID_SIZE + KEY_PATH_LEN];
+	HMAC_SHA256_CTX ctx;
+	hmac_sha256_Init(&ctx, master, 32);
+	hmac_sha256_Update(&ctx, &label, 1);
+	hmac_sha256_Update(&ctx, app_id, U2F_APPID_SIZE);
+	hmac_sha256_Update(&ctx, key_handle, KEY_PATH_LEN);
+	hmac_sha256_Final(&ctx, out);
+}
 
-	// Derivation path is m/U2F'/r'/r'/r'/r'/r'/r'/r'/r'
-	uint32_t key_path[KEY_PATH_ENTRIES];
-	for (uint32_t i = 0; i < KEY_PATH_ENTRIES; i++) {
-		// high bit for hardened keys
-		key_path[i]= 0x80000000 | random32();
+// compares in time independent of where the buffers differ
+static bool macEqual(const uint8_t a[SHA256_DIGEST_LENGTH], const uint8_t b[SHA256_DIGEST_LENGTH])
+{
+	uint8_t diff = 0;
+	for (int i = 0; i < SHA256_DIGEST_LENGTH; i++) {
+		diff |= a[i] ^ b[i];
 	}
+	return diff == 0;
+}
 
-	// First half of keyhandle is key_path
-	memcpy(key_handle, key_path, KEY_PATH_LEN);
-
-	// prepare keypair from /random data
-	const HDNode *node = getDerivedNode(key_path, KEY_PATH_ENTRIES);
-	if (!node)
-		return NULL;
-
-	// For second half of keyhandle
-	// Signature of app_id and random data
-	memcpy(&keybase[0], app_id, U2F_APPID_SIZE);
-	memcpy(&keybase[U2F_APPID_SIZE], key_handle, KEY_PATH_LEN);
-	hmac_sha256(node->private_key, sizeof(node->private_key),
-					keybase, sizeof(keybase), &key_handle[KEY_PATH_LEN]);
-
-	// Done!
-	return node;
+/*
+ * Derives the key of a v2 key handle.  A new handle gets its MAC written
+ * to mac_out, a handle from the host is checked against expected_mac and
+ * nothing derived from it is left behind when it does not match.
+ */
+static const HDNode *keyHandleNode(const uint8_t app_id[], const uint8_t key_handle[], uint8_t mac_out[SHA256_DIGEST_LENGTH], const uint8_t expected_mac[SHA256_DIGEST_LENGTH])
+{
+	static CONFIDENTIAL HDNode node;
+	static CONFIDENTIAL uint8_t master[32];
+	uint8_t mac[SHA256_DIGEST_LENGTH];
+	if (!storage_getU2FRoot(&node)) {
+		layoutHome();
+		debugLog(0, "", "ERR: Device not init");
+		return 0;
+	}
+	hmac_sha256(node.private_key, sizeof(node.private_key),
+				(const uint8_t *)"U2F key handle", 14, master);
+
+	keyHandleDerive(master, 'k', app_id, key_handle, node.private_key);
+	keyHandleDerive(master, 'm', app_id, key_handle, mac);
+	memzero(master, sizeof(master));
+	memzero(node.chain_code, sizeof(node.chain_code));
+	memzero(node.public_key, sizeof(node.public_key));
+
+	bignum256 k;
+	bn_read_be(node.private_key, &k);
+	bool valid = !bn_is_zero(&k) && bn_is_less(&k, &nist256p1.order);
+	memzero(&k, sizeof(k));
+	if (!valid) {
+		memzero(&node, sizeof(node));
+		debugLog(0, "", "ERR: Derive private failed");
+		return 0;
+	}
+	if (expected_mac && !macEqual(mac, expected_mac)) {
+		memzero(&node, sizeof(node));
+		return 0;
+	}
+	if (mac_out) {
+		memcpy(mac_out, mac, sizeof(mac));
+	}
+	return &node;
 }
 
+static const HDNode *generateKeyHandle(const uint8_t app_id[], uint8_t key_handle[])
+{
+	memcpy(key_handle, key_handle_v2_tag, sizeof(key_handle_v2_tag));
+	random_buffer(key_handle + sizeof(key_handle_v2_tag), KEY_PATH_LEN - sizeof(key_handle_v2_tag));
+	return keyHandleNode(app_id, key_handle, &key_handle[KEY_PATH_LEN], NULL);
+}
 
-static const HDNode *validateKeyHandle(const uint8_t app_id[], const uint8_t key_handle[])
+static const HDNode *validateKeyHandleV1(const uint8_t app_id[], const uint8_t key_handle[])
 {
 	uint32_t key_path[KEY_PATH_ENTRIES];
 	memcpy(key_path, key_handle, KEY_PATH_LEN);
@@ -528,6 +764,14 @@ static const HDNode *validateKeyHandle(const uint8_t app_id[], const uint8_t key
 	return node;
 }
 
+static const HDNode *validateKeyHandle(const uint8_t app_id[], const uint8_t key_handle[])
+{
+	if (memcmp(key_handle, key_handle_v2_tag, sizeof(key_handle_v2_tag)) != 0)
+		return validateKeyHandleV1(app_id, key_handle);
+
+	return keyHandleNode(app_id, key_handle, NULL, &key_handle[KEY_PATH_LEN]);
+}
+
 
 void u2f_register(const APDU *a)
 {
@@ -556,7 +800,7 @@ void u2f_register(const APDU *a)
 	// First Time request, return not present and display request dialog
 	if (last_req_state == INIT) {
 		// error: testof-user-presence is required
-		buttonUpdate(); // Clear button state
+		buttonFlush(); // Clear button state
 		if (0 == memcmp(req->appId, BOGUS_APPID, U2F_APPID_SIZE)) {
 			layoutDialogSplit(
 				&bmp_icon_warning,
@@ -701,7 +945,7 @@ void u2f_authenticate(const APDU *a)
 
 	if (last_req_state == INIT) {
 		// error: testof-user-presence is required
-		buttonUpdate(); // Clear button state
+		buttonFlush(); // Clear button state
 		const char *appname;
 		const BITMAP *appicon;
 		getReadableAppId(req->appId, &appname, &appicon);
@@ -24,9 +24,13 @@
 #include "messages.h"
 #include "timer.h"
 #include "debug.h"
+#include "stats.h"
 
 static volatile char tiny = 0;
 
+// longest time to block for, so that display and buttons stay responsive
+#define EMULATOR_POLL_MS 10
+
 void usbInit(void) {
 	emulatorSocketInit();
 }
@@ -37,6 +41,22 @@ void usbInit(void) {
 #define _ISDBG ('n')
 #endif
 
+// drain the output queues, since usbIdle() may block on the sockets
+static void usb_drain(void) {
+	const uint8_t *data;
+	while ((data = msg_out_data()) != NULL) {
+		emulatorSocketWrite(0, data, 64);
+		stats_table.bytes_out[STATS_IF_MAIN] += 64;
+	}
+
+#if DEBUG_LINK
+	while ((data = msg_debug_out_data()) != NULL) {
+		emulatorSocketWrite(1, data, 64);
+		stats_table.bytes_out[STATS_IF_DEBUG] += 64;
+	}
+#endif
+}
+
 void usbPoll(void) {
 	emulatorPoll();
 
@@ -44,6 +64,7 @@ void usbPoll(void) {
 
 	int iface = 0;
 	if (emulatorSocketRead(&iface, buffer, sizeof(buffer)) > 0) {
+		stats_table.bytes_in[iface == 1 ? STATS_IF_DEBUG : STATS_IF_MAIN] += sizeof(buffer);
 		if (!tiny) {
 			msg_read_common(_ISDBG, buffer, sizeof(buffer));
 		} else {
@@ -51,17 +72,17 @@ void usbPoll(void) {
 		}
 	}
 
-	const uint8_t *data = msg_out_data();
-	if (data != NULL) {
-		emulatorSocketWrite(0, data, 64);
-	}
+	usb_drain();
+}
 
-#if DEBUG_LINK
-	data = msg_debug_out_data();
-	if (data != NULL) {
-		emulatorSocketWrite(1, data, 64);
-	}
-#endif
+// the sockets buffer incoming packets, they are read by the next usbPoll()
+void usbPollTx(void) {
+	emulatorPoll();
+	usb_drain();
+}
+
+void usbIdle(void) {
+	emulatorSocketWait(EMULATOR_POLL_MS);
 }
 
 char usbTiny(char set) {
@@ -75,5 +96,10 @@ void usbSleep(uint32_t millis) {
 
 	while (!timer_expired(start + millis)) {
 		usbPoll();
+
+		uint32_t left = start + millis - timer_ms();
+		if (left > 0 && left <= millis) {
+			emulatorSocketWait(left < EMULATOR_POLL_MS ? left : EMULATOR_POLL_MS);
+		}
 	}
 }
@@ -17,8 +17,12 @@
  * along with this library.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <string.h>
 #include <libopencm3/usb/usbd.h>
 #include <libopencm3/usb/hid.h>
+#include <libopencm3/stm32/otg_fs.h>
+#include <libopencm3/cm3/nvic.h>
+#include <libopencm3/cm3/scb.h>
 
 #include "trezor.h"
 #include "usb.h"
@@ -28,6 +32,15 @@
 #include "storage.h"
 #include "util.h"
 #include "timer.h"
+#include "webusb.h"
+#include "profile.h"
+#include "stats.h"
+
+/*
+ * The vendor bulk interface needs its own pair of endpoints; the OTG FS
+ * core has three besides EP0, so debug link builds stay HID only.
+ */
+#define USB_BULK (!DEBUG_LINK)
 
 #define USB_INTERFACE_INDEX_MAIN 0
 #if DEBUG_LINK
@@ -35,6 +48,7 @@
 #define USB_INTERFACE_INDEX_U2F 2
 #else
 #define USB_INTERFACE_INDEX_U2F 1
+#define USB_INTERFACE_INDEX_BULK 2
 #endif
 
 #define ENDPOINT_ADDRESS_IN         (0x81)
@@ -43,6 +57,8 @@
 #define ENDPOINT_ADDRESS_DEBUG_OUT  (0x02)
 #define ENDPOINT_ADDRESS_U2F_IN     (0x83)
 #define ENDPOINT_ADDRESS_U2F_OUT    (0x03)
+#define ENDPOINT_ADDRESS_BULK_IN    (0x82)
+#define ENDPOINT_ADDRESS_BULK_OUT   (0x02)
 
 #define USB_STRINGS \
 	X(MANUFACTURER, "Archos") \
@@ -50,7 +66,8 @@
 	X(SERIAL_NUMBER, storage_uuid_str) \
 	X(INTERFACE_MAIN,  "Safe-T Interface") \
 	X(INTERFACE_DEBUG, "Safe-T Debug Link Interface") \
-	X(INTERFACE_U2F,   "U2F Interface")
+	X(INTERFACE_U2F,   "U2F Interface") \
+	X(INTERFACE_BULK,  "Safe-T WebUSB Interface")
 
 #define X(name, value) USB_STRING_##name,
 enum {
@@ -68,7 +85,11 @@ static const char *usb_strings[] = {
 static const struct usb_device_descriptor dev_descr = {
 	.bLength = USB_DT_DEVICE_SIZE,
 	.bDescriptorType = USB_DT_DEVICE,
+#if USB_BULK
+	.bcdUSB = 0x0210,	// BOS with the WebUSB and WinUSB capabilities
+#else
 	.bcdUSB = 0x0200,
+#endif
 	.bDeviceClass = 0,
 	.bDeviceSubClass = 0,
 	.bDeviceProtocol = 0,
@@ -244,6 +265,39 @@ static const struct usb_interface_descriptor hid_iface_u2f[] = {{
 	.extralen = sizeof(hid_function_u2f),
 }};
 
+#if USB_BULK
+static const struct usb_endpoint_descriptor bulk_endpoints[2] = {{
+	.bLength = USB_DT_ENDPOINT_SIZE,
+	.bDescriptorType = USB_DT_ENDPOINT,
+	.bEndpointAddress = ENDPOINT_ADDRESS_BULK_IN,
+	.bmAttributes = USB_ENDPOINT_ATTR_BULK,
+	.wMaxPacketSize = 64,
+	.bInterval = 0,
+}, {
+	.bLength = USB_DT_ENDPOINT_SIZE,
+	.bDescriptorType = USB_DT_ENDPOINT,
+	.bEndpointAddress = ENDPOINT_ADDRESS_BULK_OUT,
+	.bmAttributes = USB_ENDPOINT_ATTR_BULK,
+	.wMaxPacketSize = 64,
+	.bInterval = 0,
+}};
+
+static const struct usb_interface_descriptor bulk_iface[] = {{
+	.bLength = USB_DT_INTERFACE_SIZE,
+	.bDescriptorType = USB_DT_INTERFACE,
+	.bInterfaceNumber = USB_INTERFACE_INDEX_BULK,
+	.bAlternateSetting = 0,
+	.bNumEndpoints = 2,
+	.bInterfaceClass = USB_CLASS_VENDOR,
+	.bInterfaceSubClass = 0,
+	.bInterfaceProtocol = 0,
+	.iInterface = USB_STRING_INTERFACE_BULK,
+	.endpoint = bulk_endpoints,
+	.extra = NULL,
+	.extralen = 0,
+}};
+#endif
+
 #if DEBUG_LINK
 static const struct usb_endpoint_descriptor hid_endpoints_debug[2] = {{
 	.bLength = USB_DT_ENDPOINT_SIZE,
@@ -288,6 +342,11 @@ static const struct usb_interface ifaces[] = {{
 }, {
 	.num_altsetting = 1,
 	.altsetting = hid_iface_u2f,
+#if USB_BULK
+}, {
+	.num_altsetting = 1,
+	.altsetting = bulk_iface,
+#endif
 }};
 
 static const struct usb_config_descriptor config = {
@@ -297,7 +356,7 @@ static const struct usb_config_descriptor config = {
 #if DEBUG_LINK
 	.bNumInterfaces = 3,
 #else
-	.bNumInterfaces = 2,
+	.bNumInterfaces = 3,
 #endif
 	.bConfigurationValue = 1,
 	.iConfiguration = 0,
@@ -340,17 +399,59 @@ static int hid_control_request(usbd_device *dev, struct usb_setup_data *req, uin
 
 static volatile char tiny = 0;
 
+#if USB_BULK
+// responses go out on the interface the last request came in on
+static volatile char bulk_active = 0;
+#endif
+
+/*
+ * Packets of the message OUT endpoints are parked by the rx callbacks and
+ * handed on by usbPoll() once usbd_poll() has returned, so a handler that
+ * polls USB again while it waits never runs inside the USB stack.  The
+ * endpoint NAKs the host while its packet is parked, a park with a ready
+ * check keeps the packet until the handler can take it.  Handing packets
+ * on can also be deferred, see usbPollTx().
+ */
+static volatile char rx_deferred = 0;
+
+struct usb_rx_park {
+	uint8_t ep;
+	uint8_t full;
+	uint16_t len;
+	void (*handle)(const uint8_t *buf, uint16_t len);
+	bool (*ready)(void);
+	uint8_t buf[64] __attribute__ ((aligned(4)));
+};
+
+static void usb_rx_packet(usbd_device *dev, struct usb_rx_park *park, const uint8_t *buf, uint16_t len)
+{
+	memcpy(park->buf, buf, len);
+	park->len = len;
+	park->full = 1;
+	usbd_ep_nak_set(dev, park->ep, 1);
+}
+
+static void hid_rx_handle(const uint8_t *buf, uint16_t len)
+{
+#if USB_BULK
+	bulk_active = 0;
+#endif
+	if (!tiny) {
+		msg_read(buf, len);
+	} else {
+		msg_read_tiny(buf, len);
+	}
+}
+
+static struct usb_rx_park CONFIDENTIAL hid_rx_park = { ENDPOINT_ADDRESS_OUT, 0, 0, hid_rx_handle, 0, {0} };
+
 static void hid_rx_callback(usbd_device *dev, uint8_t ep)
 {
 	(void)ep;
 	static CONFIDENTIAL uint8_t buf[64] __attribute__ ((aligned(4)));
 	if ( usbd_ep_read_packet(dev, ENDPOINT_ADDRESS_OUT, buf, 64) != 64) return;
-	debugLog(0, "", "hid_rx_callback");
-	if (!tiny) {
-		msg_read(buf, 64);
-	} else {
-		msg_read_tiny(buf, 64);
-	}
+	stats_table.bytes_in[STATS_IF_MAIN] += 64;
+	usb_rx_packet(dev, &hid_rx_park, buf, 64);
 }
 
 static void hid_u2f_rx_callback(usbd_device *dev, uint8_t ep)
@@ -358,38 +459,358 @@ static void hid_u2f_rx_callback(usbd_device *dev, uint8_t ep)
 	(void)ep;
 	static CONFIDENTIAL uint8_t buf[64] __attribute__ ((aligned(4)));
 
-	debugLog(0, "", "hid_u2f_rx_callback");
 	if ( usbd_ep_read_packet(dev, ENDPOINT_ADDRESS_U2F_OUT, buf, 64) != 64) return;
+	stats_table.bytes_in[STATS_IF_U2F] += 64;
 	u2fhid_read(tiny, (const U2FHID_FRAME *) (void*) buf);
 }
 
 #if DEBUG_LINK
+static void hid_debug_rx_handle(const uint8_t *buf, uint16_t len)
+{
+	if (!tiny) {
+		msg_debug_read(buf, len);
+	} else {
+		msg_read_tiny(buf, len);
+	}
+}
+
+static struct usb_rx_park CONFIDENTIAL hid_debug_rx_park = { ENDPOINT_ADDRESS_DEBUG_OUT, 0, 0, hid_debug_rx_handle, 0, {0} };
+
 static void hid_debug_rx_callback(usbd_device *dev, uint8_t ep)
 {
 	(void)ep;
 	static CONFIDENTIAL uint8_t buf[64] __attribute__ ((aligned(4)));
 	if ( usbd_ep_read_packet(dev, ENDPOINT_ADDRESS_DEBUG_OUT, buf, 64) != 64) return;
-	debugLog(0, "", "hid_debug_rx_callback");
+	stats_table.bytes_in[STATS_IF_DEBUG] += 64;
+	usb_rx_packet(dev, &hid_debug_rx_park, buf, 64);
+}
+#endif
+
+static usbd_device *usbd_dev;
+
+#if USB_BULK
+/*
+ * Vendor bulk transport.
+ *
+ * The bulk interface carries the same "##" framed messages as HID, but as
+ * a plain byte stream: there is no '?' marker per packet and the host may
+ * queue several 64-byte packets per USB frame.  Both directions are cut
+ * back into the 64-byte '?' frames of the HID protocol here, so the
+ * message layer does not know which interface a message used.  Message
+ * boundaries come from the length in the "##" header: each response
+ * starts a new packet and the host reads until it has the header plus
+ * the announced length, so no zero-length packet is needed.
+ */
+
+/*
+ * A packet completes at most one frame per 8 bytes (a message without
+ * payload is a bare header) plus the frame that was already started.  A
+ * packet is only taken while the queue has room for that many frames,
+ * until then the endpoint NAKs the host, so no frame is ever dropped.
+ * The queue indices wrap at 256, so the size has to divide it.
+ */
+#define BULK_RX_FRAMES 16
+#define BULK_RX_PACKET_FRAMES (1 + (64 - 1) / 8)
+
+_Static_assert(BULK_RX_FRAMES >= BULK_RX_PACKET_FRAMES && 256 % BULK_RX_FRAMES == 0, "BULK_RX_FRAMES");
+
+static struct {
+	uint8_t frame[64];	// '?' frame being collected
+	uint8_t pos;		// next free byte in frame
+	char header;		// the "##" header of the current message was seen
+	uint32_t left;		// message bytes still to come after the header
+	uint8_t ready[BULK_RX_FRAMES][64];	// complete frames not yet handed on
+	uint8_t head, tail;
+} CONFIDENTIAL bulk_rx __attribute__ ((aligned(4)));
+
+static void bulk_rx_clear(void)
+{
+	memset(bulk_rx.frame, 0, sizeof(bulk_rx.frame));
+	bulk_rx.frame[0] = '?';
+	bulk_rx.pos = 1;
+}
+
+static bool bulk_rx_room(void)
+{
+	return BULK_RX_FRAMES - (uint8_t)(bulk_rx.head - bulk_rx.tail) >= BULK_RX_PACKET_FRAMES;
+}
+
+static void bulk_rx_push(void)
+{
+	// bulk_rx_room() was checked before the packet was taken
+	memcpy(bulk_rx.ready[bulk_rx.head % BULK_RX_FRAMES], bulk_rx.frame, 64);
+	bulk_rx.head++;
+	bulk_rx_clear();
+}
+
+static void bulk_rx_reset(void)
+{
+	bulk_rx_clear();
+	bulk_rx.header = 0;
+	bulk_rx.left = 0;
+	bulk_rx.head = bulk_rx.tail = 0;
+}
+
+static void bulk_rx_handle(const uint8_t *buf, uint16_t len)
+{
+	bulk_active = 1;
+
+	for (uint16_t i = 0; i < len; i++) {
+		bulk_rx.frame[bulk_rx.pos++] = buf[i];
+		if (!bulk_rx.header) {
+			if (bulk_rx.pos < 9) {
+				continue;
+			}
+			const uint8_t *h = bulk_rx.frame + 1;
+			if (h[0] != '#' || h[1] != '#') {
+				// not a message start, drop the rest of the packet
+				bulk_rx_clear();
+				break;
+			}
+			bulk_rx.left = ((uint32_t)h[4] << 24) + (h[5] << 16) + (h[6] << 8) + h[7];
+			bulk_rx.header = 1;
+		} else {
+			bulk_rx.left--;
+		}
+		if (bulk_rx.left == 0) {
+			bulk_rx_push();
+			bulk_rx.header = 0;
+		} else if (bulk_rx.pos == 64) {
+			bulk_rx_push();
+		}
+	}
+}
+
+/*
+ * Frames are handed on one per usbPoll(), like HID packets, so a decoder
+ * waiting for the next frame gets exactly one.  A frame leaves the queue
+ * before it is handed on, so a nested usbPoll() keeps the stream order.
+ */
+static void bulk_rx_next(void)
+{
+	if (bulk_rx.tail == bulk_rx.head) {
+		return;
+	}
+	static CONFIDENTIAL uint8_t frame[64] __attribute__ ((aligned(4)));
+	memcpy(frame, bulk_rx.ready[bulk_rx.tail % BULK_RX_FRAMES], 64);
+	bulk_rx.tail++;
 	if (!tiny) {
-		msg_debug_read(buf, 64);
+		msg_read(frame, 64);
 	} else {
-		msg_read_tiny(buf, 64);
+		msg_read_tiny(frame, 64);
+	}
+}
+
+static struct usb_rx_park CONFIDENTIAL bulk_rx_park = { ENDPOINT_ADDRESS_BULK_OUT, 0, 0, bulk_rx_handle, bulk_rx_room, {0} };
+
+static void bulk_rx_callback(usbd_device *dev, uint8_t ep)
+{
+	(void)ep;
+	static CONFIDENTIAL uint8_t buf[64] __attribute__ ((aligned(4)));
+	uint16_t len = usbd_ep_read_packet(dev, ENDPOINT_ADDRESS_BULK_OUT, buf, 64);
+	stats_table.bytes_in[STATS_IF_BULK] += len;
+	usb_rx_packet(dev, &bulk_rx_park, buf, len);
+	memset(buf, 0, sizeof(buf));
+}
+
+static struct {
+	uint8_t frame[64];	// '?' frame taken from the message queue
+	uint8_t pos;		// next unsent byte in frame, 64 once consumed
+	uint32_t left;		// message bytes not yet packed, 0 between messages
+	uint8_t len;		// bytes collected in packet
+	uint8_t packet[64];
+} bulk_tx __attribute__ ((aligned(4)));
+
+static void bulk_tx_reset(void)
+{
+	bulk_tx.pos = 64;
+	bulk_tx.left = 0;
+	bulk_tx.len = 0;
+}
+
+static const uint8_t *bulk_tx_next(uint8_t *len)
+{
+	if (!bulk_active) {
+		return NULL;
+	}
+	while (bulk_tx.len < 64) {
+		if (bulk_tx.pos == 64) {
+			const uint8_t *data = msg_out_data();
+			if (!data) {
+				// keep a partial packet until the rest of the message is queued
+				return NULL;
+			}
+			memcpy(bulk_tx.frame, data, 64);
+			bulk_tx.pos = 1;
+			if (bulk_tx.left == 0) {
+				const uint8_t *h = bulk_tx.frame + 1;
+				if (h[0] != '#' || h[1] != '#') {
+					bulk_tx.pos = 64;
+					continue;
+				}
+				bulk_tx.left = 8 + (((uint32_t)h[4] << 24) + (h[5] << 16) + (h[6] << 8) + h[7]);
+			}
+		}
+		uint32_t n = 64 - bulk_tx.len;
+		n = MIN(n, (uint32_t)(64 - bulk_tx.pos));
+		n = MIN(n, bulk_tx.left);
+		memcpy(bulk_tx.packet + bulk_tx.len, bulk_tx.frame + bulk_tx.pos, n);
+		bulk_tx.len += n;
+		bulk_tx.pos += n;
+		bulk_tx.left -= n;
+		if (bulk_tx.left == 0) {
+			// the rest of the frame is padding, the message ends this packet
+			bulk_tx.pos = 64;
+			break;
+		}
+	}
+	*len = bulk_tx.len;
+	bulk_tx.len = 0;
+	return bulk_tx.packet;
+}
+#endif
+
+static struct usb_rx_park * const usb_rx_parks[] = {
+	&hid_rx_park,
+#if DEBUG_LINK
+	&hid_debug_rx_park,
+#endif
+#if USB_BULK
+	&bulk_rx_park,
+#endif
+};
+
+// hand on the parked packets, their endpoints accept the next one
+static void usb_rx_release(void)
+{
+	if (rx_deferred) return;
+#if USB_BULK
+	bulk_rx_next();
+#endif
+	for (size_t i = 0; i < sizeof(usb_rx_parks) / sizeof(*usb_rx_parks); i++) {
+		struct usb_rx_park *park = usb_rx_parks[i];
+		if (!park->full || (park->ready && !park->ready())) continue;
+		park->full = 0;
+		usbd_ep_nak_set(usbd_dev, park->ep, 0);
+		park->handle(park->buf, park->len);
 	}
 }
+
+/*
+ * IN endpoint transmit scheduler.
+ *
+ * Each IN endpoint owns one slot.  A report is handed to the hardware only
+ * while the endpoint is idle; the IN-complete callback clears the busy flag
+ * and immediately refills the endpoint from its output queue, so long
+ * responses leave at the full HID frame rate from within usbd_poll()
+ * instead of one packet per usbPoll() call with a busy-wait in between.
+ * HID reports are always 64 bytes, bulk packets may be shorter.
+ */
+struct usb_tx_slot {
+	uint8_t ep;
+	uint8_t iface;		// StatsInterface
+	volatile uint8_t busy;
+	uint8_t pending;
+	uint8_t len;
+	const uint8_t *(*next)(uint8_t *len);
+	uint8_t buf[64] __attribute__ ((aligned(4)));
+};
+
+static const uint8_t *hid_tx_next(uint8_t *len)
+{
+	*len = 64;
+#if USB_BULK
+	if (bulk_active) {
+		return NULL;
+	}
 #endif
+	return msg_out_data();
+}
+
+static const uint8_t *hid_u2f_tx_next(uint8_t *len)
+{
+	*len = 64;
+	return u2f_out_data();
+}
+
+#if DEBUG_LINK
+static const uint8_t *hid_debug_tx_next(uint8_t *len)
+{
+	*len = 64;
+	return msg_debug_out_data();
+}
+#endif
+
+static struct usb_tx_slot usb_tx[] = {
+	{ ENDPOINT_ADDRESS_IN,       STATS_IF_MAIN,  0, 0, 0, hid_tx_next,       {0} },
+	{ ENDPOINT_ADDRESS_U2F_IN,   STATS_IF_U2F,   0, 0, 0, hid_u2f_tx_next,   {0} },
+#if DEBUG_LINK
+	{ ENDPOINT_ADDRESS_DEBUG_IN, STATS_IF_DEBUG, 0, 0, 0, hid_debug_tx_next, {0} },
+#endif
+#if USB_BULK
+	{ ENDPOINT_ADDRESS_BULK_IN,  STATS_IF_BULK,  0, 0, 0, bulk_tx_next,      {0} },
+#endif
+};
+
+static void usb_tx_pump(struct usb_tx_slot *slot)
+{
+	if (slot->busy) return;
+	if (!slot->pending) {
+		const uint8_t *data = slot->next(&slot->len);
+		if (!data) return;
+		memcpy(slot->buf, data, slot->len);
+		slot->pending = 1;
+	}
+	if (usbd_ep_write_packet(usbd_dev, slot->ep, slot->buf, slot->len) == slot->len) {
+		stats_table.bytes_out[slot->iface] += slot->len;
+		slot->pending = 0;
+		slot->busy = 1;
+	}
+}
+
+static void hid_tx_callback(usbd_device *dev, uint8_t ep)
+{
+	(void)dev;
+	for (size_t i = 0; i < sizeof(usb_tx) / sizeof(*usb_tx); i++) {
+		if ((usb_tx[i].ep & 0x7F) == (ep & 0x7F)) {
+			usb_tx[i].busy = 0;
+			usb_tx_pump(&usb_tx[i]);
+			return;
+		}
+	}
+}
 
 static void hid_set_config(usbd_device *dev, uint16_t wValue)
 {
 	(void)wValue;
 
-	usbd_ep_setup(dev, ENDPOINT_ADDRESS_IN,  USB_ENDPOINT_ATTR_INTERRUPT, 64, 0);
+	profileBoot(PROFILE_BOOT_CONFIGURED);
+
+	// endpoints are reset on (re)configuration, nothing is in flight anymore
+	for (size_t i = 0; i < sizeof(usb_tx) / sizeof(*usb_tx); i++) {
+		usb_tx[i].busy = 0;
+	}
+	for (size_t i = 0; i < sizeof(usb_rx_parks) / sizeof(*usb_rx_parks); i++) {
+		usb_rx_parks[i]->full = 0;
+		usbd_ep_nak_set(dev, usb_rx_parks[i]->ep, 0);
+	}
+#if USB_BULK
+	bulk_rx_reset();
+	bulk_tx_reset();
+#endif
+
+	usbd_ep_setup(dev, ENDPOINT_ADDRESS_IN,  USB_ENDPOINT_ATTR_INTERRUPT, 64, hid_tx_callback);
 	usbd_ep_setup(dev, ENDPOINT_ADDRESS_OUT, USB_ENDPOINT_ATTR_INTERRUPT, 64, hid_rx_callback);
-	usbd_ep_setup(dev, ENDPOINT_ADDRESS_U2F_IN,  USB_ENDPOINT_ATTR_INTERRUPT, 64, 0);
+	usbd_ep_setup(dev, ENDPOINT_ADDRESS_U2F_IN,  USB_ENDPOINT_ATTR_INTERRUPT, 64, hid_tx_callback);
 	usbd_ep_setup(dev, ENDPOINT_ADDRESS_U2F_OUT, USB_ENDPOINT_ATTR_INTERRUPT, 64, hid_u2f_rx_callback);
 #if DEBUG_LINK
-	usbd_ep_setup(dev, ENDPOINT_ADDRESS_DEBUG_IN,  USB_ENDPOINT_ATTR_INTERRUPT, 64, 0);
+	usbd_ep_setup(dev, ENDPOINT_ADDRESS_DEBUG_IN,  USB_ENDPOINT_ATTR_INTERRUPT, 64, hid_tx_callback);
 	usbd_ep_setup(dev, ENDPOINT_ADDRESS_DEBUG_OUT, USB_ENDPOINT_ATTR_INTERRUPT, 64, hid_debug_rx_callback);
 #endif
+#if USB_BULK
+	usbd_ep_setup(dev, ENDPOINT_ADDRESS_BULK_IN,  USB_ENDPOINT_ATTR_BULK, 64, hid_tx_callback);
+	usbd_ep_setup(dev, ENDPOINT_ADDRESS_BULK_OUT, USB_ENDPOINT_ATTR_BULK, 64, bulk_rx_callback);
+#endif
 
 	usbd_register_control_callback(
 		dev,
@@ -398,36 +819,67 @@ static void hid_set_config(usbd_device *dev, uint16_t wValue)
 		hid_control_request);
 }
 
-static usbd_device *usbd_dev;
 static uint8_t usbd_control_buffer[128];
 
 void usbInit(void)
 {
 	usbd_dev = usbd_init(&otgfs_usb_driver, &dev_descr, &config, usb_strings, sizeof(usb_strings) / sizeof(*usb_strings), usbd_control_buffer, sizeof(usbd_control_buffer));
 	usbd_register_set_config_callback(usbd_dev, hid_set_config);
+#if USB_BULK
+	webusb_setup(usbd_dev, USB_INTERFACE_INDEX_BULK);
+#endif
 }
 
 void usbPoll(void)
 {
-	static const uint8_t *data;
-	// poll read buffer
+	// poll read buffer, completed IN transfers refill their endpoint here
 	usbd_poll(usbd_dev);
-	// write pending data
-	data = msg_out_data();
-	if (data) {
-		while ( usbd_ep_write_packet(usbd_dev, ENDPOINT_ADDRESS_IN, data, 64) != 64 ) {}
+	usb_rx_release();
+	// kick idle endpoints that have new data pending
+	for (size_t i = 0; i < sizeof(usb_tx) / sizeof(*usb_tx); i++) {
+		usb_tx_pump(&usb_tx[i]);
+	}
+}
+
+/*
+ * Keep the device serviced and the IN endpoints sending without starting
+ * to read new messages, e.g. from within a display animation.  Messages
+ * that arrive meanwhile wait for the next usbPoll().
+ */
+void usbPollTx(void)
+{
+	char old = rx_deferred;
+	rx_deferred = 1;
+	usbPoll();
+	rx_deferred = old;
+}
+
+/*
+ * Sleep until the next event when no USB work is pending.  The USB
+ * interrupt is not enabled in the NVIC, USB is serviced by polling, but
+ * with SEVONPEND the interrupt becoming pending still wakes the core from
+ * WFE, so a host request is polled right away and not on the next SysTick.
+ * The pending bit is cleared first, only a new interrupt sets the event.
+ * Needs privileged mode, see main().
+ */
+void usbIdle(void)
+{
+	SCB_SCR |= SCB_SCR_SEVEONPEND;
+	nvic_clear_pending_irq(NVIC_OTG_FS_IRQ);
+	if (OTG_FS_GINTSTS & OTG_FS_GINTMSK) {
+		return;
 	}
-	data = u2f_out_data();
-	if (data) {
-		while ( usbd_ep_write_packet(usbd_dev, ENDPOINT_ADDRESS_U2F_IN, data, 64) != 64 ) {}
+	for (size_t i = 0; i < sizeof(usb_tx) / sizeof(*usb_tx); i++) {
+		if (usb_tx[i].pending) {
+			return;
+		}
 	}
-#if DEBUG_LINK
-	// write pending debug data
-	data = msg_debug_out_data();
-	if (data) {
-		while ( usbd_ep_write_packet(usbd_dev, ENDPOINT_ADDRESS_DEBUG_IN, data, 64) != 64 ) {}
+#if USB_BULK
+	if (bulk_rx.tail != bulk_rx.head) {	// frames left for the next usbPoll()
+		return;
 	}
 #endif
+	__asm__ volatile("wfe");
 }
 
 void usbReconnect(void)
@@ -450,5 +902,6 @@ void usbSleep(uint32_t millis)
 
 	while (!timer_expired(start + millis)) {
 		usbd_poll(usbd_dev);
+		usb_rx_release();
 	}
 }
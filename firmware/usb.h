@@ -22,6 +22,8 @@
 
 void usbInit(void);
 void usbPoll(void);
+void usbPollTx(void);
+void usbIdle(void);
 void usbReconnect(void);
 char usbTiny(char set);
 void usbSleep(uint32_t millis);
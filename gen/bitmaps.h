@@ -3,8 +3,13 @@
 
 #include <stdint.h>
 
+// rows of width / 8 bytes, MSB is the leftmost pixel
+#define BITMAP_ROWS 0
+// display columns of 8 pixels, 8 rows at a time, run-length encoded
+#define BITMAP_RLE  1
+
 typedef struct {
-	uint8_t width, height;
+	uint8_t width, height, format;
 	const uint8_t *data;
 } BITMAP;
 
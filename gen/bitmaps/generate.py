@@ -2,58 +2,112 @@
 from __future__ import print_function
 import glob
 import os
-from PIL import Image
 
 hdrs = []
 data = []
 imgs = []
 
-def encode_pixels(img):
-	r = ''
-	img = [ (x[0] + x[1] + x[2] > 384 and '1' or '0') for x in img]
+def pixels_to_rows(img):
+	img = [ (x[0] + x[1] + x[2] > 384 and 1 or 0) for x in img]
+	rows = []
 	for i in range(len(img) // 8):
-		c = ''.join(img[i * 8 : i * 8 + 8])
-		r += '0x%02x, ' % int(c, 2)
+		c = 0
+		for b in img[i * 8 : i * 8 + 8]:
+			c = (c << 1) | b
+		rows.append(c)
+	return rows
+
+# 8 rows at a time collected into columns, MSB is the top row, which is
+# the layout of the display pages (see oledBlitColumn)
+def rows_to_columns(rows, w, h):
+	stride = w // 8
+	cols = []
+	for j in range(0, h, 8):
+		for i in range(w):
+			c = 0
+			for k in range(min(8, h - j)):
+				if rows[(j + k) * stride + i // 8] & (0x80 >> (i % 8)):
+					c |= 0x80 >> k
+			cols.append(c)
+	return cols
+
+# control byte 0x80 | (n - 1) repeats the next byte n times (n = 2..128),
+# n - 1 copies the next n bytes (n = 1..128)
+def encode_rle(cols):
+	r = []
+	i = 0
+	while i < len(cols):
+		n = 1
+		while i + n < len(cols) and n < 128 and cols[i + n] == cols[i]:
+			n += 1
+		if n >= 2:
+			r += [0x80 | (n - 1), cols[i]]
+			i += n
+			continue
+		n = 1
+		while i + n < len(cols) and n < 128 and not (i + n + 1 < len(cols) and cols[i + n] == cols[i + n + 1]):
+			n += 1
+		r += [n - 1] + cols[i : i + n]
+		i += n
 	return r
 
-cnt = 0
-for fn in sorted(glob.glob('*.png')):
-	print('Processing:', fn)
-	im = Image.open(fn)
-	name = os.path.splitext(fn)[0]
-	w, h = im.size
-	if w % 8 != 0:
-		raise Exception('Width must be divisable by 8! (%s is %dx%d)' % (fn, w, h))
-	img = list(im.getdata())
-	hdrs.append('extern const BITMAP bmp_%s;\n' % name)
-	imgs.append('const BITMAP bmp_%s = {%d, %d, bmp_%s_data};\n' % (name, w, h, name))
-	data.append('const uint8_t bmp_%s_data[] = { %s};\n' % (name, encode_pixels(img)))
-	cnt += 1
-
-with open('../bitmaps.c', 'wt') as f:
-	f.write('#include "bitmaps.h"\n\n')
-	for i in range(cnt):
-		f.write(data[i])
-	f.write('\n')
-	for i in range(cnt):
-		f.write(imgs[i])
-	f.close()
-
-with open('../bitmaps.h', 'wt') as f:
-	f.write('''#ifndef __BITMAPS_H__
+def encode_bytes(b):
+	return ''.join('0x%02x, ' % c for c in b)
+
+def encode_bitmap(rows, w, h):
+	rle = encode_rle(rows_to_columns(rows, w, h))
+	if len(rle) < len(rows):
+		return 'BITMAP_RLE', rle
+	return 'BITMAP_ROWS', rows
+
+def main():
+	from PIL import Image
+	cnt = 0
+	for fn in sorted(glob.glob('*.png')):
+		print('Processing:', fn)
+		im = Image.open(fn)
+		name = os.path.splitext(fn)[0]
+		w, h = im.size
+		if w % 8 != 0:
+			raise Exception('Width must be divisable by 8! (%s is %dx%d)' % (fn, w, h))
+		fmt, enc = encode_bitmap(pixels_to_rows(list(im.getdata())), w, h)
+		hdrs.append('extern const BITMAP bmp_%s;\n' % name)
+		imgs.append('const BITMAP bmp_%s = {%d, %d, %s, bmp_%s_data};\n' % (name, w, h, fmt, name))
+		data.append('const uint8_t bmp_%s_data[] = { %s};\n' % (name, encode_bytes(enc)))
+		cnt += 1
+
+	with open('../bitmaps.c', 'wt') as f:
+		f.write('#include "bitmaps.h"\n\n')
+		for i in range(cnt):
+			f.write(data[i])
+		f.write('\n')
+		for i in range(cnt):
+			f.write(imgs[i])
+		f.close()
+
+	with open('../bitmaps.h', 'wt') as f:
+		f.write('''#ifndef __BITMAPS_H__
 #define __BITMAPS_H__
 
 #include <stdint.h>
 
+// rows of width / 8 bytes, MSB is the leftmost pixel
+#define BITMAP_ROWS 0
+// display columns of 8 pixels, 8 rows at a time, run-length encoded
+#define BITMAP_RLE  1
+
 typedef struct {
-	uint8_t width, height;
+	uint8_t width, height, format;
 	const uint8_t *data;
 } BITMAP;
 
 ''')
 
-	for i in range(cnt):
-		f.write(hdrs[i])
+		for i in range(cnt):
+			f.write(hdrs[i])
+
+		f.write('\n#endif\n')
+		f.close()
 
-	f.write('\n#endif\n')
-	f.close()
+if __name__ == '__main__':
+	main()
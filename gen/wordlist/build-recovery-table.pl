@@ -79,6 +79,44 @@ sub computerange($$$) {
     return $j + $rng;
 }
 
+# Same formatting as add_choice() used to do at runtime in recovery.c.
+sub computelabel($$$) {
+    my ($prefixlen, $i1, $i2) = @_;
+    my $first = $words[$i1] . "\0" x 8;
+    my $last = $words[$i2 - 1] . "\0" x 8;
+    my $label = substr($first, 0, $prefixlen);
+    if (substr($first, 0, 1) ne substr($last, 0, 1)) {
+	$label .= "-" . substr($last, 0, 1);
+    } elsif (substr($last, $prefixlen-1, 1) eq substr($first, $prefixlen-1, 1)) {
+    } elsif ($prefixlen < 3) {
+	$label .= "-" . substr($last, 0, $prefixlen);
+    } else {
+	substr($label, -1) = " ";
+	$label .= substr($first, $prefixlen-1, 1) if substr($first, $prefixlen-1, 1) ne "\0";
+	$label .= "-" . substr($last, $prefixlen-1, 1);
+    }
+    $label =~ s/\0.*//s;
+    die if length($label) > 7;
+    return "\U$label";
+}
+
+sub printlabels($$@) {
+    my ($name, $width, @labels) = @_;
+    my $len = @labels;
+    print "\nstatic const char ${name}[$len][$width] =\n";
+    print "{";
+    my $line = "";
+    for ($i = 0; $i < @labels; $i++) {
+	$line .= sprintf(" %-10s", "\"$labels[$i]\",");
+	if ($i % 6 == 5 || $i == @labels - 1) {
+	    $line =~ s/ +$//;
+	    print "\n   $line";
+	    $line = "";
+	}
+    }
+    print "\n};\n";
+}
+
 print << 'EOF';
 /* DO NOT EDIT: This file is automatically generated by
  * cd ../gen/wordlist
@@ -108,3 +146,25 @@ for ($i = 0; $i< @arr2; $i++) {
     printf(" %5d,", $arr2[$i] + 4096 * $prefixlen);
 }
 print "\n};\n";
+
+# Display labels for the first three levels of the matrix, indexed like
+# the tables above.  The last level shows the words themselves.
+my @labels0;
+for ($i = 0; $i < 9; $i++) {
+    push @labels0, computelabel(1, $arr2[$arr1[9*$i]], $arr2[$arr1[9*($i+1)]]);
+}
+printlabels("word_label0", 4, @labels0);
+
+my @labels1;
+for ($i = 0; $i < @arr1 - 1; $i++) {
+    $prefixlen = computerange($arr2[$arr1[$i]], $arr2[$arr1[$i+1]], $arr1[$i+1]-$arr1[$i]);
+    push @labels1, computelabel($prefixlen, $arr2[$arr1[$i]], $arr2[$arr1[$i+1]]);
+}
+printlabels("word_label1", 8, @labels1);
+
+my @labels2;
+for ($i = 0; $i < @arr2 - 1; $i++) {
+    $prefixlen = computerange($arr2[$i], $arr2[$i+1], $arr2[$i+1]-$arr2[$i]);
+    push @labels2, computelabel($prefixlen, $arr2[$i], $arr2[$i+1]);
+}
+printlabels("word_label2", 8, @labels2);
@@ -62,6 +62,11 @@
 
  flags & 0x01 -> restore storage after flashing (if signatures are ok)
 
+ The firmware cannot write the first 256 bytes: the MPU maps the meta
+ sectors read-only for unprivileged code, svc_flash_program_block() only
+ accepts the storage part and svc_flash_erase_sector() of sector 2 puts
+ the header back itself.
+
  */
 
 #define FLASH_ORIGIN		(0x08000000)
@@ -111,11 +116,22 @@ void memory_protect(void);
 void memory_write_unlock(void);
 int memory_bootloader_hash(uint8_t *hash);
 
+#if EMULATOR
+// go through the emulator so that written sectors are tracked
+#include <libopencm3/stm32/flash.h>
+inline void flash_write32(uint32_t addr, uint32_t word) {
+	flash_program_word(addr, word);
+}
+inline void flash_write8(uint32_t addr, uint8_t byte) {
+	flash_program_byte(addr, byte);
+}
+#else
 inline void flash_write32(uint32_t addr, uint32_t word) {
 	*(volatile uint32_t *) FLASH_PTR(addr) = word;
 }
 inline void flash_write8(uint32_t addr, uint8_t byte) {
 	*(volatile uint8_t *) FLASH_PTR(addr) = byte;
 }
+#endif
 
 #endif
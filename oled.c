@@ -19,6 +19,7 @@
 
 #include <libopencm3/stm32/gpio.h>
 #include <libopencm3/stm32/spi.h>
+#include <libopencm3/cm3/nvic.h>
 
 #include <string.h>
 
@@ -42,6 +43,8 @@
 #define OLED_SETHIGHCOLUMN		0x10
 #define OLED_SETSTARTLINE		0x40
 #define OLED_MEMORYMODE			0x20
+#define OLED_COLUMNADDR			0x21
+#define OLED_PAGEADDR			0x22
 #define OLED_COMSCANINC			0xC0
 #define OLED_COMSCANDEC			0xC8
 #define OLED_SEGREMAP			0xA0
@@ -65,6 +68,8 @@
 
 static uint8_t _oledbuffer[OLED_BUFSIZE];
 static bool is_debug_link = 0;
+static uint32_t (*oled_anim_now)(void) = NULL;
+static void (*oled_anim_idle)(void) = NULL;
 static void oledSetBrightness(uint8_t contrast, uint8_t precharge, uint8_t vcom);
 
 /*
@@ -106,12 +111,147 @@ void oledInvertPixel(int x, int y)
 	_oledbuffer[OLED_OFFSET(x, y)] ^= OLED_MASK(x, y);
 }
 
+/*
+ * Writes a column of 8 pixels at (x,y)..(x,y+7) in one go.  The MSB of
+ * bits is the top most pixel, which is the format of both the font data
+ * and the display pages.  Only pixels selected by mask are changed.
+ */
+static RAMCODE void oledBlitColumn(int x, int y, uint8_t bits, uint8_t mask)
+{
+	if ((x < 0) || (x >= OLED_WIDTH) || (y <= -8) || (y >= OLED_HEIGHT)) {
+		return;
+	}
+	const int page = (y + 8) / 8 - 1;
+	const int shift = (y + 8) % 8;
+	const uint16_t b = ((uint16_t)(bits & mask) << 8) >> shift;
+	const uint16_t m = ((uint16_t)mask << 8) >> shift;
+	if (page >= 0) {
+		uint8_t *p = &_oledbuffer[OLED_OFFSET(x, page * 8)];
+		*p = (*p & ~(m >> 8)) | (b >> 8);
+	}
+	if (shift && page + 1 < OLED_HEIGHT / 8) {
+		uint8_t *p = &_oledbuffer[OLED_OFFSET(x, (page + 1) * 8)];
+		*p = (*p & ~(m & 0xFF)) | (b & 0xFF);
+	}
+}
+
 #if !EMULATOR
+/*
+ * A refresh is sent as a list of segments, a command segment selecting
+ * the changed range of a page followed by the data segment for it.  In
+ * async mode the SPI1 interrupt works through the list while the caller
+ * continues, the data is taken from _oledsent and not from _oledbuffer,
+ * so drawing into the buffer does not race with the transfer.
+ */
+struct oled_segment {
+	const uint8_t *data;
+	uint16_t len;
+	bool is_data;
+};
+
+static struct oled_segment oled_segments[2 * OLED_HEIGHT / 8];
+static uint8_t oled_commands[OLED_HEIGHT / 8][6];
+static bool oled_async = false;
+static volatile bool oled_busy = false;
+static volatile int oled_segment_cur, oled_segment_count, oled_segment_pos;
+
+static void oledSendNext(void);
+
+static bool oledInThreadMode(void)
+{
+	uint32_t ipsr;
+	__asm__ volatile("mrs %0, ipsr" : "=r" (ipsr));
+	return ipsr == 0;
+}
+
+/*
+ * Waits for the last async refresh.  oled_busy is only cleared by
+ * oledSendNext() and that never runs twice at the same time: in thread
+ * mode the SPI interrupt finishes the transfer.  Anywhere else it may not
+ * be able to preempt, the transfer is then finished by polling with
+ * interrupts masked, so the check and the wait cannot race with it.
+ */
+static void oledWaitIdle(void)
+{
+	uint32_t primask;
+	__asm__ volatile("mrs %0, primask" : "=r" (primask));
+	if (oledInThreadMode() && !primask) {
+		while (oled_busy);
+		return;
+	}
+	__asm__ volatile("cpsid i" : : : "memory");
+	while (oled_busy) {
+		oledSendNext();
+	}
+	if (!primask) {
+		__asm__ volatile("cpsie i" : : : "memory");
+	}
+}
+
+void oledFlush(void)
+{
+	oledWaitIdle();
+}
+
+static void oledSegmentStart(const struct oled_segment *seg)
+{
+	if (seg->is_data) {
+		gpio_set(OLED_DC_PORT, OLED_DC_PIN);		// set to DATA
+	}
+	gpio_clear(OLED_CS_PORT, OLED_CS_PIN);		// SPI select
+	SPI_DR(SPI_BASE) = seg->data[0];
+	oled_segment_pos = 1;
+}
+
+/*
+ * Bytes are sent one at a time on RXNE: a byte has been received once the
+ * one sent has left the shift register, so at the end of a segment chip
+ * select and data/command may change right away, without waiting for BSY.
+ */
+static void oledSendNext(void)
+{
+	if (!oled_busy || !(SPI_SR(SPI_BASE) & SPI_SR_RXNE)) {
+		return;
+	}
+	(void)SPI_DR(SPI_BASE);
+	const struct oled_segment *seg = &oled_segments[oled_segment_cur];
+	if (oled_segment_pos < seg->len) {
+		SPI_DR(SPI_BASE) = seg->data[oled_segment_pos++];
+		return;
+	}
+	gpio_set(OLED_CS_PORT, OLED_CS_PIN);		// SPI deselect
+	gpio_clear(OLED_DC_PORT, OLED_DC_PIN);		// set to CMD
+	oled_segment_cur++;
+	if (oled_segment_cur < oled_segment_count) {
+		oledSegmentStart(&oled_segments[oled_segment_cur]);
+		return;
+	}
+	spi_disable_rx_buffer_not_empty_interrupt(SPI_BASE);
+	oled_busy = false;
+}
+
+void spi1_isr(void)
+{
+	oledSendNext();
+}
+
+/*
+ * Enables refreshing the display from the SPI interrupt.  This needs
+ * privileged mode to set up the interrupt controller, so it has to be
+ * called before the MPU is configured.
+ */
+void oledInitAsync(void)
+{
+	nvic_enable_irq(NVIC_SPI1_IRQ);
+	oled_async = true;
+}
+
 /*
  * Send a block of data via the SPI bus.
  */
 static inline void SPISend(uint32_t base, const uint8_t *data, int len)
 {
+	oledWaitIdle();
 	delay(1);
 	for (int i = 0; i < len; i++) {
 		spi_send(base, data[i]);
@@ -171,6 +311,14 @@ void oledInit()
 	oledClear();
 	oledRefresh();
 }
+#else
+void oledInitAsync(void)
+{
+}
+
+void oledFlush(void)
+{
+}
 #endif
 
 /*
@@ -197,27 +345,92 @@ void oledInvertDebugLink()
  * contents.  This must be called after every operation to the buffer to
  * make the change visible.  All other operations only change the buffer
  * not the content of the display.
+ *
+ * Only the part of every display page that differs from what was sent
+ * last time is transferred.  Layouts usually clear and redraw the whole
+ * screen, so comparing against the last frame finds the changed range
+ * much more precisely than marking pixels as they are drawn.
+ */
+static uint8_t _oledsent[OLED_BUFSIZE];
+static uint8_t _oledsent_valid = 0;
+
+/*
+ * Finds the columns of a display page that changed since it was last
+ * sent and records them as sent.  Returns false if nothing changed.
  */
+bool oledPageChanged(int page, int *first, int *last)
+{
+	const uint8_t *row = _oledbuffer + page * OLED_WIDTH;
+	uint8_t *sent = _oledsent + page * OLED_WIDTH;
+	*first = 0;
+	*last = OLED_WIDTH - 1;
+	if (_oledsent_valid & (1 << page)) {
+		while (*first < OLED_WIDTH && row[*first] == sent[*first]) {
+			(*first)++;
+		}
+		if (*first == OLED_WIDTH) {
+			return false;
+		}
+		while (row[*last] == sent[*last]) {
+			(*last)--;
+		}
+	}
+	_oledsent_valid |= 1 << page;
+	memcpy(sent + *first, row + *first, *last - *first + 1);
+	return true;
+}
+
 #if !EMULATOR
 void oledRefresh()
 {
-	static const uint8_t s[3] = {OLED_SETLOWCOLUMN | 0x00, OLED_SETHIGHCOLUMN | 0x00, OLED_SETSTARTLINE | 0x00};
+	// _oledsent is still being sent from
+	oledWaitIdle();
 
 	// draw triangle in upper right corner
 	oledInvertDebugLink();
 
-	gpio_clear(OLED_CS_PORT, OLED_CS_PIN);		// SPI select
-	SPISend(SPI_BASE, s, 3);
-	gpio_set(OLED_CS_PORT, OLED_CS_PIN);		// SPI deselect
+	int count = 0;
+	for (int page = 0; page < OLED_HEIGHT / 8; page++) {
+		int first, last;
+		if (!oledPageChanged(page, &first, &last)) {
+			continue;
+		}
 
-	gpio_set(OLED_DC_PORT, OLED_DC_PIN);		// set to DATA
-	gpio_clear(OLED_CS_PORT, OLED_CS_PIN);		// SPI select
-	SPISend(SPI_BASE, _oledbuffer, sizeof(_oledbuffer));
-	gpio_set(OLED_CS_PORT, OLED_CS_PIN);		// SPI deselect
-	gpio_clear(OLED_DC_PORT, OLED_DC_PIN);		// set to CMD
+		uint8_t *s = oled_commands[page];
+		s[0] = OLED_COLUMNADDR; s[1] = first; s[2] = last;
+		s[3] = OLED_PAGEADDR; s[4] = page; s[5] = page;
+
+		oled_segments[count++] = (struct oled_segment){s, 6, false};
+		oled_segments[count++] = (struct oled_segment){_oledsent + page * OLED_WIDTH + first, last - first + 1, true};
+	}
 
 	// return it back
 	oledInvertDebugLink();
+
+	if (count == 0) {
+		return;
+	}
+	// fault handlers draw with the SPI interrupt masked
+	if (oled_async && oledInThreadMode()) {
+		oled_segment_cur = 0;
+		oled_segment_count = count;
+		oled_busy = true;
+		// the bus is idle, clear what the blocking sends left in RX
+		(void)SPI_DR(SPI_BASE);
+		(void)SPI_SR(SPI_BASE);
+		oledSegmentStart(&oled_segments[0]);
+		spi_enable_rx_buffer_not_empty_interrupt(SPI_BASE);
+		return;
+	}
+	for (int i = 0; i < count; i++) {
+		if (oled_segments[i].is_data) {
+			gpio_set(OLED_DC_PORT, OLED_DC_PIN);		// set to DATA
+		}
+		gpio_clear(OLED_CS_PORT, OLED_CS_PIN);		// SPI select
+		SPISend(SPI_BASE, oled_segments[i].data, oled_segments[i].len);
+		gpio_set(OLED_CS_PORT, OLED_CS_PIN);		// SPI deselect
+		gpio_clear(OLED_DC_PORT, OLED_DC_PIN);		// set to CMD
+	}
 }
 #endif
 
@@ -237,7 +450,7 @@ void oledSetBuffer(uint8_t *buf)
 	memcpy(_oledbuffer, buf, sizeof(_oledbuffer));
 }
 
-void oledDrawChar(int x, int y, char c, int font)
+RAMCODE void oledDrawChar(int x, int y, char c, int font)
 {
 	if (x >= OLED_WIDTH || y >= OLED_HEIGHT || y <= -FONT_HEIGHT) {
 		return;
@@ -251,14 +464,22 @@ void oledDrawChar(int x, int y, char c, int font)
 		return;
 	}
 
+	// every nibble of a glyph column becomes one byte in double size
+	static const uint8_t double4[16] = {
+		0x00, 0x03, 0x0C, 0x0F, 0x30, 0x33, 0x3C, 0x3F,
+		0xC0, 0xC3, 0xCC, 0xCF, 0xF0, 0xF3, 0xFC, 0xFF,
+	};
+
 	for (int xo = 0; xo < char_width; xo++) {
-		for (int yo = 0; yo < FONT_HEIGHT; yo++) {
-			if (char_data[xo] & (1 << (FONT_HEIGHT - 1 - yo))) {
-				if (zoom <= 1) {
-					oledDrawPixel(x + xo, y + yo);
-				} else {
-					oledBox(x + xo * zoom, y + yo * zoom, x + (xo + 1) * zoom - 1, y + (yo + 1) * zoom - 1, true);
-				}
+		const uint8_t column = char_data[xo];
+		if (zoom <= 1) {
+			oledBlitColumn(x + xo, y, column, column);
+		} else {
+			const uint8_t top = double4[column >> 4];
+			const uint8_t bottom = double4[column & 0x0F];
+			for (int i = 0; i < zoom; i++) {
+				oledBlitColumn(x + xo * zoom + i, y, top, top);
+				oledBlitColumn(x + xo * zoom + i, y + FONT_HEIGHT, bottom, bottom);
 			}
 		}
 	}
@@ -319,15 +540,60 @@ void oledDrawStringRight(int x, int y, const char* text, int font)
 	oledDrawString(x, y, text, font);
 }
 
-void oledDrawBitmap(int x, int y, const BITMAP *bmp)
+/*
+ * BITMAP_RLE data is already in the column format of the display pages,
+ * so a page aligned band is decoded straight into the buffer.
+ */
+static void oledDrawBitmapRLE(int x, int y, const BITMAP *bmp)
 {
-	for (int i = 0; i < bmp->width; i++) {
-		for (int j = 0; j < bmp->height; j++) {
-			if (bmp->data[(i / 8) + j * bmp->width / 8] & (1 << (7 - i % 8))) {
-				oledDrawPixel(x + i, y + j);
+	const uint8_t *src = bmp->data;
+	int count = 0;  // columns left in the current run or literal block
+	bool repeat = false;
+	for (int j = 0; j < bmp->height; j += 8) {
+		const int rows = MIN(8, bmp->height - j);
+		const uint8_t mask = 0xFF << (8 - rows);
+		const bool aligned = rows == 8 && y + j >= 0 && y + j < OLED_HEIGHT && (y + j) % 8 == 0;
+		for (int i = 0; i < bmp->width; i++) {
+			if (count == 0) {
+				repeat = (*src & 0x80) != 0;
+				count = (*src & 0x7F) + 1;
+				src++;
+			}
+			const uint8_t column = *src;
+			count--;
+			if (!repeat || count == 0) {
+				src++;
+			}
+			if (aligned && x + i >= 0 && x + i < OLED_WIDTH) {
+				_oledbuffer[OLED_OFFSET(x + i, y + j)] = column;
 			} else {
-				oledClearPixel(x + i, y + j);
+				oledBlitColumn(x + i, y + j, column, mask);
+			}
+		}
+	}
+}
+
+void oledDrawBitmap(int x, int y, const BITMAP *bmp)
+{
+	if (bmp->format == BITMAP_RLE) {
+		oledDrawBitmapRLE(x, y, bmp);
+		return;
+	}
+	const int stride = bmp->width / 8;
+	for (int j = 0; j < bmp->height; j += 8) {
+		// bitmaps are stored by rows, collect 8 rows into a column
+		const int rows = MIN(8, bmp->height - j);
+		const uint8_t mask = 0xFF << (8 - rows);
+		for (int i = 0; i < bmp->width; i++) {
+			const uint8_t *src = bmp->data + (i / 8) + j * stride;
+			const uint8_t bit = 1 << (7 - i % 8);
+			uint8_t column = 0;
+			for (int k = 0; k < rows; k++) {
+				if (src[k * stride] & bit) {
+					column |= 0x80 >> k;
+				}
 			}
+			oledBlitColumn(x + i, y + j, column, mask);
 		}
 	}
 }
@@ -389,43 +655,63 @@ void oledFrame(int x1, int y1, int x2, int y2)
 }
 
 /*
- * Animates the display, swiping the current contents out to the left.
- * This clears the display.
+ * Sets the clock and the idle function used to pace animations.  The
+ * idle function is called repeatedly until the frame budget is used up,
+ * so the caller can keep servicing USB while the display animates.
+ * Without a clock, animations run as fast as the display allows.
  */
-void oledSwipeLeft(void)
+void oledSetAnimationTimer(uint32_t (*now)(void), void (*idle)(void))
+{
+	oled_anim_now = now;
+	oled_anim_idle = idle;
+}
+
+/*
+ * Shifts the buffer by OLED_SWIPE_STEP columns per frame, towards
+ * lower buffer offsets (right on screen) if dir > 0, otherwise towards
+ * higher offsets (left on screen).
+ */
+static void oledSwipe(int dir)
 {
-	for (int i = 0; i < OLED_WIDTH; i++) {
+	for (int i = 0; i < OLED_WIDTH / OLED_SWIPE_STEP; i++) {
+		uint32_t deadline = oled_anim_now ? oled_anim_now() + OLED_SWIPE_FRAME_MS : 0;
 		for (int j = 0; j < OLED_HEIGHT / 8; j++) {
-			for (int k = OLED_WIDTH-1; k > 0; k--) {
-				_oledbuffer[j * OLED_WIDTH + k] = _oledbuffer[j * OLED_WIDTH + k - 1];
+			uint8_t *page = _oledbuffer + j * OLED_WIDTH;
+			if (dir > 0) {
+				memmove(page, page + OLED_SWIPE_STEP, OLED_WIDTH - OLED_SWIPE_STEP);
+				memset(page + OLED_WIDTH - OLED_SWIPE_STEP, 0, OLED_SWIPE_STEP);
+			} else {
+				memmove(page + OLED_SWIPE_STEP, page, OLED_WIDTH - OLED_SWIPE_STEP);
+				memset(page, 0, OLED_SWIPE_STEP);
 			}
-			_oledbuffer[j * OLED_WIDTH] = 0;
 		}
 		oledRefresh();
+		if (oled_anim_now) {
+			do {
+				if (oled_anim_idle) {
+					oled_anim_idle();
+				}
+			} while ((int32_t)(deadline - oled_anim_now()) > 0);
+		}
 	}
 }
 
+/*
+ * Animates the display, swiping the current contents out to the left.
+ * This clears the display.
+ */
+void oledSwipeLeft(void)
+{
+	oledSwipe(-1);
+}
+
 /*
  * Animates the display, swiping the current contents out to the right.
  * This clears the display.
  */
 void oledSwipeRight(void)
 {
-	for (int i = 0; i < OLED_WIDTH / 4; i++) {
-		for (int j = 0; j < OLED_HEIGHT / 8; j++) {
-			for (int k = 0; k < OLED_WIDTH / 4 - 1; k++) {
-				_oledbuffer[k * 4 + 0 + j * OLED_WIDTH] = _oledbuffer[k * 4 + 4 + j * OLED_WIDTH];
-				_oledbuffer[k * 4 + 1 + j * OLED_WIDTH] = _oledbuffer[k * 4 + 5 + j * OLED_WIDTH];
-				_oledbuffer[k * 4 + 2 + j * OLED_WIDTH] = _oledbuffer[k * 4 + 6 + j * OLED_WIDTH];
-				_oledbuffer[k * 4 + 3 + j * OLED_WIDTH] = _oledbuffer[k * 4 + 7 + j * OLED_WIDTH];
-			}
-			_oledbuffer[j * OLED_WIDTH + OLED_WIDTH - 1] = 0;
-			_oledbuffer[j * OLED_WIDTH + OLED_WIDTH - 2] = 0;
-			_oledbuffer[j * OLED_WIDTH + OLED_WIDTH - 3] = 0;
-			_oledbuffer[j * OLED_WIDTH + OLED_WIDTH - 4] = 0;
-		}
-		oledRefresh();
-	}
+	oledSwipe(1);
 }
 
 void oledChangeBrightnessLevel(void)
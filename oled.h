@@ -35,9 +35,15 @@
 #define OLED_BRIGHTNESS_MEDIUM 2
 #define OLED_BRIGHTNESS_HIGH 3
 
+#define OLED_SWIPE_STEP      4	// columns per animation frame
+#define OLED_SWIPE_FRAME_MS  8	// time budget of one animation frame
+
 void oledInit(void);
+void oledInitAsync(void);
+void oledFlush(void);
 void oledClear(void);
 void oledRefresh(void);
+bool oledPageChanged(int page, int *first, int *last);
 
 void oledSetDebugLink(bool set);
 void oledInvertDebugLink(void);
@@ -58,6 +64,7 @@ void oledInvert(int x1, int y1, int x2, int y2);
 void oledBox(int x1, int y1, int x2, int y2, bool set);
 void oledHLine(int y);
 void oledFrame(int x1, int y1, int x2, int y2);
+void oledSetAnimationTimer(uint32_t (*now)(void), void (*idle)(void));
 void oledSwipeLeft(void);
 void oledSwipeRight(void);
 void oledChangeBrightness(uint8_t brightness_level);
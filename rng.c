@@ -18,21 +18,91 @@
  */
 
 #include <libopencm3/cm3/common.h>
+#include <libopencm3/cm3/nvic.h>
 #include <libopencm3/stm32/memorymap.h>
 #include <libopencm3/stm32/f2/rng.h>
 
 #include "rng.h"
 
 #if !EMULATOR
-uint32_t random32(void)
+/* Words collected by the RNG interrupt, so that bursts of random32()
+ * calls do not wait for the generator.  One slot stays empty to tell
+ * a full pool from an empty one.
+ */
+#define RNG_POOL_SIZE 16
+
+static CONFIDENTIAL volatile uint32_t rng_pool[RNG_POOL_SIZE];
+static volatile uint32_t rng_pool_head, rng_pool_tail;
+static bool rng_pooled = false;
+
+/* last number read from the generator, for the continuous test */
+static volatile uint32_t rng_last = 0;
+
+static uint32_t rng_read(void)
 {
-	static uint32_t last = 0, new = 0;
-	while (new == last) {
+	uint32_t new = rng_last;
+	while (new == rng_last) {
 		if ((RNG_SR & (RNG_SR_SECS | RNG_SR_CECS | RNG_SR_DRDY)) == RNG_SR_DRDY) {
 			new = RNG_DR;
 		}
 	}
-	last = new;
+	rng_last = new;
+	return new;
+}
+
+void hash_rng_isr(void)
+{
+	uint32_t sr = RNG_SR;
+	if (sr & (RNG_SR_SEIS | RNG_SR_CEIS)) {
+		RNG_SR = 0;
+	}
+	if (sr & RNG_SR_DRDY) {
+		// always read, an unread number would raise the interrupt again
+		uint32_t new = RNG_DR;
+		if ((sr & (RNG_SR_SECS | RNG_SR_CECS)) == 0 && new != rng_last) {
+			rng_last = new;
+			rng_pool[rng_pool_head] = new;
+			rng_pool_head = (rng_pool_head + 1) % RNG_POOL_SIZE;
+		}
+	}
+	if ((rng_pool_head + 1) % RNG_POOL_SIZE == rng_pool_tail) {
+		RNG_CR &= ~RNG_CR_IE;
+	}
+}
+
+/*
+ * Enables filling the random pool from the RNG interrupt.  This needs
+ * privileged mode to set up the interrupt controller, so it has to be
+ * called before the MPU is configured.
+ */
+void rngInitPool(void)
+{
+	rng_pool_head = rng_pool_tail = 0;
+	rng_pooled = true;
+	nvic_enable_irq(NVIC_HASH_RNG_IRQ);
+	RNG_CR |= RNG_CR_IE;
+}
+
+uint32_t random32(void)
+{
+	if (!rng_pooled) {
+		return rng_read();
+	}
+	uint32_t new;
+	if (rng_pool_tail != rng_pool_head) {
+		new = rng_pool[rng_pool_tail];
+		rng_pool[rng_pool_tail] = 0;
+		rng_pool_tail = (rng_pool_tail + 1) % RNG_POOL_SIZE;
+	} else {
+		// pool is empty, wait for the generator directly
+		RNG_CR &= ~RNG_CR_IE;
+		new = rng_read();
+	}
+	RNG_CR |= RNG_CR_IE;
 	return new;
 }
+#else
+void rngInitPool(void)
+{
+}
 #endif
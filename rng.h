@@ -22,4 +22,6 @@
 
 #include "rand.h"
 
+void rngInitPool(void);
+
 #endif
@@ -0,0 +1,391 @@
+#!/usr/bin/env python3
+#
+# Throughput benchmark for the emulator.
+#
+# Replays canned SignTx, EthereumSignTx and NEMSignTx workloads over the UDP
+# transport of an emulator built with DEBUG_LINK=1 and records wall time,
+# messages and bytes per phase.  Wall time is split at the last
+# ButtonRequest: everything before it is streaming and checking (phase 1),
+# everything after it is signing.
+#
+# The driver talks the wire protocol directly instead of going through
+# trezorlib, so results do not depend on the host library version.
+#
+# Usage: script/emulator_bench.py [--sizes 10,100] [--workloads signtx,...]
+#                                 [--json results.json]
+
+import argparse
+import hashlib
+import json
+import socket
+import struct
+import sys
+import time
+
+HOST = '127.0.0.1'
+PORT = 21324
+
+# message types
+MSG_INITIALIZE = 0
+MSG_SUCCESS = 2
+MSG_FAILURE = 3
+MSG_WIPE_DEVICE = 5
+MSG_LOAD_DEVICE = 13
+MSG_SIGN_TX = 15
+MSG_FEATURES = 17
+MSG_TX_REQUEST = 21
+MSG_TX_ACK = 22
+MSG_BUTTON_REQUEST = 26
+MSG_BUTTON_ACK = 27
+MSG_GET_ADDRESS = 29
+MSG_ADDRESS = 30
+MSG_ETHEREUM_SIGN_TX = 58
+MSG_ETHEREUM_TX_REQUEST = 59
+MSG_ETHEREUM_TX_ACK = 60
+MSG_NEM_GET_ADDRESS = 67
+MSG_NEM_ADDRESS = 68
+MSG_NEM_SIGN_TX = 69
+MSG_NEM_SIGNED_TX = 70
+MSG_DEBUG_LINK_DECISION = 100
+
+# TxRequest.request_type
+TXINPUT = 0
+TXOUTPUT = 1
+TXMETA = 2
+TXFINISHED = 3
+
+# InputScriptType / OutputScriptType
+SPENDADDRESS = 0
+SPENDWITNESS = 3
+PAYTOADDRESS = 0
+
+H = 0x80000000
+
+MNEMONIC = 'alcohol woman abuse must during monitor noble actual mixed trade anger aisle'
+
+
+# protobuf
+
+def pb_varint(n):
+    out = bytearray()
+    while True:
+        b = n & 0x7f
+        n >>= 7
+        if n:
+            out.append(b | 0x80)
+        else:
+            out.append(b)
+            return bytes(out)
+
+
+def pb_uint(num, value):
+    return pb_varint(num << 3) + pb_varint(value)
+
+
+def pb_bytes(num, value):
+    if isinstance(value, str):
+        value = value.encode()
+    return pb_varint((num << 3) | 2) + pb_varint(len(value)) + value
+
+
+def pb_path(num, path):
+    return b''.join(pb_uint(num, p) for p in path)
+
+
+def pb_decode(data):
+    fields = {}
+    i = 0
+    while i < len(data):
+        key, i = pb_read_varint(data, i)
+        num, wire = key >> 3, key & 7
+        if wire == 0:
+            value, i = pb_read_varint(data, i)
+        elif wire == 2:
+            size, i = pb_read_varint(data, i)
+            value, i = data[i:i + size], i + size
+        else:
+            raise ValueError('unsupported wire type %d' % wire)
+        fields.setdefault(num, []).append(value)
+    return fields
+
+
+def pb_read_varint(data, i):
+    n = shift = 0
+    while True:
+        b = data[i]
+        i += 1
+        n |= (b & 0x7f) << shift
+        shift += 7
+        if not b & 0x80:
+            return n, i
+
+
+# transport
+
+class Stats(object):
+
+    def __init__(self):
+        self.messages = 0
+        self.bytes_out = 0
+        self.bytes_in = 0
+
+    def copy(self):
+        s = Stats()
+        s.messages, s.bytes_out, s.bytes_in = self.messages, self.bytes_out, self.bytes_in
+        return s
+
+    def since(self, other):
+        return {
+            'messages': self.messages - other.messages,
+            'bytes_out': self.bytes_out - other.bytes_out,
+            'bytes_in': self.bytes_in - other.bytes_in,
+        }
+
+
+class UdpLink(object):
+
+    def __init__(self, port, stats):
+        self.sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+        self.sock.connect((HOST, port))
+        self.sock.settimeout(600)
+        self.stats = stats
+
+    def write(self, msg_type, payload=b''):
+        data = b'##' + struct.pack('>HL', msg_type, len(payload)) + payload
+        while data:
+            chunk, data = data[:63], data[63:]
+            self.sock.send(b'?' + chunk.ljust(63, b'\0'))
+            self.stats.bytes_out += 64
+        self.stats.messages += 1
+
+    def read(self):
+        frame = self.sock.recv(64)
+        self.stats.bytes_in += 64
+        if frame[:3] != b'?##':
+            raise RuntimeError('unexpected frame')
+        msg_type, size = struct.unpack('>HL', frame[3:9])
+        data = frame[9:]
+        while len(data) < size:
+            frame = self.sock.recv(64)
+            self.stats.bytes_in += 64
+            if frame[:1] != b'?':
+                raise RuntimeError('unexpected frame')
+            data += frame[1:]
+        self.stats.messages += 1
+        return msg_type, data[:size]
+
+
+class Device(object):
+
+    def __init__(self):
+        self.stats = Stats()
+        self.main = UdpLink(PORT, self.stats)
+        self.debug = UdpLink(PORT + 1, Stats())
+        self.buttons = []
+
+    def call(self, msg_type, payload=b''):
+        self.main.write(msg_type, payload)
+        return self.response()
+
+    def response(self):
+        while True:
+            msg_type, data = self.main.read()
+            if msg_type == MSG_BUTTON_REQUEST:
+                self.main.write(MSG_BUTTON_ACK)
+                self.debug.write(MSG_DEBUG_LINK_DECISION, pb_uint(1, 1))
+                self.buttons.append((time.time(), self.stats.copy()))
+                continue
+            if msg_type == MSG_FAILURE:
+                f = pb_decode(data)
+                raise RuntimeError('Failure: %s' % f.get(2, [b'?'])[0].decode())
+            return msg_type, pb_decode(data)
+
+    def connect(self, timeout=10):
+        deadline = time.time() + timeout
+        self.main.sock.settimeout(1)
+        while True:
+            try:
+                msg_type, fields = self.call(MSG_INITIALIZE)
+                break
+            except (socket.timeout, ConnectionRefusedError):
+                if time.time() > deadline:
+                    raise
+        self.main.sock.settimeout(600)
+        return fields
+
+    def load(self):
+        self.call(MSG_WIPE_DEVICE)
+        self.call(MSG_LOAD_DEVICE, pb_bytes(1, MNEMONIC) + pb_uint(7, 1) + pb_bytes(6, 'bench'))
+
+
+# workloads
+
+def b58decode(s):
+    alphabet = '123456789ABCDEFGHJKLMNPQRSTUVWXYZabcdefghijkmnopqrstuvwxyz'
+    n = 0
+    for c in s:
+        n = n * 58 + alphabet.index(c)
+    data = n.to_bytes((n.bit_length() + 7) // 8, 'big')
+    pad = len(s) - len(s.lstrip('1'))
+    return b'\0' * pad + data
+
+
+def prev_tx(script_pubkey, amount, salt):
+    """Legacy transaction with one output, its hash and its fields."""
+    ser = struct.pack('<L', 1) + b'\x01'
+    ser += b'\0' * 32 + struct.pack('<L', salt) + b'\x00' + struct.pack('<L', 0xffffffff)
+    ser += b'\x01' + struct.pack('<Q', amount) + bytes([len(script_pubkey)]) + script_pubkey
+    ser += struct.pack('<L', 0)
+    txid = hashlib.sha256(hashlib.sha256(ser).digest()).digest()[::-1]
+    return txid, salt
+
+
+def tx_input(i, script_type, prev_hash, amount):
+    purpose = 84 if script_type == SPENDWITNESS else 44
+    path = [purpose | H, 1 | H, 0 | H, 0, i]
+    return (pb_path(1, path) + pb_bytes(2, prev_hash) + pb_uint(3, 0) + pb_uint(5, 0xffffffff) +
+            pb_uint(6, script_type) + pb_uint(8, amount))
+
+
+def workload_signtx(dev, size, legacy):
+    amount = 100000
+    script_type = SPENDADDRESS if legacy else SPENDWITNESS
+    prevs = {}
+    inputs = []
+    for i in range(size):
+        if legacy:
+            _, fields = dev.call(MSG_GET_ADDRESS, pb_path(1, [44 | H, 1 | H, 0 | H, 0, i]) + pb_bytes(2, 'Testnet'))
+            pkh = b58decode(fields[1][0].decode())[1:21]
+            script = b'\x76\xa9\x14' + pkh + b'\x88\xac'
+            txid, salt = prev_tx(script, amount, i)
+            prevs[txid] = (script, salt)
+        else:
+            txid = hashlib.sha256(b'bench %d' % i).digest()
+        inputs.append(tx_input(i, script_type, txid, amount))
+    # a second account of the same wallet, so the output is confirmed
+    output = pb_path(2, [44 | H, 1 | H, 1 | H, 0, 0]) + pb_uint(3, size * amount - 10000) + pb_uint(4, PAYTOADDRESS)
+
+    msg_type, req = dev.call(MSG_SIGN_TX, pb_uint(1, 1) + pb_uint(2, size) + pb_bytes(3, 'Testnet'))
+    while True:
+        rtype = req.get(1, [0])[0]
+        if rtype == TXFINISHED:
+            return
+        details = pb_decode(req[2][0]) if 2 in req else {}
+        index = details.get(1, [0])[0]
+        tx_hash = details.get(2, [None])[0]
+        if tx_hash is not None:
+            script, salt = prevs[bytes(tx_hash)]
+            if rtype == TXMETA:
+                tx = pb_uint(1, 1) + pb_uint(4, 0) + pb_uint(6, 1) + pb_uint(7, 1)
+            elif rtype == TXINPUT:
+                tx = pb_bytes(2, pb_bytes(2, b'\0' * 32) + pb_uint(3, salt) + pb_bytes(4, b'') + pb_uint(5, 0xffffffff))
+            else:
+                tx = pb_bytes(3, pb_uint(1, amount) + pb_bytes(2, script))
+        elif rtype == TXMETA:
+            raise RuntimeError('unexpected TXMETA')
+        elif rtype == TXINPUT:
+            tx = pb_bytes(2, inputs[index])
+        else:
+            tx = pb_bytes(5, output)
+        msg_type, req = dev.call(MSG_TX_ACK, pb_bytes(1, tx))
+
+
+def workload_signtx_segwit(dev, size):
+    workload_signtx(dev, size, False)
+
+
+def workload_signtx_legacy(dev, size):
+    workload_signtx(dev, size, True)
+
+
+def workload_ethereum(dev, size):
+    # size KiB of data, sent in 1 KiB chunks
+    data = bytes(range(256)) * 4 * size
+    msg = (pb_path(1, [44 | H, 60 | H, 0 | H, 0, 0]) + pb_bytes(2, b'\x01') + pb_bytes(3, b'\x04\xa8\x17\xc8\x00') +
+           pb_bytes(4, b'\x07\xa1\x20') + pb_bytes(5, b'\x12' * 20) + pb_bytes(6, b'\x01') +
+           pb_bytes(7, data[:1024]) + pb_uint(8, len(data)) + pb_uint(9, 1))
+    msg_type, req = dev.call(MSG_ETHEREUM_SIGN_TX, msg)
+    offset = 1024
+    while msg_type == MSG_ETHEREUM_TX_REQUEST and 1 in req and req[1][0] > 0:
+        n = req[1][0]
+        msg_type, req = dev.call(MSG_ETHEREUM_TX_ACK, pb_bytes(1, data[offset:offset + n]))
+        offset += n
+
+
+def workload_nem(dev, size):
+    # size mosaics, at most 16 fit into a transfer
+    address_n = [44 | H, 43 | H, 0 | H]
+    _, fields = dev.call(MSG_NEM_GET_ADDRESS, pb_path(1, [44 | H, 43 | H, 1 | H]) + pb_uint(2, 0x68))
+    recipient = fields[1][0]
+    common = pb_path(1, address_n) + pb_uint(2, 0x68) + pb_uint(3, 74649215) + pb_uint(4, 2000000) + pb_uint(5, 74735615)
+    mosaics = b''.join(pb_bytes(5, pb_bytes(1, 'bench') + pb_bytes(2, 'm%d' % i) + pb_uint(3, i + 1))
+                       for i in range(min(size, 16)))
+    transfer = pb_bytes(1, recipient) + pb_uint(2, 1000000) + pb_bytes(3, b'bench') + mosaics
+    dev.call(MSG_NEM_SIGN_TX, pb_bytes(1, common) + pb_bytes(3, transfer))
+
+
+WORKLOADS = {
+    'signtx': workload_signtx_segwit,
+    'signtx_legacy': workload_signtx_legacy,
+    'ethereum': workload_ethereum,
+    'nem': workload_nem,
+}
+
+
+def run(dev, name, size):
+    dev.buttons = []
+    start_stats = dev.stats.copy()
+    start = time.time()
+    WORKLOADS[name](dev, size)
+    end = time.time()
+    total = dev.stats.since(start_stats)
+    result = {
+        'workload': name,
+        'size': size,
+        'wall_s': end - start,
+        'messages': total['messages'],
+        'bytes': total['bytes_out'] + total['bytes_in'],
+        'msgs_per_sec': total['messages'] / (end - start),
+        'bytes_per_sec': (total['bytes_out'] + total['bytes_in']) / (end - start),
+        'phases': {},
+    }
+    if dev.buttons:
+        split_time, split_stats = dev.buttons[-1]
+        phase1 = split_stats.since(start_stats)
+        phase1['wall_s'] = split_time - start
+        phase2 = dev.stats.since(split_stats)
+        phase2['wall_s'] = end - split_time
+        result['phases'] = {'phase1': phase1, 'sign': phase2}
+    return result
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Emulator throughput benchmark')
+    parser.add_argument('--workloads', default='signtx,ethereum,nem',
+                        help='comma separated, out of %s' % ','.join(sorted(WORKLOADS)))
+    parser.add_argument('--sizes', default='10,100',
+                        help='inputs, KiB of data or mosaics per workload')
+    parser.add_argument('--json', help='write the results to this file')
+    args = parser.parse_args()
+
+    dev = Device()
+    features = dev.connect()
+    dev.load()
+
+    results = []
+    for name in args.workloads.split(','):
+        for size in (int(s) for s in args.sizes.split(',')):
+            r = run(dev, name, size)
+            results.append(r)
+            print('%-14s %5d %9.3f s %7d msgs %9.1f msgs/s %11.1f B/s' %
+                  (name, size, r['wall_s'], r['messages'], r['msgs_per_sec'], r['bytes_per_sec']))
+            sys.stdout.flush()
+
+    if args.json:
+        version = '.'.join(str(features.get(n, [0])[0]) for n in (2, 3, 4))
+        with open(args.json, 'w') as f:
+            json.dump({'firmware': version, 'time': int(time.time()), 'results': results}, f, indent=2)
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,72 @@
+#!/usr/bin/env python3
+#
+# Stack frame report from the *.su files gcc writes with -fstack-usage.
+#
+# Build with STACK_USAGE=1 (from a clean tree, so that every object is
+# recompiled) and run "make stack-usage", or pass the .su files directly.
+# Frames are per function, callees are not included: the deepest call
+# chain still has to be measured, see the stack high-water mark that
+# PROFILE=1 builds record per message.
+#
+# Usage: script/stack_usage.py [--top 40] [--min 0] file.su ...
+
+import argparse
+import collections
+import os
+import sys
+
+
+def parse(path):
+    with open(path) as f:
+        for line in f:
+            # file:line:column:function<TAB>bytes<TAB>static|dynamic[,bounded]
+            location, size, kind = line.rstrip('\n').split('\t')
+            function = location.rsplit(':', 1)[-1]
+            yield function, int(size), kind
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument('--top', type=int, default=40,
+                        help='number of functions to list')
+    parser.add_argument('--min', type=int, default=0,
+                        help='skip frames smaller than this many bytes')
+    parser.add_argument('files', nargs='+')
+    args = parser.parse_args()
+
+    frames = []
+    per_file = collections.Counter()
+    for path in args.files:
+        if not os.path.exists(path):
+            continue
+        name = os.path.relpath(path)[:-len('.su')]
+        for function, size, kind in parse(path):
+            frames.append((size, name, function, kind))
+            per_file[name] = max(per_file[name], size)
+
+    if not frames:
+        print('no stack usage files, build with STACK_USAGE=1', file=sys.stderr)
+        return 1
+
+    frames.sort(reverse=True)
+    print('%8s  %-16s %s' % ('bytes', 'kind', 'function'))
+    for size, name, function, kind in frames[:args.top]:
+        if size < args.min:
+            break
+        print('%8d  %-16s %s (%s)' % (size, kind, function, name))
+
+    dynamic = [f for f in frames if f[3].startswith('dynamic')]
+    if dynamic:
+        print()
+        print('variable size frames (VLAs, alloca):')
+        for size, name, function, kind in dynamic:
+            print('%8d  %-16s %s (%s)' % (size, kind, function, name))
+
+    print()
+    print('%d functions in %d files, largest frame %d bytes' %
+          (len(frames), len(per_file), frames[0][0]))
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -17,6 +17,8 @@
  * along with this library.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <string.h>
+
 #include <libopencm3/cm3/mpu.h>
 #include <libopencm3/cm3/nvic.h>
 #include <libopencm3/cm3/scb.h>
@@ -134,6 +136,13 @@ void setup(void)
 
 void setupApp(void)
 {
+#if RAMFUNC
+	// the hot functions run from SRAM, copy them before any of them is called
+	memcpy(_ramfunc, _ramfunc_loadaddr, _eramfunc - _ramfunc);
+	__asm__ volatile("dsb");
+	__asm__ volatile("isb");
+#endif
+
 	// for completeness, disable RNG peripheral interrupts for old bootloaders that had
 	// enabled them in RNG control register (the RNG interrupt was never enabled in the NVIC)
 	RNG_CR &= ~RNG_CR_IE;
@@ -182,6 +191,10 @@ void setupApp(void)
 
 #define FLASH_OTP_BASE	(0x1FFF7800U)
 
+#if RAMFUNC && MEMORY_PROTECT
+#error "RAMFUNC executes code from SRAM, which the MPU maps execute never"
+#endif
+
 /* enable access to sensitive areas only if "secure" is set, e.g. not for unsigned firmware */
 static void mpu_config_int(int secure)
 {
@@ -194,10 +207,11 @@ static void mpu_config_int(int secure)
 	MPU_RBAR = FLASH_BASE | MPU_RBAR_VALID | (0 << MPU_RBAR_REGION_LSB);
 	MPU_RASR = MPU_RASR_ENABLE | MPU_RASR_ATTR_FLASH | MPU_RASR_SIZE_1MB | MPU_RASR_ATTR_AP_PRO_URO;
 
-	// Metadata in Flash is read-write when unlocked
-	// (0x08008000 - 0x0800FFFF, 32 KiB, read-write, execute never)
+	// Metadata in Flash is written by the supervisor calls only, which keep
+	// the firmware header out of reach (see svhandler_flash_program_block)
+	// (0x08008000 - 0x0800FFFF, 32 KiB, privileged read-write, user read-only, execute never)
 	MPU_RBAR = (FLASH_BASE + 0x8000) | MPU_RBAR_VALID | (1 << MPU_RBAR_REGION_LSB);
-	MPU_RASR = MPU_RASR_ENABLE | MPU_RASR_ATTR_FLASH | MPU_RASR_SIZE_32KB | MPU_RASR_ATTR_AP_PRW_URW | MPU_RASR_ATTR_XN;
+	MPU_RASR = MPU_RASR_ENABLE | MPU_RASR_ATTR_FLASH | MPU_RASR_SIZE_32KB | MPU_RASR_ATTR_AP_PRW_URO | MPU_RASR_ATTR_XN;
 
 	// SRAM (0x20000000 - 0x2001FFFF, read-write, execute never)
 	MPU_RBAR = SRAM_BASE | MPU_RBAR_VALID | (2 << MPU_RBAR_REGION_LSB);
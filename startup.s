@@ -39,6 +39,8 @@ reset_handler:
   .global shutdown
   .type shutdown, STT_FUNC
 shutdown:
+  // let an async display refresh finish before interrupts are gone
+  bl oledFlush
   cpsid f
   ldr r0, =0
   mov r1, r0
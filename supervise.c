@@ -18,9 +18,13 @@
  */
 
 #include <libopencm3/stm32/flash.h>
+#include <libopencm3/cm3/dwt.h>
+#include <stdbool.h>
 #include <stdint.h>
+#include <string.h>
 #include "supervise.h"
 #include "memory.h"
+#include "util.h"
 
 #if !EMULATOR
 
@@ -43,13 +47,52 @@ static void svhandler_flash_program(uint32_t psize) {
 	FLASH_CR |= FLASH_CR_PG;
 }
 
+static bool svhandler_range_in(uint32_t addr, uint32_t len, uint32_t start, uint32_t end) {
+	return addr >= start && addr <= end && len <= end - addr;
+}
+
+static void svhandler_flash_program_block(uint32_t dst, const uint32_t *src, uint32_t len) {
+	/* check the whole range once: only the storage part of the meta
+	 * sectors may be programmed, the firmware header belongs to the
+	 * bootloader, and only from SRAM or flash */
+	if (((dst | (uint32_t)src | len) & 3) != 0) {
+		return;
+	}
+	if (!svhandler_range_in(dst, len, FLASH_STORAGE_START, FLASH_META_START + FLASH_META_LEN)) {
+		return;
+	}
+	if (!svhandler_range_in((uint32_t)src, len, (uint32_t)_ram_start, (uint32_t)_ram_end)
+		&& !svhandler_range_in((uint32_t)src, len, FLASH_ORIGIN, FLASH_ORIGIN + FLASH_TOTAL_SIZE)) {
+		return;
+	}
+	/* 32-bit parallelism is the widest one without external VPP */
+	svhandler_flash_program(FLASH_CR_PROGRAM_X32);
+	for (uint32_t i = 0; i < len / sizeof(uint32_t); i++) {
+		MMIO32(dst + i * sizeof(uint32_t)) = src[i];
+	}
+	flash_wait_for_last_operation();
+}
+
 static void svhandler_flash_erase_sector(uint16_t sector) {
 	/* we only allow erasing meta sectors 2 and 3. */
 	if (sector < FLASH_META_SECTOR_FIRST ||
 		sector > FLASH_META_SECTOR_LAST) {
 		return;
 	}
+	if (sector != FLASH_META_SECTOR_FIRST) {
+		flash_erase_sector(sector, FLASH_CR_PROGRAM_X32);
+		return;
+	}
+	/* the firmware header survives, the firmware cannot write it back */
+	uint32_t header[FLASH_META_DESC_LEN / sizeof(uint32_t)];
+	memcpy(header, (const void *)FLASH_META_START, sizeof(header));
 	flash_erase_sector(sector, FLASH_CR_PROGRAM_X32);
+	svhandler_flash_program(FLASH_CR_PROGRAM_X32);
+	for (uint32_t i = 0; i < sizeof(header) / sizeof(uint32_t); i++) {
+		MMIO32(FLASH_META_START + i * sizeof(uint32_t)) = header[i];
+	}
+	flash_wait_for_last_operation();
+	FLASH_CR &= ~FLASH_CR_PG;
 }
 
 static uint32_t svhandler_flash_lock(void) {
@@ -74,6 +117,9 @@ void svc_handler_main(uint32_t *stack) {
 	case SVC_FLASH_PROGRAM:
 		svhandler_flash_program(stack[0]);
 		break;
+	case SVC_FLASH_PROGRAM_BLOCK:
+		svhandler_flash_program_block(stack[0], (const uint32_t *)stack[1], stack[2]);
+		break;
 	case SVC_FLASH_ERASE:
 		svhandler_flash_erase_sector(stack[0]);
 		break;
@@ -83,6 +129,9 @@ void svc_handler_main(uint32_t *stack) {
 	case SVC_TIMER_MS:
 		stack[0] = system_millis;
 		break;
+	case SVC_CYCLE_COUNT:
+		stack[0] = DWT_CYCCNT;
+		break;
 	default:
 		stack[0] = 0xffffffff;
 		break;
@@ -27,6 +27,8 @@
 #define SVC_FLASH_PROGRAM 2
 #define SVC_FLASH_LOCK    3
 #define SVC_TIMER_MS      4
+#define SVC_CYCLE_COUNT   5
+#define SVC_FLASH_PROGRAM_BLOCK 6
 
 /* Unlocks flash.  This function needs to be called before programming
  * or erasing. Multiple calls of flash_program and flash_erase can
@@ -45,9 +47,26 @@ inline void svc_flash_program(uint32_t program_size) {
 	__asm__ __volatile__ ("svc %0" :: "i" (SVC_FLASH_PROGRAM), "r" (r0) : "memory");
 }
 
+/* Program len bytes from src to flash at dst in a single call.
+ * Has to be called after svc_flash_unlock(), programming stays enabled
+ * (as after svc_flash_program(FLASH_CR_PROGRAM_X32)) until svc_flash_lock().
+ * @param dst  destination in the meta sectors 2 and 3 past the firmware
+ *             header (FLASH_STORAGE_START and up), 32-bit aligned
+ * @param src  source in SRAM or flash, 32-bit aligned
+ * @param len  number of bytes, a multiple of 4
+ * The call does nothing if the range is not valid.
+ */
+inline void svc_flash_program_block(uint32_t dst, const void *src, uint32_t len) {
+	register uint32_t r0 __asm__("r0") = dst;
+	register const void *r1 __asm__("r1") = src;
+	register uint32_t r2 __asm__("r2") = len;
+	__asm__ __volatile__ ("svc %0" :: "i" (SVC_FLASH_PROGRAM_BLOCK), "r" (r0), "r" (r1), "r" (r2) : "memory");
+}
+
 /* Erase a flash sector.
  * @param sector sector number 0..11 
  *    (this only allows erasing meta sectors 2 and 3 though).
+ * The firmware header at the start of sector 2 is programmed back.
  */
 inline void svc_flash_erase_sector(uint8_t sector) {
 	register uint32_t r0 __asm__("r0") = sector;
@@ -69,10 +88,18 @@ inline uint32_t svc_timer_ms(void) {
 	return r0;
 }
 
+/* DWT cycle counter, which is not accessible in unprivileged mode */
+inline uint32_t svc_cycle_count(void) {
+	register uint32_t r0 __asm__("r0");
+	__asm__ __volatile__ ("svc %1" : "=r" (r0) : "i" (SVC_CYCLE_COUNT) : "memory");
+	return r0;
+}
+
 #else
 
 extern void svc_flash_unlock(void);
 extern void svc_flash_program(uint32_t program_size);
+extern void svc_flash_program_block(uint32_t dst, const void *src, uint32_t len);
 extern void svc_flash_erase_sector(uint16_t sector);
 extern uint32_t svc_flash_lock(void);
 extern uint32_t svc_timer_ms(void);
@@ -19,6 +19,7 @@
 
 
 #include "timer.h"
+#include "buttons.h"
 
 #include <libopencm3/stm32/rcc.h>
 #include <libopencm3/cm3/systick.h>
@@ -59,4 +60,5 @@ void timer_init(void) {
 
 void sys_tick_handler(void) {
 	system_millis++;
+	buttonTick();
 }
@@ -66,3 +66,30 @@ uint32_t readprotobufint(uint8_t **ptr)
 	(*ptr)++;
 	return result;
 }
+
+#if !EMULATOR
+
+#define STACK_PAINT 0xCCCCCCCC
+
+// words kept clear below the current stack pointer while painting
+#define STACK_PAINT_MARGIN 16
+
+void stack_paint(void)
+{
+	uint32_t *sp;
+	__asm__ volatile("mov %0, sp" : "=r" (sp));
+	for (uint32_t *p = (uint32_t *)_ebss; p < sp - STACK_PAINT_MARGIN; p++) {
+		*p = STACK_PAINT;
+	}
+}
+
+uint32_t stack_used(void)
+{
+	const uint32_t *p = (const uint32_t *)_ebss;
+	while (p < (const uint32_t *)_stack && *p == STACK_PAINT) {
+		p++;
+	}
+	return _stack - (const uint8_t *)p;
+}
+
+#endif
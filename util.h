@@ -45,10 +45,29 @@ uint32_t readprotobufint(uint8_t **ptr);
 
 extern void __attribute__((noreturn)) shutdown(void);
 
+#if RAMFUNC && !EMULATOR
+// executed from SRAM, copied there by setupApp() (see memory_ramfunc.ld)
+#define RAMCODE __attribute__((section(".ramfunc"), noinline))
+#else
+#define RAMCODE
+#endif
+
 #if !EMULATOR
 // defined in memory.ld
 extern uint8_t _ram_start[], _ram_end[];
 extern uint8_t _stack[];
+// defined in libopencm3_stm32f2.ld, the stack grows down towards it
+extern uint8_t _ebss[];
+
+// fill the unused part of the stack with a known pattern
+void stack_paint(void);
+// number of stack bytes touched since the last stack_paint()
+uint32_t stack_used(void);
+
+#if RAMFUNC
+// defined in memory_ramfunc.ld
+extern uint8_t _ramfunc[], _eramfunc[], _ramfunc_loadaddr[];
+#endif
 
 // defined in startup.s
 extern void memset_reg(void *start, void *stop, uint32_t val);
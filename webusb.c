@@ -0,0 +1,193 @@
+/*
+ * This file is part of the TREZOR project, https://trezor.io/
+ *
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include "util.h"
+#include "webusb.h"
+
+/* WebUSB platform capability, https://wicg.github.io/webusb/ */
+struct webusb_platform_descriptor {
+	uint8_t bLength;
+	uint8_t bDescriptorType;
+	uint8_t bDevCapabilityType;
+	uint8_t bReserved;
+	uint8_t platformCapabilityUUID[16];
+	uint16_t bcdVersion;
+	uint8_t bVendorCode;
+	uint8_t iLandingPage;
+} __attribute__((packed));
+
+/* Microsoft OS 2.0 platform capability and descriptor set */
+struct msos20_platform_descriptor {
+	uint8_t bLength;
+	uint8_t bDescriptorType;
+	uint8_t bDevCapabilityType;
+	uint8_t bReserved;
+	uint8_t platformCapabilityUUID[16];
+	uint32_t dwWindowsVersion;
+	uint16_t wMSOSDescriptorSetTotalLength;
+	uint8_t bMS_VendorCode;
+	uint8_t bAltEnumCode;
+} __attribute__((packed));
+
+struct msos20_descriptor_set {
+	struct {
+		uint16_t wLength;
+		uint16_t wDescriptorType;
+		uint32_t dwWindowsVersion;
+		uint16_t wTotalLength;
+	} __attribute__((packed)) header;
+	struct {
+		uint16_t wLength;
+		uint16_t wDescriptorType;
+		uint8_t bConfigurationValue;
+		uint8_t bReserved;
+		uint16_t wTotalLength;
+	} __attribute__((packed)) configuration;
+	struct {
+		uint16_t wLength;
+		uint16_t wDescriptorType;
+		uint8_t bFirstInterface;
+		uint8_t bReserved;
+		uint16_t wSubsetLength;
+	} __attribute__((packed)) function;
+	struct {
+		uint16_t wLength;
+		uint16_t wDescriptorType;
+		uint8_t CompatibleID[8];
+		uint8_t SubCompatibleID[8];
+	} __attribute__((packed)) compatible_id;
+} __attribute__((packed));
+
+#define MSOS20_WINDOWS_VERSION      0x06030000  // Windows 8.1
+#define MSOS20_SET_HEADER           0x00
+#define MSOS20_SUBSET_CONFIGURATION 0x01
+#define MSOS20_SUBSET_FUNCTION      0x02
+#define MSOS20_FEATURE_COMPATIBLE_ID 0x03
+#define MSOS20_DESCRIPTOR_INDEX     0x07
+
+#define WEBUSB_REQ_GET_URL          0x02
+
+static const struct webusb_platform_descriptor webusb_platform = {
+	.bLength = sizeof(struct webusb_platform_descriptor),
+	.bDescriptorType = USB_DT_DEVICE_CAPABILITY,
+	.bDevCapabilityType = USB_DC_PLATFORM,
+	.bReserved = 0,
+	// {3408b638-09a9-47a0-8bfd-a0768815b665}
+	.platformCapabilityUUID = { 0x38, 0xb6, 0x08, 0x34, 0xa9, 0x09, 0xa0, 0x47, 0x8b, 0xfd, 0xa0, 0x76, 0x88, 0x15, 0xb6, 0x65 },
+	.bcdVersion = 0x0100,
+	.bVendorCode = WEBUSB_VENDOR_CODE,
+	.iLandingPage = 0,
+};
+
+static const struct msos20_platform_descriptor msos20_platform = {
+	.bLength = sizeof(struct msos20_platform_descriptor),
+	.bDescriptorType = USB_DT_DEVICE_CAPABILITY,
+	.bDevCapabilityType = USB_DC_PLATFORM,
+	.bReserved = 0,
+	// {d8dd60df-4589-4cc7-9cd2-659d9e648a9f}
+	.platformCapabilityUUID = { 0xdf, 0x60, 0xdd, 0xd8, 0x89, 0x45, 0xc7, 0x4c, 0x9c, 0xd2, 0x65, 0x9d, 0x9e, 0x64, 0x8a, 0x9f },
+	.dwWindowsVersion = MSOS20_WINDOWS_VERSION,
+	.wMSOSDescriptorSetTotalLength = sizeof(struct msos20_descriptor_set),
+	.bMS_VendorCode = WINUSB_VENDOR_CODE,
+	.bAltEnumCode = 0,
+};
+
+// bFirstInterface is filled in by webusb_setup()
+static struct msos20_descriptor_set msos20_set = {
+	.header = {
+		.wLength = sizeof(msos20_set.header),
+		.wDescriptorType = MSOS20_SET_HEADER,
+		.dwWindowsVersion = MSOS20_WINDOWS_VERSION,
+		.wTotalLength = sizeof(struct msos20_descriptor_set),
+	},
+	.configuration = {
+		.wLength = sizeof(msos20_set.configuration),
+		.wDescriptorType = MSOS20_SUBSET_CONFIGURATION,
+		.bConfigurationValue = 0,
+		.bReserved = 0,
+		.wTotalLength = sizeof(struct msos20_descriptor_set) - sizeof(msos20_set.header),
+	},
+	.function = {
+		.wLength = sizeof(msos20_set.function),
+		.wDescriptorType = MSOS20_SUBSET_FUNCTION,
+		.bFirstInterface = 0,
+		.bReserved = 0,
+		.wSubsetLength = sizeof(msos20_set.function) + sizeof(msos20_set.compatible_id),
+	},
+	.compatible_id = {
+		.wLength = sizeof(msos20_set.compatible_id),
+		.wDescriptorType = MSOS20_FEATURE_COMPATIBLE_ID,
+		.CompatibleID = { 'W', 'I', 'N', 'U', 'S', 'B', 0, 0 },
+		.SubCompatibleID = { 0 },
+	},
+};
+
+static const struct usb_device_capability_descriptor *capabilities[] = {
+	(const struct usb_device_capability_descriptor *)&webusb_platform,
+	(const struct usb_device_capability_descriptor *)&msos20_platform,
+};
+
+static const struct usb_bos_descriptor bos = {
+	.bLength = USB_DT_BOS_SIZE,
+	.bDescriptorType = USB_DT_BOS,
+	.wTotalLength = 0,
+	.bNumDeviceCaps = sizeof(capabilities) / sizeof(*capabilities),
+	.capabilities = capabilities,
+};
+
+static int webusb_control_vendor_request(usbd_device *usbd_dev, struct usb_setup_data *req, uint8_t **buf, uint16_t *len, usbd_control_complete_callback *complete)
+{
+	(void)usbd_dev;
+	(void)complete;
+
+	if (req->bRequest == WINUSB_VENDOR_CODE && req->wIndex == MSOS20_DESCRIPTOR_INDEX) {
+		*buf = (uint8_t *)&msos20_set;
+		*len = MIN(*len, sizeof(msos20_set));
+		return USBD_REQ_HANDLED;
+	}
+
+	// there is no landing page to report for GET_URL
+	if (req->bRequest == WEBUSB_VENDOR_CODE && req->wIndex == WEBUSB_REQ_GET_URL) {
+		return USBD_REQ_NOTSUPP;
+	}
+
+	return USBD_REQ_NEXT_CALLBACK;
+}
+
+static void webusb_set_config(usbd_device *usbd_dev, uint16_t wValue)
+{
+	(void)wValue;
+
+	usbd_register_control_callback(
+		usbd_dev,
+		USB_REQ_TYPE_IN | USB_REQ_TYPE_VENDOR | USB_REQ_TYPE_DEVICE,
+		USB_REQ_TYPE_DIRECTION | USB_REQ_TYPE_TYPE | USB_REQ_TYPE_RECIPIENT,
+		webusb_control_vendor_request);
+}
+
+void webusb_setup(usbd_device *usbd_dev, uint8_t interface)
+{
+	msos20_set.function.bFirstInterface = interface;
+
+	usb21_setup(usbd_dev, &bos);
+
+	/* Windows asks for the descriptor set before any configuration is set */
+	webusb_set_config(usbd_dev, 0x0000);
+	usbd_register_set_config_callback(usbd_dev, webusb_set_config);
+}
@@ -0,0 +1,35 @@
+/*
+ * This file is part of the TREZOR project, https://trezor.io/
+ *
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __WEBUSB_H__
+#define __WEBUSB_H__
+
+#include "usb21_standard.h"
+
+// vendor request codes announced in the BOS platform capabilities
+#define WEBUSB_VENDOR_CODE  0x01
+#define WINUSB_VENDOR_CODE  0x02
+
+/*
+ * Announce the WebUSB and Microsoft OS 2.0 platform capabilities in the
+ * BOS descriptor and bind WinUSB to the given vendor class interface, so
+ * browsers and libusb can open it without a driver install.  The device
+ * descriptor has to report bcdUSB 0x0210 for hosts to ask for the BOS.
+ */
+void webusb_setup(usbd_device *usbd_dev, uint8_t interface);
+
+#endif